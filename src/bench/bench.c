@@ -0,0 +1,388 @@
+/**
+ * @file bench.c
+ * @author Jason Conway (jpc@jasonconway.dev)
+ * @brief Micro-benchmarks for the crypto primitives and wire encryption, reported as JSON
+ * @version 0.9.4
+ * @date 2025-01-12
+ *
+ * @copyright Copyright (c) 2025 Jason Conway. All rights reserved.
+ *
+ */
+
+#include "aes128.h"
+#include "csprng.h"
+#include "sha256.h"
+#include "wire.h"
+#include "x25519.h"
+#include "xplatform.h"
+#include "xutils.h"
+
+enum BenchDefaults {
+    BENCH_SIZE_MIN = 16,
+    BENCH_SIZE_MAX = 1 << 26,
+    BENCH_SIZE_STEP = 4,      // payload sizes grow by this factor from BENCH_SIZE_MIN
+    BENCH_TIME_MS = 100,      // minimum time spent on each measurement
+    BENCH_X25519_BATCH = 8,
+};
+
+typedef struct measure_t {
+    uint64_t ns;
+    uint64_t cycles;
+    size_t ops;
+} measure_t;
+
+typedef void (*bench_fn_t)(void *arg);
+
+static bool first_result = true;
+
+// Time stamp counter, 0 where there isn't one to read
+static uint64_t bench_cycles(void)
+{
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+    return __builtin_ia32_rdtsc();
+#else
+    return 0;
+#endif
+}
+
+// Run `fn` in growing batches until at least `min_ns` has elapsed
+static measure_t measure(bench_fn_t fn, void *arg, uint64_t min_ns)
+{
+    fn(arg); // warm up caches, backend selection, and worker threads
+
+    measure_t m = { 0 };
+    size_t batch = 1;
+    while (m.ns < min_ns) {
+        const uint64_t cycles = bench_cycles();
+        const uint64_t start = xclock_ns();
+        for (size_t i = 0; i < batch; i++) {
+            fn(arg);
+        }
+        m.ns += xclock_ns() - start;
+        m.cycles += bench_cycles() - cycles;
+        m.ops += batch;
+
+        // Aim the next batch at the remaining time
+        const uint64_t per_op = m.ns / m.ops + 1;
+        batch = m.ns < min_ns ? (size_t)((min_ns - m.ns) / per_op) + 1 : 0;
+    }
+    return m;
+}
+
+static void report(const char *name, const char *backend, size_t bytes, size_t ops_per_call, measure_t m)
+{
+    const size_t ops = m.ops * ops_per_call;
+    const double ns_per_op = (double)m.ns / (double)ops;
+
+    printf("%s\n    {\"name\": \"%s\", \"backend\": \"%s\", \"bytes\": %zu, \"ops\": %zu, \"ns_per_op\": %.1f",
+        first_result ? "" : ",", name, backend, bytes, ops, ns_per_op);
+    if (bytes) {
+        printf(", \"mb_per_s\": %.1f", (double)bytes * 1e3 / ns_per_op);
+    }
+    if (bytes && m.cycles) {
+        printf(", \"cycles_per_byte\": %.2f", (double)m.cycles / ((double)ops * (double)bytes));
+    }
+    else if (m.cycles) {
+        printf(", \"cycles_per_op\": %.0f", (double)m.cycles / (double)ops);
+    }
+    printf("}");
+    fflush(stdout);
+    first_result = false;
+}
+
+/**
+ * @section AES-128
+ */
+
+typedef struct aes_bench_t {
+    aes128_t ctx;
+    uint8_t *data;
+    size_t length;
+    uint8_t mac[AES_BLOCK_SIZE];
+} aes_bench_t;
+
+static void bench_aes128_encrypt(void *arg)
+{
+    aes_bench_t *b = arg;
+    aes128_encrypt(&b->ctx, b->data, b->length);
+}
+
+static void bench_aes128_decrypt(void *arg)
+{
+    aes_bench_t *b = arg;
+    aes128_decrypt(&b->ctx, b->data, b->length);
+}
+
+static void bench_aes128_cmac(void *arg)
+{
+    aes_bench_t *b = arg;
+    aes128_cmac(&b->ctx, b->data, b->length, b->mac);
+}
+
+static void bench_aes128(uint8_t *data, size_t max, uint64_t min_ns)
+{
+    static const uint8_t key[AES_KEY_LEN] = { 0x2b, 0x7e, 0x15, 0x16, 0x28, 0xae, 0xd2, 0xa6 };
+    static const uint8_t iv[AES_BLOCK_SIZE] = { 0 };
+    const char *backend = aes128_backend_name(aes128_get_backend());
+
+    aes_bench_t b = { .data = data };
+    for (b.length = BENCH_SIZE_MIN; b.length <= max; b.length *= BENCH_SIZE_STEP) {
+        aes128_init(&b.ctx, iv, key);
+        report("aes128_encrypt", backend, b.length, 1, measure(bench_aes128_encrypt, &b, min_ns));
+        report("aes128_decrypt", backend, b.length, 1, measure(bench_aes128_decrypt, &b, min_ns));
+        aes128_init_cmac(&b.ctx, key);
+        report("aes128_cmac", backend, b.length, 1, measure(bench_aes128_cmac, &b, min_ns));
+    }
+}
+
+/**
+ * @section Wire
+ */
+
+// Encryption happens in-place and wipes nothing the next decryption needs, so the two are
+// timed back to back on the same wire
+static void bench_wire(const char *backend, wire_suite_t suite, const uint8_t *data, size_t max, uint64_t min_ns)
+{
+    uint8_t key[KEY_LEN];
+    (void)csprng_fill(key, sizeof(key));
+    wire_key_t wire_key;
+    wire_key_init(&wire_key, key, suite, WIRE_KEY_SESSION);
+
+    for (size_t length = BENCH_SIZE_MIN; length <= max; length *= BENCH_SIZE_STEP) {
+        size_t len = length;
+        wire_t *wire = init_wire(length <= DATA_LEN_MAX ? TYPE_TEXT : TYPE_FILE, data, &len);
+        if (!wire) {
+            break;
+        }
+        const size_t wire_len = wire_get_sealed_length(wire, suite);
+
+        measure_t enc = { 0 }, dec = { 0 };
+        bool ok = encrypt_wire(wire, &wire_key) && decrypt_wire(wire, wire_len, &wire_key, NULL);
+        while (ok && (enc.ns < min_ns || dec.ns < min_ns)) {
+            uint64_t cycles = bench_cycles();
+            uint64_t start = xclock_ns();
+            ok = encrypt_wire(wire, &wire_key);
+            enc.ns += xclock_ns() - start;
+            enc.cycles += bench_cycles() - cycles;
+            enc.ops++;
+
+            cycles = bench_cycles();
+            start = xclock_ns();
+            ok = ok && decrypt_wire(wire, wire_len, &wire_key, NULL);
+            dec.ns += xclock_ns() - start;
+            dec.cycles += bench_cycles() - cycles;
+            dec.ops++;
+        }
+        free_wire(wire);
+
+        if (!ok) {
+            log_error("wire round trip failed for %zu bytes", length);
+            break;
+        }
+        report("encrypt_wire", backend, length, 1, enc);
+        report("decrypt_wire", backend, length, 1, dec);
+    }
+    wire_key_wipe(&wire_key);
+}
+
+/**
+ * @section SHA-256
+ */
+
+typedef struct sha_bench_t {
+    const uint8_t *data;
+    size_t length;
+    uint8_t digest[SHA256_LANES][SHA256_DIGEST_LEN];
+} sha_bench_t;
+
+static void bench_sha256_op(void *arg)
+{
+    sha_bench_t *b = arg;
+    sha256_t ctx;
+    sha256_init(&ctx);
+    sha256_append(&ctx, b->data, b->length);
+    sha256_finish(&ctx, b->digest[0]);
+}
+
+static void bench_sha256_x8_op(void *arg)
+{
+    sha_bench_t *b = arg;
+    const void *src[SHA256_LANES];
+    for (size_t n = 0; n < SHA256_LANES; n++) {
+        src[n] = &b->data[n * b->length];
+    }
+    sha256_x8_t ctx;
+    sha256_init_x8(&ctx);
+    sha256_append_x8(&ctx, src, b->length);
+    sha256_finish_x8(&ctx, b->digest);
+}
+
+static void bench_sha256(const uint8_t *data, size_t max, uint64_t min_ns)
+{
+    const char *backend = sha256_backend_name(sha256_get_backend());
+
+    sha_bench_t b = { .data = data };
+    for (b.length = BENCH_SIZE_MIN; b.length <= max; b.length *= BENCH_SIZE_STEP) {
+        report("sha256", backend, b.length, 1, measure(bench_sha256_op, &b, min_ns));
+    }
+
+    // Each call hashes SHA256_LANES messages of `length` bytes, reported per message
+    for (b.length = BENCH_SIZE_MIN; b.length * SHA256_LANES <= max; b.length *= BENCH_SIZE_STEP) {
+        report("sha256_x8", backend, b.length, SHA256_LANES, measure(bench_sha256_x8_op, &b, min_ns));
+    }
+}
+
+/**
+ * @section X25519
+ */
+
+typedef struct x25519_bench_t {
+    uint8_t secret[BENCH_X25519_BATCH][32];
+    uint8_t point[BENCH_X25519_BATCH][32];
+    uint8_t public[BENCH_X25519_BATCH][32];
+} x25519_bench_t;
+
+static void bench_x25519_op(void *arg)
+{
+    x25519_bench_t *b = arg;
+    x25519(b->public[0], b->secret[0], b->point[0]);
+}
+
+static void bench_x25519_base_op(void *arg)
+{
+    x25519_bench_t *b = arg;
+    x25519_base(b->public[0], b->secret[0]);
+}
+
+static void bench_x25519_batch_op(void *arg)
+{
+    x25519_bench_t *b = arg;
+    x25519_batch(b->public[0], b->secret[0], b->point[0], BENCH_X25519_BATCH);
+}
+
+static void bench_x25519(uint64_t min_ns)
+{
+    x25519_bench_t b;
+    (void)csprng_fill(b.secret, sizeof(b.secret));
+    for (size_t i = 0; i < BENCH_X25519_BATCH; i++) {
+        x25519_base(b.point[i], b.secret[(i + 1) % BENCH_X25519_BATCH]);
+    }
+
+    report("x25519", x25519_backend_name(), 0, 1, measure(bench_x25519_op, &b, min_ns));
+    report("x25519_base", x25519_backend_name(), 0, 1, measure(bench_x25519_base_op, &b, min_ns));
+
+    const x25519_batch_backend_t batch_default = x25519_batch_get_backend();
+    static const x25519_batch_backend_t batch_backends[] = {
+        X25519_BATCH_BACKEND_SCALAR,
+        X25519_BATCH_BACKEND_AVX2,
+        X25519_BATCH_BACKEND_AVX512,
+    };
+    for (size_t i = 0; i < sizeof(batch_backends) / sizeof(*batch_backends); i++) {
+        if (x25519_batch_set_backend(batch_backends[i])) {
+            report("x25519_batch", x25519_batch_backend_name(batch_backends[i]), 0, BENCH_X25519_BATCH,
+                measure(bench_x25519_batch_op, &b, min_ns));
+        }
+    }
+    (void)x25519_batch_set_backend(batch_default);
+}
+
+/**
+ * @section CSPRNG
+ */
+
+static void bench_csprng_op(void *arg)
+{
+    (void)csprng_fill(arg, AES_BLOCK_SIZE);
+}
+
+static void usage(FILE *f)
+{
+    static const char usage[] =
+        "usage: parcel-bench [-h] [-m MAX] [-t MS]\n"
+        "  -m MAX   largest payload in bytes (default 67108864)\n"
+        "  -t MS    minimum milliseconds spent on each measurement (default 100)\n"
+        "  -h       print this usage information\n";
+    fprintf(f, "%s", usage);
+}
+
+int main(int argc, char **argv)
+{
+    log_init(LOG_ERROR);
+
+    long max = BENCH_SIZE_MAX;
+    long ms = BENCH_TIME_MS;
+
+    xgetopt_t xgo = { 0 };
+    for (ptrdiff_t opt = -1; (opt = xgetopt(&xgo, argc, argv, "hm:t:")) != -1;) {
+        switch (opt) {
+            case 'm':
+                if (!xstrrange(xgo.arg, &max, BENCH_SIZE_MIN, BENCH_SIZE_MAX)) {
+                    fprintf(stderr, "payload limit must be between %d and %d bytes\n", BENCH_SIZE_MIN, BENCH_SIZE_MAX);
+                    return 1;
+                }
+                break;
+            case 't':
+                if (!xstrrange(xgo.arg, &ms, 1, 60000)) {
+                    fprintf(stderr, "measurement time must be between 1 and 60000 ms\n");
+                    return 1;
+                }
+                break;
+            case 'h':
+                usage(stdout);
+                return 0;
+            case ':':
+                fprintf(stderr, "option is missing an argument\n");
+                return 1;
+            default:
+                usage(stderr);
+                return -1;
+        }
+    }
+
+    const uint64_t min_ns = (uint64_t)ms * 1000000;
+    uint8_t *data = xmalloc((size_t)max);
+    if (!data || !csprng_fill(data, (size_t)max)) {
+        return 1;
+    }
+
+    printf("{\n  \"version\": \"" STR(PARCEL_VERSION) "\",\n");
+    printf("  \"cpus\": %zu,\n", xgetncpu());
+    printf("  \"cycles\": \"%s\",\n", bench_cycles() ? "tsc" : "none");
+    printf("  \"results\": [");
+
+    // Every backend this machine supports, restoring the automatic choice afterwards
+    const aes128_backend_t aes_default = aes128_get_backend();
+    static const aes128_backend_t aes_backends[] = { AES128_BACKEND_SOFTWARE, AES128_BACKEND_AESNI };
+    for (size_t i = 0; i < sizeof(aes_backends) / sizeof(*aes_backends); i++) {
+        if (!aes128_set_backend(aes_backends[i])) {
+            continue;
+        }
+        bench_aes128(data, (size_t)max, min_ns);
+
+        char backend[64];
+        snprintf(backend, sizeof(backend), "%s/%s", wire_suite_name(WIRE_SUITE_CBC_CMAC),
+            aes128_backend_name(aes_backends[i]));
+        bench_wire(backend, WIRE_SUITE_CBC_CMAC, data, (size_t)max, min_ns);
+    }
+    (void)aes128_set_backend(aes_default);
+    bench_wire(wire_suite_name(WIRE_SUITE_CHACHA20_POLY1305), WIRE_SUITE_CHACHA20_POLY1305, data, (size_t)max, min_ns);
+    bench_wire(wire_suite_name(WIRE_SUITE_COMPACT), WIRE_SUITE_COMPACT, data, (size_t)max, min_ns);
+
+    const sha256_backend_t sha_default = sha256_get_backend();
+    static const sha256_backend_t sha_backends[] = { SHA256_BACKEND_SOFTWARE, SHA256_BACKEND_SHANI };
+    for (size_t i = 0; i < sizeof(sha_backends) / sizeof(*sha_backends); i++) {
+        if (sha256_set_backend(sha_backends[i])) {
+            bench_sha256(data, (size_t)max, min_ns);
+        }
+    }
+    (void)sha256_set_backend(sha_default);
+
+    bench_x25519(min_ns);
+
+    uint8_t iv[AES_BLOCK_SIZE];
+    report("csprng_fill", "chacha20", AES_BLOCK_SIZE, 1, measure(bench_csprng_op, iv, min_ns));
+
+    printf("\n  ]\n}\n");
+    xfree(data);
+    return 0;
+}
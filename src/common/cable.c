@@ -6,9 +6,32 @@
 #include <stddef.h>
 
 
-cable_t *alloc_cable(void)
+cable_t *cable_buffer_reserve(cable_buffer_t *buf, size_t len)
 {
-    return xcalloc(sizeof(cable_header_t));
+    size_t capacity = buf->capacity;
+    if (len > capacity) {
+        capacity = MAX(MAX(2 * capacity, (size_t)CABLE_BUFFER_MIN), len);
+    }
+    else if (capacity > CABLE_BUFFER_KEEP && len <= CABLE_BUFFER_KEEP) {
+        capacity = CABLE_BUFFER_KEEP;
+    }
+
+    if (capacity != buf->capacity) {
+        buf->cable = xrealloc(buf->cable, capacity);
+        buf->capacity = capacity;
+    }
+    return buf->cable;
+}
+
+cable_t *cable_buffer_get(cable_buffer_t *buf)
+{
+    return buf->capacity ? buf->cable : cable_buffer_reserve(buf, sizeof(cable_header_t));
+}
+
+void cable_buffer_free(cable_buffer_t *buf)
+{
+    buf->cable = xfree(buf->cable);
+    buf->capacity = 0;
 }
 
 void cable_set_signature(cable_t *cable)
@@ -21,11 +44,6 @@ void cable_set_len(cable_t *cable, size_t len)
     wire_unpack64(cable->hdr.len, len);
 }
 
-void cable_set_data(cable_t *cable, const void *data, size_t len)
-{
-    memcpy(&cable->data, data, len);
-}
-
 size_t cable_get_total_len(cable_t *cable)
 {
     return wire_pack64(cable->hdr.len);
@@ -41,94 +59,207 @@ static bool cable_check_signature(cable_t *cable)
     return !memcmp(cable->hdr.signature, "parcel", sizeof(cable->hdr.signature));
 }
 
-static bool cable_recv_remaining(sock_t sock, cable_t **cable)
+static bool cable_recv_remaining(sock_t sock, cable_buffer_t *buf)
 {
-    size_t cable_size = cable_get_total_len(*cable);
-    *cable = xrealloc(*cable, cable_size);
-    size_t remaining = cable_size - sizeof(cable_header_t);
-    return xrecvall(sock, (*cable)->data, remaining);
+    const size_t cable_size = cable_get_total_len(buf->cable);
+    if (cable_size < sizeof(cable_t)) {
+        log_error("cable length is invalid (%zu bytes)", cable_size);
+        return false;
+    }
+    cable_t *cable = cable_buffer_reserve(buf, cable_size);
+    return xrecvall(sock, cable->data, cable_size - sizeof(cable_header_t));
+}
+
+size_t cable_prefix_len(wire_suite_t suite)
+{
+    return suite == WIRE_SUITE_COMPACT ? CABLE_COMPACT_PREFIX : sizeof(cable_header_t);
+}
+
+// Length of the compact frame that starts with `prefix`, including the varint, 0 if it's invalid
+static size_t cable_compact_len(const uint8_t *prefix, size_t *varint_len)
+{
+    uint64_t len = 0;
+    *varint_len = wire_pack_varint(prefix, CABLE_COMPACT_PREFIX, &len);
+    if (!*varint_len || len < WIRE_COMPACT_OVERHEAD + 1) {
+        log_error("compact frame length is invalid");
+        return 0;
+    }
+    return *varint_len + (size_t)len;
+}
+
+static size_t cable_recv_compact(sock_t sock, cable_buffer_t *buf)
+{
+    size_t varint_len = 0;
+    const size_t len = cable_compact_len((const uint8_t *)buf->cable, &varint_len);
+    if (!len) {
+        return 0;
+    }
+    uint8_t *frame = (uint8_t *)cable_buffer_reserve(buf, len);
+    if (!xrecvall(sock, &frame[CABLE_COMPACT_PREFIX], len - CABLE_COMPACT_PREFIX)) {
+        log_error("failed to receive compact frame (%zu bytes)", len);
+        return 0;
+    }
+    log_trace("cable_recv_data() len: %zu bytes (compact)", len);
+    return len;
 }
 
-size_t cable_recv_data(sock_t sock, cable_t **cable)
+size_t cable_recv_data(sock_t sock, cable_buffer_t *buf, wire_suite_t suite, size_t received)
 {
-    if (!cable_check_signature(*cable)) {
+    const size_t prefix = cable_prefix_len(suite);
+    if (received < prefix && !xrecvall(sock, &((uint8_t *)buf->cable)[received], prefix - received)) {
+        log_error("failed to receive cable header");
+        return 0;
+    }
+    if (suite == WIRE_SUITE_COMPACT) {
+        return cable_recv_compact(sock, buf);
+    }
+
+    if (!cable_check_signature(buf->cable)) {
         log_error("cable signature is invalid");
         return 0;
     }
-    if (!cable_recv_remaining(sock, cable)) {
-        size_t exp = cable_get_payload_len(*cable);
+    if (!cable_recv_remaining(sock, buf)) {
+        size_t exp = cable_get_payload_len(buf->cable);
         log_error("failed to receive cable data (%zu bytes)", exp);
         return 0;
     }
 
-    size_t payload_len = cable_get_payload_len(*cable);
-    size_t len = cable_get_total_len(*cable);
+    size_t payload_len = cable_get_payload_len(buf->cable);
+    size_t len = cable_get_total_len(buf->cable);
     log_trace("cable_recv_data() len: %zu bytes (payload: %zu bytes)", len, payload_len);
     return len;
 }
 
-bool transmit_cabled_wire(sock_t sock, wire_t *wire, const uint8_t *key)
+uint8_t *seal_cable(wire_t *wire, const wire_key_t *key, size_t *len)
+{
+    size_t sealed_len = wire_get_sealed_length(wire, key->suite); // unreadable once the header is encrypted
+    if (key->suite == WIRE_SUITE_COMPACT && sealed_len > CABLE_COMPACT_MAX - CABLE_COMPACT_PREFIX) {
+        log_error("wire too long for a compact frame (%zu bytes)", sealed_len);
+        return NULL;
+    }
+    if (!encrypt_wire(wire, key)) {
+        return NULL;
+    }
+    if (key->suite != WIRE_SUITE_COMPACT) {
+        cable_t *cable = cable_from_wire(wire, &sealed_len);
+        *len = sealed_len;
+        return (uint8_t *)cable;
+    }
+
+    // The varint goes directly in front of the frame, still inside the wire header
+    uint8_t *frame = wire_get_sealed(wire, key->suite);
+    const size_t varint_len = wire_varint_length(sealed_len);
+    frame -= varint_len;
+    wire_unpack_varint(frame, sealed_len);
+    *len = varint_len + sealed_len;
+    return frame;
+}
+
+bool transmit_cabled_wire(sock_t sock, wire_t *wire, const wire_key_t *key)
 {
-    size_t len = wire_get_length(wire);
-    encrypt_wire(wire, key);
-    cable_t *cable = init_cable(wire, &len);
-    bool ok = xsendall(sock, cable, len);
-    xfree(cable);
-    return ok;
+    size_t len = 0;
+    const uint8_t *cable = seal_cable(wire, key, &len);
+    return cable && xsendall(sock, cable, len);
 }
 
-static bool cable_recv_header(sock_t sock, cable_t **cable)
+static bool cable_recv_header(sock_t sock, cable_buffer_t *buf)
 {
-    return xrecvall(sock, &(*cable)->hdr, sizeof(cable_header_t));
+    cable_t *cable = cable_buffer_get(buf);
+    return xrecvall(sock, &cable->hdr, sizeof(cable_header_t));
 }
 
-cable_t *recv_cable(sock_t sock, size_t *cable_length)
+// Receive the cable header, or a compact frame's prefix, and make room for the rest. `*len` is
+// set to the length of the wire or frame, and `*received` to how much of it is already in
+static wire_t *cable_recv_begin(sock_t sock, cable_buffer_t *buf, wire_suite_t suite, size_t *len, size_t *received)
 {
-    cable_t *cable = alloc_cable();
-    if (!cable_recv_header(sock, &cable)) {
-        log_error("failed to receive cable header ");
-        goto err;
+    if (suite != WIRE_SUITE_COMPACT) {
+        if (!cable_recv_header(sock, buf)) {
+            log_error("failed to receive cable header ");
+            return NULL;
+        }
+        if (!cable_check_signature(buf->cable)) {
+            log_error("cable signature is invalid");
+            return NULL;
+        }
+        const size_t cable_size = cable_get_total_len(buf->cable);
+        if (cable_size < sizeof(cable_t)) {
+            log_error("cable length is invalid (%zu bytes)", cable_size);
+            return NULL;
+        }
+        cable_t *cable = cable_buffer_reserve(buf, cable_size);
+        *len = cable_get_payload_len(cable);
+        *received = 0;
+        return (wire_t *)cable->data;
     }
-    if (!cable_check_signature(cable)) {
-        log_error("cable signature is invalid");
-        goto err;
+
+    uint8_t prefix[CABLE_COMPACT_PREFIX];
+    if (!xrecvall(sock, prefix, sizeof(prefix))) {
+        log_error("failed to receive compact frame prefix");
+        return NULL;
     }
-    if (!cable_recv_remaining(sock, &cable)) {
-        size_t exp = cable_get_payload_len(cable);
-        log_error("failed to receive cable data (%zu bytes)", exp);
-        goto err;
+    size_t varint_len = 0;
+    const size_t frame_len = cable_compact_len(prefix, &varint_len);
+    if (!frame_len) {
+        return NULL;
     }
 
-    *cable_length = cable_get_total_len(cable);
-    size_t payload_len = cable_get_payload_len(cable);
-    log_trace("recv_cable() len: %zu bytes (payload: %zu bytes)", *cable_length, payload_len);
+    // The frame goes where it overlays the end of a wire header, so the data lands at `wire->data`
+    *len = frame_len - varint_len;
+    *received = sizeof(prefix) - varint_len;
+    cable_t *cable = cable_buffer_reserve(buf, sizeof(cable_t) + WIRE_OFFSET_COMPACT + *len);
+    wire_t *wire = (wire_t *)cable->data;
+    memcpy(wire_get_sealed(wire, suite), &prefix[varint_len], *received);
+    return wire;
+}
 
-    if (0) {
-err:
-        cable = xfree(cable);
+cable_t *recv_cable_decrypt(sock_t sock, cable_buffer_t *buf, const wire_key_t *key1, const wire_key_t *key2, bool *decrypted)
+{
+    *decrypted = false;
+    size_t len = 0;
+    size_t received = 0;
+    wire_t *wire = cable_recv_begin(sock, buf, key1->suite, &len, &received);
+    if (!wire) {
+        return NULL;
     }
 
-    return cable;
+    wire_stream_t stream;
+    wire_stream_init(&stream, wire, len, key1, key2);
+    (void)wire_stream_update(&stream, received);
+    uint8_t *dst = wire_get_sealed(wire, key1->suite);
+    for (size_t i = received; i < len;) {
+        const ssize_t bytes_recv = xrecv(sock, &dst[i], MIN(len - i, (size_t)CABLE_RECV_CHUNK), 0);
+        if (bytes_recv <= 0) {
+            log_error("failed to receive cable data (%zu bytes)", len);
+            (void)wire_stream_final(&stream);
+            return NULL;
+        }
+        i += (size_t)bytes_recv;
+
+        // A wire that fails part way is still drained so the next cable starts where it should
+        (void)wire_stream_update(&stream, (size_t)bytes_recv);
+    }
+
+    *decrypted = wire_stream_final(&stream);
+    if (*decrypted && key1->suite == WIRE_SUITE_COMPACT) {
+        cable_set_signature(buf->cable);
+        cable_set_len(buf->cable, sizeof(cable_t) + wire_get_length(wire));
+    }
+    log_trace("recv_cable_decrypt() len: %zu bytes", len);
+    return buf->cable;
 }
 
-cable_t *init_cable(wire_t *wire, size_t *len)
+cable_t *cable_from_wire(wire_t *wire, size_t *len)
 {
     const size_t cable_length = sizeof(cable_t) + *len;
 
-    cable_t *cable = xcalloc(cable_length);
+    cable_t *cable = pointer_offset(wire, -(ptrdiff_t)sizeof(cable_header_t));
 
     cable_set_signature(cable);
     cable_set_len(cable, cable_length);
-    cable_set_data(cable, wire, *len);
     *len = cable_length;
     return cable;
 }
 
-void free_cabled_wire(wire_t *wire)
-{
-    xfree(pointer_offset(wire, -(ptrdiff_t)(sizeof(cable_header_t))));
-}
-
 wire_t *get_cabled_wire(cable_t *cable, size_t *len)
 {
     *len = cable_get_payload_len(cable);
@@ -3,10 +3,28 @@
 #include "xplatform.h"
 #include "xutils.h"
 #include "wire-util.h"
+#include "wire.h"
 #include "log.h"
 #include <stdint.h>
 
-typedef struct wire_t wire_t;
+
+// Largest single read while streaming a cable in, bounding how much arrives before it's decrypted
+enum { CABLE_RECV_CHUNK = 1 << 16 };
+
+enum CableBuffer {
+    CABLE_BUFFER_MIN = 1 << 12,  // first allocation, enough for chat without ever growing
+    CABLE_BUFFER_KEEP = 1 << 17, // capacity a buffer shrinks back to once large cables stop arriving
+};
+
+// Under WIRE_SUITE_COMPACT the cable header is replaced by a varint of the frame length. Every
+// frame is longer than CABLE_COMPACT_PREFIX bytes, so that many are read before the length is
+// decoded, which caps frames at 2^28 - 1 bytes
+enum CableCompact {
+    CABLE_COMPACT_PREFIX = 4,
+    CABLE_COMPACT_MAX = (1 << (7 * CABLE_COMPACT_PREFIX)) - 1,
+};
+
+_Static_assert(CABLE_COMPACT_PREFIX < 1 + WIRE_COMPACT_OVERHEAD, "compact frames must outlast their prefix");
 
 typedef struct cable_header_t {
     uint8_t signature[6]; // "parcel"
@@ -18,12 +36,31 @@ typedef struct cable_t {
     uint8_t data[];
 } __attribute__((packed)) cable_t;
 
-// Allocate an empty cable, only large enough to receive the cable header
-cable_t *alloc_cable(void);
+_Static_assert(sizeof(cable_header_t) == WIRE_HEADROOM, "wires must reserve room for the cable header");
+
+// Receive buffer reused for every cable from a connection. Cables received into it are only
+// valid until the next receive, and are never freed on their own
+typedef struct cable_buffer_t {
+    cable_t *cable;
+    size_t capacity;
+} cable_buffer_t;
 
-// Create a new cable containing the provided `*len`-byte `wire`
-// `wire` should be encrypted prior to calling this function
-cable_t *init_cable(wire_t *wire, size_t *len);
+// Make room for a `len`-byte cable, keeping whatever was already received. Grows geometrically,
+// and drops back to CABLE_BUFFER_KEEP bytes when a cable that fits follows a larger one
+cable_t *cable_buffer_reserve(cable_buffer_t *buf, size_t len);
+
+// The buffer as it stands, allocated on first use, for receiving a cable header into. Sizing
+// waits for the header so the buffer isn't shrunk between the chunks of a large file
+cable_t *cable_buffer_get(cable_buffer_t *buf);
+
+// Release the buffer's memory, it can be reused afterwards
+void cable_buffer_free(cable_buffer_t *buf);
+
+// Fill in the cable header reserved in front of the provided `*len`-byte `wire` and return
+// the cable, setting `*len` to its total length. Nothing is copied or allocated: the cable
+// and `wire` are the same buffer, so `xfree()` the cable or `free_wire()` the wire, not both
+// `wire` should come from `alloc_wire()` or `init_wire()` and be encrypted prior to calling this function
+cable_t *cable_from_wire(wire_t *wire, size_t *len);
 
 // Return the length of the variably-sized cable payload
 size_t cable_get_payload_len(cable_t *cable);
@@ -31,10 +68,13 @@ size_t cable_get_payload_len(cable_t *cable);
 // Return the total length of the `cable`, including headers
 size_t cable_get_total_len(cable_t *cable);
 
-// Receive the remainding "payload" section of a cable from the provided socket
-// `*cable` should point to received but unverified cable header
-// Returns the total cable length or `0` on failure
-size_t cable_recv_data(sock_t sock, cable_t **cable);
+// Bytes at the start of every cable under `suite` that have to be in before its length is known
+size_t cable_prefix_len(wire_suite_t suite);
+
+// Receive the rest of a cable sent under `suite`, as-is, from the provided socket. `buf` should
+// hold the first `received` bytes of it, at most `cable_prefix_len()`, and nothing is verified.
+// Returns the total cable length, the cable is the first that many bytes of `buf`, or `0` on failure
+size_t cable_recv_data(sock_t sock, cable_buffer_t *buf, wire_suite_t suite, size_t received);
 
 
 // Called after receiving a complete cable. Returns a pointer to the wire 
@@ -42,14 +82,17 @@ size_t cable_recv_data(sock_t sock, cable_t **cable);
 // wire
 wire_t *get_cabled_wire(cable_t *cable, size_t *len);
 
-// Free a wire returned from `get_cabled_wire(...)`
-// [note] the cable containing `wire` gets freed
-void free_cabled_wire(wire_t *wire);
+// Receive a cable from the provided socket, verifying and decrypting its wire with
+// `key1` (or `key2`) as the data arrives rather than after the whole cable is in.
+// `*decrypted` is set only if the wire authenticated. Returns `NULL` if the cable
+// itself couldn't be received. The cable lives in `buf`. A compact frame is received
+// in place inside a wire, and on success is handed back behind a regular cable header
+cable_t *recv_cable_decrypt(sock_t sock, cable_buffer_t *buf, const wire_key_t *key1, const wire_key_t *key2, bool *decrypted);
 
-// Receive a cable from the provided socket, setting `cable_length` 
-// Returns `NULL` on failure
-cable_t *recv_cable(sock_t sock, size_t *cable_length);
+// Encrypt `wire` in place with `key` and frame it for sending, a cable header in the headroom
+// or a compact frame's varint inside the wire header. Returns the first of the `*len` bytes
+// to send, all of them inside `wire`'s buffer, or NULL on failure
+uint8_t *seal_cable(wire_t *wire, const wire_key_t *key, size_t *len);
 
-// Encrypts `wire` using the provided `key`, encapsulates the encrypted wire in
-// a cable, and transmits the cable to provided socket `sock`
-bool transmit_cabled_wire(sock_t sock, wire_t *wire, const uint8_t *key);
+// Encrypts `wire` in place using the provided `key` and transmits it to `sock` as a cable
+bool transmit_cabled_wire(sock_t sock, wire_t *wire, const wire_key_t *key);
@@ -0,0 +1,135 @@
+/**
+ * @file csprng.c
+ * @author Jason Conway (jpc@jasonconway.dev)
+ * @brief Per-thread fast-key-erasure ChaCha20 CSPRNG for IVs, nonces, and ephemeral keys
+ * @ref https://blog.cr.yp.to/20170723-random.html
+ * @version 0.9.4
+ * @date 2025-01-12
+ *
+ * @copyright Copyright (c) 2025 Jason Conway. All rights reserved.
+ *
+ */
+
+#include "csprng.h"
+
+typedef struct csprng_t {
+    uint8_t key[CHACHA20_KEY_LEN];
+    uint8_t buffer[CSPRNG_BUFFER_LEN];
+    size_t available;    // unserved keystream at the end of `buffer`
+    size_t until_reseed; // output left before the next reseed
+    unsigned generation; // `forks` when this thread last reseeded
+    uint64_t sequence;   // next value handed out by `csprng_sequence()`
+    bool sequenced;      // `sequence` has been given a random start since the last reseed
+    bool seeded;
+} csprng_t;
+
+static _Thread_local csprng_t rng;
+
+// A forked child inherits the parent's generator, so every fork forces a reseed
+static atomic_uint forks;
+
+#if __unix__ || __APPLE__
+static void csprng_atfork_child(void)
+{
+    atomic_fetch_add_explicit(&forks, 1, memory_order_relaxed);
+}
+
+static void csprng_register_atfork(void)
+{
+    (void)pthread_atfork(NULL, NULL, csprng_atfork_child);
+}
+#endif
+
+// Mix fresh OS entropy into the key, discarding whatever keystream was left
+static bool csprng_reseed(csprng_t *ctx)
+{
+#if __unix__ || __APPLE__
+    static pthread_once_t atfork_once = PTHREAD_ONCE_INIT;
+    (void)pthread_once(&atfork_once, csprng_register_atfork);
+#endif
+
+    uint8_t seed[CHACHA20_KEY_LEN];
+    if (xgetrandom(seed, sizeof(seed)) != (ssize_t)sizeof(seed)) {
+        return false;
+    }
+    for (size_t i = 0; i < sizeof(seed); i++) {
+        ctx->key[i] ^= seed[i];
+    }
+    memset(seed, 0, sizeof(seed));
+    memset(ctx->buffer, 0, sizeof(ctx->buffer));
+
+    ctx->available = 0;
+    ctx->until_reseed = CSPRNG_RESEED_BYTES;
+    ctx->generation = atomic_load_explicit(&forks, memory_order_relaxed);
+    ctx->sequenced = false;
+    ctx->seeded = true;
+    return true;
+}
+
+// Every key is used for exactly one keystream, so the nonce and counter can stay fixed
+static void csprng_refill(csprng_t *ctx)
+{
+    static const uint8_t nonce[CHACHA20_NONCE_LEN] = { 0 };
+    memset(ctx->buffer, 0, sizeof(ctx->buffer));
+    chacha20_xor(ctx->key, nonce, 0, ctx->buffer, sizeof(ctx->buffer));
+
+    // The old key is overwritten right away, so earlier output can't be recovered from this state
+    memcpy(ctx->key, ctx->buffer, CHACHA20_KEY_LEN);
+    memset(ctx->buffer, 0, CHACHA20_KEY_LEN);
+    ctx->available = CSPRNG_BUFFER_LEN - CHACHA20_KEY_LEN;
+}
+
+// Reseed first if `len` more bytes would outlast the current seed, or the process forked
+static bool csprng_ready(csprng_t *ctx, size_t len)
+{
+    if (!ctx->seeded || ctx->until_reseed < len ||
+        ctx->generation != atomic_load_explicit(&forks, memory_order_relaxed)) {
+        return csprng_reseed(ctx);
+    }
+    return true;
+}
+
+bool csprng_fill(void *dst, size_t len)
+{
+    csprng_t *ctx = &rng;
+    if (!csprng_ready(ctx, len)) {
+        return false;
+    }
+    ctx->until_reseed -= MIN(len, ctx->until_reseed);
+
+    uint8_t *out = (uint8_t *)dst;
+    while (len) {
+        if (!ctx->available) {
+            csprng_refill(ctx);
+        }
+        uint8_t *keystream = &ctx->buffer[CSPRNG_BUFFER_LEN - ctx->available];
+        const size_t take = MIN(len, ctx->available);
+        memcpy(out, keystream, take);
+        memset(keystream, 0, take);
+        ctx->available -= take;
+        out += take;
+        len -= take;
+    }
+    return true;
+}
+
+bool csprng_sequence(uint64_t *value)
+{
+    csprng_t *ctx = &rng;
+    if (!csprng_ready(ctx, 0)) {
+        return false;
+    }
+    if (!ctx->sequenced) {
+        if (!csprng_fill(&ctx->sequence, sizeof(ctx->sequence))) {
+            return false;
+        }
+        ctx->sequenced = true;
+    }
+    *value = ctx->sequence++;
+    return true;
+}
+
+void csprng_wipe(void)
+{
+    memset(&rng, 0, sizeof(rng));
+}
@@ -0,0 +1,47 @@
+/**
+ * @file csprng.h
+ * @author Jason Conway (jpc@jasonconway.dev)
+ * @brief Per-thread fast-key-erasure ChaCha20 CSPRNG for IVs, nonces, and ephemeral keys
+ * @ref https://blog.cr.yp.to/20170723-random.html
+ * @version 0.9.4
+ * @date 2025-01-12
+ *
+ * @copyright Copyright (c) 2025 Jason Conway. All rights reserved.
+ *
+ */
+
+#pragma once
+
+#include "chacha20-poly1305.h"
+#include "xplatform.h"
+
+enum Csprng {
+    CSPRNG_BUFFER_LEN = 16 * CHACHA20_BLOCK_SIZE, // keystream generated per refill, the first CHACHA20_KEY_LEN bytes become the next key
+    CSPRNG_RESEED_BYTES = 1 << 20,                // output served before fresh OS entropy is mixed into the key
+};
+
+/**
+ * @brief Fill `dst` with `len` random bytes from the calling thread's generator. Each thread
+ * seeds itself from `xgetrandom()` on first use, after CSPRNG_RESEED_BYTES of output, and
+ * in the child after a fork. Served keystream is wiped from the generator immediately
+ *
+ * @param[out] dst destination
+ * @param[in] len number of bytes
+ * @return false if the OS entropy source failed while (re)seeding, `dst` is left untouched
+ */
+bool csprng_fill(void *dst, size_t len);
+
+/**
+ * @brief Next value of the calling thread's sequence, which counts up from a random start and
+ * jumps to a fresh one whenever the generator reseeds. Values never repeat between reseeds,
+ * and distinct threads or processes only collide if their 64-bit runs happen to overlap
+ *
+ * @param[out] value next sequence value
+ * @return false if the OS entropy source failed while (re)seeding
+ */
+bool csprng_sequence(uint64_t *value);
+
+/**
+ * @brief Erase the calling thread's generator, the next `csprng_fill()` reseeds
+ */
+void csprng_wipe(void);
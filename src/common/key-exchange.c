@@ -10,6 +10,7 @@
  */
 
 #include "key-exchange.h"
+#include "csprng.h"
 #include "wire-ctrl.h"
 #include "wire-raw.h"
 #include "wire.h"
@@ -19,15 +20,16 @@
 #include <string.h>
 #include "cable.h"
 
-bool ke_snd(sock_t sock, key_type_t type, const uint8_t *key)
+bool ke_snd(sock_t sock, key_type_t type, uint8_t suites, const uint8_t *key)
 {
-    ke_t ke = { .type = (uint8_t)type };
+    ke_t ke = { .type = (uint8_t)type, .suites = suites };
     memcpy(ke.key, key, KEY_LEN);
     // xhexdump(&ke, sizeof(ke_t));
     return xsendall(sock, &ke, sizeof(ke_t));
 }
 
-bool ke_rcv(sock_t sock, key_type_t type, uint8_t *key)
+// `suites` may be NULL when the message doesn't carry suite information
+bool ke_rcv(sock_t sock, key_type_t type, uint8_t *suites, uint8_t *key)
 {
     ke_t ke = { 0 };
     if (!xrecvall(sock, &ke, sizeof(ke_t))) {
@@ -39,6 +41,9 @@ bool ke_rcv(sock_t sock, key_type_t type, uint8_t *key)
         return false;
     }
     // xhexdump(&ke, sizeof(ke_t));
+    if (suites) {
+        *suites = ke.suites;
+    }
     memcpy(key, ke.key, KEY_LEN);
     return true;
 }
@@ -54,7 +59,7 @@ void sha256_key_digest(const uint8_t *key, uint8_t *hash)
 // ECDH private key ( {d ∈ ℕ | d < n} )
 static void point_d(uint8_t *dst)
 {
-    (void)xgetrandom(dst, KEY_LEN);
+    (void)csprng_fill(dst, KEY_LEN);
     dst[0x00] &= 0xf8;
     dst[0x1f] &= 0x7f;
     dst[0x1f] |= 0x40;
@@ -63,8 +68,7 @@ static void point_d(uint8_t *dst)
 // ECDH public key (Q = d * G)
 static void point_q(const uint8_t *secret_key, uint8_t *public_key, uint8_t *fingerprint)
 {
-    const uint8_t basepoint[KEY_LEN] = { 9 };
-    x25519(public_key, secret_key, basepoint);
+    x25519_base(public_key, secret_key);
     if (fingerprint) {
         uint8_t hash[KEY_LEN];
         sha256_key_digest(public_key, hash);
@@ -78,7 +82,7 @@ static void point_kx(uint8_t *shared_key, const uint8_t *secret_key, const uint8
     x25519(shared_key, secret_key, public_key);
 }
 
-bool two_party_client(sock_t socket, uint8_t *ctrl_key)
+bool two_party_client(sock_t socket, uint8_t *ctrl_key, wire_suite_t *suite, uint8_t *features)
 {
     // Diffie-Hellman keys
     uint8_t secret_key[KEY_LEN] = { 0 };
@@ -87,105 +91,207 @@ bool two_party_client(sock_t socket, uint8_t *ctrl_key)
     point_d(secret_key);
     point_q(secret_key, public_key, NULL);
 
-    // Send public key to begin
-    if (!ke_snd(socket, KEY_CLIENT_PUBLIC, public_key)) {
+    // Send public key to begin, along with every wire suite and feature we can handle
+    if (!ke_snd(socket, KEY_CLIENT_PUBLIC, WIRE_SUITES_SUPPORTED | WIRE_FEATURES_SUPPORTED, public_key)) {
         log_fatal("failed to send public key to server");
         return false;
     }
 
+    // The server picks the suite and features used by the whole session
+    uint8_t selected = 0;
     uint8_t server_public_key[KEY_LEN] = { 0 };
-    if (!ke_rcv(socket, KEY_SERVER_PUBLIC, server_public_key)) {
+    if (!ke_rcv(socket, KEY_SERVER_PUBLIC, &selected, server_public_key)) {
         log_fatal("failed to receive server's public key");
         return false;
     }
+    *features = selected & WIRE_FEATURES_MASK;
+    selected &= ~WIRE_FEATURES_MASK;
+    if (selected >= WIRE_SUITE_COUNT || !(WIRE_SUITES_SUPPORTED & (1 << selected))) {
+        log_fatal("server selected an unsupported wire suite (%u)", selected);
+        return false;
+    }
+    if (*features & ~WIRE_FEATURES_SUPPORTED) {
+        log_fatal("server selected unsupported features (%02x)", *features);
+        return false;
+    }
+    *suite = (wire_suite_t)selected;
+    log_debug("using wire suite %s%s", wire_suite_name(*suite), (*features & WIRE_FEATURE_COMPRESS) ? " with compression" : "");
 
     uint8_t shared_secret[KEY_LEN] = { 0 };
     point_kx(shared_secret, secret_key, server_public_key);
 
-    size_t len = 0;
-    cable_t *cable = recv_cable(socket, &len);
+    // Shared secret gets hashed in point_kx()
+    wire_key_t handshake_key;
+    wire_key_init(&handshake_key, shared_secret, *suite, WIRE_KEY_SESSION);
+
+    bool ok = false;
+    cable_buffer_t buf = { 0 };
+    cable_t *cable = recv_cable_decrypt(socket, &buf, &handshake_key, NULL, &ok);
+    wire_key_wipe(&handshake_key);
     if (!cable) {
         log_fatal("failed to receive cable from server");
+        cable_buffer_free(&buf);
         return false;
     }
-
-    size_t wire_len = 0;
-    wire_t *wire = get_cabled_wire(cable, &wire_len);
-
-    // Shared secret gets hashed in point_kx()
-    if (!decrypt_wire(wire, wire_len, shared_secret, NULL)) {
+    if (!ok) {
         log_fatal("decryption failure");
-        free_cabled_wire(wire);
+        cable_buffer_free(&buf);
         return false;
     }
 
+    size_t wire_len = 0;
+    wire_t *wire = get_cabled_wire(cable, &wire_len);
+
     assert(wire_get_type(wire) == TYPE_SESSION_KEY);
     memcpy(ctrl_key, wire->data, KEY_LEN);
-    free_cabled_wire(wire);
+    cable_buffer_free(&buf);
     return true;
 }
 
-bool two_party_server(sock_t socket, uint8_t *session_key)
+bool two_party_server(sock_t socket, const wire_key_t *session_key, uint8_t features)
 {
-    // Receive public key from the client
-    uint8_t public_key[KEY_LEN] = { 0 };
-    if (!ke_rcv(socket, KEY_CLIENT_PUBLIC, public_key)) {
-        log_fatal("failed to receive public key from client");
-        return false;
-    }
+    bool joined = false;
+    return two_party_server_batch(&socket, 1, session_key, features, &joined) == 1;
+}
 
-    // Generate a single-use secret key for the key pair
-    uint8_t secret_key[KEY_LEN] = { 0 };
-    point_d(secret_key);
+size_t two_party_server_batch(const sock_t *sockets, size_t count, const wire_key_t *session_key, uint8_t features, bool *joined)
+{
+    const wire_suite_t suite = session_key->suite;
+
+    // Client public keys, our secret keys, and the shared secrets, `count` keys each
+    uint8_t *keys = xcalloc(3 * count * KEY_LEN);
+    uint8_t *public_keys = &keys[0];
+    uint8_t *secret_keys = &keys[count * KEY_LEN];
+    uint8_t *shared_secrets = &keys[2 * count * KEY_LEN];
+
+    for (size_t i = 0; i < count; i++) {
+        joined[i] = false;
+
+        // Receive public key from the client
+        uint8_t client_suites = 0;
+        if (!ke_rcv(sockets[i], KEY_CLIENT_PUBLIC, &client_suites, &public_keys[i * KEY_LEN])) {
+            log_error("failed to receive public key from client");
+            continue;
+        }
 
-    // Compute a single-use public key and our shared secret with the client
-    uint8_t server_public_key[KEY_LEN] = { 0 };
-    point_q(secret_key, server_public_key, NULL);
+        // Every client shares the session's suite and features, so one that can't use them can't join
+        if (!(client_suites & (1 << suite))) {
+            log_error("client does not support wire suite %s", wire_suite_name(suite));
+            continue;
+        }
+        if ((client_suites & features) != features) {
+            log_error("client does not support the session's features (%02x)", features);
+            continue;
+        }
 
-    if (!ke_snd(socket, KEY_SERVER_PUBLIC, server_public_key)) {
-        log_fatal("did not send full key length");
-        return false;
+        // Generate a single-use secret key for the key pair
+        point_d(&secret_keys[i * KEY_LEN]);
+
+        // Compute a single-use public key
+        uint8_t server_public_key[KEY_LEN] = { 0 };
+        point_q(&secret_keys[i * KEY_LEN], server_public_key, NULL);
+
+        if (!ke_snd(sockets[i], KEY_SERVER_PUBLIC, (uint8_t)suite | features, server_public_key)) {
+            log_error("did not send full key length");
+            continue;
+        }
+        joined[i] = true;
     }
 
-    uint8_t shared_secret[KEY_LEN] = { 0 };
-    point_kx(shared_secret, secret_key, public_key);
+    // Every shared secret in one go, spread across SIMD lanes where supported. Slots of
+    // clients that dropped out are computed along with the rest and thrown away
+    x25519_batch(shared_secrets, secret_keys, public_keys, count);
 
+    size_t n = 0;
     session_key_t sk;
-    memcpy(&sk, session_key, sizeof(session_key_t));
-    wire_t *wire = init_wire_from_session_key(&sk);
-
-    bool ok = transmit_cabled_wire(socket, wire, shared_secret);
-    if (!ok) {
-        log_fatal("failed to send session key to client");
+    memcpy(&sk, session_key->key, sizeof(session_key_t));
+    for (size_t i = 0; i < count; i++) {
+        if (!joined[i]) {
+            continue;
+        }
+        wire_key_t handshake_key;
+        wire_key_init(&handshake_key, &shared_secrets[i * KEY_LEN], suite, WIRE_KEY_SESSION);
+        wire_t *wire = init_wire_from_session_key(&sk);
+        joined[i] = wire && transmit_cabled_wire(sockets[i], wire, &handshake_key);
+        wire_key_wipe(&handshake_key);
+        free_wire(wire);
+        if (!joined[i]) {
+            log_error("failed to send session key to client");
+            continue;
+        }
+        n++;
     }
-    xfree(wire);
-    return ok;
-}
 
+    memset(&sk, 0, sizeof(sk));
+    memset(keys, 0, 3 * count * KEY_LEN);
+    xfree(keys);
+    return n;
+}
 
-static bool server_send_ctrl_key(sock_t *sockets, size_t count, uint8_t *ctrl_key)
+static bool server_send_ctrl_key(sock_t *sockets, size_t count, wire_key_t *ctrl_key)
 {
     uint8_t renewed_key[32] = { 0 };
-    if (xgetrandom(renewed_key, KEY_LEN) < 0) {
+    if (!csprng_fill(renewed_key, KEY_LEN)) {
         return false;
     }
 
-    cable_t *cable = init_ctrl_key_cable(count - 1, renewed_key, ctrl_key);
-    size_t len = cable_get_total_len(cable);
+    size_t len = 0;
+    wire_t *wire = init_ctrl_key_wire(count - 1, renewed_key);
+    const uint8_t *cable = wire ? seal_cable(wire, ctrl_key, &len) : NULL;
 
-    memcpy(ctrl_key, renewed_key, KEY_LEN);
+    // Expand the renewed key once here rather than on every wire it protects
+    wire_key_init(ctrl_key, renewed_key, ctrl_key->suite, WIRE_KEY_CTRL);
+    memset(renewed_key, 0, KEY_LEN);
 
-    bool ok = true;
-    for (size_t i = 1; i <= count; i++) {
+    bool ok = cable != NULL;
+    for (size_t i = 1; ok && i <= count; i++) {
         log_trace("sending control key to socket %zu", i);
         if (!xsendall(sockets[i], cable, len)) {
             log_fatal("failed to send control key to socket %zu", i);
             ok = false;
-            break;
         }
     }
 
-    xfree(cable);
+    free_wire(wire);
+    return ok;
+}
+
+void held_cables_free(held_cables_t *held)
+{
+    for (size_t i = 0; i < held->count; i++) {
+        xfree(held->cables[i].data);
+    }
+    held->cables = xfree(held->cables);
+    held->count = 0;
+}
+
+// No cable starts with a byte a key exchange message could: a compact frame's varint is never
+// smaller than a frame, and any other cable starts with its signature
+_Static_assert(WIRE_COMPACT_OVERHEAD + 1 > KEY_EX_LAST_ROUND, "compact frames must be told apart from key exchange messages");
+
+// Whatever a client sent before the CTRL reached it is still ahead of its first key exchange
+// message. Every such cable is received whole and held, and the exchange picks up after it
+static bool hold_sent_cables(sock_t sock, size_t index, wire_suite_t suite, held_cables_t *held)
+{
+    cable_buffer_t buf = { 0 };
+    bool ok = true;
+    for (;;) {
+        uint8_t first = 0;
+        ok = xrecv(sock, &first, 1, MSG_PEEK) == 1;
+        if (!ok || first <= KEY_EX_LAST_ROUND) {
+            break;
+        }
+
+        (void)cable_buffer_get(&buf);
+        const size_t len = cable_recv_data(sock, &buf, suite, 0);
+        if (!(ok = len > 0)) {
+            break;
+        }
+        held->cables = xrealloc(held->cables, (held->count + 1) * sizeof(held_cable_t));
+        held->cables[held->count++] = (held_cable_t) { .sender = index, .data = xmemdup(buf.cable, len), .len = len };
+        log_debug("holding %zu byte cable sent by socket %zu before the rekey", len, index);
+    }
+    cable_buffer_free(&buf);
     return ok;
 }
 
@@ -218,12 +324,16 @@ static bool server_send_ctrl_key(sock_t *sockets, size_t count, uint8_t *ctrl_ke
  *    |<----------------------------------------------Qbcdef-|
  *    |          |          |          |          |          |
  */
-static bool rotate_intermediates(sock_t *sockets, size_t count)
+static bool rotate_intermediates(sock_t *sockets, size_t count, wire_suite_t suite, held_cables_t *held)
 {
     for (size_t i = 1; i <= count; i++) {
+        if (held && !hold_sent_cables(sockets[i], i, suite, held)) {
+            log_fatal("failed to receive cables ahead of the key exchange from socket %zu", i);
+            return false;
+        }
         uint8_t intermediate_key[KEY_LEN] = { 0 };
         log_trace("receiving intermediate key from socket %zu", i);
-        if (!ke_rcv(sockets[i], KEY_EX_INTERMEDIATE, intermediate_key)) {
+        if (!ke_rcv(sockets[i], KEY_EX_INTERMEDIATE, NULL, intermediate_key)) {
             log_fatal("failed to receive intermediate key from socket %zu", i);
             return false;
         }
@@ -231,7 +341,7 @@ static bool rotate_intermediates(sock_t *sockets, size_t count)
         // Rotate right, skip server's socket
         const size_t next = (i == count) ? 1 : i + 1; 
         log_trace("sending intermediate key to socket %zu", next);
-        if (!ke_snd(sockets[next], KEY_EX_INTERMEDIATE, intermediate_key)) {
+        if (!ke_snd(sockets[next], KEY_EX_INTERMEDIATE, 0, intermediate_key)) {
             log_fatal("failed to send intermediate key to socket %zu", next);
             return false;
         }
@@ -239,7 +349,7 @@ static bool rotate_intermediates(sock_t *sockets, size_t count)
     return true;
 }
 
-bool n_party_server(sock_t *sockets, size_t connection_count, uint8_t *ctrl_key)
+bool n_party_server(sock_t *sockets, size_t connection_count, wire_key_t *ctrl_key, held_cables_t *held)
 {
     assert(connection_count != 0);
 
@@ -260,7 +370,8 @@ bool n_party_server(sock_t *sockets, size_t connection_count, uint8_t *ctrl_key)
 
     for (size_t i = 0; i < rounds; i++) {
         log_trace("starting exchange round %zu of %zu", i + 1, rounds);
-        if (!rotate_intermediates(sockets, connection_count)) {
+        // Clients stop sending before their first key exchange message, so only the first round can find cables
+        if (!rotate_intermediates(sockets, connection_count, ctrl_key->suite, i ? NULL : held)) {
             return false;
         }
         log_trace("round %zu complete", i + 1);
@@ -279,7 +390,7 @@ bool n_party_client(sock_t socket, uint8_t *session_key, size_t rounds)
     point_q(secret_key, public_key, NULL);
 
     // Send our public key to the client on our right
-    if (!ke_snd(socket, KEY_EX_INTERMEDIATE, public_key)) {
+    if (!ke_snd(socket, KEY_EX_INTERMEDIATE, 0, public_key)) {
         log_fatal("failed to send public key (round 0)");
         return false;
     }
@@ -289,7 +400,7 @@ bool n_party_client(sock_t socket, uint8_t *session_key, size_t rounds)
     for (size_t i = 0; i < rounds; i++) {
         log_trace("starting round %zu", i + 1);
         uint8_t intermediate_public[KEY_LEN] = { 0 };
-        if (!ke_rcv(socket, KEY_EX_INTERMEDIATE, intermediate_public)) {
+        if (!ke_rcv(socket, KEY_EX_INTERMEDIATE, NULL, intermediate_public)) {
             log_fatal("failed to receive intermediate key (round %zu)", i + 1);
             return false;
         }
@@ -303,7 +414,7 @@ bool n_party_client(sock_t socket, uint8_t *session_key, size_t rounds)
             log_debug("key exchange complete");
             return true;
         }
-        if (!ke_snd(socket, KEY_EX_INTERMEDIATE, shared_secret)) {
+        if (!ke_snd(socket, KEY_EX_INTERMEDIATE, 0, shared_secret)) {
             log_fatal("failed to send intermediate key (round %zu)", i);
             return false;
         }
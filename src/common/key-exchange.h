@@ -31,11 +31,31 @@ typedef enum key_type_t {
 
 typedef struct ke_t {
     const uint8_t type;
+    uint8_t suites; // Client public key: bitmask of supported wire suites. Server public key: the selected suite. Either way, WireFeatures in the high bits
     uint8_t key[KEY_LEN];
 } __attribute__((packed)) ke_t;
 
-bool two_party_client(sock_t socket, uint8_t *ctrl_key);
-bool two_party_server(sock_t socket, uint8_t *session_key);
+bool two_party_client(sock_t socket, uint8_t *ctrl_key, wire_suite_t *suite, uint8_t *features);
+bool two_party_server(sock_t socket, const wire_key_t *session_key, uint8_t features);
+// Sets `joined[i]` for each socket that completed the exchange and returns how many did.
+// A socket that fails is left for the caller to close and doesn't hold up the rest
+size_t two_party_server_batch(const sock_t *sockets, size_t count, const wire_key_t *session_key, uint8_t features, bool *joined);
+
+// A cable that was already on its way when a rekey started, held until the group has new keys
+typedef struct held_cable_t {
+    size_t sender; // socket index
+    uint8_t *data;
+    size_t len;
+} held_cable_t;
+
+typedef struct held_cables_t {
+    held_cable_t *cables;
+    size_t count;
+} held_cables_t;
+
+void held_cables_free(held_cables_t *held);
 
 bool n_party_client(sock_t socket, uint8_t *session_key, size_t rounds);
-bool n_party_server(sock_t *sockets, size_t connections, uint8_t *ctrl_key);
+// Any cables clients sent before they saw the rekey start are read off and added to `held`,
+// for the caller to pass on once every member has the new keys
+bool n_party_server(sock_t *sockets, size_t connections, wire_key_t *ctrl_key, held_cables_t *held);
@@ -0,0 +1,178 @@
+/**
+ * @file lz4.c
+ * @author Jason Conway (jpc@jasonconway.dev)
+ * @brief LZ4 block format compression for wire data
+ * @ref https://github.com/lz4/lz4/blob/dev/doc/lz4_Block_format.md
+ * @version 0.9.4
+ * @date 2025-01-12
+ *
+ * @copyright Copyright (c) 2025 Jason Conway. All rights reserved.
+ *
+ */
+
+#include "lz4.h"
+#include "wire-util.h"
+
+// A block is a run of sequences, each [token | literal length | literals | offset | match length].
+// The token's high nibble is the literal length and its low nibble the match length less
+// LZ4_MIN_MATCH, and either spills over into extra bytes when it's 15. The last sequence is
+// only literals
+
+static uint32_t lz4_hash(uint32_t sequence)
+{
+    return (sequence * 2654435761u) >> (32 - LZ4_HASH_BITS);
+}
+
+static bool lz4_put_length(uint8_t *dst, size_t cap, size_t *out, size_t len)
+{
+    for (; len >= 255; len -= 255) {
+        if (*out == cap) {
+            return false;
+        }
+        dst[(*out)++] = 255;
+    }
+    if (*out == cap) {
+        return false;
+    }
+    dst[(*out)++] = (uint8_t)len;
+    return true;
+}
+
+// `match_len` excludes LZ4_MIN_MATCH, and a sequence with no `offset` is the last
+static bool lz4_put_sequence(uint8_t *dst, size_t cap, size_t *out, const uint8_t *literals, size_t literal_len,
+    size_t offset, size_t match_len)
+{
+    if (*out == cap) {
+        return false;
+    }
+    uint8_t *token = &dst[(*out)++];
+    *token = (uint8_t)(MIN(literal_len, (size_t)15) << 4);
+    if (literal_len >= 15 && !lz4_put_length(dst, cap, out, literal_len - 15)) {
+        return false;
+    }
+    if (literal_len > cap - *out) {
+        return false;
+    }
+    memcpy(&dst[*out], literals, literal_len);
+    *out += literal_len;
+    if (!offset) {
+        return true;
+    }
+
+    *token |= (uint8_t)MIN(match_len, (size_t)15);
+    if (cap - *out < 2) {
+        return false;
+    }
+    wire_store16(&dst[*out], (uint16_t)offset);
+    *out += 2;
+    return match_len < 15 || lz4_put_length(dst, cap, out, match_len - 15);
+}
+
+size_t lz4_compress(const uint8_t *src, size_t len, uint8_t *dst, size_t cap)
+{
+    uint32_t table[1 << LZ4_HASH_BITS] = { 0 }; // last position each hash was seen at
+    size_t out = 0;
+    size_t anchor = 0; // start of the literals not yet written
+
+    if (len > LZ4_MATCH_LIMIT) {
+        const size_t search_end = len - LZ4_MATCH_LIMIT;
+        const size_t match_end = len - LZ4_LAST_LITERALS;
+        size_t misses = 1 << LZ4_SKIP_TRIGGER;
+        for (size_t i = 0; i < search_end;) {
+            const uint32_t sequence = wire_load32(&src[i]);
+            const uint32_t hash = lz4_hash(sequence);
+            size_t ref = table[hash];
+            table[hash] = (uint32_t)i;
+            if (ref >= i || i - ref > LZ4_OFFSET_MAX || wire_load32(&src[ref]) != sequence) {
+                i += misses++ >> LZ4_SKIP_TRIGGER;
+                continue;
+            }
+            misses = 1 << LZ4_SKIP_TRIGGER;
+
+            // Grow the match backwards into the pending literals, then as far forward as it goes
+            size_t start = i;
+            while (start > anchor && ref > 0 && src[start - 1] == src[ref - 1]) {
+                start--;
+                ref--;
+            }
+            size_t end = i + LZ4_MIN_MATCH;
+            while (end < match_end && src[end] == src[ref + end - start]) {
+                end++;
+            }
+
+            if (!lz4_put_sequence(dst, cap, &out, &src[anchor], start - anchor, start - ref, end - start - LZ4_MIN_MATCH)) {
+                return 0;
+            }
+            anchor = i = end;
+            if (i - 2 < search_end) {
+                table[lz4_hash(wire_load32(&src[i - 2]))] = (uint32_t)(i - 2);
+            }
+        }
+    }
+
+    return lz4_put_sequence(dst, cap, &out, &src[anchor], len - anchor, 0, 0) ? out : 0;
+}
+
+static bool lz4_get_length(const uint8_t *src, size_t len, size_t *in, size_t *value)
+{
+    uint8_t byte;
+    do {
+        if (*in == len) {
+            return false;
+        }
+        byte = src[(*in)++];
+        *value += byte;
+    } while (byte == 255);
+    return true;
+}
+
+bool lz4_decompress(const uint8_t *src, size_t len, uint8_t *dst, size_t out_len)
+{
+    size_t in = 0;
+    size_t out = 0;
+    while (in < len) {
+        const uint8_t token = src[in++];
+
+        size_t literal_len = token >> 4;
+        if (literal_len == 15 && !lz4_get_length(src, len, &in, &literal_len)) {
+            return false;
+        }
+        if (literal_len > len - in || literal_len > out_len - out) {
+            return false;
+        }
+        memcpy(&dst[out], &src[in], literal_len);
+        in += literal_len;
+        out += literal_len;
+        if (in == len) {
+            break;
+        }
+
+        if (len - in < 2) {
+            return false;
+        }
+        const size_t offset = wire_load16(&src[in]);
+        in += 2;
+        size_t match_len = token & 15;
+        if (match_len == 15 && !lz4_get_length(src, len, &in, &match_len)) {
+            return false;
+        }
+        match_len += LZ4_MIN_MATCH;
+        if (!offset || offset > out || match_len > out_len - out) {
+            return false;
+        }
+
+        // A match can overlap the bytes it's producing, repeating a run of `offset` bytes,
+        // so short and overlapping matches are copied a byte at a time
+        const uint8_t *ref = &dst[out - offset];
+        if (offset >= match_len && match_len > 16) {
+            memcpy(&dst[out], ref, match_len);
+        }
+        else {
+            for (size_t i = 0; i < match_len; i++) {
+                dst[out + i] = ref[i];
+            }
+        }
+        out += match_len;
+    }
+    return out == out_len;
+}
@@ -0,0 +1,48 @@
+/**
+ * @file lz4.h
+ * @author Jason Conway (jpc@jasonconway.dev)
+ * @brief LZ4 block format compression for wire data
+ * @ref https://github.com/lz4/lz4/blob/dev/doc/lz4_Block_format.md
+ * @version 0.9.4
+ * @date 2025-01-12
+ *
+ * @copyright Copyright (c) 2025 Jason Conway. All rights reserved.
+ *
+ */
+
+#pragma once
+
+#include "xplatform.h"
+
+enum Lz4 {
+    LZ4_MIN_MATCH = 4,
+    LZ4_LAST_LITERALS = 5,    // the block always ends in at least this many literals
+    LZ4_MATCH_LIMIT = 12,     // no match starts within this many bytes of the end
+    LZ4_OFFSET_MAX = 0xffff,
+    LZ4_HASH_BITS = 12,
+    LZ4_SKIP_TRIGGER = 6,     // misses in a row before the search starts stepping faster
+};
+
+/**
+ * @brief Compress `len` bytes of `src` into a single LZ4 block. Data that doesn't compress
+ * runs through quickly, the search steps over it faster the longer it goes without a match
+ *
+ * @param[in] src data to compress
+ * @param[in] len length of `src`
+ * @param[out] dst compressed block
+ * @param[in] cap capacity of `dst`
+ * @return length of the block, or 0 if it doesn't fit in `cap` bytes
+ */
+size_t lz4_compress(const uint8_t *src, size_t len, uint8_t *dst, size_t cap);
+
+/**
+ * @brief Decompress an LZ4 block that's known to expand to exactly `out_len` bytes. Nothing
+ * is read or written outside of `src` and `dst`, whatever the block contains
+ *
+ * @param[in] src compressed block
+ * @param[in] len length of `src`
+ * @param[out] dst decompressed data
+ * @param[in] out_len expected length of the decompressed data
+ * @return false if the block is malformed or doesn't expand to `out_len` bytes
+ */
+bool lz4_decompress(const uint8_t *src, size_t len, uint8_t *dst, size_t out_len);
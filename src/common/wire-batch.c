@@ -0,0 +1,54 @@
+#include "wire-util.h"
+#include "wire-gen.h"
+#include "wire.h"
+#include <stddef.h>
+#include "wire-batch.h"
+
+GEN_SCHEMA_FUNCS(batch_msg, batch_msg_type_t, BATCH_MSG_SCHEMA)
+
+size_t batch_entry_length(size_t len)
+{
+    return 1 + wire_varint_length(len) + len;
+}
+
+size_t batch_entry_put(uint8_t *dst, wire_type_t type, const void *msg, size_t len)
+{
+    size_t i = 0;
+    dst[i++] = (uint8_t)type;
+    i += wire_unpack_varint(&dst[i], len);
+    memcpy(&dst[i], msg, len);
+    return i + len;
+}
+
+bool batch_entry_next(const uint8_t *entries, size_t len, size_t *at, batch_entry_t *entry)
+{
+    if (*at >= len) {
+        return false;
+    }
+    const uint8_t *src = &entries[*at];
+    const size_t remaining = len - *at;
+
+    uint64_t msg_len = 0;
+    const size_t n = wire_pack_varint(&src[1], remaining - 1, &msg_len);
+    if (!n || msg_len > remaining - 1 - n) {
+        return false;
+    }
+    entry->type = (wire_type_t)src[0];
+    entry->msg = &src[1 + n];
+    entry->len = (size_t)msg_len;
+    *at += 1 + n + entry->len;
+    return true;
+}
+
+// The entries are copied once, straight into the wire
+wire_t *init_wire_from_batch(const uint8_t *entries, size_t len, size_t count)
+{
+    wire_t *wire = NULL;
+    batch_msg_t *batch_msg = init_batch_msg_wire(&wire, TYPE_BATCH, BATCH_MSG_NORMAL, len);
+    if (!batch_msg) {
+        return NULL;
+    }
+    batch_msg_set_count(batch_msg, count);
+    batch_msg_set_data(batch_msg, entries, len);
+    return wire;
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+#include "wire.h"
+#include "wire-gen.h"
+
+typedef enum batch_msg_type_t {
+    BATCH_MSG_NORMAL,
+} batch_msg_type_t;
+
+enum batch_msg_cfg {
+    BATCH_ENTRIES_MAX = 64,
+    BATCH_DATA_MAX = 1 << 14, // bytes of entries, messages that don't fit are sent on their own
+};
+
+// The data is `count` messages back to back, each as [wire type (1) | length (varint) | message]
+// where the message is exactly what the data of a wire of its own would have been
+#define BATCH_MSG_SCHEMA(msg, FIXED, VAR) \
+    FIXED(msg, count, 16, size_t)
+
+GEN_SCHEMA_HEADERS(batch_msg, batch_msg_type_t, BATCH_MSG_SCHEMA)
+
+typedef struct batch_entry_t {
+    wire_type_t type;
+    const uint8_t *msg; // inside the batch, nothing is copied
+    size_t len;
+} batch_entry_t;
+
+// Bytes a `len`-byte message takes up as an entry
+size_t batch_entry_length(size_t len);
+
+// Write an entry to `dst`, which has room for batch_entry_length() bytes, returning its length
+size_t batch_entry_put(uint8_t *dst, wire_type_t type, const void *msg, size_t len);
+
+// Read the entry at `*at` in the first `len` bytes of `entries` and step `*at` past it.
+// False if it runs past `len` bytes
+bool batch_entry_next(const uint8_t *entries, size_t len, size_t *at, batch_entry_t *entry);
+
+wire_t *init_wire_from_batch(const uint8_t *entries, size_t len, size_t count);
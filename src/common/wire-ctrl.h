@@ -8,14 +8,13 @@ typedef enum ctrl_msg_type_t {
     CTRL_ERROR = -1,
     CTRL_EXIT,
     CTRL_DHKE,
+    CTRL_STALE, // the next cable went out before the latest rekey, under the previous session key
 } ctrl_msg_type_t;
 
-GEN_STD_HEADERS(ctrl_msg, ctrl_msg_type_t)
+#define CTRL_MSG_SCHEMA(msg, FIXED, VAR) \
+    FIXED(msg, cnt, 16, size_t)
 
-GEN_GETTER_SETTER_HEADERS(ctrl_msg, cnt, size_t)
+GEN_SCHEMA_HEADERS(ctrl_msg, ctrl_msg_type_t, CTRL_MSG_SCHEMA)
 
-void ctrl_msg_set_cnt(ctrl_msg_t *ctrl, size_t cnt);
-
-ctrl_msg_t *init_ctrl(size_t count, const uint8_t *renewed_key);
-wire_t *init_wire_from_ctrl_msg(ctrl_msg_t *ctrl_msg);
-cable_t *init_ctrl_key_cable(size_t count, const uint8_t *renewed_key, const uint8_t *ctrl_key);
+wire_t *init_ctrl_key_wire(size_t count, const uint8_t *renewed_key);
+wire_t *init_ctrl_stale_wire(void);
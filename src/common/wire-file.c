@@ -7,52 +7,56 @@
 #include "log.h"
 #include "xutils.h"
 
-TYPE_BEGIN_DEF(file_msg, file_msg_type_t)
-    uint8_t user[FILE_USERNAME_LENGTH];
-    uint8_t filename[PATH_MAX];
-    uint8_t gid[4];
-    uint8_t uid[4];
-    uint8_t mode[2];
-TYPE_END_DEF(file_msg, file_msg_type_t)
+GEN_SCHEMA_FUNCS(file_msg, file_msg_type_t, FILE_MSG_SCHEMA)
+GEN_SCHEMA_FUNCS(file_chunk_msg, file_msg_type_t, FILE_CHUNK_MSG_SCHEMA)
 
-GEN_STD_FUNCS(file_msg, file_msg_type_t)
+// Chunked transfers in progress. Wires are only ever handled by the receive thread, so no lock
+typedef struct file_transfer_t {
+    uint32_t id;
+    FILE *f;
+    char *path;
+    mode_t mode;
+    size_t size;
+    size_t received;
+    size_t started; // order in which transfers began, the oldest is dropped when every slot is busy
+} file_transfer_t;
 
-GEN_4BYTE_GETTER_SETTER_FUNCS(file_msg, gid, gid_t)
-GEN_4BYTE_GETTER_SETTER_FUNCS(file_msg, uid, uid_t)
-GEN_2BYTE_GETTER_SETTER_FUNCS(file_msg, mode, mode_t)
+static file_transfer_t transfers[FILE_TRANSFERS_MAX];
 
 
-void file_msg_set_user(file_msg_t *fm, const char *user)
+bool file_msg_get_filename(const file_msg_view_t *fm, char *out)
 {
-    memset(fm->user, 0, sizeof(fm->user));
-    const size_t len = strnlen(user, sizeof(fm->user) - 1);
-    memcpy(fm->user, user, len);
-}
-bool file_msg_get_user(file_msg_t *fm, char *user)
-{
-    const size_t len = strnlen((const char *)fm->user, sizeof(fm->user));
-    memcpy(user, fm->user, len);
+    const size_t len = fm->name ? strnlen((const char *)fm->name, fm->name_len) : 0;
+    if (len) {
+        memcpy(out, fm->name, len);
+    }
+    out[len] = '\0';
     return len > 0;
 }
 
-void file_msg_set_filename(file_msg_t *f, const char *name)
+// Everything but the file contents, in a new wire
+static file_msg_t *file_msg_init_head(wire_t **wire, uint32_t member, const char *path, size_t len)
 {
-    memset(f->filename, 0, sizeof(f->filename));
-    size_t len = strnlen(name, sizeof(f->filename) - 1);
-    memcpy(f->filename, name, len);
-}
+    const char *name = xconstbasename(path);
+    const size_t name_len = strnlen(name, FILE_NAME_LEN);
 
-bool file_msg_get_filename(file_msg_t *f, char *out)
-{
-    size_t len = strnlen((const char *)f->filename, sizeof(f->filename) - 1);
-    memcpy(out, f->filename, len);
-    out[len] = '\0';
-    return len > 0;
+    file_msg_type_t type = xfiletype(path) ? FILE_TYPE_BINARY : FILE_TYPE_TEXT;
+    file_msg_t *fm = init_file_msg_wire(wire, TYPE_FILE, type, wire_field_length(name_len) + len);
+    if (!fm) {
+        return NULL;
+    }
+
+    file_msg_set_member(fm, member);
+    file_msg_set_name(fm, name, name_len);
+    file_msg_set_gid(fm, xgetgid(path));
+    file_msg_set_uid(fm, xgetuid(path));
+    file_msg_set_mode(fm, xgetmode(path));
+    return fm;
 }
 
-file_msg_t *file_msg_from_file(const char *user, const char *path)
+wire_t *init_wire_from_file(uint32_t member, const char *path)
 {
-    if (!path || !user) {
+    if (!path) {
         return NULL;
     }
 
@@ -67,58 +71,177 @@ file_msg_t *file_msg_from_file(const char *user, const char *path)
         return NULL;
     }
 
-    file_msg_type_t type = xfiletype(path) ? FILE_TYPE_BINARY : FILE_TYPE_TEXT;
-    file_msg_t *fm = init_file_msg(type, size);
+    wire_t *wire = init_wire_from_file_head(member, path, f, 0, size, size);
+    fclose(f);
+    return wire;
+}
 
-    file_msg_set_filename(fm, xconstbasename(path));
-    file_msg_set_gid(fm, xgetgid(path));
-    file_msg_set_uid(fm, xgetuid(path));
-    file_msg_set_mode(fm, xgetmode(path));
+wire_t *init_wire_from_file_head(uint32_t member, const char *path, FILE *f, uint32_t id, size_t size, size_t len)
+{
+    wire_t *wire = NULL;
+    file_msg_t *fm = file_msg_init_head(&wire, member, path, len);
+    if (!fm) {
+        return NULL;
+    }
+    file_msg_set_id(fm, id);
+    file_msg_set_size(fm, size);
 
-    if (fread(fm->data, 1, size, f) != size) {
-        fm = xfree(fm);
+    if (fseek(f, 0, SEEK_SET) || fread(file_msg_get_data(fm), 1, len, f) != len) {
+        wire = free_wire(wire);
     }
-    fclose(f);
-    return fm;
+    return wire;
 }
 
-bool file_msg_to_file(file_msg_t *fm, const char *directory)
+wire_t *init_wire_from_file_chunk(FILE *f, file_msg_type_t type, uint32_t id, size_t offset, size_t len)
 {
-    if (!fm) {
-        return false;
+    wire_t *wire = NULL;
+    file_chunk_msg_t *chunk = init_file_chunk_msg_wire(&wire, TYPE_FILE_CHUNK, type, len);
+    if (!chunk) {
+        return NULL;
     }
+    file_chunk_msg_set_id(chunk, id);
+    file_chunk_msg_set_offset(chunk, offset);
 
-    char filename[PATH_MAX] = { 0 };
+    if (fseek(f, (long)offset, SEEK_SET) || fread(file_chunk_msg_get_data(chunk), 1, len, f) != len) {
+        wire = free_wire(wire);
+    }
+    return wire;
+}
+
+static char *file_msg_get_path(const file_msg_view_t *fm, const char *directory)
+{
+    char filename[FILE_NAME_LEN + 1] = { 0 };
     if (!file_msg_get_filename(fm, filename)) {
         log_error("empty filename field");
-        return false;
+        return NULL;
     }
 
-    char *path = NULL;
     if (directory) {
-        path = xstrcat(directory, "/", filename);
+        return xstrcat(directory, "/", filename);
+    }
+    return xstrdup(filename);
+}
+
+static void file_transfer_end(file_transfer_t *transfer, bool complete)
+{
+    bool ok = complete && !(fflush(transfer->f) || fclose(transfer->f));
+    if (!complete) {
+        fclose(transfer->f);
+        log_error("chunked transfer of %s abandoned after %zu of %zu bytes", transfer->path, transfer->received, transfer->size);
     }
-    else {
-        path = xstrdup(filename);
+    if (ok && !xchmod(transfer->path, transfer->mode)) {
+        log_error("could not set mode of %s", transfer->path);
+    }
+    xfree(transfer->path);
+    memset(transfer, 0, sizeof(*transfer));
+}
+
+// Open the file and write the head of a chunked transfer, taking ownership of `path`
+static bool file_transfer_begin(const file_msg_view_t *fm, char *path)
+{
+    const uint32_t id = file_msg_get_id(fm->msg);
+    const size_t size = file_msg_get_size(fm->msg);
+    if (!id || size > FILE_DATA_MAX_SIZE) {
+        log_error("invalid chunked transfer (id %u, %zu bytes)", id, size);
+        xfree(path);
+        return false;
+    }
+
+    static size_t started = 0;
+    file_transfer_t *transfer = &transfers[0];
+    for (size_t i = 0; i < FILE_TRANSFERS_MAX; i++) {
+        if (!transfers[i].id || transfers[i].started < transfer->started) {
+            transfer = &transfers[i];
+            if (!transfer->id) {
+                break;
+            }
+        }
+    }
+    if (transfer->id) {
+        file_transfer_end(transfer, false);
+    }
+
+    FILE *f = fopen(path, "wb");
+    const size_t len = fm->data_len;
+    if (!f || fwrite(fm->data, 1, len, f) != len) {
+        if (f) {
+            fclose(f);
+        }
+        xfree(path);
+        return false;
+    }
+
+    *transfer = (file_transfer_t) {
+        .id = id,
+        .f = f,
+        .path = path,
+        .mode = file_msg_get_mode(fm->msg),
+        .size = size,
+        .received = len,
+        .started = ++started,
+    };
+    return true;
+}
+
+bool file_chunk_msg_to_file(const file_chunk_msg_view_t *chunk)
+{
+    const uint32_t id = file_chunk_msg_get_id(chunk->msg);
+    file_transfer_t *transfer = NULL;
+    for (size_t i = 0; i < FILE_TRANSFERS_MAX && id; i++) {
+        if (transfers[i].id == id) {
+            transfer = &transfers[i];
+        }
+    }
+    if (!transfer) {
+        log_error("chunk for unknown transfer %u", id);
+        return false;
+    }
+
+    // Chunks from one sender arrive in order, anything else means one went missing
+    const size_t offset = file_chunk_msg_get_offset(chunk->msg);
+    const size_t len = chunk->data_len;
+    if (offset != transfer->received || len > transfer->size - transfer->received) {
+        log_error("chunk at offset %zu doesn't follow the %zu bytes received", offset, transfer->received);
+        file_transfer_end(transfer, false);
+        return false;
+    }
+    if (fwrite(chunk->data, 1, len, transfer->f) != len) {
+        file_transfer_end(transfer, false);
+        return false;
+    }
+
+    transfer->received += len;
+    if (transfer->received == transfer->size) {
+        file_transfer_end(transfer, true);
+    }
+    return true;
+}
+
+bool file_msg_to_file(const file_msg_view_t *fm, const char *directory)
+{
+    if (!fm) {
+        return false;
+    }
+
+    char *path = file_msg_get_path(fm, directory);
+    if (!path) {
+        return false;
+    }
+
+    const size_t size = fm->data_len;
+    if (file_msg_get_size(fm->msg) != size) {
+        return file_transfer_begin(fm, path);
     }
 
     bool ok = false;
     FILE *f = fopen(path, "wb");
     if (f) {
-        size_t size = file_msg_get_payload_length(fm);
         ok = fwrite(fm->data, 1, size, f) == size;
         ok &= !(fflush(f) || fclose(f));
     }
-    mode_t mode = file_msg_get_mode(fm);
+    mode_t mode = file_msg_get_mode(fm->msg);
     ok &= xchmod(path, mode);
 
     xfree(path);
     return ok;
 }
-
-wire_t *init_wire_from_file_msg(file_msg_t *file_msg)
-{
-    size_t len = file_msg_get_wire_length(file_msg);
-    return init_wire(TYPE_FILE, file_msg, &len);
-}
-
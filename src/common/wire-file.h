@@ -10,7 +10,6 @@ typedef enum file_msg_type_t {
 } file_msg_type_t;
 
 enum file_cfg {
-    FILE_USERNAME_LENGTH = 64,
     FILE_PATH_MAX_LENGTH = FILENAME_MAX,
     FILE_NAME_START = 0,
     FILE_NAME_LEN = (1 << 8) - 1, // Win32 API limit
@@ -18,22 +17,41 @@ enum file_cfg {
     FILE_DATA_START = FILE_NAME_LEN + BLOCK_LEN,
     FILE_HEADER_SIZE = FILE_DATA_START,
     FILE_DATA_MAX_SIZE = (1ull<<31) - FILE_HEADER_SIZE,
+    FILE_CHUNK_SIZE = 1 << 20, // Larger files are sent as a TYPE_FILE wire followed by TYPE_FILE_CHUNK wires
+    FILE_TRANSFERS_MAX = 8,    // Chunked transfers that can be received at once
 };
 
-GEN_STD_HEADERS(file_msg, file_msg_type_t)
-GEN_GETTER_SETTER_HEADERS(file_msg, gid, gid_t)
-GEN_GETTER_SETTER_HEADERS(file_msg, uid, uid_t)
-GEN_GETTER_SETTER_HEADERS(file_msg, mode, mode_t)
-
-
+enum file_msg_field {
+    FILE_FIELD_NAME = 1,
+};
 
-void file_msg_set_user(file_msg_t *fm, const char *user);
-bool file_msg_get_user(file_msg_t *fm, char *user);
-void file_msg_set_filename(file_msg_t *f, const char *name);
-bool file_msg_get_filename(file_msg_t *f, char *out);
-file_msg_t *file_msg_from_file(const char *user, const char *path);
-bool file_msg_to_file(file_msg_t *fm, const char *directory);
-wire_t *init_wire_from_file_msg(file_msg_t *file_msg);
+#define FILE_MSG_SCHEMA(msg, FIXED, VAR) \
+    FIXED(msg, member, 32, uint32_t) /* sender */ \
+    FIXED(msg, gid, 32, gid_t) \
+    FIXED(msg, uid, 32, uid_t) \
+    FIXED(msg, mode, 16, mode_t) \
+    FIXED(msg, id, 32, uint32_t) /* chunked transfer id, 0 when the whole file is in this message */ \
+    FIXED(msg, size, 64, size_t) /* size of the entire file */ \
+    VAR(msg, name, FILE_FIELD_NAME, FILE_NAME_LEN)
+
+#define FILE_CHUNK_MSG_SCHEMA(msg, FIXED, VAR) \
+    FIXED(msg, id, 32, uint32_t) \
+    FIXED(msg, offset, 64, size_t)
+
+GEN_SCHEMA_HEADERS(file_msg, file_msg_type_t, FILE_MSG_SCHEMA)
+GEN_SCHEMA_HEADERS(file_chunk_msg, file_msg_type_t, FILE_CHUNK_MSG_SCHEMA)
+
+// `out` holds at least FILE_NAME_LEN + 1 bytes
+bool file_msg_get_filename(const file_msg_view_t *fm, char *out);
+wire_t *init_wire_from_file(uint32_t member, const char *path);
+bool file_msg_to_file(const file_msg_view_t *fm, const char *directory);
+
+// Chunked transfers: the first `len` bytes of the file go in a file_msg_t along with its
+// metadata, and the remainder follows in order as file_chunk_msg_t's sharing the same `id`
+// and the head's type. File contents are read straight into the wire
+wire_t *init_wire_from_file_head(uint32_t member, const char *path, FILE *f, uint32_t id, size_t size, size_t len);
+wire_t *init_wire_from_file_chunk(FILE *f, file_msg_type_t type, uint32_t id, size_t offset, size_t len);
+bool file_chunk_msg_to_file(const file_chunk_msg_view_t *chunk);
 
 bool handle_file_msg(wire_t *wire);
 
@@ -1,5 +1,23 @@
 #pragma once
 
+#include "wire-util.h"
+
+// Message types are generated from a schema listing their fields in order:
+//
+//     #define NAME_SCHEMA(msg, FIXED, VAR)
+//         FIXED(msg, field, bits, RT)   fixed-size little-endian field of 8, 16, 32, or 64 bits
+//         VAR(msg, field, tag, max)     variable-length field of at most `max` bytes
+//
+// GEN_SCHEMA_HEADERS() expands it into the message struct, inline accessors for the fixed
+// fields, and a view type, and GEN_SCHEMA_FUNCS() into the rest.
+//
+// A message is its type and length, its fixed fields, its variable-length fields as
+// [tag (1) | length (varint) | value] closed by a zero tag (even when there aren't any), then
+// its data. Builders write straight into a wire: `init_##name##_wire()` reserves room for the
+// fields (see wire_field_length()) and data, the fields are set in order, then the data goes
+// in. Readers go through `name##_view()`, which validates a received message once and finds
+// every variable-length field and the data, so nothing after it parses, copies, or allocates
+
 #ifndef TYPE_BEGIN_DEF
     #define TYPE_BEGIN_DEF(name, T) \
         typedef struct name##_t { \
@@ -9,12 +27,22 @@
 
 #ifndef TYPE_END_DEF
     #define TYPE_END_DEF(name, T) \
-            uint8_t data[]; \
+            uint8_t tail[]; /* variable-length fields, then data */ \
         } __attribute__((packed)) name##_t;
 #endif
 
 #ifndef GEN_STD_FUNCS
     #define GEN_STD_FUNCS(name, T) \
+        static size_t name##_get_tail_length(const name##_t *name) \
+        { \
+            const size_t msg_len = wire_load64(name->len); \
+            return msg_len > sizeof(name##_t) ? msg_len - sizeof(name##_t) : 0; \
+        } \
+        bool name##_check(const name##_t *name, size_t len) \
+        { \
+            return len > sizeof(name##_t) && name##_get_wire_length(name) <= len && \
+                   wire_fields_length(name->tail, name##_get_tail_length(name)); \
+        } \
         T name##_get_type(const name##_t *name) \
         { \
             return name->type; \
@@ -25,81 +53,58 @@
         } \
         size_t name##_get_wire_length(const name##_t *name) \
         { \
-            return wire_pack64(name->len); \
+            return wire_load64(name->len); \
         } \
         size_t name##_get_payload_length(const name##_t *name) \
         { \
-            return wire_pack64(name->len) - sizeof(name##_t); \
+            const size_t tail_len = name##_get_tail_length(name); \
+            const size_t fields_len = wire_fields_length(name->tail, tail_len); \
+            return fields_len ? tail_len - fields_len : 0; \
         } \
         void *name##_get_data(name##_t *name) \
         { \
-            return name->data; \
+            return &name->tail[wire_fields_length(name->tail, name##_get_tail_length(name))]; \
         } \
         void name##_set_data(name##_t *name, const void *data, size_t len) \
         { \
-            memcpy(name->data, data, len); \
+            memcpy(name##_get_data(name), data, MIN(len, name##_get_payload_length(name))); \
         } \
         void name##_set_len(name##_t *name, size_t len) \
         { \
-            wire_unpack64(name->len, len); \
+            wire_store64(name->len, len); \
         } \
-        name##_t *init_##name(T type, size_t len) \
+        name##_t *init_##name##_wire(wire_t **wire, wire_type_t wire_type, T type, size_t len) \
         { \
-            const size_t msg_len = sizeof(name##_t) + len; \
-            name##_t *name = xcalloc(msg_len); \
+            const size_t msg_len = sizeof(name##_t) + 1 + len; \
+            *wire = alloc_wire(wire_type, msg_len); \
+            if (!*wire) { \
+                return NULL; \
+            } \
+            name##_t *name = (name##_t *)(*wire)->data; \
             name##_set_type(name, type); \
             name##_set_len(name, msg_len); \
             return name; \
         }
 #endif
 
-#ifndef GEN_FIELD_FUNCS
-    #define GEN_FIELD_FUNCS(name, T1, field, T2, RT) \
-        RT name##_get_##field(const name##_t *name) \
-        { \
-            return (RT)name->field; \
-        } \
-        void name##_set_##field(name##_t *name, RT field) \
-        { \
-            name->field = (T2)field; \
-        }
-#endif
-
-#ifndef GEN_4BYTE_GETTER_SETTER_FUNCS
-    #define GEN_4BYTE_GETTER_SETTER_FUNCS(name, field, RT) \
-        RT name##_get_##field(const name##_t *name) \
-        { \
-            return wire_pack32(name->field); \
-        } \
-        void name##_set_##field(name##_t *name, RT field) \
-        { \
-            wire_unpack32(name->field, (uint32_t)field); \
-        }
-#endif
-
-#ifndef GEN_2BYTE_GETTER_SETTER_FUNCS
-    #define GEN_2BYTE_GETTER_SETTER_FUNCS(name, field, RT) \
-        RT name##_get_##field(const name##_t *name) \
-        { \
-            return wire_pack16(name->field); \
-        } \
-        void name##_set_##field(name##_t *name, RT field) \
+// Fields are set in order, all before the data, and only once each
+#ifndef GEN_VAR_FIELD_FUNCS
+    #define GEN_VAR_FIELD_FUNCS(name, field, tag, max) \
+        bool name##_set_##field(name##_t *name, const void *value, size_t len) \
         { \
-            wire_unpack16(name->field, (uint16_t)field); \
+            return len <= (max) && wire_field_append(name->tail, name##_get_tail_length(name), tag, value, len); \
         }
 #endif
 
-#ifndef GEN_GETTER_SETTER_HEADERS
-    #define GEN_GETTER_SETTER_HEADERS(name, field, RT) \
-        RT name##_get_##field(const name##_t *name); \
-        void name##_set_##field(name##_t *name, RT field);
+#ifndef GEN_VAR_FIELD_HEADERS
+    #define GEN_VAR_FIELD_HEADERS(name, field) \
+        bool name##_set_##field(name##_t *name, const void *value, size_t len);
 #endif
 
-
-
 #ifndef GEN_STD_HEADERS
     #define GEN_STD_HEADERS(name, T) \
         typedef struct name##_t name##_t; \
+        bool name##_check(const name##_t *name, size_t len); \
         T name##_get_type(const name##_t *name); \
         void name##_set_type(name##_t *name, T type); \
         size_t name##_get_wire_length(const name##_t *name); \
@@ -107,11 +112,81 @@
         void *name##_get_data(name##_t *name); \
         void name##_set_data(name##_t *name, const void *data, size_t len); \
         void name##_set_len(name##_t *name, size_t len); \
-        name##_t *init_##name(T type, size_t len);
+        /* `len` covers the variable-length fields and the data */ \
+        name##_t *init_##name##_wire(wire_t **wire, wire_type_t wire_type, T type, size_t len);
 #endif
 
-#ifndef GEN_FIELD_HEADERS
-    #define GEN_FIELD_HEADERS(name, T1, field, T2, RT) \
-        RT name##_get_##field(const name##_t *name); \
-        void name##_set_##field(name##_t *name, RT field);
-#endif
+/**
+ * @section Schema expansion
+ */
+
+#define GEN_SCHEMA_SKIP(...)
+
+#define GEN_SCHEMA_STRUCT_FIELD(name, field, bits, RT) \
+    uint8_t field[(bits) / 8];
+
+// A single unaligned load or store, inlined wherever the message is read or built
+#define GEN_SCHEMA_FIXED_ACCESSORS(name, field, bits, RT) \
+    static inline RT name##_get_##field(const name##_t *name) \
+    { \
+        return (RT)wire_load##bits(name->field); \
+    } \
+    static inline void name##_set_##field(name##_t *name, RT field) \
+    { \
+        wire_store##bits(name->field, (uint##bits##_t)field); \
+    }
+
+#define GEN_SCHEMA_VAR_HEADERS(name, field, tag, max) \
+    GEN_VAR_FIELD_HEADERS(name, field)
+
+#define GEN_SCHEMA_VIEW_FIELD(name, field, tag, max) \
+    const uint8_t *field; /* NULL if the message doesn't have it */ \
+    size_t field##_len;
+
+// The first field with a known tag wins, and one longer than its schema allows fails the view
+#define GEN_SCHEMA_VIEW_BIND(name, field, tag, max) \
+    if (tail[i] == (tag) && !view->field) { \
+        if (field_len - value_at > (max)) { \
+            return false; \
+        } \
+        view->field = &tail[i + value_at]; \
+        view->field##_len = field_len - value_at; \
+    }
+
+#define GEN_SCHEMA_HEADERS(name, T, SCHEMA) \
+    TYPE_BEGIN_DEF(name, T) \
+        SCHEMA(name, GEN_SCHEMA_STRUCT_FIELD, GEN_SCHEMA_SKIP) \
+    TYPE_END_DEF(name, T) \
+    GEN_STD_HEADERS(name, T) \
+    SCHEMA(name, GEN_SCHEMA_FIXED_ACCESSORS, GEN_SCHEMA_VAR_HEADERS) \
+    typedef struct name##_view_t { \
+        const name##_t *msg; /* fixed fields, read with name##_get_*() */ \
+        SCHEMA(name, GEN_SCHEMA_SKIP, GEN_SCHEMA_VIEW_FIELD) \
+        const uint8_t *data; \
+        size_t data_len; \
+    } name##_view_t; \
+    bool name##_view(name##_view_t *view, const void *msg, size_t len);
+
+#define GEN_SCHEMA_FUNCS(name, T, SCHEMA) \
+    GEN_STD_FUNCS(name, T) \
+    SCHEMA(name, GEN_SCHEMA_SKIP, GEN_VAR_FIELD_FUNCS) \
+    bool name##_view(name##_view_t *view, const void *msg, size_t len) \
+    { \
+        memset(view, 0, sizeof(*view)); \
+        if (!name##_check(msg, len)) { \
+            return false; \
+        } \
+        view->msg = msg; \
+        const uint8_t *tail = view->msg->tail; \
+        const size_t tail_len = name##_get_tail_length(view->msg); \
+        size_t i = 0; \
+        while (tail[i]) { \
+            size_t value_at = 0; \
+            const size_t field_len = wire_field_next(&tail[i], tail_len - i, &value_at); \
+            SCHEMA(name, GEN_SCHEMA_SKIP, GEN_SCHEMA_VIEW_BIND) \
+            i += field_len; \
+        } \
+        view->data = &tail[i + 1]; \
+        view->data_len = tail_len - i - 1; \
+        return true; \
+    }
@@ -7,17 +7,24 @@ typedef enum stat_msg_type_t {
     STAT_USER_CONNECT,
     STAT_USER_DISCONNECT,
     STAT_USER_RENAME,
+    STAT_USER_PRESENT, // reply to a connect, so the new member learns who's already here
 } stat_msg_type_t;
 
 enum stat_msg_cfg {
     STAT_USERNAME_LENGTH = 64,
 };
 
-GEN_STD_HEADERS(stat_msg, stat_msg_type_t)
+enum stat_msg_field {
+    STAT_FIELD_NAME = 1,
+};
+
+#define STAT_MSG_SCHEMA(msg, FIXED, VAR) \
+    FIXED(msg, member, 32, uint32_t) \
+    VAR(msg, name, STAT_FIELD_NAME, STAT_USERNAME_LENGTH - 1)
 
-bool stat_msg_get_user(stat_msg_t *sm, char *user);
-void stat_msg_set_user(stat_msg_t *sm, const char *user);
-wire_t *init_wire_from_stat_msg(stat_msg_t *stat_msg);
-stat_msg_t *init_stat_conn_msg(stat_msg_type_t type, const char *user);
+GEN_SCHEMA_HEADERS(stat_msg, stat_msg_type_t, STAT_MSG_SCHEMA)
 
-stat_msg_t *init_stat_rename_msg(const char *curr_name, const char *new_name);
+// Members are named only in their connect, rename, and present messages, which carry the
+// (new) name in their `name` field. Everything else they send refers to them by member id
+bool stat_msg_get_user(const stat_msg_view_t *sm, char *user);
+wire_t *init_wire_from_stat(stat_msg_type_t type, uint32_t member, const char *user);
@@ -9,13 +9,13 @@ typedef enum text_msg_type_t {
 } text_msg_type_t;
 
 enum text_msg_cfg {
-    TEXT_USERNAME_LENGTH = 64,
+    TEXT_HEADER_LENGTH = 14, // type, length, sender's member id, and the (empty) fields' end tag
 };
 
-GEN_STD_HEADERS(text_msg, text_msg_type_t)
+#define TEXT_MSG_SCHEMA(msg, FIXED, VAR) \
+    FIXED(msg, member, 32, uint32_t) /* sender */
 
-bool text_msg_get_user(text_msg_t *tm, char *user);
-void text_msg_set_user(text_msg_t *tm, const char *user);
-text_msg_t *text_msg_from_text(const char *user, const void *data, size_t len);
-wire_t *init_wire_from_text_msg(text_msg_t *text_msg);
+GEN_SCHEMA_HEADERS(text_msg, text_msg_type_t, TEXT_MSG_SCHEMA)
+
+wire_t *init_wire_from_text(uint32_t member, const void *data, size_t len);
 
@@ -70,3 +70,90 @@ void wire_unpack8(uint8_t *dst, uint8_t src)
 {
     dst[0] = src;
 }
+
+// Bytes taken by `value` as an unsigned LEB128 varint, seven bits per byte
+size_t wire_varint_length(uint64_t value)
+{
+    size_t len = 1;
+    while (value >>= 7) {
+        len++;
+    }
+    return len;
+}
+
+// Read a varint from at most `len` bytes of `src`, returning the bytes it took or
+// 0 if it doesn't end within `len` bytes or overflows 64 bits
+size_t wire_pack_varint(const uint8_t *src, size_t len, uint64_t *value)
+{
+    uint64_t v = 0;
+    for (size_t i = 0; i < len && i < 10; i++) {
+        v |= (uint64_t)(src[i] & 0x7f) << (7 * i);
+        if (!(src[i] & 0x80)) {
+            *value = v;
+            return i + 1;
+        }
+    }
+    return 0;
+}
+
+// Write `value` as a varint, returning the bytes written
+size_t wire_unpack_varint(uint8_t *dst, uint64_t value)
+{
+    size_t i = 0;
+    for (; value >= 0x80; value >>= 7) {
+        dst[i++] = (uint8_t)(value | 0x80);
+    }
+    dst[i++] = (uint8_t)value;
+    return i;
+}
+
+// Bytes a field with a `len`-byte value takes up
+size_t wire_field_length(size_t len)
+{
+    return 1 + wire_varint_length(len) + len;
+}
+
+// Step over the field at `fields`, `len` bytes from the end of the message. Returns the length of
+// the field and sets `*value_at` to the offset of its value, or 0 if it runs past `len` bytes
+size_t wire_field_next(const uint8_t *fields, size_t len, size_t *value_at)
+{
+    uint64_t value_len = 0;
+    const size_t n = wire_pack_varint(&fields[1], len - 1, &value_len);
+    if (!n || value_len > len - 1 - n) {
+        return 0;
+    }
+    *value_at = 1 + n;
+    return 1 + n + (size_t)value_len;
+}
+
+// Length of the fields in the first `len` bytes of `fields`, end tag included, or 0 if they
+// don't end within `len` bytes
+size_t wire_fields_length(const uint8_t *fields, size_t len)
+{
+    size_t i = 0;
+    while (i < len && fields[i]) {
+        size_t value_at = 0;
+        const size_t field_len = wire_field_next(&fields[i], len - i, &value_at);
+        if (!field_len) {
+            return 0;
+        }
+        i += field_len;
+    }
+    return i < len ? i + 1 : 0;
+}
+
+// Write a field over the end tag and close the fields again after it. False if that doesn't
+// fit in `len` bytes, in which case nothing is written
+bool wire_field_append(uint8_t *fields, size_t len, uint8_t tag, const void *value, size_t value_len)
+{
+    const size_t end = wire_fields_length(fields, len);
+    if (!end || !tag || wire_field_length(value_len) >= len - end + 1) {
+        return false;
+    }
+    uint8_t *dst = &fields[end - 1];
+    *dst++ = tag;
+    dst += wire_unpack_varint(dst, value_len);
+    memcpy(dst, value, value_len);
+    dst[value_len] = 0;
+    return true;
+}
@@ -1,6 +1,69 @@
 #pragma once
 
+#include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
+#include <string.h>
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    #define wire_le16(x) __builtin_bswap16(x)
+    #define wire_le32(x) __builtin_bswap32(x)
+    #define wire_le64(x) __builtin_bswap64(x)
+#else
+    #define wire_le16(x) (x)
+    #define wire_le32(x) (x)
+    #define wire_le64(x) (x)
+#endif
+
+// Unaligned little-endian loads and stores, a single move on little-endian targets
+static inline uint8_t wire_load8(const uint8_t *src)
+{
+    return src[0];
+}
+
+static inline uint16_t wire_load16(const uint8_t *src)
+{
+    uint16_t v;
+    memcpy(&v, src, sizeof(v));
+    return wire_le16(v);
+}
+
+static inline uint32_t wire_load32(const uint8_t *src)
+{
+    uint32_t v;
+    memcpy(&v, src, sizeof(v));
+    return wire_le32(v);
+}
+
+static inline uint64_t wire_load64(const uint8_t *src)
+{
+    uint64_t v;
+    memcpy(&v, src, sizeof(v));
+    return wire_le64(v);
+}
+
+static inline void wire_store8(uint8_t *dst, uint8_t v)
+{
+    dst[0] = v;
+}
+
+static inline void wire_store16(uint8_t *dst, uint16_t v)
+{
+    v = wire_le16(v);
+    memcpy(dst, &v, sizeof(v));
+}
+
+static inline void wire_store32(uint8_t *dst, uint32_t v)
+{
+    v = wire_le32(v);
+    memcpy(dst, &v, sizeof(v));
+}
+
+static inline void wire_store64(uint8_t *dst, uint64_t v)
+{
+    v = wire_le64(v);
+    memcpy(dst, &v, sizeof(v));
+}
 
 uint8_t wire_pack8(const uint8_t *src);
 uint16_t wire_pack16(const uint8_t *src);
@@ -11,3 +74,13 @@ void wire_unpack64(uint8_t *dst, uint64_t src);
 void wire_unpack32(uint8_t *dst, uint32_t src);
 void wire_unpack16(uint8_t *dst, uint16_t src);
 void wire_unpack8(uint8_t *dst, uint8_t src);
+
+size_t wire_varint_length(uint64_t value);
+size_t wire_pack_varint(const uint8_t *src, size_t len, uint64_t *value);
+size_t wire_unpack_varint(uint8_t *dst, uint64_t value);
+
+// Variable-length message fields, each [tag (1) | length (varint) | value], closed by a zero tag
+size_t wire_field_length(size_t len);
+size_t wire_field_next(const uint8_t *fields, size_t len, size_t *value_at);
+size_t wire_fields_length(const uint8_t *fields, size_t len);
+bool wire_field_append(uint8_t *fields, size_t len, uint8_t tag, const void *value, size_t value_len);
@@ -10,7 +10,9 @@
  */
 
 #include "wire.h"
+#include "csprng.h"
 #include "log.h"
+#include "lz4.h"
 #include "wire-util.h"
 #include "xplatform.h"
 #include "xutils.h"
@@ -25,7 +27,7 @@ size_t get_aligned_len(size_t len)
 
 size_t header_get_alignment(const header_t *header)
 {
-    return header->alignment;
+    return header->alignment & WIRE_ALIGNMENT_MASK;
 }
 
 size_t wire_get_alignment(const wire_t *wire)
@@ -79,27 +81,72 @@ void wire_set_length(wire_t *wire, size_t len)
 
 void wire_set_alignment(wire_t *wire, size_t alignment)
 {
-    wire->header.alignment = alignment;
+    wire->header.alignment = (wire->header.alignment & ~WIRE_ALIGNMENT_MASK) | (uint8_t)alignment;
 }
 
-void header_set_signature(header_t *header)
+uint8_t wire_get_flags(const wire_t *wire)
 {
-    memcpy(header->signature, "-wire-", sizeof(header->signature));
+    return wire->header.alignment & ~WIRE_ALIGNMENT_MASK;
 }
 
-void wire_set_signature(wire_t *wire)
+static void wire_set_flags(wire_t *wire, uint8_t flags)
 {
-    header_set_signature(&wire->header);
+    wire->header.alignment = (wire->header.alignment & WIRE_ALIGNMENT_MASK) | flags;
 }
 
-bool header_check_signature(header_t *header)
+// Shrink the data of a wire that was allocated for at least `len` bytes of it
+static void wire_set_data_length(wire_t *wire, size_t len)
 {
-    return !memcmp(header->signature, "-wire-", sizeof(header->signature));
+    const size_t data_length = get_aligned_len(len);
+    wire_set_alignment(wire, data_length - len);
+    wire_set_length(wire, sizeof(wire_t) + data_length);
 }
 
-bool wire_check_signature(wire_t *wire)
+static const char *const signatures[WIRE_SUITE_COUNT] = {
+    [WIRE_SUITE_CBC_CMAC] = "-wire-",
+    [WIRE_SUITE_CHACHA20_POLY1305] = "-aead-",
+    [WIRE_SUITE_COMPACT] = "-cmpt-",
+};
+
+void header_set_signature(header_t *header, wire_suite_t suite)
 {
-    return header_check_signature(&wire->header);
+    memcpy(header->signature, signatures[suite], sizeof(header->signature));
+}
+
+void wire_set_signature(wire_t *wire, wire_suite_t suite)
+{
+    header_set_signature(&wire->header, suite);
+}
+
+bool header_check_signature(header_t *header, wire_suite_t suite)
+{
+    return !memcmp(header->signature, signatures[suite], sizeof(header->signature));
+}
+
+bool wire_check_signature(wire_t *wire, wire_suite_t suite)
+{
+    return header_check_signature(&wire->header, suite);
+}
+
+const char *wire_suite_name(wire_suite_t suite)
+{
+    static const char *names[WIRE_SUITE_COUNT] = {
+        [WIRE_SUITE_CBC_CMAC] = "aes128-cbc-cmac",
+        [WIRE_SUITE_CHACHA20_POLY1305] = "chacha20-poly1305",
+        [WIRE_SUITE_COMPACT] = "chacha20-poly1305-compact",
+    };
+    return (size_t)suite < WIRE_SUITE_COUNT ? names[suite] : "unknown";
+}
+
+bool wire_suite_from_name(const char *name, wire_suite_t *suite)
+{
+    for (size_t i = 0; i < WIRE_SUITE_COUNT; i++) {
+        if (!strcmp(name, wire_suite_name((wire_suite_t)i))) {
+            *suite = (wire_suite_t)i;
+            return true;
+        }
+    }
+    return false;
 }
 
 void wire_set_type(wire_t *wire, wire_type_t type)
@@ -120,7 +167,7 @@ header_t wire_decrypt_header(aes128_t *aes128, wire_t *wire)
     header_t h = { 0 };
     memcpy(&h, &wire->header, sizeof(header_t));
     aes128_decrypt(aes128, (void *)&h, BLOCK_LEN);
-    if (!header_check_signature(&h)) {
+    if (!header_check_signature(&h, WIRE_SUITE_CBC_CMAC)) {
         log_error("header signature invalid");
         return (header_t) { 0 };
     }
@@ -133,28 +180,80 @@ void wire_decrypt_data(aes128_t *aes128, wire_t *wire, size_t len)
     aes128_decrypt(aes128, wire->data, len);
 }
 
-bool wire_verify_outer_mac(aes128_t *aes128, wire_t *wire, size_t wire_len)
+typedef struct decrypt_job_t {
+    aes128_t cipher;
+    uint8_t *data;
+    size_t len;
+} decrypt_job_t;
+
+static void *decrypt_segment(void *arg)
+{
+    decrypt_job_t *job = arg;
+    aes128_decrypt(&job->cipher, job->data, job->len);
+    return NULL;
+}
+
+// Number of threads worth splitting `len` bytes of file data across
+static size_t wire_decrypt_threads(size_t len)
+{
+    const size_t threads = MIN(xgetncpu(), (size_t)PARALLEL_DECRYPT_THREADS_MAX);
+    return MIN(threads, len / PARALLEL_DECRYPT_SEGMENT_MIN);
+}
+
+// Each CBC segment only needs the ciphertext block before it as its IV, so large
+// wires can be split into independent segments and decrypted on separate threads
+static void wire_decrypt_data_parallel(aes128_t *aes128, wire_t *wire, size_t len, size_t threads)
+{
+    const size_t segment_len = ROUND_UP(len / threads, BLOCK_LEN);
+
+    // Capture every segment's IV before any of the ciphertext gets overwritten
+    decrypt_job_t jobs[PARALLEL_DECRYPT_THREADS_MAX];
+    size_t count = 0;
+    for (size_t offset = 0; offset < len; offset += segment_len, count++) {
+        jobs[count].cipher = *aes128;
+        if (offset) {
+            memcpy(jobs[count].cipher.iv, &wire->data[offset - BLOCK_LEN], BLOCK_LEN);
+        }
+        jobs[count].data = &wire->data[offset];
+        jobs[count].len = MIN(segment_len, len - offset);
+    }
+
+    // Segment 0 runs on this thread, and any segment whose thread fails to start runs here as well
+    pthread_t tids[PARALLEL_DECRYPT_THREADS_MAX];
+    bool started[PARALLEL_DECRYPT_THREADS_MAX] = { 0 };
+    for (size_t i = 1; i < count; i++) {
+        started[i] = !pthread_create(&tids[i], NULL, decrypt_segment, &jobs[i]);
+    }
+    decrypt_segment(&jobs[0]);
+    for (size_t i = 1; i < count; i++) {
+        if (started[i]) {
+            pthread_join(tids[i], NULL);
+        }
+        else {
+            decrypt_segment(&jobs[i]);
+        }
+    }
+
+    memcpy(aes128->iv, jobs[count - 1].cipher.iv, BLOCK_LEN);
+}
+
+bool wire_verify_outer_mac(const aes128_t *aes128, wire_t *wire, size_t wire_len)
 {
     uint8_t cmac[BLOCK_LEN] = { 0 };
     aes128_cmac(aes128, wire->auth.mac_inner, wire_len - WIRE_OFFSET_MAC_INNER, cmac);
     return !memcmp(&wire->auth.mac_outer[0], cmac, BLOCK_LEN);
 }
 
-bool wire_verify_inner_mac(aes128_t *aes128, wire_t *wire)
+bool wire_verify_inner_mac(const aes128_t *aes128, wire_t *wire)
 {
     uint8_t cmac[BLOCK_LEN] = { 0 };
     aes128_cmac(aes128, (uint8_t *)&wire->header, BLOCK_LEN, cmac);
     return !memcmp(&wire->auth.mac_inner[0], cmac, BLOCK_LEN);
 }
 
-wire_t *alloc_wire(void)
-{
-    return xcalloc(RECV_MAX_BYTES);
-}
-
 static bool wire_auth_init_iv(wire_t *wire)
 {
-    return xgetrandom(wire->auth.iv, BLOCK_LEN) == BLOCK_LEN;
+    return csprng_fill(wire->auth.iv, BLOCK_LEN);
 }
 
 static void wire_set_data(wire_t *wire, const void *data, size_t len)
@@ -163,9 +262,7 @@ static void wire_set_data(wire_t *wire, const void *data, size_t len)
 }
 
 
-// len should point to the length of the data to be added
-// len is updated to the total wire length
-wire_t *init_wire(wire_type_t type, const void *data, size_t *len)
+wire_t *alloc_wire(wire_type_t type, size_t len)
 {
     static const char *types[] = {
         [TYPE_NONE] = "TYPE_NONE",
@@ -174,99 +271,338 @@ wire_t *init_wire(wire_type_t type, const void *data, size_t *len)
         [TYPE_CTRL] = "TYPE_CTRL",
         [TYPE_STAT] = "TYPE_STAT",
         [TYPE_SESSION_KEY] = "TYPE_SESSION_KEY",
+        [TYPE_FILE_CHUNK] = "TYPE_FILE_CHUNK",
+        [TYPE_BATCH] = "TYPE_BATCH",
     };
-    log_trace("init_wire(%s)", types[type]);
+    log_trace("alloc_wire(%s)", types[type]);
 
-    const size_t data_length = get_aligned_len(*len);
-    const size_t alignment = data_length - *len;
+    const size_t data_length = get_aligned_len(len);
+    const size_t alignment = data_length - len;
     const size_t wire_length = sizeof(wire_t) + data_length;
 
-    log_trace("  payload length: %zu bytes (%zu bytes aligned)", *len, data_length);
+    log_trace("  payload length: %zu bytes (%zu bytes aligned)", len, data_length);
     log_trace("  padding required: %zu bytes", alignment);
     log_trace("  total wire length: %zu bytes", wire_length);
 
-    wire_t *wire = xcalloc(wire_length);
+    // The cable header goes in front, so the encrypted wire never has to be copied into a cable
+    wire_t *wire = pointer_offset(xcalloc(WIRE_HEADROOM + wire_length + WIRE_TAILROOM), WIRE_HEADROOM);
 
     if (!wire_auth_init_iv(wire)) {
-        xfree(wire);
-        return NULL;
+        return free_wire(wire);
     }
 
-    wire_set_signature(wire);
+    wire_set_signature(wire, WIRE_SUITE_CBC_CMAC);
     wire_set_alignment(wire, alignment);
     wire_set_length(wire, wire_length);
     wire_set_type(wire, type);
+    return wire;
+}
+
+// len should point to the length of the data to be added
+// len is updated to the total wire length
+wire_t *init_wire(wire_type_t type, const void *data, size_t *len)
+{
+    wire_t *wire = alloc_wire(type, *len);
+    if (!wire) {
+        return NULL;
+    }
     wire_set_data(wire, data, *len);
 
-    *len = wire_length;
+    *len = wire_get_length(wire);
     return wire;
 }
 
-// [note] `len` must be passed explicitly here since `wire` is already encrypted
-static void wire_gen_cmacs(const aes128_t *cmac, wire_t *wire, size_t len)
+void *free_wire(wire_t *wire)
 {
-    // Generate inner MAC
-    aes128_cmac(cmac, (uint8_t *)&wire->header, BLOCK_LEN, wire->auth.mac_inner);
-    
-    // Generate outer MAC over
-    //  - inner MAC
-    //  - IV
-    //  - header
-    //  - data
-    aes128_cmac(cmac, wire->auth.mac_inner, len - WIRE_OFFSET_MAC_INNER, wire->auth.mac_outer);
+    return wire ? xfree(pointer_offset(wire, -(ptrdiff_t)WIRE_HEADROOM)) : NULL;
 }
 
-bool encrypt_wire(wire_t *wire, const uint8_t *key)
+// Compressed straight into a wire sized for the original, which is then cut down to fit
+wire_t *wire_compress(wire_t *wire)
 {
-    if (!wire || !key) {
-        return false;
+    const size_t len = wire_get_data_length(wire);
+    if (len < WIRE_COMPRESS_MIN || (wire_get_flags(wire) & WIRE_FLAG_COMPRESSED)) {
+        return NULL;
+    }
+
+    wire_t *packed = alloc_wire(TYPE_NONE, len);
+    if (!packed) {
+        return NULL;
+    }
+    const size_t prefix = wire_unpack_varint(packed->data, len);
+    const size_t block = lz4_compress(wire->data, len, &packed->data[prefix], len - prefix - 1);
+    if (!block) {
+        return free_wire(packed);
+    }
+
+    wire_set_type(packed, wire_get_type(wire));
+    wire_set_data_length(packed, prefix + block);
+    wire_set_flags(packed, WIRE_FLAG_COMPRESSED);
+    log_trace("compressed %zu bytes of wire data to %zu", len, prefix + block);
+    return packed;
+}
+
+wire_t *wire_decompress(wire_t *wire)
+{
+    const size_t len = wire_get_data_length(wire);
+    uint64_t original = 0;
+    const size_t prefix = wire_pack_varint(wire->data, len, &original);
+    if (!prefix || original > WIRE_DECOMPRESSED_MAX) {
+        log_error("compressed wire has an invalid length");
+        return NULL;
     }
 
-    aes128_t cipher = { 0 };
-    aes128_t cmac = { 0 };
+    wire_t *plain = alloc_wire(TYPE_NONE, (size_t)original);
+    if (!plain) {
+        return NULL;
+    }
+    if (!lz4_decompress(&wire->data[prefix], len - prefix, plain->data, (size_t)original)) {
+        log_error("malformed compressed wire");
+        return free_wire(plain);
+    }
+    wire_set_type(plain, wire_get_type(wire));
+    return plain;
+}
 
-    aes128_init(&cipher, wire->auth.iv, &key[CIPHER_OFFSET]);
-    aes128_init_cmac(&cmac, &key[CMAC_OFFSET]);
+// The outer MAC covers the inner MAC, IV, header, and data. Everything ahead of the header
+// is known before the data pass, so it's absorbed up front and the data is then MAC'd
+// block by block as it's encrypted (or before it's decrypted) rather than in a second pass
+static void wire_outer_mac_begin(const aes128_t *cmac, const wire_t *wire, uint8_t *state)
+{
+    memset(state, 0, BLOCK_LEN);
+    aes128_cmac_update(cmac, state, wire->auth.mac_inner, (WIRE_OFFSET_MAGIC - WIRE_OFFSET_MAC_INNER) / BLOCK_LEN);
+}
+
+static void encrypt_wire_cbc(wire_t *wire, const wire_key_t *key)
+{
+    const aes128_t *cmac = &key->cmac;
+    aes128_t cipher = key->cipher;
+    memcpy(cipher.iv, wire->auth.iv, BLOCK_LEN);
 
     // Grab block-aligned data length from wire
     size_t data_len = wire_get_aligned_data_length(wire);
-    size_t wire_len = wire_get_length(wire);
 
-    // Encrypt chunks
+    // Encrypt and MAC the header
     aes128_encrypt(&cipher, (uint8_t *)&wire->header, BLOCK_LEN);
-    aes128_encrypt(&cipher, wire->data, data_len);
+    aes128_cmac(cmac, (uint8_t *)&wire->header, BLOCK_LEN, wire->auth.mac_inner);
+
+    // Encrypt the data while absorbing it into the outer MAC, holding back the final block for CMAC's last step
+    uint8_t state[BLOCK_LEN];
+    uint8_t *last = (uint8_t *)&wire->header;
+    wire_outer_mac_begin(cmac, wire, state);
+    if (data_len) {
+        aes128_cmac_update(cmac, state, last, 1);
+        last = &wire->data[data_len - BLOCK_LEN];
+        aes128_encrypt_cmac(&cipher, cmac, state, wire->data, data_len - BLOCK_LEN);
+        aes128_encrypt(&cipher, last, BLOCK_LEN);
+    }
+    aes128_cmac_final(cmac, state, last, BLOCK_LEN, wire->auth.mac_outer);
+}
+
+// The AEAD suite uses the full 256-bit key with the first 12 bytes of `auth.iv` as the nonce.
+// Keystream block 0 provides both one-time Poly1305 keys: bytes 0-31 for the RFC 8439 tag
+// in `mac_outer`, and bytes 32-63 for a tag over just the encrypted header in `mac_inner`
+static void wire_aead_inner_mac(const wire_t *wire, const uint8_t *key, uint8_t *mac)
+{
+    uint8_t block[CHACHA20_BLOCK_SIZE];
+    chacha20_block(block, key, wire->auth.iv, 0);
+
+    poly1305_t poly1305;
+    poly1305_init(&poly1305, &block[POLY1305_KEY_LEN]);
+    poly1305_update(&poly1305, (const uint8_t *)&wire->header, BLOCK_LEN);
+    poly1305_finish(&poly1305, mac);
+    memset(block, 0, sizeof(block));
+}
+
+// Header and data are encrypted and authenticated in one pass, with the IV field as associated data
+static void encrypt_wire_aead(wire_t *wire, const uint8_t *key)
+{
+    const size_t wire_len = wire_get_length(wire);
+    chacha20_poly1305_encrypt(key, wire->auth.iv, wire->auth.iv, BLOCK_LEN,
+        (uint8_t *)&wire->header, wire_len - WIRE_OFFSET_MAGIC, wire->auth.mac_outer);
+    wire_aead_inner_mac(wire, key, wire->auth.mac_inner);
+}
+
+static wire_compact_t *wire_get_compact(wire_t *wire)
+{
+    return pointer_offset(wire, WIRE_OFFSET_COMPACT);
+}
+
+size_t wire_get_sealed_length(wire_t *wire, wire_suite_t suite)
+{
+    return suite == WIRE_SUITE_COMPACT ? wire_get_data_length(wire) + WIRE_COMPACT_OVERHEAD : wire_get_length(wire);
+}
+
+uint8_t *wire_get_sealed(wire_t *wire, wire_suite_t suite)
+{
+    return suite == WIRE_SUITE_COMPACT ? (uint8_t *)wire_get_compact(wire) : (uint8_t *)wire;
+}
+
+// TLS 1.3 style: the explicit sequence is XOR'd into the low 8 bytes of the key's implicit IV
+static void wire_compact_nonce(const wire_key_t *key, const wire_compact_t *frame, uint8_t *nonce)
+{
+    memcpy(nonce, key->iv, CHACHA20_NONCE_LEN);
+    for (size_t i = 0; i < sizeof(frame->sequence); i++) {
+        nonce[CHACHA20_NONCE_LEN - sizeof(frame->sequence) + i] ^= frame->sequence[i];
+    }
+}
 
-    // Generate inner and outer CMAC
-    wire_gen_cmacs(&cmac, wire, wire_len);
-    
+// The fixed part of the frame is written over the length fields, so they're read first. The
+// sequence only has to be unique per key, and every sender shares the session key, so each
+// thread counts from its own random 64-bit start
+static bool encrypt_wire_compact(wire_t *wire, const wire_key_t *key)
+{
+    const size_t data_len = wire_get_data_length(wire);
+    uint64_t sequence;
+    if (!csprng_sequence(&sequence)) {
+        return false;
+    }
+
+    wire_compact_t *frame = wire_get_compact(wire);
+    wire_unpack64(frame->sequence, sequence);
+    frame->flags &= WIRE_COMPACT_WIRE_FLAGS;
+    frame->flags |= key->role == WIRE_KEY_CTRL ? WIRE_COMPACT_CTRL_KEY : 0;
+
+    uint8_t nonce[CHACHA20_NONCE_LEN];
+    wire_compact_nonce(key, frame, nonce);
+    chacha20_poly1305_encrypt(key->key, nonce, (const uint8_t *)frame, WIRE_COMPACT_AAD_LEN,
+        &frame->type, sizeof(frame->type) + data_len, &wire->data[data_len]);
     return true;
 }
 
-bool decrypt_wire(wire_t *wire, size_t len, const uint8_t *key1, const uint8_t *key2)
+// Put back the header fields the frame was written over, so the decrypted wire reads like any
+// other. The frame's flags are where the alignment was, so only the wire flags are kept
+static void wire_compact_restore(wire_t *wire, size_t data_len)
 {
-    aes128_t cipher = { 0 };
-    aes128_t cmac = { 0 };
+    wire->header.alignment &= WIRE_COMPACT_WIRE_FLAGS;
+    wire_set_signature(wire, WIRE_SUITE_COMPACT);
+    wire_set_length(wire, sizeof(wire_t) + data_len);
+    wire_set_alignment(wire, 0);
+}
 
-    const uint8_t *key = key1;
-init:
-    aes128_init(&cipher, wire->auth.iv, &key[CIPHER_OFFSET]);
-    aes128_init_cmac(&cmac, &key[CMAC_OFFSET]);
+static const wire_key_t *wire_compact_select_key(const wire_compact_t *frame, const wire_key_t *key1, const wire_key_t *key2)
+{
+    const wire_key_role_t role = (frame->flags & WIRE_COMPACT_CTRL_KEY) ? WIRE_KEY_CTRL : WIRE_KEY_SESSION;
+    if (key1->role == role) {
+        return key1;
+    }
+    if (key2 && key2->role == role) {
+        return key2;
+    }
+    log_fatal("no %s key for compact frame", role == WIRE_KEY_CTRL ? "control" : "session");
+    return NULL;
+}
 
-    // Decrypt only the length
-    if (!wire_verify_inner_mac(&cmac, wire)) {
-        if (key == key1) {
-            if (!key2) {
-                log_fatal("inner mac verification failure");
-                return false;
-            }
-            log_trace("key1 inner mac verification failure, trying key2");
-            key = key2;
-            goto init;
-        }
-        log_fatal("inner mac verification failure");
-        log_fatal("session and ctrl keys out of sync");
+static bool decrypt_wire_compact(wire_t *wire, size_t len, const wire_key_t *key1, const wire_key_t *key2)
+{
+    if (len < WIRE_COMPACT_OVERHEAD) {
+        log_error("compact frame too short (%zu bytes)", len);
+        return false;
+    }
+    wire_compact_t *frame = wire_get_compact(wire);
+    const wire_key_t *key = wire_compact_select_key(frame, key1, key2);
+    if (!key) {
+        return false;
+    }
+
+    const size_t data_len = len - WIRE_COMPACT_OVERHEAD;
+    uint8_t nonce[CHACHA20_NONCE_LEN];
+    wire_compact_nonce(key, frame, nonce);
+    if (!chacha20_poly1305_decrypt(key->key, nonce, (const uint8_t *)frame, WIRE_COMPACT_AAD_LEN,
+            &frame->type, sizeof(frame->type) + data_len, &wire->data[data_len])) {
+        log_fatal("outer mac verification failure");
         return false;
     }
+    wire_compact_restore(wire, data_len);
+    return true;
+}
+
+void wire_key_init(wire_key_t *ctx, const uint8_t *key, wire_suite_t suite, wire_key_role_t role)
+{
+    memset(ctx, 0, sizeof(*ctx));
+    memcpy(ctx->key, key, KEY_LEN);
+    ctx->suite = suite;
+    ctx->role = role;
+    if (suite == WIRE_SUITE_CBC_CMAC) {
+        static const uint8_t iv[BLOCK_LEN] = { 0 };
+        aes128_init(&ctx->cipher, iv, &key[CIPHER_OFFSET]);
+        aes128_init_cmac(&ctx->cmac, &key[CMAC_OFFSET]);
+    }
+    else if (suite == WIRE_SUITE_COMPACT) {
+        static const char label[] = "parcel compact frame iv";
+        uint8_t digest[SHA256_DIGEST_LEN];
+        sha256_t sha;
+        sha256_init(&sha);
+        sha256_append(&sha, key, KEY_LEN);
+        sha256_append(&sha, label, sizeof(label) - 1);
+        sha256_finish(&sha, digest);
+        memcpy(ctx->iv, digest, sizeof(ctx->iv));
+        memset(digest, 0, sizeof(digest));
+    }
+}
+
+void wire_key_wipe(wire_key_t *ctx)
+{
+    memset(ctx, 0, sizeof(*ctx));
+}
+
+bool encrypt_wire(wire_t *wire, const wire_key_t *key)
+{
+    if (!wire || !key) {
+        return false;
+    }
+
+    wire_set_signature(wire, key->suite);
+    switch (key->suite) {
+        case WIRE_SUITE_CBC_CMAC:
+            encrypt_wire_cbc(wire, key);
+            return true;
+        case WIRE_SUITE_CHACHA20_POLY1305:
+            encrypt_wire_aead(wire, key->key);
+            return true;
+        case WIRE_SUITE_COMPACT:
+            return encrypt_wire_compact(wire, key);
+        default:
+            log_error("unknown wire suite %d", key->suite);
+            return false;
+    }
+}
+
+static bool wire_verify_key_inner_mac(wire_t *wire, const wire_key_t *key)
+{
+    if (key->suite == WIRE_SUITE_CHACHA20_POLY1305) {
+        uint8_t mac[POLY1305_TAG_LEN];
+        wire_aead_inner_mac(wire, key->key, mac);
+        return !memcmp(wire->auth.mac_inner, mac, POLY1305_TAG_LEN);
+    }
+    return wire_verify_inner_mac(&key->cmac, wire);
+}
+
+// Pick whichever of `key1` and `key2` produced the inner MAC, NULL if neither did
+static const wire_key_t *wire_select_key(wire_t *wire, const wire_key_t *key1, const wire_key_t *key2)
+{
+    if (wire_verify_key_inner_mac(wire, key1)) {
+        return key1;
+    }
+    if (!key2) {
+        log_fatal("inner mac verification failure");
+        return NULL;
+    }
+
+    log_trace("key1 inner mac verification failure, trying key2");
+    if (wire_verify_key_inner_mac(wire, key2)) {
+        return key2;
+    }
+    log_fatal("inner mac verification failure");
+    log_fatal("session and ctrl keys out of sync");
+    return NULL;
+}
+
+static bool decrypt_wire_cbc(wire_t *wire, size_t len, const wire_key_t *key)
+{
+    const aes128_t *cmac = &key->cmac;
+    aes128_t cipher = key->cipher;
+    memcpy(cipher.iv, wire->auth.iv, BLOCK_LEN);
 
     header_t h = wire_decrypt_header(&cipher, wire);
     size_t wire_len = header_get_length(&h);
@@ -276,17 +612,288 @@ init:
     }
 
     size_t aligned_len = header_get_aligned_data_length(&h);
+    if (aligned_len % BLOCK_LEN) {
+        log_error("wire data length (%zu bytes) isn't block aligned", aligned_len);
+        return false;
+    }
+
+    // Large file wires are better served by verifying up front and then splitting the decryption across threads
+    const size_t threads = h.type == TYPE_FILE ? wire_decrypt_threads(aligned_len) : 0;
+    if (threads > 1) {
+        if (!wire_verify_outer_mac(cmac, wire, wire_len)) {
+            log_fatal("outer mac verification failure");
+            return false;
+        }
+        wire_decrypt_data_parallel(&cipher, wire, aligned_len, threads);
+        wire_set_header(wire, &h);
+        return true;
+    }
 
-    // Verify MAC prior to decrypting in full
-    if (!wire_verify_outer_mac(&cmac, wire, wire_len)) {
+    // Otherwise the data is MAC'd and decrypted in a single pass. The final block is held back
+    // as ciphertext for CMAC's last step, and everything decrypted so far is wiped if the MAC doesn't match
+    uint8_t state[BLOCK_LEN];
+    uint8_t mac[BLOCK_LEN];
+    uint8_t *last = (uint8_t *)&wire->header;
+    wire_outer_mac_begin(cmac, wire, state);
+    if (aligned_len) {
+        aes128_cmac_update(cmac, state, last, 1);
+        last = &wire->data[aligned_len - BLOCK_LEN];
+        aes128_cmac_decrypt(&cipher, cmac, state, wire->data, aligned_len - BLOCK_LEN);
+    }
+    aes128_cmac_final(cmac, state, last, BLOCK_LEN, mac);
+
+    if (memcmp(wire->auth.mac_outer, mac, BLOCK_LEN)) {
+        memset(wire->data, 0, aligned_len);
         log_fatal("outer mac verification failure");
         return false;
     }
-
-    wire_decrypt_data(&cipher, wire, aligned_len);
+    if (aligned_len) {
+        aes128_decrypt(&cipher, last, BLOCK_LEN);
+    }
 
     // copy the decrypted header back into the wire
     wire_set_header(wire, &h);
 
     return true;
 }
+
+static bool decrypt_wire_aead(wire_t *wire, size_t len, const uint8_t *key)
+{
+    // Check the length from a copy of the header before committing to the full pass
+    header_t h = { 0 };
+    memcpy(&h, &wire->header, sizeof(header_t));
+    chacha20_xor(key, wire->auth.iv, 1, (uint8_t *)&h, sizeof(header_t));
+    if (!header_check_signature(&h, WIRE_SUITE_CHACHA20_POLY1305)) {
+        log_error("header signature invalid");
+        return false;
+    }
+
+    size_t wire_len = header_get_length(&h);
+    if (len != wire_len) {
+        log_error("wire length (%zu bytes) doesn't match received length (%zu bytes)", wire_len, len);
+        return false;
+    }
+
+    // The tag is checked as the data is decrypted, and the plaintext is wiped if it doesn't match
+    if (!chacha20_poly1305_decrypt(key, wire->auth.iv, wire->auth.iv, BLOCK_LEN,
+            (uint8_t *)&wire->header, wire_len - WIRE_OFFSET_MAGIC, wire->auth.mac_outer)) {
+        log_fatal("outer mac verification failure");
+        return false;
+    }
+    return true;
+}
+
+bool decrypt_wire(wire_t *wire, size_t len, const wire_key_t *key1, const wire_key_t *key2)
+{
+    if (key1->suite == WIRE_SUITE_COMPACT) {
+        return decrypt_wire_compact(wire, len, key1, key2);
+    }
+    if (len < sizeof(wire_t)) {
+        log_error("wire too short (%zu bytes)", len);
+        return false;
+    }
+
+    const wire_key_t *key = wire_select_key(wire, key1, key2);
+    if (!key) {
+        return false;
+    }
+
+    switch (key->suite) {
+        case WIRE_SUITE_CBC_CMAC:
+            return decrypt_wire_cbc(wire, len, key);
+        case WIRE_SUITE_CHACHA20_POLY1305:
+            return decrypt_wire_aead(wire, len, key->key);
+        default:
+            log_error("unknown wire suite %d", key->suite);
+            return false;
+    }
+}
+
+void wire_stream_init(wire_stream_t *ctx, wire_t *wire, size_t len, const wire_key_t *key1, const wire_key_t *key2)
+{
+    memset(ctx, 0, sizeof(*ctx));
+    ctx->wire = wire;
+    ctx->base = wire_get_sealed(wire, key1->suite);
+    ctx->len = len;
+    ctx->keys[0] = key1;
+    ctx->keys[1] = key2;
+}
+
+// A compact frame can be keyed as soon as its associated data is in
+static bool wire_stream_begin_compact(wire_stream_t *ctx)
+{
+    if (ctx->len < WIRE_COMPACT_OVERHEAD) {
+        log_error("compact frame too short (%zu bytes)", ctx->len);
+        return false;
+    }
+    const wire_compact_t *frame = (const wire_compact_t *)ctx->base;
+    ctx->key = wire_compact_select_key(frame, ctx->keys[0], ctx->keys[1]);
+    if (!ctx->key) {
+        return false;
+    }
+
+    uint8_t nonce[CHACHA20_NONCE_LEN];
+    wire_compact_nonce(ctx->key, frame, nonce);
+    chacha20_poly1305_init(&ctx->aead, ctx->key->key, nonce, ctx->base, WIRE_COMPACT_AAD_LEN);
+    ctx->processed = WIRE_COMPACT_AAD_LEN;
+    return true;
+}
+
+// Everything ahead of the data is in, so the key, header, and length can be checked
+// and the suite's MAC started before any of the data shows up
+static bool wire_stream_begin(wire_stream_t *ctx)
+{
+    wire_t *wire = ctx->wire;
+    if (ctx->len < sizeof(wire_t)) {
+        log_error("wire too short (%zu bytes)", ctx->len);
+        return false;
+    }
+
+    ctx->key = wire_select_key(wire, ctx->keys[0], ctx->keys[1]);
+    if (!ctx->key) {
+        return false;
+    }
+
+    const wire_suite_t suite = ctx->key->suite;
+    if (suite == WIRE_SUITE_CBC_CMAC) {
+        ctx->cipher = ctx->key->cipher;
+        memcpy(ctx->cipher.iv, wire->auth.iv, BLOCK_LEN);
+        ctx->header = wire_decrypt_header(&ctx->cipher, wire);
+    }
+    else {
+        memcpy(&ctx->header, &wire->header, sizeof(header_t));
+        chacha20_xor(ctx->key->key, wire->auth.iv, 1, (uint8_t *)&ctx->header, sizeof(header_t));
+        if (!header_check_signature(&ctx->header, suite)) {
+            log_error("header signature invalid");
+            return false;
+        }
+    }
+
+    const size_t wire_len = header_get_length(&ctx->header);
+    if (ctx->len != wire_len) {
+        log_error("wire length (%zu bytes) doesn't match received length (%zu bytes)", wire_len, ctx->len);
+        return false;
+    }
+
+    if (suite == WIRE_SUITE_CBC_CMAC) {
+        if (header_get_aligned_data_length(&ctx->header) % BLOCK_LEN) {
+            log_error("wire data length isn't block aligned");
+            return false;
+        }
+        aes128_cmac_stream_init(&ctx->cmac);
+        aes128_cmac_stream_update(&ctx->key->cmac, &ctx->cmac, wire->auth.mac_inner, WIRE_OFFSET_DATA - WIRE_OFFSET_MAC_INNER);
+    }
+    else {
+        chacha20_poly1305_init(&ctx->aead, ctx->key->key, wire->auth.iv, wire->auth.iv, BLOCK_LEN);
+        chacha20_poly1305_decrypt_update(&ctx->aead, (uint8_t *)&wire->header, sizeof(header_t));
+    }
+    ctx->processed = WIRE_OFFSET_DATA;
+    return true;
+}
+
+static bool wire_stream_final_compact(wire_stream_t *ctx)
+{
+    const size_t end = ctx->len - POLY1305_TAG_LEN;
+    bool ok = !ctx->failed && ctx->key && ctx->received == ctx->len;
+    ok = ok && chacha20_poly1305_decrypt_final(&ctx->aead, &ctx->base[end]);
+    if (ok) {
+        wire_compact_restore(ctx->wire, end - sizeof(wire_compact_t));
+    }
+    else {
+        if (ctx->processed > WIRE_COMPACT_AAD_LEN) {
+            memset(&ctx->base[WIRE_COMPACT_AAD_LEN], 0, ctx->processed - WIRE_COMPACT_AAD_LEN);
+        }
+        if (!ctx->failed && ctx->received == ctx->len) {
+            log_fatal("outer mac verification failure");
+        }
+        else if (!ctx->failed) {
+            log_error("wire ended after %zu of %zu bytes", ctx->received, ctx->len);
+        }
+    }
+    memset(ctx, 0, sizeof(*ctx));
+    return ok;
+}
+
+// `received` more bytes have been written to the wire buffer directly after those passed previously
+bool wire_stream_update(wire_stream_t *ctx, size_t received)
+{
+    if (ctx->failed) {
+        return false;
+    }
+    if (received > ctx->len - ctx->received) {
+        log_error("received more than the expected %zu wire bytes", ctx->len);
+        ctx->failed = true;
+        return false;
+    }
+    ctx->received += received;
+
+    const bool compact = ctx->keys[0]->suite == WIRE_SUITE_COMPACT;
+    if (!ctx->key) {
+        if (ctx->received < (compact ? (size_t)WIRE_COMPACT_AAD_LEN : sizeof(wire_t))) {
+            return true;
+        }
+        if (!(compact ? wire_stream_begin_compact(ctx) : wire_stream_begin(ctx))) {
+            ctx->failed = true;
+            return false;
+        }
+    }
+
+    uint8_t *data = &ctx->base[ctx->processed];
+    if (compact) {
+        // The tag at the end is compared rather than decrypted
+        const size_t end = MIN(ctx->received, ctx->len - POLY1305_TAG_LEN);
+        if (end > ctx->processed) {
+            chacha20_poly1305_decrypt_update(&ctx->aead, data, end - ctx->processed);
+            ctx->processed = end;
+        }
+    }
+    else if (ctx->key->suite == WIRE_SUITE_CBC_CMAC) {
+        // CBC only decrypts whole blocks, a partial block waits for the rest to arrive
+        const size_t n = ROUND_DOWN(ctx->received - ctx->processed, BLOCK_LEN);
+        aes128_cmac_stream_update(&ctx->key->cmac, &ctx->cmac, data, n);
+        aes128_decrypt(&ctx->cipher, data, n);
+        ctx->processed += n;
+    }
+    else {
+        const size_t n = ctx->received - ctx->processed;
+        chacha20_poly1305_decrypt_update(&ctx->aead, data, n);
+        ctx->processed += n;
+    }
+    return true;
+}
+
+bool wire_stream_final(wire_stream_t *ctx)
+{
+    wire_t *wire = ctx->wire;
+    if (ctx->keys[0]->suite == WIRE_SUITE_COMPACT) {
+        return wire_stream_final_compact(ctx);
+    }
+
+    bool ok = !ctx->failed && ctx->key && ctx->processed == ctx->len;
+    if (ok && ctx->key->suite == WIRE_SUITE_CBC_CMAC) {
+        uint8_t mac[BLOCK_LEN];
+        aes128_cmac_stream_final(&ctx->key->cmac, &ctx->cmac, mac);
+        ok = !memcmp(wire->auth.mac_outer, mac, BLOCK_LEN);
+        if (ok) {
+            wire_set_header(wire, &ctx->header);
+        }
+    }
+    else if (ok) {
+        ok = chacha20_poly1305_decrypt_final(&ctx->aead, wire->auth.mac_outer);
+    }
+
+    // Whatever was decrypted before the MAC failed never leaves here
+    if (!ok) {
+        if (ctx->processed > WIRE_OFFSET_MAGIC) {
+            memset(&wire->header, 0, ctx->processed - WIRE_OFFSET_MAGIC);
+        }
+        if (!ctx->failed && ctx->processed == ctx->len) {
+            log_fatal("outer mac verification failure");
+        }
+        else if (!ctx->failed) {
+            log_error("wire ended after %zu of %zu bytes", ctx->received, ctx->len);
+        }
+    }
+    memset(ctx, 0, sizeof(*ctx));
+    return ok;
+}
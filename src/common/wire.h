@@ -12,6 +12,7 @@
 #pragma once
 
 #include "aes128.h"
+#include "chacha20-poly1305.h"
 #include "sha256.h"
 #include "xplatform.h"
 #include "xutils.h"
@@ -26,21 +27,50 @@ typedef enum wire_type_t {
     TYPE_FILE,
     TYPE_CTRL,
     TYPE_STAT,
-    TYPE_SESSION_KEY
+    TYPE_SESSION_KEY,
+    TYPE_FILE_CHUNK,
+    TYPE_BATCH
 } wire_type_t;
 
+// Cipher suites negotiated during the two-party handshake, recorded in the header signature
+typedef enum wire_suite_t {
+    WIRE_SUITE_CBC_CMAC,          // "-wire-": AES-128-CBC, then CMAC over the header and the entire wire
+    WIRE_SUITE_CHACHA20_POLY1305, // "-aead-": RFC 8439 AEAD, a single pass over the data
+    WIRE_SUITE_COMPACT,           // v2 framing: ChaCha20-Poly1305 in compact frames, see wire_compact_t
+    WIRE_SUITE_COUNT,
+} wire_suite_t;
+
+enum WireSuites {
+    WIRE_SUITES_SUPPORTED = (1 << WIRE_SUITE_CBC_CMAC) | (1 << WIRE_SUITE_CHACHA20_POLY1305) | (1 << WIRE_SUITE_COMPACT),
+};
+
+#define WIRE_SUITE_DEFAULT WIRE_SUITE_COMPACT
+
+// Optional session features, negotiated alongside the suite in the high bits of the same byte
+enum WireFeatures {
+    WIRE_FEATURE_COMPRESS = 1 << 7, // members compress text before encrypting it, see wire_compress()
+    WIRE_FEATURES_MASK = 0xf0,
+    WIRE_FEATURES_SUPPORTED = WIRE_FEATURE_COMPRESS,
+};
+
+// Which of a receiver's keys a wire was sealed with. Compact frames carry it in their flags
+// in place of the inner MAC the other suites use to pick between the two
+typedef enum wire_key_role_t {
+    WIRE_KEY_SESSION, // group session key, and the handshake key before it
+    WIRE_KEY_CTRL,    // daemon control key
+} wire_key_role_t;
 
 typedef struct wire_auth_t {
     uint8_t mac_outer[16]; // message authentication code for an entire wire
     uint8_t mac_inner[16];  // message authentication code for the wire length
-    uint8_t iv[16];         // initialization vector for AES context
+    uint8_t iv[16];         // initialization vector for AES context, or the AEAD nonce (first 12 bytes)
 } wire_auth_t;
 
 
 typedef struct header_t {
     uint8_t signature[6]; // 72 65 77 69 72 65
     uint8_t wire_len[8];   // length of entire wire (auth + header + data + padding)
-    uint8_t alignment; // padding bytes added to data to align with block size
+    uint8_t alignment; // padding bytes added to data to align with block size, and WireFlags
     uint8_t type;     // type of wire, see enum wire_type
 } header_t;
 
@@ -50,6 +80,28 @@ typedef struct wire_t {
     uint8_t data[];     // wire data
 } __attribute__((packed)) wire_t;
 
+// Fixed part of a compact frame. Rather than the auth section and header, a compact frame
+// sends a varint of its length, this, the data without padding, and a single Poly1305 tag.
+// It's laid out in place over the end of the wire header, with `type` landing on
+// `header.type`, so the data never moves. Only `type` and the data are encrypted, `sequence`
+// and `flags` are authenticated as associated data
+typedef struct wire_compact_t {
+    uint8_t sequence[8]; // explicit nonce, XOR'd into the key's implicit IV
+    uint8_t flags;       // see enum WireCompactFlags
+    uint8_t type;
+} __attribute__((packed)) wire_compact_t;
+
+// Flags share the header's alignment byte, where a compact frame keeps its own flags
+enum WireFlags {
+    WIRE_ALIGNMENT_MASK = 0x0f,
+    WIRE_FLAG_COMPRESSED = 1 << 7, // data is an LZ4 block, see wire_compress()
+};
+
+enum WireCompactFlags {
+    WIRE_COMPACT_CTRL_KEY = 1 << 0, // sealed with the daemon control key
+    WIRE_COMPACT_WIRE_FLAGS = WIRE_FLAG_COMPRESSED, // carried over from the header
+};
+
 
 enum cfg {
     KEY_LEN = 2 * AES_KEY_LEN,
@@ -58,6 +110,18 @@ enum cfg {
     RECV_MAX_BYTES = sizeof(wire_t) + DATA_LEN_MAX,
 };
 
+enum WireCompress {
+    WIRE_COMPRESS_MIN = 64,              // shorter data isn't worth compressing
+    WIRE_DECOMPRESSED_MAX = (1 << 21) - 1, // a compressed wire expands to no more than a compact frame could carry
+};
+
+// Wires of TYPE_FILE are decrypted on up to PARALLEL_DECRYPT_THREADS_MAX threads,
+// with every thread getting at least PARALLEL_DECRYPT_SEGMENT_MIN bytes
+enum ParallelDecrypt {
+    PARALLEL_DECRYPT_SEGMENT_MIN = 1 << 18,
+    PARALLEL_DECRYPT_THREADS_MAX = 8,
+};
+
 enum TypeCtrl {
     CTRL_KEY_OFFSET = 16,
     CTRL_DATA_LEN = CTRL_KEY_OFFSET + KEY_LEN
@@ -65,6 +129,10 @@ enum TypeCtrl {
 
 enum SectionLengths {
     BASE_AUTH_LEN = sizeof(wire_t) - sizeof(header_t),
+    WIRE_HEADROOM = 14, // sizeof(cable_header_t), reserved in front of every wire so it's sent from where it was built
+    WIRE_TAILROOM = POLY1305_TAG_LEN, // reserved after the data for a compact frame's tag
+    WIRE_COMPACT_AAD_LEN = offsetof(wire_compact_t, type),
+    WIRE_COMPACT_OVERHEAD = sizeof(wire_compact_t) + POLY1305_TAG_LEN, // compact frame bytes besides the data and length
 };
 
 enum KeyOffsets {
@@ -81,8 +149,39 @@ enum SectionOffsets {
     WIRE_OFFSET_ALIGNMENT = offsetof(wire_t, header.alignment),
     WIRE_OFFSET_TYPE      = offsetof(wire_t, header.type),
     WIRE_OFFSET_DATA      = offsetof(wire_t, data),
+    WIRE_OFFSET_COMPACT   = offsetof(wire_t, data) - sizeof(wire_compact_t),
 };
 
+_Static_assert(WIRE_OFFSET_COMPACT + offsetof(wire_compact_t, type) == WIRE_OFFSET_TYPE, "compact frame type must overlay header type");
+
+// Key material for one wire key, expanded once whenever the key changes rather than on every wire
+typedef struct wire_key_t {
+    uint8_t key[KEY_LEN]; // raw key, used directly by the AEAD suites
+    wire_suite_t suite;
+    wire_key_role_t role;
+    uint8_t iv[CHACHA20_NONCE_LEN]; // implicit part of every compact frame nonce, derived from `key`
+    aes128_t cipher;      // expanded cipher schedules, `iv` is set per wire
+    aes128_t cmac;        // expanded CMAC schedule and subkeys
+} wire_key_t;
+
+// Verifies and decrypts a wire in-place while it is still arriving. Bytes are handed over
+// with `wire_stream_update()` as they land in the wire buffer, and nothing in the buffer
+// may be trusted until `wire_stream_final()` succeeds
+typedef struct wire_stream_t {
+    wire_t *wire;
+    uint8_t *base;                   // where arriving bytes land: `wire` itself, or its compact frame
+    size_t len;                      // expected length of the entire wire, or the compact frame
+    size_t received;                 // bytes of `base` that have arrived
+    size_t processed;                // bytes of `base` authenticated and decrypted so far
+    const wire_key_t *keys[2];
+    const wire_key_t *key;           // whichever of `keys` produced the inner MAC, once the header is in
+    header_t header;                 // decrypted header
+    aes128_t cipher;
+    aes128_cmac_stream_t cmac;
+    chacha20_poly1305_t aead;
+    bool failed;
+} wire_stream_t;
+
 typedef enum decrypt_status_t {
     WIRE_OK,
     WIRE_CMAC_ERROR,
@@ -92,11 +191,36 @@ typedef enum decrypt_status_t {
 
 
 
-wire_t *alloc_wire(void);
+// Allocate a `type` wire with room for `len` bytes of zeroed data, to be filled in place,
+// WIRE_HEADROOM bytes in front of it for the cable header, and WIRE_TAILROOM bytes behind
+// it for a compact frame's tag. Free with `free_wire()`
+wire_t *alloc_wire(wire_type_t type, size_t len);
+
+// `alloc_wire()` and copy in `*len` bytes of `data`, `*len` is set to the total wire length
 wire_t *init_wire(wire_type_t type, const void *data, size_t *len);
 
-bool encrypt_wire(wire_t *wire, const uint8_t *key);
-bool decrypt_wire(wire_t *wire, size_t len, const uint8_t *key1, const uint8_t *key2);
+// Free a wire from `alloc_wire()` or `init_wire()`, always returns NULL
+void *free_wire(wire_t *wire);
+
+void wire_key_init(wire_key_t *ctx, const uint8_t *key, wire_suite_t suite, wire_key_role_t role);
+void wire_key_wipe(wire_key_t *ctx);
+
+// Under WIRE_SUITE_COMPACT a wire is encrypted into a compact frame starting at
+// `wire_get_sealed()`, and `decrypt_wire()` expects one there, `len` bytes long
+bool encrypt_wire(wire_t *wire, const wire_key_t *key);
+bool decrypt_wire(wire_t *wire, size_t len, const wire_key_t *key1, const wire_key_t *key2);
+
+// Bytes `encrypt_wire()` will leave to send for `wire` under `suite`, and where they start.
+// The length has to be taken before encrypting, the header is unreadable afterwards
+size_t wire_get_sealed_length(wire_t *wire, wire_suite_t suite);
+uint8_t *wire_get_sealed(wire_t *wire, wire_suite_t suite);
+
+void wire_stream_init(wire_stream_t *ctx, wire_t *wire, size_t len, const wire_key_t *key1, const wire_key_t *key2);
+bool wire_stream_update(wire_stream_t *ctx, size_t received);
+bool wire_stream_final(wire_stream_t *ctx);
+
+const char *wire_suite_name(wire_suite_t suite);
+bool wire_suite_from_name(const char *name, wire_suite_t *suite);
 
 wire_type_t wire_get_type(const wire_t *ctx);
 
@@ -107,6 +231,16 @@ void wire_set_length(wire_t *wire, size_t len);
 
 size_t get_aligned_len(size_t len);
 
+uint8_t wire_get_flags(const wire_t *wire);
+
+// Compress the data of `wire` into a new wire flagged WIRE_FLAG_COMPRESSED, as
+// [original length (varint) | LZ4 block]. NULL if that wouldn't come out any shorter,
+// in which case `wire` goes out as it is
+wire_t *wire_compress(wire_t *wire);
+
+// Expand a WIRE_FLAG_COMPRESSED wire into a new wire, NULL if it's malformed
+wire_t *wire_decompress(wire_t *wire);
+
 void wire_set_header(wire_t *wire, header_t *hdr);
 
 
@@ -25,6 +25,29 @@ ssize_t xsend(sock_t socket, const void *data, size_t len, int flags)
 #endif
 }
 
+ssize_t xsendv(sock_t socket, const xiovec_t *iov, size_t count)
+{
+    count = MIN(count, (size_t)XIOV_MAX);
+#if __unix__ || __APPLE__
+    struct iovec bufs[XIOV_MAX];
+    for (size_t i = 0; i < count; i++) {
+        bufs[i] = (struct iovec) { .iov_base = (void *)iov[i].base, .iov_len = iov[i].len };
+    }
+    struct msghdr msg = { .msg_iov = bufs, .msg_iovlen = count };
+    return sendmsg(socket, &msg, 0);
+#elif _WIN32
+    WSABUF bufs[XIOV_MAX];
+    for (size_t i = 0; i < count; i++) {
+        bufs[i] = (WSABUF) { .len = (ULONG)MIN(iov[i].len, (size_t)ULONG_MAX), .buf = (CHAR *)iov[i].base };
+    }
+    DWORD sent = 0;
+    if (WSASend(socket, bufs, (DWORD)count, &sent, 0, NULL, NULL) == SOCKET_ERROR) {
+        return -1;
+    }
+    return (ssize_t)sent;
+#endif
+}
+
 ssize_t xrecv(sock_t socket, void *data, size_t len, int flags)
 {
 #if __unix__ || __APPLE__
@@ -34,6 +57,15 @@ ssize_t xrecv(sock_t socket, void *data, size_t len, int flags)
 #endif
 }
 
+int xshutdown(sock_t socket)
+{
+#if __unix__ || __APPLE__
+    return shutdown(socket, SHUT_RDWR);
+#elif _WIN32
+    return shutdown(socket, SD_BOTH);
+#endif
+}
+
 int xclose(sock_t socket)
 {
 #if __unix__ || __APPLE__
@@ -115,6 +147,18 @@ int xsetsockopt(sock_t socket, int level, int optname, const void *optval, sockl
 #endif
 }
 
+// Bound how long a receive on `socket` blocks, 0 waits forever
+int xsetrecvtimeout(sock_t socket, uint32_t ms)
+{
+#if __unix__ || __APPLE__
+    const struct timeval timeout = { .tv_sec = ms / 1000, .tv_usec = (ms % 1000) * 1000 };
+    return setsockopt(socket, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+#elif _WIN32
+    const DWORD timeout = ms;
+    return setsockopt(socket, SOL_SOCKET, SO_RCVTIMEO, (const char *)&timeout, sizeof(timeout)) ? -1 : 0;
+#endif
+}
+
 int xgetifaddrs(const char *prefix, const char *suffix)
 {
 #if __unix__ || __APPLE__
@@ -247,18 +291,47 @@ size_t xfd_init_count(sock_t fd)
 
 ssize_t xgetrandom(void *dst, size_t len)
 {
-#if __unix__ || __APPLE__
-    FILE *random = fopen("/dev/urandom", "rb");
-    if (!random) {
-        return -1;
+    uint8_t *bytes = (uint8_t *)dst;
+#if __linux__
+    for (size_t filled = 0; filled < len;) {
+        ssize_t ret = getrandom(&bytes[filled], len - filled, 0);
+        if (ret < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        filled += (size_t)ret;
     }
-    if (!fread(dst, len, 1, random)) {
+    return len;
+#elif __APPLE__
+    // getentropy() is limited to 256 bytes per call
+    for (size_t filled = 0; filled < len; filled += 256) {
+        if (getentropy(&bytes[filled], MIN(len - filled, (size_t)256))) {
+            return -1;
+        }
+    }
+    return len;
+#elif __unix__
+    int random = open("/dev/urandom", O_RDONLY);
+    if (random < 0) {
         return -1;
     }
-    fclose(random);
+    for (size_t filled = 0; filled < len;) {
+        ssize_t ret = read(random, &bytes[filled], len - filled);
+        if (ret <= 0) {
+            if (ret < 0 && errno == EINTR) {
+                continue;
+            }
+            close(random);
+            return -1;
+        }
+        filled += (size_t)ret;
+    }
+    close(random);
     return len;
 #elif _WIN32
-    return !RtlGenRandom(dst, len) ? -1 : (ssize_t)len;
+    return !RtlGenRandom(bytes, len) ? -1 : (ssize_t)len;
 #endif
 }
 
@@ -338,18 +411,30 @@ bool xchmod(const char *filename, mode_t mode)
 
 /**
  * @section malloc / calloc wrapper to lessen Windows runtime dependency
+ *
+ * Blocks up to 4 KiB are recycled through a per-thread cache of power-of-two size classes
+ * instead of going back to the heap. Every block is wiped as it's freed, so cached blocks
+ * come back already zeroed for `xcalloc()`. Building with -DXALLOC_DEBUG skips the cache and
+ * tracks every live allocation instead, aborting on double frees and reporting leaks at exit
  */
 
-void *xmalloc(size_t len)
+enum XallocCache {
+    XALLOC_CLASS_MIN_SHIFT = 6,  // 64 bytes: usernames, paths, key material
+    XALLOC_CLASS_MAX_SHIFT = 12, // 4 KiB: chat, stat, and control wires
+    XALLOC_CLASSES = XALLOC_CLASS_MAX_SHIFT - XALLOC_CLASS_MIN_SHIFT + 1,
+    XALLOC_CACHE_DEPTH = 8,      // blocks kept per class per thread
+};
+
+static void *xheap_alloc(size_t len, bool zero)
 {
 #if __unix__ || __APPLE__
-    void *mem = malloc(len);
+    void *mem = zero ? calloc(1, len) : malloc(len);
     if (!mem) {
         exit(EXIT_FAILURE);
     }
     return mem;
 #elif _WIN32
-    void *mem = HeapAlloc(GetProcessHeap(), 0, len);
+    void *mem = HeapAlloc(GetProcessHeap(), zero ? HEAP_ZERO_MEMORY : 0, len);
     if (!mem) {
         ExitThread(EXIT_FAILURE);
     }
@@ -357,55 +442,288 @@ void *xmalloc(size_t len)
 #endif
 }
 
-void *xcalloc(size_t len)
+static size_t xheap_size(void *mem)
 {
 #if __unix__ || __APPLE__
-    void *mem = xmalloc(len);
-    return memset(mem, 0, len);
+    return alloc_size(mem);
 #elif _WIN32
-    void *mem = HeapAlloc(GetProcessHeap(), HEAP_ZERO_MEMORY, len);
-    if (!mem) {
-        ExitThread(EXIT_FAILURE);
+    return HeapSize(GetProcessHeap(), 0, mem);
+#endif
+}
+
+static void xheap_free(void *mem)
+{
+#if __unix__ || __APPLE__
+    free(mem);
+#elif _WIN32
+    HeapFree(GetProcessHeap(), 0, mem);
+#endif
+}
+
+#if XALLOC_DEBUG
+
+typedef struct xalloc_record_t {
+    void *mem;
+    size_t len;
+} xalloc_record_t;
+
+// Open-addressed set of live allocations, kept on the raw heap so tracking never recurses
+static struct xalloc_tracker_t {
+    pthread_mutex_t lock;
+    xalloc_record_t *records;
+    size_t capacity; // power of two
+    size_t used;     // live records plus tombstones
+    size_t live;
+    size_t bytes;
+} tracker = { .lock = PTHREAD_MUTEX_INITIALIZER };
+
+#define XALLOC_TOMBSTONE ((void *)1)
+
+static size_t xalloc_slot(const void *mem, size_t capacity)
+{
+    return (size_t)(((uintptr_t)mem >> 4) * 0x9e3779b97f4a7c15ull) & (capacity - 1);
+}
+
+static void xalloc_report(void)
+{
+    pthread_mutex_lock(&tracker.lock);
+    if (tracker.live) {
+        log_warn("xalloc: %zu allocations (%zu bytes) still live at exit", tracker.live, tracker.bytes);
+        size_t shown = 0;
+        for (size_t i = 0; i < tracker.capacity && shown < 16; i++) {
+            void *mem = tracker.records[i].mem;
+            if (mem && mem != XALLOC_TOMBSTONE) {
+                log_warn("xalloc:   %p (%zu bytes)", mem, tracker.records[i].len);
+                shown++;
+            }
+        }
+    }
+    pthread_mutex_unlock(&tracker.lock);
+}
+
+static void xalloc_report_init(void)
+{
+    atexit(xalloc_report);
+}
+
+static void xalloc_insert(void *mem, size_t len)
+{
+    for (size_t i = xalloc_slot(mem, tracker.capacity);; i = (i + 1) & (tracker.capacity - 1)) {
+        if (!tracker.records[i].mem || tracker.records[i].mem == XALLOC_TOMBSTONE) {
+            tracker.used += !tracker.records[i].mem;
+            tracker.records[i] = (xalloc_record_t) { .mem = mem, .len = len };
+            return;
+        }
+    }
+}
+
+static void xalloc_track(void *mem, size_t len)
+{
+    static pthread_once_t report_once = PTHREAD_ONCE_INIT;
+    (void)pthread_once(&report_once, xalloc_report_init);
+
+    pthread_mutex_lock(&tracker.lock);
+    if (2 * (tracker.used + 1) > tracker.capacity) {
+        xalloc_record_t *old = tracker.records;
+        const size_t old_capacity = tracker.capacity;
+        tracker.capacity = MAX(2 * tracker.live, (size_t)1024);
+        while (2 * (tracker.live + 1) > tracker.capacity) {
+            tracker.capacity *= 2;
+        }
+        tracker.records = xheap_alloc(tracker.capacity * sizeof(xalloc_record_t), true);
+        tracker.used = 0;
+        for (size_t i = 0; i < old_capacity; i++) {
+            if (old[i].mem && old[i].mem != XALLOC_TOMBSTONE) {
+                xalloc_insert(old[i].mem, old[i].len);
+            }
+        }
+        if (old) {
+            xheap_free(old);
+        }
+    }
+    xalloc_insert(mem, len);
+    tracker.live++;
+    tracker.bytes += len;
+    pthread_mutex_unlock(&tracker.lock);
+}
+
+// Forget `mem`, which must be live: anything else is a double free or a foreign pointer
+static void xalloc_untrack(void *mem)
+{
+    pthread_mutex_lock(&tracker.lock);
+    if (tracker.capacity) {
+        for (size_t i = xalloc_slot(mem, tracker.capacity); tracker.records[i].mem; i = (i + 1) & (tracker.capacity - 1)) {
+            if (tracker.records[i].mem == mem) {
+                tracker.live--;
+                tracker.bytes -= tracker.records[i].len;
+                tracker.records[i] = (xalloc_record_t) { .mem = XALLOC_TOMBSTONE };
+                pthread_mutex_unlock(&tracker.lock);
+                return;
+            }
+        }
     }
+    pthread_mutex_unlock(&tracker.lock);
+    log_fatal("xalloc: %p is not a live allocation (double free?)", mem);
+    abort();
+}
+
+#else
+
+typedef struct xalloc_cache_t {
+    void *blocks[XALLOC_CLASSES][XALLOC_CACHE_DEPTH];
+    size_t count[XALLOC_CLASSES];
+    bool registered; // drained when the thread exits
+} xalloc_cache_t;
+
+static _Thread_local xalloc_cache_t xalloc_cache;
+static pthread_key_t xalloc_cache_key;
+
+static void xalloc_cache_drain(void *arg)
+{
+    xalloc_cache_t *cache = arg;
+    for (size_t class = 0; class < XALLOC_CLASSES; class++) {
+        while (cache->count[class]) {
+            xheap_free(cache->blocks[class][--cache->count[class]]);
+        }
+    }
+}
+
+static void xalloc_cache_key_init(void)
+{
+    (void)pthread_key_create(&xalloc_cache_key, xalloc_cache_drain);
+}
+
+// Smallest class that holds `len` bytes, XALLOC_CLASSES if none does
+static size_t xalloc_class_fit(size_t len)
+{
+    size_t shift = XALLOC_CLASS_MIN_SHIFT;
+    while (shift <= XALLOC_CLASS_MAX_SHIFT && ((size_t)1 << shift) < len) {
+        shift++;
+    }
+    return shift - XALLOC_CLASS_MIN_SHIFT;
+}
+
+// Largest class a block of `size` usable bytes can stand in for, XALLOC_CLASSES if none
+static size_t xalloc_class_floor(size_t size)
+{
+    if (size < ((size_t)1 << XALLOC_CLASS_MIN_SHIFT) || size >= ((size_t)2 << XALLOC_CLASS_MAX_SHIFT)) {
+        return XALLOC_CLASSES;
+    }
+    size_t shift = XALLOC_CLASS_MIN_SHIFT;
+    while (shift < XALLOC_CLASS_MAX_SHIFT && ((size_t)2 << shift) <= size) {
+        shift++;
+    }
+    return shift - XALLOC_CLASS_MIN_SHIFT;
+}
+
+// Small requests are rounded up to their class so the block can be reused for any of its size
+static void *xalloc_cached(size_t len, bool zero)
+{
+    const size_t class = xalloc_class_fit(len);
+    if (class < XALLOC_CLASSES) {
+        xalloc_cache_t *cache = &xalloc_cache;
+        if (cache->count[class]) {
+            return cache->blocks[class][--cache->count[class]];
+        }
+        len = (size_t)1 << (class + XALLOC_CLASS_MIN_SHIFT);
+    }
+    return xheap_alloc(len, zero);
+}
+
+// Keep a wiped block for reuse, false if it has to go back to the heap
+static bool xalloc_recycle(void *mem, size_t size)
+{
+    const size_t class = xalloc_class_floor(size);
+    xalloc_cache_t *cache = &xalloc_cache;
+    if (class == XALLOC_CLASSES || cache->count[class] == XALLOC_CACHE_DEPTH) {
+        return false;
+    }
+    if (!cache->registered) {
+        static pthread_once_t key_once = PTHREAD_ONCE_INIT;
+        (void)pthread_once(&key_once, xalloc_cache_key_init);
+        (void)pthread_setspecific(xalloc_cache_key, cache);
+        cache->registered = true;
+    }
+    cache->blocks[class][cache->count[class]++] = mem;
+    return true;
+}
+
+#endif
+
+void *xmalloc(size_t len)
+{
+#if XALLOC_DEBUG
+    void *mem = xheap_alloc(len, false);
+    xalloc_track(mem, len);
     return mem;
+#else
+    return xalloc_cached(len, false);
+#endif
+}
+
+void *xcalloc(size_t len)
+{
+#if XALLOC_DEBUG
+    void *mem = xheap_alloc(len, true);
+    xalloc_track(mem, len);
+    return mem;
+#else
+    return xalloc_cached(len, true);
 #endif
 }
 
 void *xrealloc(void *mem, size_t len)
 {
+#if XALLOC_DEBUG
+    if (mem) {
+        xalloc_untrack(mem);
+    }
+#endif
 #if __unix__ || __APPLE__
     void *_mem = realloc(mem, len);
-    if (!_mem) {
-        xfree(mem);
-        exit(EXIT_FAILURE);
-    }
-    return _mem;
 #elif _WIN32
     void *_mem = (!mem) ? HeapAlloc(GetProcessHeap(), 0, len) : HeapReAlloc(GetProcessHeap(), 0, mem, len);
+#endif
     if (!_mem) {
-        xfree(mem);
+        if (mem) {
+            memset(mem, 0, xheap_size(mem));
+            xheap_free(mem);
+        }
+#if __unix__ || __APPLE__
+        exit(EXIT_FAILURE);
+#elif _WIN32
         ExitThread(EXIT_FAILURE);
+#endif
     }
-    return _mem;
+#if XALLOC_DEBUG
+    xalloc_track(_mem, len);
 #endif
+    return _mem;
 }
 
 void *xfree(void *mem)
 {
-#if __unix__ || __APPLE__
-    if (mem) {
-        memset(mem, 0, alloc_size(mem));
-        free(mem);
+    if (!mem) {
+        return NULL;
     }
-    return NULL;
+#if XALLOC_DEBUG
+    xalloc_untrack(mem);
+#endif
+
+    const size_t size = xheap_size(mem);
+#if __unix__ || __APPLE__
+    memset(mem, 0, size);
 #elif _WIN32
-    if (mem) {
-        const size_t sz = HeapSize(GetProcessHeap(), 0, mem);
-        SecureZeroMemory(mem, sz);
-        HeapFree(GetProcessHeap(), 0, mem);
+    SecureZeroMemory(mem, size);
+#endif
+
+#if !XALLOC_DEBUG
+    if (xalloc_recycle(mem, size)) {
+        return NULL;
     }
-    return NULL;
 #endif
+    xheap_free(mem);
+    return NULL;
 }
 
 /**
@@ -544,6 +862,34 @@ size_t xwinsize(void)
 #endif
 }
 
+// Number of online processors, at least 1
+size_t xgetncpu(void)
+{
+#if __unix__ || __APPLE__
+    long count = sysconf(_SC_NPROCESSORS_ONLN);
+    return count > 0 ? (size_t)count : 1;
+#elif _WIN32
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return info.dwNumberOfProcessors ? info.dwNumberOfProcessors : 1;
+#endif
+}
+
+uint64_t xclock_ns(void)
+{
+#if __unix__ || __APPLE__
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+#elif _WIN32
+    LARGE_INTEGER freq, count;
+    QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&count);
+    return (uint64_t)(count.QuadPart / freq.QuadPart) * 1000000000ull +
+        (uint64_t)(count.QuadPart % freq.QuadPart) * 1000000000ull / (uint64_t)freq.QuadPart;
+#endif
+}
+
 int xtcsetattr(console_t *orig, enum xconsole_mode mode)
 {
 #if __unix__ || __APPLE__
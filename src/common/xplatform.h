@@ -11,6 +11,7 @@
 
 #pragma once
 
+#include <errno.h>
 #include <fcntl.h>
 #include <inttypes.h>
 #include <limits.h>
@@ -26,6 +27,7 @@
 #include <string.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <time.h>
 #include <assert.h>
 
 #if __unix__ || __APPLE__
@@ -40,8 +42,13 @@
     #include <dirent.h>
     #include <termios.h>
     #include <sys/time.h>
+    #include <sys/uio.h>
     #include <poll.h>
 
+    #if __linux__ || __APPLE__
+        #include <sys/random.h>
+    #endif
+
     #if __APPLE__
         #include <malloc/malloc.h>
         #define alloc_size(mem) malloc_size(mem)
@@ -95,6 +102,14 @@ typedef uint64_t bitfield;
     #define ROUND_UP(n, d) ROUND_DOWN((n) + (d) - 1, (d))
 #endif
 
+#ifndef MIN
+    #define MIN(a, b) ((a) < (b) ? (a) : (b))
+#endif
+
+#ifndef MAX
+    #define MAX(a, b) ((a) > (b) ? (a) : (b))
+#endif
+
 #define STR(a)  XSTR(a)
 #define XSTR(a) #a
 
@@ -105,7 +120,8 @@ typedef uint64_t bitfield;
 #define pointer_diff(first, second) (ptrdiff_t)((uint8_t *)(first) - (uint8_t *)(second))
 
 /**
- * @brief Platform-specific malloc(3)
+ * @brief Platform-specific malloc(3), requests up to 4 KiB are served from the calling
+ * thread's cache of freed blocks before the heap
  *
  * @param len bytes to be allocated
  * @return pointer to allocated memory
@@ -130,7 +146,8 @@ void *xcalloc(size_t len);
 void *xrealloc(void *mem, size_t len);
 
 /**
- * @brief Frees allocations created via xmalloc, xcalloc, or xrealloc
+ * @brief Wipes and frees allocations created via xmalloc, xcalloc, or xrealloc. Blocks up
+ * to 4 KiB are kept in the calling thread's cache for reuse rather than returned to the heap
  *
  * @param[inout] mem pointer to allocation, set NULL after freeing
  * @return returns NULL to allow for return chaining
@@ -142,6 +159,16 @@ bool xsocket(sock_t *xsocket, int domain, int type, int protocol);
 int xaccept(sock_t *connection_socket, sock_t listening_socket, struct sockaddr *address, socklen_t *len);
 
 ssize_t xsend(sock_t socket, const void *data, size_t len, int flags);
+
+// One piece of a gathered send, becomes a `struct iovec` or a `WSABUF`
+typedef struct xiovec_t {
+    const void *base;
+    size_t len;
+} xiovec_t;
+
+enum { XIOV_MAX = 16 }; // pieces handed to a single `xsendv()`, any beyond are left for the next call
+
+ssize_t xsendv(sock_t socket, const xiovec_t *iov, size_t count);
 ssize_t xrecv(sock_t socket, void *data, size_t len, int flags);
 
 size_t xfd_count(sock_t fd, size_t count);
@@ -154,6 +181,8 @@ int xgetpeername(sock_t socket, struct sockaddr *address, socklen_t *len);
 bool xgetpeeraddr(sock_t socket, char *address, in_port_t *port);
 
 int xsetsockopt(sock_t socket, int level, int optname, const void *optval, socklen_t optlen);
+int xsetrecvtimeout(sock_t socket, uint32_t ms);
+int xshutdown(sock_t socket);
 int xclose(sock_t socket);
 
 int xgetifaddrs(const char *prefix, const char *suffix);
@@ -172,6 +201,8 @@ int xmkdir(const char *path, mode_t mode);
 char *xgethome(void);
 
 size_t xwinsize(void);
+size_t xgetncpu(void);
+uint64_t xclock_ns(void);
 ssize_t xwrite(int fd, const void *data, size_t len);
 char xgetch(void);
 size_t xgetcp(uint8_t *c);
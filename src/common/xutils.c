@@ -124,6 +124,35 @@ bool xsendall(sock_t socket, const void *data, size_t len)
     return true;
 }
 
+bool xsendallv(sock_t socket, xiovec_t *iov, size_t count)
+{
+    for (;;) {
+        // A partial send can stop anywhere, including part way through a piece
+        while (count && !iov->len) {
+            iov++;
+            count--;
+        }
+        if (!count) {
+            return true;
+        }
+
+        ssize_t bytes_sent = xsendv(socket, iov, count);
+        if (bytes_sent < 0) {
+            return false;
+        }
+        for (size_t sent = (size_t)bytes_sent; sent;) {
+            const size_t n = MIN(sent, iov->len);
+            iov->base = (const uint8_t *)iov->base + n;
+            iov->len -= n;
+            sent -= n;
+            if (!iov->len) {
+                iov++;
+                count--;
+            }
+        }
+    }
+}
+
 bool xrecvall(sock_t socket, void *data, size_t len)
 {
     uint8_t *s = data;
@@ -131,6 +160,7 @@ bool xrecvall(sock_t socket, void *data, size_t len)
         ssize_t bytes_recv = xrecv(socket, &s[i], len - i, 0);
         switch (bytes_recv) {
             case -1:
+            case 0: // peer closed before `len` bytes arrived
                 return false;
             default:
                 i += bytes_recv;
@@ -110,6 +110,16 @@ bool xgetpublicip(char *ip);
  */
 bool xsendall(sock_t socket, const void *data, size_t len);
 
+/**
+ * @brief Send every piece of iov, in order, across as many xsendv() calls as required
+ *
+ * @param sockfd File descriptor of the sending socket
+ * @param iov Pieces to be sent, advanced past whatever has gone out
+ * @param count Number of pieces
+ * @return false on failure
+ */
+bool xsendallv(sock_t socket, xiovec_t *iov, size_t count);
+
 /**
  * @brief Receive len-bytes into data, blocking until full
  *
@@ -0,0 +1,485 @@
+/**
+ * @file aes128-ct.c
+ * @author Jason Conway (jpc@jasonconway.dev)
+ * @brief Constant-time bitsliced AES-128, eight blocks at a time
+ * @ref https://nvlpubs.nist.gov/nistpubs/fips/nist.fips.197.pdf
+ * @ref https://eprint.iacr.org/2009/191.pdf
+ * @ref https://eprint.iacr.org/2009/129.pdf
+ * @ref https://bearssl.org/constanttime.html#aes
+ * @version 0.9.4
+ * @date 2025-01-12
+ *
+ * @copyright Copyright (c) 2025 Jason Conway. All rights reserved.
+ *
+ * Four blocks are spread across eight 64-bit words such that word `i` holds bit `i` of
+ * every byte (ct64 layout), and the GCC vector type below carries two such groups side by side.
+ * SubBytes is the Boyar-Peralta circuit and every other step is shifts, masks and XORs,
+ * so nothing depends on secret data in terms of memory access or branching
+ */
+
+#include "aes128-ct.h"
+#include "aes128.h"
+
+// Two independent groups of four blocks, SSE2 / NEON registers where available
+typedef uint64_t slice_t __attribute__((vector_size(16)));
+
+static inline uint32_t load32_le(const uint8_t *src)
+{
+    return (uint32_t)src[0] | (uint32_t)src[1] << 8 | (uint32_t)src[2] << 16 | (uint32_t)src[3] << 24;
+}
+
+static inline void store32_le(uint8_t *dst, uint32_t w)
+{
+    dst[0] = (uint8_t)w;
+    dst[1] = (uint8_t)(w >> 8);
+    dst[2] = (uint8_t)(w >> 16);
+    dst[3] = (uint8_t)(w >> 24);
+}
+
+// Boyar-Peralta SubBytes, 113 gates with x0 the most-significant bit
+static void sub_bytes(slice_t *q)
+{
+    const slice_t x0 = q[7], x1 = q[6], x2 = q[5], x3 = q[4];
+    const slice_t x4 = q[3], x5 = q[2], x6 = q[1], x7 = q[0];
+
+    // Top linear transformation
+    const slice_t y14 = x3 ^ x5;
+    const slice_t y13 = x0 ^ x6;
+    const slice_t y9 = x0 ^ x3;
+    const slice_t y8 = x0 ^ x5;
+    const slice_t t0 = x1 ^ x2;
+    const slice_t y1 = t0 ^ x7;
+    const slice_t y4 = y1 ^ x3;
+    const slice_t y12 = y13 ^ y14;
+    const slice_t y2 = y1 ^ x0;
+    const slice_t y5 = y1 ^ x6;
+    const slice_t y3 = y5 ^ y8;
+    const slice_t t1 = x4 ^ y12;
+    const slice_t y15 = t1 ^ x5;
+    const slice_t y20 = t1 ^ x1;
+    const slice_t y6 = y15 ^ x7;
+    const slice_t y10 = y15 ^ t0;
+    const slice_t y11 = y20 ^ y9;
+    const slice_t y7 = x7 ^ y11;
+    const slice_t y17 = y10 ^ y11;
+    const slice_t y19 = y10 ^ y8;
+    const slice_t y16 = t0 ^ y11;
+    const slice_t y21 = y13 ^ y16;
+    const slice_t y18 = x0 ^ y16;
+
+    // Non-linear section
+    const slice_t t2 = y12 & y15;
+    const slice_t t3 = y3 & y6;
+    const slice_t t4 = t3 ^ t2;
+    const slice_t t5 = y4 & x7;
+    const slice_t t6 = t5 ^ t2;
+    const slice_t t7 = y13 & y16;
+    const slice_t t8 = y5 & y1;
+    const slice_t t9 = t8 ^ t7;
+    const slice_t t10 = y2 & y7;
+    const slice_t t11 = t10 ^ t7;
+    const slice_t t12 = y9 & y11;
+    const slice_t t13 = y14 & y17;
+    const slice_t t14 = t13 ^ t12;
+    const slice_t t15 = y8 & y10;
+    const slice_t t16 = t15 ^ t12;
+    const slice_t t17 = t4 ^ t14;
+    const slice_t t18 = t6 ^ t16;
+    const slice_t t19 = t9 ^ t14;
+    const slice_t t20 = t11 ^ t16;
+    const slice_t t21 = t17 ^ y20;
+    const slice_t t22 = t18 ^ y19;
+    const slice_t t23 = t19 ^ y21;
+    const slice_t t24 = t20 ^ y18;
+
+    const slice_t t25 = t21 ^ t22;
+    const slice_t t26 = t21 & t23;
+    const slice_t t27 = t24 ^ t26;
+    const slice_t t28 = t25 & t27;
+    const slice_t t29 = t28 ^ t22;
+    const slice_t t30 = t23 ^ t24;
+    const slice_t t31 = t22 ^ t26;
+    const slice_t t32 = t31 & t30;
+    const slice_t t33 = t32 ^ t24;
+    const slice_t t34 = t23 ^ t33;
+    const slice_t t35 = t27 ^ t33;
+    const slice_t t36 = t24 & t35;
+    const slice_t t37 = t36 ^ t34;
+    const slice_t t38 = t27 ^ t36;
+    const slice_t t39 = t29 & t38;
+    const slice_t t40 = t25 ^ t39;
+
+    const slice_t t41 = t40 ^ t37;
+    const slice_t t42 = t29 ^ t33;
+    const slice_t t43 = t29 ^ t40;
+    const slice_t t44 = t33 ^ t37;
+    const slice_t t45 = t42 ^ t41;
+    const slice_t z0 = t44 & y15;
+    const slice_t z1 = t37 & y6;
+    const slice_t z2 = t33 & x7;
+    const slice_t z3 = t43 & y16;
+    const slice_t z4 = t40 & y1;
+    const slice_t z5 = t29 & y7;
+    const slice_t z6 = t42 & y11;
+    const slice_t z7 = t45 & y17;
+    const slice_t z8 = t41 & y10;
+    const slice_t z9 = t44 & y12;
+    const slice_t z10 = t37 & y3;
+    const slice_t z11 = t33 & y4;
+    const slice_t z12 = t43 & y13;
+    const slice_t z13 = t40 & y5;
+    const slice_t z14 = t29 & y2;
+    const slice_t z15 = t42 & y9;
+    const slice_t z16 = t45 & y14;
+    const slice_t z17 = t41 & y8;
+
+    // Bottom linear transformation
+    const slice_t t46 = z15 ^ z16;
+    const slice_t t47 = z10 ^ z11;
+    const slice_t t48 = z5 ^ z13;
+    const slice_t t49 = z9 ^ z10;
+    const slice_t t50 = z2 ^ z12;
+    const slice_t t51 = z2 ^ z5;
+    const slice_t t52 = z7 ^ z8;
+    const slice_t t53 = z0 ^ z3;
+    const slice_t t54 = z6 ^ z7;
+    const slice_t t55 = z16 ^ z17;
+    const slice_t t56 = z12 ^ t48;
+    const slice_t t57 = t50 ^ t53;
+    const slice_t t58 = z4 ^ t46;
+    const slice_t t59 = z3 ^ t54;
+    const slice_t t60 = t46 ^ t57;
+    const slice_t t61 = z14 ^ t57;
+    const slice_t t62 = t52 ^ t58;
+    const slice_t t63 = t49 ^ t58;
+    const slice_t t64 = z4 ^ t59;
+    const slice_t t65 = t61 ^ t62;
+    const slice_t t66 = z1 ^ t63;
+    const slice_t s0 = t59 ^ t63;
+    const slice_t s6 = t56 ^ ~t62;
+    const slice_t s7 = t48 ^ ~t60;
+    const slice_t t67 = t64 ^ t65;
+    const slice_t s3 = t53 ^ t66;
+    const slice_t s4 = t51 ^ t66;
+    const slice_t s5 = t47 ^ t65;
+    const slice_t s1 = t64 ^ ~s3;
+    const slice_t s2 = t55 ^ ~t67;
+
+    q[7] = s0;
+    q[6] = s1;
+    q[5] = s2;
+    q[4] = s3;
+    q[3] = s4;
+    q[2] = s5;
+    q[1] = s6;
+    q[0] = s7;
+}
+
+// Inverse of the affine transformation within SubBytes (0x05 constant folded in as the NOTs)
+static void inv_affine(slice_t *q)
+{
+    const slice_t q0 = ~q[0], q1 = ~q[1], q2 = q[2], q3 = q[3];
+    const slice_t q4 = q[4], q5 = ~q[5], q6 = ~q[6], q7 = q[7];
+
+    q[7] = q1 ^ q4 ^ q6;
+    q[6] = q0 ^ q3 ^ q5;
+    q[5] = q7 ^ q2 ^ q4;
+    q[4] = q6 ^ q1 ^ q3;
+    q[3] = q5 ^ q0 ^ q2;
+    q[2] = q4 ^ q7 ^ q1;
+    q[1] = q3 ^ q6 ^ q0;
+    q[0] = q2 ^ q5 ^ q7;
+}
+
+// S(x) = A(x^-1), so S^-1(y) = A^-1(S(A^-1(y)))
+static void inv_sub_bytes(slice_t *q)
+{
+    inv_affine(q);
+    sub_bytes(q);
+    inv_affine(q);
+}
+
+// Transpose each 8x8 bit matrix formed by bit `j` of word `i`, converting between
+// interleaved bytes and bit planes (an involution)
+static void ortho(slice_t *q)
+{
+    #define SWAPN(cl, ch, s, x, y)                        \
+        do {                                              \
+            const slice_t a = (x), b = (y);               \
+            (x) = (a & (cl)) | ((b & (cl)) << (s));       \
+            (y) = ((a & (ch)) >> (s)) | (b & (ch));       \
+        } while (0)
+
+    #define SWAP2(x, y) SWAPN(UINT64_C(0x5555555555555555), UINT64_C(0xaaaaaaaaaaaaaaaa), 1, x, y)
+    #define SWAP4(x, y) SWAPN(UINT64_C(0x3333333333333333), UINT64_C(0xcccccccccccccccc), 2, x, y)
+    #define SWAP8(x, y) SWAPN(UINT64_C(0x0f0f0f0f0f0f0f0f), UINT64_C(0xf0f0f0f0f0f0f0f0), 4, x, y)
+
+    SWAP2(q[0], q[1]);
+    SWAP2(q[2], q[3]);
+    SWAP2(q[4], q[5]);
+    SWAP2(q[6], q[7]);
+
+    SWAP4(q[0], q[2]);
+    SWAP4(q[1], q[3]);
+    SWAP4(q[4], q[6]);
+    SWAP4(q[5], q[7]);
+
+    SWAP8(q[0], q[4]);
+    SWAP8(q[1], q[5]);
+    SWAP8(q[2], q[6]);
+    SWAP8(q[3], q[7]);
+
+    #undef SWAP8
+    #undef SWAP4
+    #undef SWAP2
+    #undef SWAPN
+}
+
+// Spread one block's four words over two 64-bit words, 16 bits at a time
+static void interleave_in(uint64_t *q0, uint64_t *q1, const uint32_t *w)
+{
+    uint64_t x[4];
+    for (size_t i = 0; i < 4; i++) {
+        x[i] = w[i];
+        x[i] |= x[i] << 16;
+        x[i] &= UINT64_C(0x0000ffff0000ffff);
+        x[i] |= x[i] << 8;
+        x[i] &= UINT64_C(0x00ff00ff00ff00ff);
+    }
+    *q0 = x[0] | (x[2] << 8);
+    *q1 = x[1] | (x[3] << 8);
+}
+
+static void interleave_out(uint32_t *w, uint64_t q0, uint64_t q1)
+{
+    uint64_t x[4] = {
+        q0 & UINT64_C(0x00ff00ff00ff00ff),
+        q1 & UINT64_C(0x00ff00ff00ff00ff),
+        (q0 >> 8) & UINT64_C(0x00ff00ff00ff00ff),
+        (q1 >> 8) & UINT64_C(0x00ff00ff00ff00ff),
+    };
+    for (size_t i = 0; i < 4; i++) {
+        x[i] |= x[i] >> 8;
+        x[i] &= UINT64_C(0x0000ffff0000ffff);
+        w[i] = (uint32_t)x[i] | (uint32_t)(x[i] >> 16);
+    }
+}
+
+// Blocks 0-3 go to the first half of each slice, blocks 4-7 to the second, missing blocks are zero
+static void load_blocks(slice_t *q, const uint8_t *src, size_t count)
+{
+    for (size_t b = 0; b < AES128_CT_BLOCKS; b++) {
+        uint32_t w[4] = { 0 };
+        if (b < count) {
+            for (size_t i = 0; i < 4; i++) {
+                w[i] = load32_le(&src[AES_BLOCK_SIZE * b + 4 * i]);
+            }
+        }
+        uint64_t lo, hi;
+        interleave_in(&lo, &hi, w);
+        q[b % 4][b / 4] = lo;
+        q[b % 4 + 4][b / 4] = hi;
+    }
+    ortho(q);
+}
+
+static void store_blocks(uint8_t *dst, slice_t *q, size_t count)
+{
+    ortho(q);
+    for (size_t b = 0; b < count; b++) {
+        uint32_t w[4];
+        interleave_out(w, q[b % 4][b / 4], q[b % 4 + 4][b / 4]);
+        for (size_t i = 0; i < 4; i++) {
+            store32_le(&dst[AES_BLOCK_SIZE * b + 4 * i], w[i]);
+        }
+    }
+}
+
+static inline void add_round_key(slice_t *q, const uint64_t *sk)
+{
+    for (size_t i = 0; i < AES128_CT_PLANES; i++) {
+        q[i] ^= sk[i];
+    }
+}
+
+static void shift_rows(slice_t *q)
+{
+    for (size_t i = 0; i < AES128_CT_PLANES; i++) {
+        const slice_t x = q[i];
+        q[i] = (x & UINT64_C(0x000000000000ffff))
+            | ((x & UINT64_C(0x00000000fff00000)) >> 4)
+            | ((x & UINT64_C(0x00000000000f0000)) << 12)
+            | ((x & UINT64_C(0x0000ff0000000000)) >> 8)
+            | ((x & UINT64_C(0x000000ff00000000)) << 8)
+            | ((x & UINT64_C(0xf000000000000000)) >> 12)
+            | ((x & UINT64_C(0x0fff000000000000)) << 4);
+    }
+}
+
+static void inv_shift_rows(slice_t *q)
+{
+    for (size_t i = 0; i < AES128_CT_PLANES; i++) {
+        const slice_t x = q[i];
+        q[i] = (x & UINT64_C(0x000000000000ffff))
+            | ((x & UINT64_C(0x000000000fff0000)) << 4)
+            | ((x & UINT64_C(0x00000000f0000000)) >> 12)
+            | ((x & UINT64_C(0x000000ff00000000)) << 8)
+            | ((x & UINT64_C(0x0000ff0000000000)) >> 8)
+            | ((x & UINT64_C(0x000f000000000000)) << 12)
+            | ((x & UINT64_C(0xfff0000000000000)) >> 4);
+    }
+}
+
+// Each 16-bit lane of a plane is one row, so rotating by 16 / 32 bits moves one / two rows down
+static inline slice_t rotr16(slice_t x)
+{
+    return (x >> 16) | (x << 48);
+}
+
+static inline slice_t rotr32(slice_t x)
+{
+    return (x >> 32) | (x << 32);
+}
+
+static void mix_columns(slice_t *q)
+{
+    const slice_t q0 = q[0], q1 = q[1], q2 = q[2], q3 = q[3];
+    const slice_t q4 = q[4], q5 = q[5], q6 = q[6], q7 = q[7];
+    const slice_t r0 = rotr16(q0), r1 = rotr16(q1), r2 = rotr16(q2), r3 = rotr16(q3);
+    const slice_t r4 = rotr16(q4), r5 = rotr16(q5), r6 = rotr16(q6), r7 = rotr16(q7);
+
+    q[0] = q7 ^ r7 ^ r0 ^ rotr32(q0 ^ r0);
+    q[1] = q0 ^ r0 ^ q7 ^ r7 ^ r1 ^ rotr32(q1 ^ r1);
+    q[2] = q1 ^ r1 ^ r2 ^ rotr32(q2 ^ r2);
+    q[3] = q2 ^ r2 ^ q7 ^ r7 ^ r3 ^ rotr32(q3 ^ r3);
+    q[4] = q3 ^ r3 ^ q7 ^ r7 ^ r4 ^ rotr32(q4 ^ r4);
+    q[5] = q4 ^ r4 ^ r5 ^ rotr32(q5 ^ r5);
+    q[6] = q5 ^ r5 ^ r6 ^ rotr32(q6 ^ r6);
+    q[7] = q6 ^ r6 ^ r7 ^ rotr32(q7 ^ r7);
+}
+
+// Multiply every byte by x (0x02) modulo x^8 + x^4 + x^3 + x + 1
+static void xtime(slice_t *dst, const slice_t *src)
+{
+    const slice_t hi = src[7];
+    dst[7] = src[6];
+    dst[6] = src[5];
+    dst[5] = src[4];
+    dst[4] = src[3] ^ hi;
+    dst[3] = src[2] ^ hi;
+    dst[2] = src[1];
+    dst[1] = src[0] ^ hi;
+    dst[0] = hi;
+}
+
+// 0B·x^3 + 0D·x^2 + 09·x + 0E = (03·x^3 + 01·x^2 + 01·x + 02)(04·x^2 + 05), so InvMixColumns is
+// MixColumns after multiplying each column by 04·x^2 + 05, i.e. a[i] ^= 04·(a[i] ^ a[i + 2])
+static void inv_mix_columns(slice_t *q)
+{
+    slice_t t[AES128_CT_PLANES], u[AES128_CT_PLANES];
+    for (size_t i = 0; i < AES128_CT_PLANES; i++) {
+        t[i] = q[i] ^ rotr32(q[i]);
+    }
+    xtime(u, t);
+    xtime(t, u);
+    for (size_t i = 0; i < AES128_CT_PLANES; i++) {
+        q[i] ^= t[i];
+    }
+    mix_columns(q);
+}
+
+// SubWord() for the key schedule, byte `i` of `x` lands in byte `i` of the first plane
+static uint32_t sub_word(uint32_t x)
+{
+    slice_t q[AES128_CT_PLANES] = { 0 };
+    q[0][0] = x;
+    ortho(q);
+    sub_bytes(q);
+    ortho(q);
+    return (uint32_t)q[0][0];
+}
+
+void aes128_ct_key_expansion(uint8_t *round_key, const uint8_t *key)
+{
+    static const uint8_t round_constants[AES_ROUNDS] = { 0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, 0x80, 0x1b, 0x36 };
+
+    uint32_t w[AES_WORD_COUNT * (AES_ROUNDS + 1)];
+    for (size_t i = 0; i < AES_WORD_COUNT; i++) {
+        w[i] = load32_le(&key[4 * i]);
+    }
+
+    for (size_t i = AES_WORD_COUNT; i < AES_WORD_COUNT * (AES_ROUNDS + 1); i++) {
+        uint32_t t = w[i - 1];
+        // Rotate and substitute
+        if (!(i % AES_WORD_COUNT)) {
+            t = sub_word((t >> 8) | (t << 24)) ^ round_constants[i / AES_WORD_COUNT - 1];
+        }
+        w[i] = w[i - AES_WORD_COUNT] ^ t;
+    }
+
+    for (size_t i = 0; i < AES_WORD_COUNT * (AES_ROUNDS + 1); i++) {
+        store32_le(&round_key[4 * i], w[i]);
+    }
+}
+
+void aes128_ct_slice_key(uint64_t *sliced_key, const uint8_t *round_key)
+{
+    for (size_t r = 0; r <= AES_ROUNDS; r++) {
+        uint32_t w[4];
+        for (size_t i = 0; i < 4; i++) {
+            w[i] = load32_le(&round_key[AES_BLOCK_SIZE * r + 4 * i]);
+        }
+
+        // Same key in every block position
+        uint64_t lo, hi;
+        interleave_in(&lo, &hi, w);
+        slice_t q[AES128_CT_PLANES];
+        for (size_t i = 0; i < 4; i++) {
+            q[i] = (slice_t){ lo, lo };
+            q[i + 4] = (slice_t){ hi, hi };
+        }
+        ortho(q);
+
+        for (size_t i = 0; i < AES128_CT_PLANES; i++) {
+            sliced_key[AES128_CT_PLANES * r + i] = q[i][0];
+        }
+    }
+}
+
+void aes128_ct_encrypt(const uint64_t *sliced_key, uint8_t *blocks, size_t count)
+{
+    slice_t q[AES128_CT_PLANES];
+    load_blocks(q, blocks, count);
+
+    add_round_key(q, &sliced_key[0]);
+    for (size_t r = 1; r < AES_ROUNDS; r++) {
+        sub_bytes(q);
+        shift_rows(q);
+        mix_columns(q);
+        add_round_key(q, &sliced_key[AES128_CT_PLANES * r]);
+    }
+    sub_bytes(q);
+    shift_rows(q);
+    add_round_key(q, &sliced_key[AES128_CT_PLANES * AES_ROUNDS]);
+
+    store_blocks(blocks, q, count);
+}
+
+void aes128_ct_decrypt(const uint64_t *sliced_key, uint8_t *blocks, size_t count)
+{
+    slice_t q[AES128_CT_PLANES];
+    load_blocks(q, blocks, count);
+
+    add_round_key(q, &sliced_key[AES128_CT_PLANES * AES_ROUNDS]);
+    for (size_t r = AES_ROUNDS - 1; r; r--) {
+        inv_shift_rows(q);
+        inv_sub_bytes(q);
+        add_round_key(q, &sliced_key[AES128_CT_PLANES * r]);
+        inv_mix_columns(q);
+    }
+    inv_shift_rows(q);
+    inv_sub_bytes(q);
+    add_round_key(q, &sliced_key[0]);
+
+    store_blocks(blocks, q, count);
+}
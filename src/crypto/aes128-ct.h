@@ -0,0 +1,54 @@
+/**
+ * @file aes128-ct.h
+ * @author Jason Conway (jpc@jasonconway.dev)
+ * @brief Constant-time bitsliced AES-128, eight blocks at a time
+ * @version 0.9.4
+ * @date 2025-01-12
+ *
+ * @copyright Copyright (c) 2025 Jason Conway. All rights reserved.
+ *
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+enum AES128CT {
+    AES128_CT_BLOCKS = 8, // Blocks processed per call
+    AES128_CT_PLANES = 8, // Bit planes per round key
+};
+
+/**
+ * @brief FIPS 197 key expansion without any table lookups
+ *
+ * @param[out] round_key 176-byte key schedule
+ * @param[in] key 128-bit cipher key
+ */
+void aes128_ct_key_expansion(uint8_t *round_key, const uint8_t *key);
+
+/**
+ * @brief Convert a byte-oriented key schedule into bit planes
+ *
+ * @param[out] sliced_key AES128_CT_PLANES words per round key
+ * @param[in] round_key 176-byte key schedule
+ */
+void aes128_ct_slice_key(uint64_t *sliced_key, const uint8_t *round_key);
+
+/**
+ * @brief Encrypt up to AES128_CT_BLOCKS independent blocks in-place (ECB)
+ *
+ * @param[in] sliced_key key schedule from `aes128_ct_slice_key()`
+ * @param[inout] blocks `count` consecutive 16-byte blocks
+ * @param[in] count 1 to AES128_CT_BLOCKS, the cost is the same either way
+ */
+void aes128_ct_encrypt(const uint64_t *sliced_key, uint8_t *blocks, size_t count);
+
+/**
+ * @brief Decrypt up to AES128_CT_BLOCKS independent blocks in-place (ECB)
+ *
+ * @param[in] sliced_key key schedule from `aes128_ct_slice_key()`
+ * @param[inout] blocks `count` consecutive 16-byte blocks
+ * @param[in] count 1 to AES128_CT_BLOCKS, the cost is the same either way
+ */
+void aes128_ct_decrypt(const uint64_t *sliced_key, uint8_t *blocks, size_t count);
@@ -0,0 +1,191 @@
+/**
+ * @file aes128-ni.c
+ * @author Jason Conway (jpc@jasonconway.dev)
+ * @brief AES-128 using the x86 AES New Instructions
+ * @ref https://www.intel.com/content/dam/doc/white-paper/advanced-encryption-standard-new-instructions-set-paper.pdf
+ * @version 0.9.4
+ * @date 2025-01-12
+ *
+ * @copyright Copyright (c) 2025 Jason Conway. All rights reserved.
+ *
+ */
+
+#include "aes128-ni.h"
+#include "aes128.h"
+
+#if AES128_NI
+
+#include <cpuid.h>
+#include <immintrin.h>
+
+#define TARGET __attribute__((target("aes,sse2")))
+
+// Blocks in flight for CBC decryption
+#define AES128_NI_LANES 8
+
+bool aes128_ni_supported(void)
+{
+    unsigned int eax, ebx, ecx, edx;
+    if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx)) {
+        return false;
+    }
+    return (ecx & bit_AES) && (edx & bit_SSE2);
+}
+
+// w[i] = w[i - 4] ^ w[i - 1] for all four words at once, with SubWord(RotWord(w[3])) ^ rcon from `assist`
+static TARGET inline __m128i expand_round(__m128i key, __m128i assist)
+{
+    assist = _mm_shuffle_epi32(assist, 0xff);
+    key = _mm_xor_si128(key, _mm_slli_si128(key, 4));
+    key = _mm_xor_si128(key, _mm_slli_si128(key, 4));
+    key = _mm_xor_si128(key, _mm_slli_si128(key, 4));
+    return _mm_xor_si128(key, assist);
+}
+
+// The round constant has to be an immediate
+#define EXPAND_ROUND(k, rcon) expand_round(k, _mm_aeskeygenassist_si128(k, rcon))
+
+TARGET void aes128_ni_key_expansion(uint8_t *round_key, uint8_t *inv_round_key, const uint8_t *key)
+{
+    __m128i rk[AES_ROUNDS + 1];
+    rk[0] = _mm_loadu_si128((const __m128i *)key);
+    rk[1] = EXPAND_ROUND(rk[0], 0x01);
+    rk[2] = EXPAND_ROUND(rk[1], 0x02);
+    rk[3] = EXPAND_ROUND(rk[2], 0x04);
+    rk[4] = EXPAND_ROUND(rk[3], 0x08);
+    rk[5] = EXPAND_ROUND(rk[4], 0x10);
+    rk[6] = EXPAND_ROUND(rk[5], 0x20);
+    rk[7] = EXPAND_ROUND(rk[6], 0x40);
+    rk[8] = EXPAND_ROUND(rk[7], 0x80);
+    rk[9] = EXPAND_ROUND(rk[8], 0x1b);
+    rk[10] = EXPAND_ROUND(rk[9], 0x36);
+
+    for (size_t i = 0; i <= AES_ROUNDS; i++) {
+        _mm_storeu_si128((__m128i *)&round_key[AES_BLOCK_SIZE * i], rk[i]);
+    }
+
+    // Equivalent inverse cipher: reversed schedule with InvMixColumns applied to the inner round keys
+    if (inv_round_key) {
+        _mm_storeu_si128((__m128i *)&inv_round_key[0], rk[AES_ROUNDS]);
+        for (size_t i = 1; i < AES_ROUNDS; i++) {
+            _mm_storeu_si128((__m128i *)&inv_round_key[AES_BLOCK_SIZE * i], _mm_aesimc_si128(rk[AES_ROUNDS - i]));
+        }
+        _mm_storeu_si128((__m128i *)&inv_round_key[AES_BLOCK_SIZE * AES_ROUNDS], rk[0]);
+    }
+}
+
+static TARGET inline void load_schedule(__m128i *rk, const uint8_t *round_key)
+{
+    for (size_t i = 0; i <= AES_ROUNDS; i++) {
+        rk[i] = _mm_loadu_si128((const __m128i *)&round_key[AES_BLOCK_SIZE * i]);
+    }
+}
+
+static TARGET inline __m128i encrypt_block(const __m128i *rk, __m128i x)
+{
+    x = _mm_xor_si128(x, rk[0]);
+    for (size_t i = 1; i < AES_ROUNDS; i++) {
+        x = _mm_aesenc_si128(x, rk[i]);
+    }
+    return _mm_aesenclast_si128(x, rk[AES_ROUNDS]);
+}
+
+static TARGET inline __m128i decrypt_block(const __m128i *rk, __m128i x)
+{
+    x = _mm_xor_si128(x, rk[0]);
+    for (size_t i = 1; i < AES_ROUNDS; i++) {
+        x = _mm_aesdec_si128(x, rk[i]);
+    }
+    return _mm_aesdeclast_si128(x, rk[AES_ROUNDS]);
+}
+
+TARGET void aes128_ni_cbc_encrypt(const uint8_t *round_key, uint8_t *iv, uint8_t *chunk, size_t length)
+{
+    __m128i rk[AES_ROUNDS + 1];
+    load_schedule(rk, round_key);
+
+    __m128i x = _mm_loadu_si128((const __m128i *)iv);
+    for (size_t i = 0; i < length; i += AES_BLOCK_SIZE) {
+        x = _mm_xor_si128(x, _mm_loadu_si128((const __m128i *)&chunk[i]));
+        x = encrypt_block(rk, x);
+        _mm_storeu_si128((__m128i *)&chunk[i], x);
+    }
+    _mm_storeu_si128((__m128i *)iv, x);
+}
+
+// CBC encryption and CBC-MAC are both serial chains, but they're independent of each other
+// past the ciphertext block they share, so running them side by side hides the aesenc
+// latency of one chain behind the other
+TARGET void aes128_ni_cbc_encrypt_mac(const uint8_t *round_key, uint8_t *iv, const uint8_t *mac_round_key,
+    uint8_t *state, uint8_t *chunk, size_t length)
+{
+    __m128i rk[AES_ROUNDS + 1], mk[AES_ROUNDS + 1];
+    load_schedule(rk, round_key);
+    load_schedule(mk, mac_round_key);
+
+    __m128i x = _mm_loadu_si128((const __m128i *)iv);
+    __m128i m = _mm_loadu_si128((const __m128i *)state);
+    for (size_t i = 0; i < length; i += AES_BLOCK_SIZE) {
+        x = _mm_xor_si128(x, _mm_loadu_si128((const __m128i *)&chunk[i]));
+        x = encrypt_block(rk, x);
+        _mm_storeu_si128((__m128i *)&chunk[i], x);
+        m = encrypt_block(mk, _mm_xor_si128(m, x));
+    }
+    _mm_storeu_si128((__m128i *)iv, x);
+    _mm_storeu_si128((__m128i *)state, m);
+}
+
+// Unlike encryption, CBC decryption has no dependency between blocks, so eight blocks
+// go through each round together to keep the aesdec pipeline full
+TARGET void aes128_ni_cbc_decrypt(const uint8_t *inv_round_key, uint8_t *iv, uint8_t *chunk, size_t length)
+{
+    __m128i rk[AES_ROUNDS + 1];
+    load_schedule(rk, inv_round_key);
+
+    __m128i prev = _mm_loadu_si128((const __m128i *)iv);
+
+    size_t i = 0;
+    for (; i + AES128_NI_LANES * AES_BLOCK_SIZE <= length; i += AES128_NI_LANES * AES_BLOCK_SIZE) {
+        __m128i c[AES128_NI_LANES], x[AES128_NI_LANES];
+        #pragma GCC unroll 8
+        for (size_t j = 0; j < AES128_NI_LANES; j++) {
+            c[j] = _mm_loadu_si128((const __m128i *)&chunk[i + AES_BLOCK_SIZE * j]);
+            x[j] = _mm_xor_si128(c[j], rk[0]);
+        }
+        for (size_t r = 1; r < AES_ROUNDS; r++) {
+            #pragma GCC unroll 8
+            for (size_t j = 0; j < AES128_NI_LANES; j++) {
+                x[j] = _mm_aesdec_si128(x[j], rk[r]);
+            }
+        }
+        #pragma GCC unroll 8
+        for (size_t j = 0; j < AES128_NI_LANES; j++) {
+            x[j] = _mm_aesdeclast_si128(x[j], rk[AES_ROUNDS]);
+            x[j] = _mm_xor_si128(x[j], j ? c[j - 1] : prev);
+            _mm_storeu_si128((__m128i *)&chunk[i + AES_BLOCK_SIZE * j], x[j]);
+        }
+        prev = c[AES128_NI_LANES - 1];
+    }
+
+    for (; i < length; i += AES_BLOCK_SIZE) {
+        const __m128i c = _mm_loadu_si128((const __m128i *)&chunk[i]);
+        _mm_storeu_si128((__m128i *)&chunk[i], _mm_xor_si128(decrypt_block(rk, c), prev));
+        prev = c;
+    }
+    _mm_storeu_si128((__m128i *)iv, prev);
+}
+
+TARGET void aes128_ni_cbc_mac(const uint8_t *round_key, uint8_t *state, const uint8_t *msg, size_t blocks)
+{
+    __m128i rk[AES_ROUNDS + 1];
+    load_schedule(rk, round_key);
+
+    __m128i x = _mm_loadu_si128((const __m128i *)state);
+    for (size_t i = 0; i < blocks; i++) {
+        x = _mm_xor_si128(x, _mm_loadu_si128((const __m128i *)&msg[AES_BLOCK_SIZE * i]));
+        x = encrypt_block(rk, x);
+    }
+    _mm_storeu_si128((__m128i *)state, x);
+}
+
+#endif
@@ -0,0 +1,66 @@
+/**
+ * @file aes128-ni.h
+ * @author Jason Conway (jpc@jasonconway.dev)
+ * @brief AES-128 using the x86 AES New Instructions
+ * @version 0.9.4
+ * @date 2025-01-12
+ *
+ * @copyright Copyright (c) 2025 Jason Conway. All rights reserved.
+ *
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Define AES128_PORTABLE to build without the AES-NI backend
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__)) && !defined(AES128_PORTABLE)
+    #define AES128_NI 1
+#else
+    #define AES128_NI 0
+#endif
+
+#if AES128_NI
+
+/**
+ * @brief Check CPUID for AES-NI support
+ *
+ * @return true if the `aesenc` family of instructions is available
+ */
+bool aes128_ni_supported(void);
+
+/**
+ * @brief Expand `key` into the encryption schedule (FIPS 197 byte order) and the
+ * equivalent inverse cipher schedule used by `aesdec`
+ *
+ * @param[out] round_key 176-byte encryption key schedule
+ * @param[out] inv_round_key 176-byte decryption key schedule, may be NULL
+ * @param[in] key 128-bit cipher key
+ */
+void aes128_ni_key_expansion(uint8_t *round_key, uint8_t *inv_round_key, const uint8_t *key);
+
+/**
+ * @brief CBC encrypt `length` bytes in-place, updating `iv` with the final ciphertext block
+ */
+void aes128_ni_cbc_encrypt(const uint8_t *round_key, uint8_t *iv, uint8_t *chunk, size_t length);
+
+/**
+ * @brief CBC encrypt `length` bytes in-place while CBC-MAC'ing each ciphertext block into
+ * `state` under `mac_round_key`, updating `iv` with the final ciphertext block
+ */
+void aes128_ni_cbc_encrypt_mac(const uint8_t *round_key, uint8_t *iv, const uint8_t *mac_round_key,
+    uint8_t *state, uint8_t *chunk, size_t length);
+
+/**
+ * @brief CBC decrypt `length` bytes in-place, updating `iv` with the final ciphertext block
+ */
+void aes128_ni_cbc_decrypt(const uint8_t *inv_round_key, uint8_t *iv, uint8_t *chunk, size_t length);
+
+/**
+ * @brief CBC-MAC `blocks` full blocks of `msg` into the running `state`
+ */
+void aes128_ni_cbc_mac(const uint8_t *round_key, uint8_t *state, const uint8_t *msg, size_t blocks);
+
+#endif
@@ -16,6 +16,8 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include "aes128-ct.h"
+
 enum AES128 {
     AES_WORD_COUNT = 4,
     AES_ROUNDS = 10,
@@ -25,11 +27,53 @@ enum AES128 {
     AES_KEY_BITS = 8 * AES_KEY_LEN,
 };
 
+typedef enum aes128_backend_t {
+    AES128_BACKEND_SOFTWARE,
+    AES128_BACKEND_AESNI,
+} aes128_backend_t;
+
 typedef struct aes128_t {
     uint8_t round_key[AES_BLOCK_SIZE * (AES_ROUNDS + 1)];
+    uint8_t inv_round_key[AES_BLOCK_SIZE * (AES_ROUNDS + 1)]; // Only used by AES-NI
+    uint64_t sliced_key[AES128_CT_PLANES * (AES_ROUNDS + 1)];   // Only used by the bitsliced cipher
+    uint8_t cmac_subkey[2][AES_BLOCK_SIZE];                     // K1 and K2, only set by `aes128_init_cmac()`
     uint8_t iv[AES_BLOCK_SIZE];
 } aes128_t;
 
+// Running state of a CMAC fed in arbitrarily sized pieces. The most recent block is held
+// back in `buffer` until more input shows it isn't the last one
+typedef struct aes128_cmac_stream_t {
+    uint8_t state[AES_BLOCK_SIZE];
+    uint8_t buffer[AES_BLOCK_SIZE];
+    size_t buffered;
+} aes128_cmac_stream_t;
+
+/**
+ * @brief Get the implementation behind the aes128_* functions. AES-NI is used when
+ * CPUID reports it and it passes a known-answer self-test against the bitsliced cipher,
+ * which is the constant-time portable default otherwise
+ *
+ * @return Selected backend
+ */
+aes128_backend_t aes128_get_backend(void);
+
+/**
+ * @brief Override the backend chosen by `aes128_get_backend()`, for benchmarking. The two
+ * backends lay out their key schedules differently, so every aes128_t must be initialized again
+ *
+ * @param[in] selected backend to use from now on
+ * @return false if `selected` is unavailable on this machine
+ */
+bool aes128_set_backend(aes128_backend_t selected);
+
+/**
+ * @brief Human-readable name of an aes128 backend
+ *
+ * @param[in] backend backend returned by `aes128_get_backend()`
+ * @return "aes-ni" or "bitsliced"
+ */
+const char *aes128_backend_name(aes128_backend_t backend);
+
 /**
  * @brief Initiate a new aes128_t context for encryption / decryption
  *
@@ -40,7 +84,7 @@ typedef struct aes128_t {
 void aes128_init(aes128_t *ctx, const uint8_t *iv, const uint8_t *key);
 
 /**
- * @brief Initiate a new aes128_t context for CMAC
+ * @brief Initiate a new aes128_t context for CMAC, including the K1 and K2 subkeys
  *
  * @param[inout] ctx aes128 instance
  * @param[in] key 128-bit key
@@ -74,3 +118,74 @@ void aes128_decrypt(aes128_t *ctx, uint8_t *chunk, size_t length);
  * @param[out] mac 16-byte generated tag
  */
 void aes128_cmac(const aes128_t *ctx, const uint8_t *msg, size_t length, uint8_t *mac);
+
+/**
+ * @brief Absorb `blocks` complete blocks into a running CMAC `state`. The final block of
+ * the message must be left for `aes128_cmac_final()`
+ *
+ * @param[in] ctx CMAC-specific aes128 instance
+ * @param[inout] state 16-byte chaining value, zeroed before the first call
+ * @param[in] msg pointer to message blocks
+ * @param[in] blocks number of 16-byte blocks to absorb
+ */
+void aes128_cmac_update(const aes128_t *ctx, uint8_t *state, const uint8_t *msg, size_t blocks);
+
+/**
+ * @brief Finish a CMAC started with `aes128_cmac_update()`
+ *
+ * @param[in] ctx CMAC-specific aes128 instance
+ * @param[in] state 16-byte chaining value
+ * @param[in] msg final (possibly partial) block of the message
+ * @param[in] length length of the final block, 0 to 16 bytes
+ * @param[out] mac 16-byte generated tag
+ */
+void aes128_cmac_final(const aes128_t *ctx, const uint8_t *state, const uint8_t *msg, size_t length, uint8_t *mac);
+
+/**
+ * @brief CBC encrypt contents in-place, absorbing the ciphertext into a running CMAC
+ * in the same pass
+ *
+ * @param[inout] cipher aes128 instance
+ * @param[in] cmac CMAC-specific aes128 instance
+ * @param[inout] state CMAC chaining value, see `aes128_cmac_update()`
+ * @param[inout] chunk pointer to plaintext/ciphertext
+ * @param[in] length number of bytes to encrypt, a multiple of the block size
+ */
+void aes128_encrypt_cmac(aes128_t *cipher, const aes128_t *cmac, uint8_t *state, uint8_t *chunk, size_t length);
+
+/**
+ * @brief Absorb ciphertext into a running CMAC and CBC decrypt it in-place in the same pass
+ *
+ * @param[inout] cipher aes128 instance
+ * @param[in] cmac CMAC-specific aes128 instance
+ * @param[inout] state CMAC chaining value, see `aes128_cmac_update()`
+ * @param[inout] chunk pointer to ciphertext/plaintext
+ * @param[in] length number of bytes to decrypt, a multiple of the block size
+ */
+void aes128_cmac_decrypt(aes128_t *cipher, const aes128_t *cmac, uint8_t *state, uint8_t *chunk, size_t length);
+
+/**
+ * @brief Begin an incremental CMAC
+ *
+ * @param[out] stream CMAC stream state
+ */
+void aes128_cmac_stream_init(aes128_cmac_stream_t *stream);
+
+/**
+ * @brief Absorb the next `length` bytes of the message, which needn't be block aligned
+ *
+ * @param[in] ctx CMAC-specific aes128 instance
+ * @param[inout] stream CMAC stream state
+ * @param[in] msg next piece of the message
+ * @param[in] length number of bytes in `msg`
+ */
+void aes128_cmac_stream_update(const aes128_t *ctx, aes128_cmac_stream_t *stream, const uint8_t *msg, size_t length);
+
+/**
+ * @brief Finish an incremental CMAC and wipe the stream state
+ *
+ * @param[in] ctx CMAC-specific aes128 instance
+ * @param[inout] stream CMAC stream state
+ * @param[out] mac 16-byte generated tag
+ */
+void aes128_cmac_stream_final(const aes128_t *ctx, aes128_cmac_stream_t *stream, uint8_t *mac);
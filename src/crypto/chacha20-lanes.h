@@ -0,0 +1,60 @@
+/**
+ * @file chacha20-lanes.h
+ * @author Jason Conway (jpc@jasonconway.dev)
+ * @brief Multi-lane ChaCha20, one keystream block per SIMD lane
+ * @ref https://www.rfc-editor.org/rfc/rfc8439#section-2.3
+ * @version 0.9.4
+ * @date 2025-01-12
+ *
+ * @copyright Copyright (c) 2025 Jason Conway. All rights reserved.
+ *
+ * This file is a template and is intentionally missing an include guard.
+ * chacha20-poly1305.c includes it once per vector width after defining:
+ *
+ *  LANES         number of 32-bit lanes in `vec_t`
+ *  vec_t         GCC vector of LANES uint32_t
+ *  TARGET        target attribute enabling the instruction set
+ *  LANES_FN(fn)  name mangling for this instantiation
+ *
+ * Word `i` of every block lives in `x[i]`, with lane `n` holding block `counter + n`,
+ * so each quarter round operates on LANES blocks at once
+ */
+
+// XOR LANES consecutive keystream blocks into `data`, advancing the block counter in `state`
+static TARGET void LANES_FN(chacha20_xor_blocks)(uint32_t *state, uint8_t *data)
+{
+    vec_t s[16], x[16];
+    for (size_t i = 0; i < 16; i++) {
+        s[i] = (vec_t) { 0 } + state[i];
+    }
+    for (size_t n = 0; n < LANES; n++) {
+        s[12][n] += (uint32_t)n;
+    }
+    memcpy(x, s, sizeof(x));
+
+    for (size_t i = 0; i < 10; i++) {
+        QUARTER_ROUND(x[0], x[4], x[8], x[12]);
+        QUARTER_ROUND(x[1], x[5], x[9], x[13]);
+        QUARTER_ROUND(x[2], x[6], x[10], x[14]);
+        QUARTER_ROUND(x[3], x[7], x[11], x[15]);
+        QUARTER_ROUND(x[0], x[5], x[10], x[15]);
+        QUARTER_ROUND(x[1], x[6], x[11], x[12]);
+        QUARTER_ROUND(x[2], x[7], x[8], x[13]);
+        QUARTER_ROUND(x[3], x[4], x[9], x[14]);
+    }
+
+    uint32_t keystream[16][LANES];
+    for (size_t i = 0; i < 16; i++) {
+        x[i] += s[i];
+        memcpy(keystream[i], &x[i], sizeof(x[i]));
+    }
+
+    for (size_t n = 0; n < LANES; n++) {
+        uint8_t *block = &data[CHACHA20_BLOCK_SIZE * n];
+        for (size_t i = 0; i < 16; i++) {
+            xor32_le(&block[4 * i], keystream[i][n]);
+        }
+    }
+
+    state[12] += LANES;
+}
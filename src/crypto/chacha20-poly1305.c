@@ -0,0 +1,543 @@
+/**
+ * @file chacha20-poly1305.c
+ * @author Jason Conway (jpc@jasonconway.dev)
+ * @brief ChaCha20, Poly1305, and the ChaCha20-Poly1305 AEAD construction following RFC 8439
+ * @ref https://www.rfc-editor.org/rfc/rfc8439
+ * @ref https://cr.yp.to/chacha/chacha-20080128.pdf
+ * @ref https://cr.yp.to/mac/poly1305-20050329.pdf
+ * @version 0.9.4
+ * @date 2025-01-12
+ *
+ * @copyright Copyright (c) 2025 Jason Conway. All rights reserved.
+ *
+ */
+
+#include "chacha20-poly1305.h"
+#include <string.h>
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+    #define CHACHA20_AVX2 1
+#else
+    #define CHACHA20_AVX2 0
+#endif
+
+// -Os would otherwise leave the byte-order helpers as calls inside the block loops
+#define ALWAYS_INLINE inline __attribute__((always_inline))
+
+// Keystream generation and MAC alternate over chunks this size so the ciphertext is still in L1 for Poly1305
+enum { AEAD_CHUNK_SIZE = 8 * CHACHA20_BLOCK_SIZE };
+
+static ALWAYS_INLINE uint32_t load32_le(const uint8_t *src)
+{
+    return (uint32_t)src[0] | (uint32_t)src[1] << 8 | (uint32_t)src[2] << 16 | (uint32_t)src[3] << 24;
+}
+
+static ALWAYS_INLINE void store32_le(uint8_t *dst, uint32_t w)
+{
+    dst[0] = (uint8_t)w;
+    dst[1] = (uint8_t)(w >> 8);
+    dst[2] = (uint8_t)(w >> 16);
+    dst[3] = (uint8_t)(w >> 24);
+}
+
+// XOR a keystream word into `dst`, as one 32-bit access on little-endian targets
+static ALWAYS_INLINE void xor32_le(uint8_t *dst, uint32_t w)
+{
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    uint32_t x;
+    memcpy(&x, dst, sizeof(x));
+    x ^= w;
+    memcpy(dst, &x, sizeof(x));
+#else
+    store32_le(dst, load32_le(dst) ^ w);
+#endif
+}
+
+#define ROTL(x, n) (((x) << (n)) | ((x) >> (32 - (n))))
+
+#define QUARTER_ROUND(a, b, c, d)     \
+    do {                              \
+        a += b; d ^= a; d = ROTL(d, 16); \
+        c += d; b ^= c; b = ROTL(b, 12); \
+        a += b; d ^= a; d = ROTL(d, 8);  \
+        c += d; b ^= c; b = ROTL(b, 7);  \
+    } while (0)
+
+// Four lanes: SSE2 on x86-64, NEON on AArch64, and scalar code elsewhere
+#define LANES 4
+#define TARGET
+#define LANES_FN(fn) fn##_x4
+#define vec_t vec4_t
+typedef uint32_t vec_t __attribute__((vector_size(4 * LANES)));
+#include "chacha20-lanes.h"
+#undef LANES
+#undef TARGET
+#undef LANES_FN
+#undef vec_t
+
+#if CHACHA20_AVX2
+#define LANES 8
+#define TARGET __attribute__((target("avx2")))
+#define LANES_FN(fn) fn##_x8
+#define vec_t vec8_t
+typedef uint32_t vec_t __attribute__((vector_size(4 * LANES)));
+#include "chacha20-lanes.h"
+#undef LANES
+#undef TARGET
+#undef LANES_FN
+#undef vec_t
+
+static bool chacha20_avx2(void)
+{
+    static int avx2 = -1;
+    if (avx2 < 0) {
+        __builtin_cpu_init();
+        avx2 = __builtin_cpu_supports("avx2");
+    }
+    return avx2;
+}
+#endif
+
+#undef QUARTER_ROUND
+#undef ROTL
+
+static void chacha20_init_state(uint32_t *state, const uint8_t *key, const uint8_t *nonce, uint32_t counter)
+{
+    // "expand 32-byte k"
+    state[0] = 0x61707865;
+    state[1] = 0x3320646e;
+    state[2] = 0x79622d32;
+    state[3] = 0x6b206574;
+    for (size_t i = 0; i < 8; i++) {
+        state[4 + i] = load32_le(&key[4 * i]);
+    }
+    state[12] = counter;
+    for (size_t i = 0; i < 3; i++) {
+        state[13 + i] = load32_le(&nonce[4 * i]);
+    }
+}
+
+// XOR keystream into `data`, a partial final block ends the stream
+static void chacha20_stream(uint32_t *state, uint8_t *data, size_t length)
+{
+#if CHACHA20_AVX2
+    if (chacha20_avx2()) {
+        for (; length >= 8 * CHACHA20_BLOCK_SIZE; length -= 8 * CHACHA20_BLOCK_SIZE) {
+            chacha20_xor_blocks_x8(state, data);
+            data += 8 * CHACHA20_BLOCK_SIZE;
+        }
+    }
+#endif
+    for (; length >= 4 * CHACHA20_BLOCK_SIZE; length -= 4 * CHACHA20_BLOCK_SIZE) {
+        chacha20_xor_blocks_x4(state, data);
+        data += 4 * CHACHA20_BLOCK_SIZE;
+    }
+    if (length) {
+        uint8_t tail[4 * CHACHA20_BLOCK_SIZE] = { 0 };
+        memcpy(tail, data, length);
+        chacha20_xor_blocks_x4(state, tail);
+        memcpy(data, tail, length);
+        memset(tail, 0, sizeof(tail));
+    }
+}
+
+void chacha20_block(uint8_t *block, const uint8_t *key, const uint8_t *nonce, uint32_t counter)
+{
+    uint32_t state[16];
+    chacha20_init_state(state, key, nonce, counter);
+    memset(block, 0, CHACHA20_BLOCK_SIZE);
+    chacha20_stream(state, block, CHACHA20_BLOCK_SIZE);
+    memset(state, 0, sizeof(state));
+}
+
+void chacha20_xor(const uint8_t *key, const uint8_t *nonce, uint32_t counter, uint8_t *data, size_t length)
+{
+    uint32_t state[16];
+    chacha20_init_state(state, key, nonce, counter);
+    chacha20_stream(state, data, length);
+    memset(state, 0, sizeof(state));
+}
+
+void chacha20_init(chacha20_t *ctx, const uint8_t *key, const uint8_t *nonce, uint32_t counter)
+{
+    chacha20_init_state(ctx->state, key, nonce, counter);
+    memset(ctx->keystream, 0, sizeof(ctx->keystream));
+    ctx->used = sizeof(ctx->keystream);
+}
+
+void chacha20_update(chacha20_t *ctx, uint8_t *data, size_t length)
+{
+    // Leftover keystream from the previous call
+    for (; length && ctx->used < sizeof(ctx->keystream); length--) {
+        *data++ ^= ctx->keystream[ctx->used++];
+    }
+
+    // Whole multiples of the buffered keystream go straight through the wide path
+    const size_t bulk = length - length % sizeof(ctx->keystream);
+    chacha20_stream(ctx->state, data, bulk);
+    data += bulk;
+    length -= bulk;
+
+    if (length) {
+        memset(ctx->keystream, 0, sizeof(ctx->keystream));
+        chacha20_xor_blocks_x4(ctx->state, ctx->keystream);
+        for (ctx->used = 0; ctx->used < length; ctx->used++) {
+            data[ctx->used] ^= ctx->keystream[ctx->used];
+        }
+    }
+}
+
+static ALWAYS_INLINE uint64_t load64_le(const uint8_t *src)
+{
+    return (uint64_t)load32_le(src) | (uint64_t)load32_le(&src[4]) << 32;
+}
+
+static ALWAYS_INLINE void store64_le(uint8_t *dst, uint64_t w)
+{
+    store32_le(dst, (uint32_t)w);
+    store32_le(&dst[4], (uint32_t)(w >> 32));
+}
+
+#if defined(__SIZEOF_INT128__)
+
+typedef unsigned __int128 uint128_t;
+
+#define POLY1305_HIBIT ((uint64_t)1 << 40)
+
+void poly1305_init(poly1305_t *ctx, const uint8_t *key)
+{
+    memset(ctx, 0, sizeof(*ctx));
+
+    // r &= 0xffffffc0ffffffc0ffffffc0fffffff, split into 44 / 44 / 42-bit limbs
+    const uint64_t t0 = load64_le(&key[0]);
+    const uint64_t t1 = load64_le(&key[8]);
+    ctx->r[0] = t0 & 0xffc0fffffff;
+    ctx->r[1] = ((t0 >> 44) | (t1 << 20)) & 0xfffffc0ffff;
+    ctx->r[2] = (t1 >> 24) & 0x00ffffffc0f;
+
+    ctx->pad[0] = load64_le(&key[16]);
+    ctx->pad[1] = load64_le(&key[24]);
+}
+
+// h = (h + m) * r mod 2^130 - 5 for every 16-byte block, `hibit` is the 2^128 bit of a full block
+static void poly1305_blocks(poly1305_t *ctx, const uint8_t *msg, size_t blocks, uint64_t hibit)
+{
+    const uint64_t r0 = ctx->r[0], r1 = ctx->r[1], r2 = ctx->r[2];
+    const uint64_t s1 = r1 * (5 << 2), s2 = r2 * (5 << 2);
+    uint64_t h0 = ctx->h[0], h1 = ctx->h[1], h2 = ctx->h[2];
+
+    for (size_t i = 0; i < blocks; i++, msg += POLY1305_BLOCK_SIZE) {
+        const uint64_t t0 = load64_le(&msg[0]);
+        const uint64_t t1 = load64_le(&msg[8]);
+        h0 += t0 & 0xfffffffffff;
+        h1 += ((t0 >> 44) | (t1 << 20)) & 0xfffffffffff;
+        h2 += ((t1 >> 24) & 0x3ffffffffff) | hibit;
+
+        const uint128_t d0 = (uint128_t)h0 * r0 + (uint128_t)h1 * s2 + (uint128_t)h2 * s1;
+        uint128_t d1 = (uint128_t)h0 * r1 + (uint128_t)h1 * r0 + (uint128_t)h2 * s2;
+        uint128_t d2 = (uint128_t)h0 * r2 + (uint128_t)h1 * r1 + (uint128_t)h2 * r0;
+
+        h0 = (uint64_t)d0 & 0xfffffffffff;
+        d1 += (uint64_t)(d0 >> 44);
+        h1 = (uint64_t)d1 & 0xfffffffffff;
+        d2 += (uint64_t)(d1 >> 44);
+        h2 = (uint64_t)d2 & 0x3ffffffffff;
+        h0 += (uint64_t)(d2 >> 42) * 5;
+        h1 += h0 >> 44;
+        h0 &= 0xfffffffffff;
+    }
+
+    ctx->h[0] = h0;
+    ctx->h[1] = h1;
+    ctx->h[2] = h2;
+}
+
+// Fully reduce h mod 2^130 - 5 and add the pad mod 2^128
+static void poly1305_tag(poly1305_t *ctx, uint8_t *tag)
+{
+    uint64_t h0 = ctx->h[0], h1 = ctx->h[1], h2 = ctx->h[2];
+
+    for (size_t i = 0; i < 2; i++) {
+        h2 += h1 >> 44;
+        h1 &= 0xfffffffffff;
+        h0 += (h2 >> 42) * 5;
+        h2 &= 0x3ffffffffff;
+        h1 += h0 >> 44;
+        h0 &= 0xfffffffffff;
+    }
+
+    // g = h + 5 - 2^130, selected in constant time if h >= 2^130 - 5
+    uint64_t g0 = h0 + 5;
+    uint64_t g1 = h1 + (g0 >> 44);
+    g0 &= 0xfffffffffff;
+    uint64_t g2 = h2 + (g1 >> 44) - ((uint64_t)1 << 42);
+    g1 &= 0xfffffffffff;
+
+    const uint64_t mask = (g2 >> 63) - 1;
+    h0 = (h0 & ~mask) | (g0 & mask);
+    h1 = (h1 & ~mask) | (g1 & mask);
+    h2 = (h2 & ~mask) | (g2 & mask);
+
+    const uint64_t t0 = ctx->pad[0], t1 = ctx->pad[1];
+    h0 += t0 & 0xfffffffffff;
+    h1 += (((t0 >> 44) | (t1 << 20)) & 0xfffffffffff) + (h0 >> 44);
+    h0 &= 0xfffffffffff;
+    h2 += ((t1 >> 24) & 0x3ffffffffff) + (h1 >> 44);
+    h1 &= 0xfffffffffff;
+
+    store64_le(&tag[0], h0 | (h1 << 44));
+    store64_le(&tag[8], (h1 >> 20) | (h2 << 24));
+}
+
+#else
+
+#define POLY1305_HIBIT ((uint32_t)1 << 24)
+
+void poly1305_init(poly1305_t *ctx, const uint8_t *key)
+{
+    memset(ctx, 0, sizeof(*ctx));
+
+    // r &= 0xffffffc0ffffffc0ffffffc0fffffff, split into 26-bit limbs
+    ctx->r[0] = load32_le(&key[0]) & 0x3ffffff;
+    ctx->r[1] = (load32_le(&key[3]) >> 2) & 0x3ffff03;
+    ctx->r[2] = (load32_le(&key[6]) >> 4) & 0x3ffc0ff;
+    ctx->r[3] = (load32_le(&key[9]) >> 6) & 0x3f03fff;
+    ctx->r[4] = (load32_le(&key[12]) >> 8) & 0x00fffff;
+
+    ctx->pad[0] = load64_le(&key[16]);
+    ctx->pad[1] = load64_le(&key[24]);
+}
+
+// h = (h + m) * r mod 2^130 - 5 for every 16-byte block, `hibit` is the 2^128 bit of a full block
+static void poly1305_blocks(poly1305_t *ctx, const uint8_t *msg, size_t blocks, uint32_t hibit)
+{
+    const uint32_t r0 = (uint32_t)ctx->r[0], r1 = (uint32_t)ctx->r[1], r2 = (uint32_t)ctx->r[2];
+    const uint32_t r3 = (uint32_t)ctx->r[3], r4 = (uint32_t)ctx->r[4];
+    const uint32_t s1 = r1 * 5, s2 = r2 * 5, s3 = r3 * 5, s4 = r4 * 5;
+    uint32_t h0 = (uint32_t)ctx->h[0], h1 = (uint32_t)ctx->h[1], h2 = (uint32_t)ctx->h[2];
+    uint32_t h3 = (uint32_t)ctx->h[3], h4 = (uint32_t)ctx->h[4];
+
+    for (size_t i = 0; i < blocks; i++, msg += POLY1305_BLOCK_SIZE) {
+        h0 += load32_le(&msg[0]) & 0x3ffffff;
+        h1 += (load32_le(&msg[3]) >> 2) & 0x3ffffff;
+        h2 += (load32_le(&msg[6]) >> 4) & 0x3ffffff;
+        h3 += (load32_le(&msg[9]) >> 6) & 0x3ffffff;
+        h4 += (load32_le(&msg[12]) >> 8) | hibit;
+
+        const uint64_t d0 = (uint64_t)h0 * r0 + (uint64_t)h1 * s4 + (uint64_t)h2 * s3 + (uint64_t)h3 * s2 + (uint64_t)h4 * s1;
+        uint64_t d1 = (uint64_t)h0 * r1 + (uint64_t)h1 * r0 + (uint64_t)h2 * s4 + (uint64_t)h3 * s3 + (uint64_t)h4 * s2;
+        uint64_t d2 = (uint64_t)h0 * r2 + (uint64_t)h1 * r1 + (uint64_t)h2 * r0 + (uint64_t)h3 * s4 + (uint64_t)h4 * s3;
+        uint64_t d3 = (uint64_t)h0 * r3 + (uint64_t)h1 * r2 + (uint64_t)h2 * r1 + (uint64_t)h3 * r0 + (uint64_t)h4 * s4;
+        uint64_t d4 = (uint64_t)h0 * r4 + (uint64_t)h1 * r3 + (uint64_t)h2 * r2 + (uint64_t)h3 * r1 + (uint64_t)h4 * r0;
+
+        h0 = (uint32_t)d0 & 0x3ffffff;
+        d1 += d0 >> 26;
+        h1 = (uint32_t)d1 & 0x3ffffff;
+        d2 += d1 >> 26;
+        h2 = (uint32_t)d2 & 0x3ffffff;
+        d3 += d2 >> 26;
+        h3 = (uint32_t)d3 & 0x3ffffff;
+        d4 += d3 >> 26;
+        h4 = (uint32_t)d4 & 0x3ffffff;
+        h0 += (uint32_t)(d4 >> 26) * 5;
+        h1 += h0 >> 26;
+        h0 &= 0x3ffffff;
+    }
+
+    ctx->h[0] = h0;
+    ctx->h[1] = h1;
+    ctx->h[2] = h2;
+    ctx->h[3] = h3;
+    ctx->h[4] = h4;
+}
+
+// Fully reduce h mod 2^130 - 5 and add the pad mod 2^128
+static void poly1305_tag(poly1305_t *ctx, uint8_t *tag)
+{
+    uint32_t h0 = (uint32_t)ctx->h[0], h1 = (uint32_t)ctx->h[1], h2 = (uint32_t)ctx->h[2];
+    uint32_t h3 = (uint32_t)ctx->h[3], h4 = (uint32_t)ctx->h[4];
+
+    h2 += h1 >> 26;
+    h1 &= 0x3ffffff;
+    h3 += h2 >> 26;
+    h2 &= 0x3ffffff;
+    h4 += h3 >> 26;
+    h3 &= 0x3ffffff;
+    h0 += (h4 >> 26) * 5;
+    h4 &= 0x3ffffff;
+    h1 += h0 >> 26;
+    h0 &= 0x3ffffff;
+
+    // g = h + 5 - 2^130, selected in constant time if h >= 2^130 - 5
+    uint32_t g0 = h0 + 5;
+    uint32_t g1 = h1 + (g0 >> 26);
+    g0 &= 0x3ffffff;
+    uint32_t g2 = h2 + (g1 >> 26);
+    g1 &= 0x3ffffff;
+    uint32_t g3 = h3 + (g2 >> 26);
+    g2 &= 0x3ffffff;
+    uint32_t g4 = h4 + (g3 >> 26) - (1u << 26);
+    g3 &= 0x3ffffff;
+
+    const uint32_t mask = (g4 >> 31) - 1;
+    h0 = (h0 & ~mask) | (g0 & mask);
+    h1 = (h1 & ~mask) | (g1 & mask);
+    h2 = (h2 & ~mask) | (g2 & mask);
+    h3 = (h3 & ~mask) | (g3 & mask);
+    h4 = (h4 & ~mask) | (g4 & mask);
+
+    const uint32_t w[4] = {
+        h0 | (h1 << 26),
+        (h1 >> 6) | (h2 << 20),
+        (h2 >> 12) | (h3 << 14),
+        (h3 >> 18) | (h4 << 8),
+    };
+    const uint32_t pad[4] = {
+        (uint32_t)ctx->pad[0], (uint32_t)(ctx->pad[0] >> 32),
+        (uint32_t)ctx->pad[1], (uint32_t)(ctx->pad[1] >> 32),
+    };
+    uint64_t f = 0;
+    for (size_t i = 0; i < 4; i++) {
+        f += (uint64_t)w[i] + pad[i];
+        store32_le(&tag[4 * i], (uint32_t)f);
+        f >>= 32;
+    }
+}
+
+#endif
+
+void poly1305_update(poly1305_t *ctx, const uint8_t *msg, size_t length)
+{
+    if (ctx->buffered) {
+        size_t n = POLY1305_BLOCK_SIZE - ctx->buffered;
+        n = n < length ? n : length;
+        memcpy(&ctx->buffer[ctx->buffered], msg, n);
+        ctx->buffered += n;
+        msg += n;
+        length -= n;
+        if (ctx->buffered < POLY1305_BLOCK_SIZE) {
+            return;
+        }
+        poly1305_blocks(ctx, ctx->buffer, 1, POLY1305_HIBIT);
+        ctx->buffered = 0;
+    }
+
+    const size_t blocks = length / POLY1305_BLOCK_SIZE;
+    poly1305_blocks(ctx, msg, blocks, POLY1305_HIBIT);
+    msg += blocks * POLY1305_BLOCK_SIZE;
+    length -= blocks * POLY1305_BLOCK_SIZE;
+
+    memcpy(ctx->buffer, msg, length);
+    ctx->buffered = length;
+}
+
+void poly1305_finish(poly1305_t *ctx, uint8_t *tag)
+{
+    // A partial block gets a 1 appended in place of the 2^128 bit
+    if (ctx->buffered) {
+        ctx->buffer[ctx->buffered] = 1;
+        memset(&ctx->buffer[ctx->buffered + 1], 0, POLY1305_BLOCK_SIZE - ctx->buffered - 1);
+        poly1305_blocks(ctx, ctx->buffer, 1, 0);
+    }
+    poly1305_tag(ctx, tag);
+    memset(ctx, 0, sizeof(*ctx));
+}
+
+static void poly1305_pad16(poly1305_t *ctx, size_t length)
+{
+    static const uint8_t zero[POLY1305_BLOCK_SIZE] = { 0 };
+    if (length % POLY1305_BLOCK_SIZE) {
+        poly1305_update(ctx, zero, POLY1305_BLOCK_SIZE - length % POLY1305_BLOCK_SIZE);
+    }
+}
+
+// One-time Poly1305 key from block 0, then the AAD, with the keystream for `data` starting at block 1
+static void aead_init(poly1305_t *mac, uint32_t *state, const uint8_t *key, const uint8_t *nonce,
+    const uint8_t *aad, size_t aad_length)
+{
+    uint8_t mac_key[CHACHA20_BLOCK_SIZE];
+    chacha20_block(mac_key, key, nonce, 0);
+    poly1305_init(mac, mac_key);
+    memset(mac_key, 0, sizeof(mac_key));
+
+    poly1305_update(mac, aad, aad_length);
+    poly1305_pad16(mac, aad_length);
+
+    chacha20_init_state(state, key, nonce, 1);
+}
+
+static void aead_finish(poly1305_t *mac, uint32_t *state, size_t aad_length, size_t length, uint8_t *tag)
+{
+    poly1305_pad16(mac, length);
+
+    uint8_t lengths[16];
+    store64_le(&lengths[0], aad_length);
+    store64_le(&lengths[8], length);
+    poly1305_update(mac, lengths, sizeof(lengths));
+    poly1305_finish(mac, tag);
+
+    memset(state, 0, 16 * sizeof(uint32_t));
+}
+
+void chacha20_poly1305_encrypt(const uint8_t *key, const uint8_t *nonce, const uint8_t *aad, size_t aad_length,
+    uint8_t *data, size_t length, uint8_t *tag)
+{
+    poly1305_t mac;
+    uint32_t state[16];
+    aead_init(&mac, state, key, nonce, aad, aad_length);
+
+    for (size_t i = 0; i < length; i += AEAD_CHUNK_SIZE) {
+        const size_t n = length - i < AEAD_CHUNK_SIZE ? length - i : AEAD_CHUNK_SIZE;
+        chacha20_stream(state, &data[i], n);
+        poly1305_update(&mac, &data[i], n);
+    }
+
+    aead_finish(&mac, state, aad_length, length, tag);
+}
+
+void chacha20_poly1305_init(chacha20_poly1305_t *ctx, const uint8_t *key, const uint8_t *nonce,
+    const uint8_t *aad, size_t aad_length)
+{
+    memset(ctx, 0, sizeof(*ctx));
+    aead_init(&ctx->mac, ctx->cipher.state, key, nonce, aad, aad_length);
+    ctx->cipher.used = sizeof(ctx->cipher.keystream);
+    ctx->aad_length = aad_length;
+}
+
+void chacha20_poly1305_decrypt_update(chacha20_poly1305_t *ctx, uint8_t *data, size_t length)
+{
+    for (size_t i = 0; i < length; i += AEAD_CHUNK_SIZE) {
+        const size_t n = length - i < AEAD_CHUNK_SIZE ? length - i : AEAD_CHUNK_SIZE;
+        poly1305_update(&ctx->mac, &data[i], n);
+        chacha20_update(&ctx->cipher, &data[i], n);
+    }
+    ctx->length += length;
+}
+
+bool chacha20_poly1305_decrypt_final(chacha20_poly1305_t *ctx, const uint8_t *tag)
+{
+    uint8_t expected[POLY1305_TAG_LEN];
+    aead_finish(&ctx->mac, ctx->cipher.state, ctx->aad_length, ctx->length, expected);
+
+    uint8_t diff = 0;
+    for (size_t i = 0; i < POLY1305_TAG_LEN; i++) {
+        diff |= expected[i] ^ tag[i];
+    }
+    memset(ctx, 0, sizeof(*ctx));
+    return !diff;
+}
+
+bool chacha20_poly1305_decrypt(const uint8_t *key, const uint8_t *nonce, const uint8_t *aad, size_t aad_length,
+    uint8_t *data, size_t length, const uint8_t *tag)
+{
+    chacha20_poly1305_t ctx;
+    chacha20_poly1305_init(&ctx, key, nonce, aad, aad_length);
+    chacha20_poly1305_decrypt_update(&ctx, data, length);
+
+    // Never hand back unauthenticated plaintext
+    if (!chacha20_poly1305_decrypt_final(&ctx, tag)) {
+        memset(data, 0, length);
+        return false;
+    }
+    return true;
+}
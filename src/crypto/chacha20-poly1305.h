@@ -0,0 +1,158 @@
+/**
+ * @file chacha20-poly1305.h
+ * @author Jason Conway (jpc@jasonconway.dev)
+ * @brief ChaCha20, Poly1305, and the ChaCha20-Poly1305 AEAD construction following RFC 8439
+ * @version 0.9.4
+ * @date 2025-01-12
+ *
+ * @copyright Copyright (c) 2025 Jason Conway. All rights reserved.
+ *
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+enum ChaCha20Poly1305 {
+    CHACHA20_KEY_LEN = 32,
+    CHACHA20_NONCE_LEN = 12,
+    CHACHA20_BLOCK_SIZE = 64,
+    POLY1305_KEY_LEN = 32,
+    POLY1305_BLOCK_SIZE = 16,
+    POLY1305_TAG_LEN = 16,
+};
+
+// Three 44-bit limbs where the compiler has 128-bit products, five 26-bit limbs otherwise
+typedef struct poly1305_t {
+    uint64_t r[5];
+    uint64_t h[5];
+    uint64_t pad[2];
+    uint8_t buffer[POLY1305_BLOCK_SIZE];
+    size_t buffered;
+} poly1305_t;
+
+// Incremental ChaCha20. Keystream is generated four blocks at a time, and whatever
+// a call leaves unused is carried over to the next
+typedef struct chacha20_t {
+    uint32_t state[16];
+    uint8_t keystream[4 * CHACHA20_BLOCK_SIZE];
+    size_t used;
+} chacha20_t;
+
+// Incremental ChaCha20-Poly1305 decryption
+typedef struct chacha20_poly1305_t {
+    chacha20_t cipher;
+    poly1305_t mac;
+    uint64_t aad_length;
+    uint64_t length;
+} chacha20_poly1305_t;
+
+/**
+ * @brief Generate a single 64-byte keystream block
+ *
+ * @param[out] block 64-byte keystream block
+ * @param[in] key 256-bit key
+ * @param[in] nonce 96-bit nonce
+ * @param[in] counter block counter
+ */
+void chacha20_block(uint8_t *block, const uint8_t *key, const uint8_t *nonce, uint32_t counter);
+
+/**
+ * @brief XOR `length` bytes of keystream starting at block `counter` into `data`
+ *
+ * @param[in] key 256-bit key
+ * @param[in] nonce 96-bit nonce
+ * @param[in] counter block counter of the first keystream block
+ * @param[inout] data plaintext/ciphertext
+ * @param[in] length number of bytes to encrypt / decrypt
+ */
+void chacha20_xor(const uint8_t *key, const uint8_t *nonce, uint32_t counter, uint8_t *data, size_t length);
+
+/**
+ * @brief Initiate a new chacha20_t context
+ *
+ * @param[out] ctx chacha20 instance
+ * @param[in] key 256-bit key
+ * @param[in] nonce 96-bit nonce
+ * @param[in] counter block counter of the first keystream block
+ */
+void chacha20_init(chacha20_t *ctx, const uint8_t *key, const uint8_t *nonce, uint32_t counter);
+
+/**
+ * @brief XOR the next `length` bytes of keystream into `data`, any length is allowed
+ */
+void chacha20_update(chacha20_t *ctx, uint8_t *data, size_t length);
+
+/**
+ * @brief Initiate a new poly1305_t context
+ *
+ * @param[out] ctx poly1305 instance
+ * @param[in] key 256-bit one-time key
+ */
+void poly1305_init(poly1305_t *ctx, const uint8_t *key);
+
+/**
+ * @brief Absorb `length` bytes of `msg`
+ */
+void poly1305_update(poly1305_t *ctx, const uint8_t *msg, size_t length);
+
+/**
+ * @brief Produce the 16-byte tag and wipe the context
+ */
+void poly1305_finish(poly1305_t *ctx, uint8_t *tag);
+
+/**
+ * @brief AEAD encrypt `data` in-place, with keystream generation and authentication fused into one pass
+ *
+ * @param[in] key 256-bit key
+ * @param[in] nonce 96-bit nonce, must never repeat for the same key
+ * @param[in] aad additional authenticated data
+ * @param[in] aad_length length of `aad`
+ * @param[inout] data plaintext in, ciphertext out
+ * @param[in] length length of `data`
+ * @param[out] tag 16-byte authentication tag
+ */
+void chacha20_poly1305_encrypt(const uint8_t *key, const uint8_t *nonce, const uint8_t *aad, size_t aad_length,
+    uint8_t *data, size_t length, uint8_t *tag);
+
+/**
+ * @brief AEAD decrypt `data` in-place, verifying `tag` in the same pass
+ *
+ * @param[in] key 256-bit key
+ * @param[in] nonce 96-bit nonce
+ * @param[in] aad additional authenticated data
+ * @param[in] aad_length length of `aad`
+ * @param[inout] data ciphertext in, plaintext out (zeroed if verification fails)
+ * @param[in] length length of `data`
+ * @param[in] tag 16-byte authentication tag
+ * @return true if `tag` is valid
+ */
+bool chacha20_poly1305_decrypt(const uint8_t *key, const uint8_t *nonce, const uint8_t *aad, size_t aad_length,
+    uint8_t *data, size_t length, const uint8_t *tag);
+
+/**
+ * @brief Begin an incremental AEAD decryption
+ *
+ * @param[out] ctx chacha20_poly1305 instance
+ * @param[in] key 256-bit key
+ * @param[in] nonce 96-bit nonce
+ * @param[in] aad additional authenticated data
+ * @param[in] aad_length length of `aad`
+ */
+void chacha20_poly1305_init(chacha20_poly1305_t *ctx, const uint8_t *key, const uint8_t *nonce,
+    const uint8_t *aad, size_t aad_length);
+
+/**
+ * @brief Authenticate and decrypt the next `length` bytes of ciphertext in-place. The
+ * plaintext must not be used, and should be wiped, unless `chacha20_poly1305_decrypt_final()` succeeds
+ */
+void chacha20_poly1305_decrypt_update(chacha20_poly1305_t *ctx, uint8_t *data, size_t length);
+
+/**
+ * @brief Check `tag` against everything passed to `chacha20_poly1305_decrypt_update()` and wipe the context
+ *
+ * @return true if `tag` is valid
+ */
+bool chacha20_poly1305_decrypt_final(chacha20_poly1305_t *ctx, const uint8_t *tag);
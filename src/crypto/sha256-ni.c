@@ -0,0 +1,94 @@
+/**
+ * @file sha256-ni.c
+ * @author Jason Conway (jpc@jasonconway.dev)
+ * @brief SHA-256 using the x86 SHA extensions
+ * @ref https://www.intel.com/content/www/us/en/developer/articles/technical/intel-sha-extensions.html
+ * @version 0.9.4
+ * @date 2025-01-12
+ *
+ * @copyright Copyright (c) 2025 Jason Conway. All rights reserved.
+ *
+ */
+
+#include "sha256-ni.h"
+
+#if SHA256_NI
+
+#include <cpuid.h>
+#include <immintrin.h>
+
+#define TARGET __attribute__((target("sha,sse4.1,ssse3")))
+
+bool sha256_ni_supported(void)
+{
+    unsigned int eax, ebx, ecx, edx;
+    if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx)) {
+        return false;
+    }
+    if (!(ecx & bit_SSSE3) || !(ecx & bit_SSE4_1)) {
+        return false;
+    }
+    if (!__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx)) {
+        return false;
+    }
+    return ebx & bit_SHA;
+}
+
+// (4.2.2)
+static const uint32_t k[64] __attribute__((aligned(16))) = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+TARGET void sha256_ni_blocks(uint32_t *state, const uint8_t *data, size_t blocks)
+{
+    // Big-endian word loads
+    const __m128i bswap = _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+
+    // `sha256rnds2` wants the working variables split as ABEF and CDGH
+    __m128i tmp = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *)&state[0]), 0xb1); // CDAB
+    __m128i cdgh = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *)&state[4]), 0x1b); // EFGH
+    __m128i abef = _mm_alignr_epi8(tmp, cdgh, 8);
+    cdgh = _mm_blend_epi16(cdgh, tmp, 0xf0);
+
+    for (; blocks; blocks--, data += 64) {
+        const __m128i abef_save = abef;
+        const __m128i cdgh_save = cdgh;
+
+        // w[4i .. 4i + 3] for the last four groups of rounds, in a ring
+        __m128i w[4];
+        for (size_t i = 0; i < 4; i++) {
+            w[i] = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)&data[16 * i]), bswap);
+        }
+
+        // Unrolled so the ring indices resolve to registers
+        #pragma GCC unroll 16
+        for (size_t i = 0; i < 16; i++) {
+            if (i >= 4) {
+                // (6.2.2.1) w[t] = σ1(w[t - 2]) + w[t - 7] + σ0(w[t - 15]) + w[t - 16]
+                __m128i t = _mm_sha256msg1_epu32(w[i % 4], w[(i + 1) % 4]);
+                t = _mm_add_epi32(t, _mm_alignr_epi8(w[(i + 3) % 4], w[(i + 2) % 4], 4));
+                w[i % 4] = _mm_sha256msg2_epu32(t, w[(i + 3) % 4]);
+            }
+            __m128i wk = _mm_add_epi32(w[i % 4], _mm_load_si128((const __m128i *)&k[4 * i]));
+            cdgh = _mm_sha256rnds2_epu32(cdgh, abef, wk);
+            abef = _mm_sha256rnds2_epu32(abef, cdgh, _mm_shuffle_epi32(wk, 0x0e));
+        }
+
+        abef = _mm_add_epi32(abef, abef_save);
+        cdgh = _mm_add_epi32(cdgh, cdgh_save);
+    }
+
+    tmp = _mm_shuffle_epi32(abef, 0x1b);  // FEBA
+    cdgh = _mm_shuffle_epi32(cdgh, 0xb1); // DCHG
+    _mm_storeu_si128((__m128i *)&state[0], _mm_blend_epi16(tmp, cdgh, 0xf0)); // DCBA
+    _mm_storeu_si128((__m128i *)&state[4], _mm_alignr_epi8(cdgh, tmp, 8));    // HGFE
+}
+
+#endif
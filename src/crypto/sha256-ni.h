@@ -0,0 +1,43 @@
+/**
+ * @file sha256-ni.h
+ * @author Jason Conway (jpc@jasonconway.dev)
+ * @brief SHA-256 using the x86 SHA extensions
+ * @version 0.9.4
+ * @date 2025-01-12
+ *
+ * @copyright Copyright (c) 2025 Jason Conway. All rights reserved.
+ *
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Define SHA256_PORTABLE to build without the SHA-NI backend
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__)) && !defined(SHA256_PORTABLE)
+    #define SHA256_NI 1
+#else
+    #define SHA256_NI 0
+#endif
+
+#if SHA256_NI
+
+/**
+ * @brief Check CPUID for the SHA extensions along with the SSSE3 / SSE4.1 shuffles they rely on
+ *
+ * @return true if the `sha256rnds2` family of instructions is available
+ */
+bool sha256_ni_supported(void);
+
+/**
+ * @brief Compress `blocks` consecutive 64-byte blocks of `data` into `state`
+ *
+ * @param[inout] state eight working variables, a through h
+ * @param[in] data message blocks
+ * @param[in] blocks number of blocks
+ */
+void sha256_ni_blocks(uint32_t *state, const uint8_t *data, size_t blocks);
+
+#endif
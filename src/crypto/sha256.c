@@ -11,6 +11,14 @@
  */
 
 #include "sha256.h"
+#include "sha256-ni.h"
+#include <stdatomic.h>
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+    #define SHA256_AVX2 1
+#else
+    #define SHA256_AVX2 0
+#endif
 
 // SHR(x, n) (3.2.3)
 static inline uint32_t shr(uint32_t x, uint32_t n)
@@ -76,20 +84,20 @@ void sha256_init(sha256_t *ctx)
     ctx->state[7] = 0x5be0cd19;
 }
 
-static void sha256_hash(sha256_t *ctx, const uint8_t *data)
-{
-    // (4.2.2)
-    static const uint32_t k[64] = {
-        0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
-        0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
-        0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
-        0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
-        0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
-        0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
-        0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
-        0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
-    };
+// (4.2.2)
+static const uint32_t k[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
 
+static void sha256_hash(uint32_t *state, const uint8_t *data)
+{
     // Message schedule (6.2.2.1)
     uint32_t w[64];
     for (size_t i = 0; i < 64; i++) {
@@ -109,14 +117,14 @@ static void sha256_hash(sha256_t *ctx, const uint8_t *data)
 
     // (6.2.2.2)
     uint32_t s[8] = {
-        ctx->state[0], // a
-        ctx->state[1], // b
-        ctx->state[2], // c
-        ctx->state[3], // d
-        ctx->state[4], // e
-        ctx->state[5], // f
-        ctx->state[6], // g
-        ctx->state[7], // h
+        state[0], // a
+        state[1], // b
+        state[2], // c
+        state[3], // d
+        state[4], // e
+        state[5], // f
+        state[6], // g
+        state[7], // h
     };
 
     // Offsets for indexing into `s` in a way the resembles the spec
@@ -144,51 +152,318 @@ static void sha256_hash(sha256_t *ctx, const uint8_t *data)
     }
     // (6.2.2.4)
     for (size_t i = 0; i < 8; i++) {
-        ctx->state[i] += s[i];
+        state[i] += s[i];
     }
 }
 
-void sha256_append(sha256_t *ctx, const void *src, size_t len)
+#if SHA256_NI
+// Chain a few blocks through both implementations
+static bool sha_ni_self_test(void)
 {
-    const uint8_t *data = (const uint8_t *)src;
-    for (size_t i = 0; i < len; i++) {
-        // Copy byte over to the context block and hash
-        // in 512-bit increments
-        ctx->data[ctx->block_bytes++] = data[i];
-        if (ctx->block_bytes == 64) {
-            sha256_hash(ctx, ctx->data);
-            ctx->bits_total += 512;
-            ctx->block_bytes = 0;
+    uint8_t msg[3 * SHA256_BLOCK_SIZE];
+    for (size_t i = 0; i < sizeof(msg); i++) {
+        msg[i] = (uint8_t)(i * 0x1d + 0x5b);
+    }
+
+    sha256_t sw, ni;
+    sha256_init(&sw);
+    sha256_init(&ni);
+    for (size_t i = 0; i < sizeof(msg); i += SHA256_BLOCK_SIZE) {
+        sha256_hash(sw.state, &msg[i]);
+    }
+    sha256_ni_blocks(ni.state, msg, sizeof(msg) / SHA256_BLOCK_SIZE);
+    return !memcmp(sw.state, ni.state, sizeof(sw.state));
+}
+#endif
+
+static atomic_int backend = -1;
+
+sha256_backend_t sha256_get_backend(void)
+{
+    int selected = atomic_load_explicit(&backend, memory_order_relaxed);
+    if (selected < 0) {
+        selected = SHA256_BACKEND_SOFTWARE;
+#if SHA256_NI
+        if (sha256_ni_supported() && sha_ni_self_test()) {
+            selected = SHA256_BACKEND_SHANI;
         }
+#endif
+        atomic_store_explicit(&backend, selected, memory_order_relaxed);
     }
+    return (sha256_backend_t)selected;
 }
 
-void sha256_finish(sha256_t *ctx, void *dst)
+bool sha256_set_backend(sha256_backend_t selected)
 {
-    uint8_t *hash = (uint8_t *)dst;
-    uint32_t block = ctx->block_bytes;
+#if SHA256_NI
+    if (selected == SHA256_BACKEND_SHANI && (!sha256_ni_supported() || !sha_ni_self_test())) {
+        return false;
+    }
+#else
+    if (selected == SHA256_BACKEND_SHANI) {
+        return false;
+    }
+#endif
+    atomic_store_explicit(&backend, selected, memory_order_relaxed);
+    return true;
+}
 
-    ctx->data[block++] = 128;
-    const uint32_t end = ctx->block_bytes < 56 ? 56 : 64;
-    while (block < end) {
-        ctx->data[block++] = 0;
+const char *sha256_backend_name(sha256_backend_t backend)
+{
+    switch (backend) {
+        case SHA256_BACKEND_SHANI:
+            return "sha-ni";
+        case SHA256_BACKEND_SOFTWARE:
+        default:
+            return "portable";
     }
-    if (end == 64) {
-        sha256_hash(ctx, ctx->data);
-        memset(ctx->data, 0, 64);
+}
+
+// Compress `blocks` consecutive blocks of `data` into `state`
+static void sha256_blocks(uint32_t *state, const uint8_t *data, size_t blocks)
+{
+#if SHA256_NI
+    if (sha256_get_backend() == SHA256_BACKEND_SHANI) {
+        sha256_ni_blocks(state, data, blocks);
+        return;
+    }
+#endif
+    for (; blocks; blocks--, data += SHA256_BLOCK_SIZE) {
+        sha256_hash(state, data);
     }
+}
+
+void sha256_append(sha256_t *ctx, const void *src, size_t len)
+{
+    const uint8_t *data = (const uint8_t *)src;
+
+    // Top off a partially filled block first
+    if (ctx->block_bytes) {
+        const size_t fill = len < SHA256_BLOCK_SIZE - ctx->block_bytes ? len : SHA256_BLOCK_SIZE - ctx->block_bytes;
+        memcpy(&ctx->data[ctx->block_bytes], data, fill);
+        ctx->block_bytes += fill;
+        data += fill;
+        len -= fill;
+        if (ctx->block_bytes < SHA256_BLOCK_SIZE) {
+            return;
+        }
+        sha256_blocks(ctx->state, ctx->data, 1);
+        ctx->bits_total += 512;
+        ctx->block_bytes = 0;
+    }
+
+    // Full blocks are hashed straight from `src`
+    const size_t blocks = len / SHA256_BLOCK_SIZE;
+    if (blocks) {
+        sha256_blocks(ctx->state, data, blocks);
+        ctx->bits_total += 512 * blocks;
+        data += SHA256_BLOCK_SIZE * blocks;
+        len -= SHA256_BLOCK_SIZE * blocks;
+    }
+
+    if (len) {
+        memcpy(ctx->data, data, len);
+        ctx->block_bytes = len;
+    }
+}
+
+// Pad the buffered bytes of `ctx` into one or two final blocks (5.1.1)
+static size_t sha256_pad(const sha256_t *ctx, uint8_t *tail)
+{
+    const size_t blocks = ctx->block_bytes < 56 ? 1 : 2;
+    memset(tail, 0, 2 * SHA256_BLOCK_SIZE);
+    memcpy(tail, ctx->data, ctx->block_bytes);
+    tail[ctx->block_bytes] = 128;
 
     // Add total length to the last 8 bytes
-    ctx->bits_total += 8 * ctx->block_bytes;
+    const uint64_t bits_total = ctx->bits_total + 8 * ctx->block_bytes;
     for (size_t i = 0; i < 8; i++) {
-        ctx->data[63 - i] = (uint8_t)(ctx->bits_total >> (uint8_t)(8 * i));
+        tail[SHA256_BLOCK_SIZE * blocks - 1 - i] = (uint8_t)(bits_total >> (uint8_t)(8 * i));
     }
-    sha256_hash(ctx, ctx->data);
+    return blocks;
+}
 
+static void sha256_output(const uint32_t *state, uint8_t *hash)
+{
     // Copy into destination in reverse order
     for (size_t i = 0; i < 4; i++) {
         for (size_t j = 0; j < 8; j++) {
-            hash[(4 * j) + i] = (ctx->state[j] >> (24 - (8 * i))) & 0xff;
+            hash[(4 * j) + i] = (state[j] >> (24 - (8 * i))) & 0xff;
         }
     }
 }
+
+void sha256_finish(sha256_t *ctx, void *dst)
+{
+    uint8_t tail[2 * SHA256_BLOCK_SIZE];
+    sha256_blocks(ctx->state, tail, sha256_pad(ctx, tail));
+    sha256_output(ctx->state, (uint8_t *)dst);
+}
+
+#if SHA256_AVX2
+typedef uint32_t vec8_t __attribute__((vector_size(4 * SHA256_LANES)));
+
+#define TARGET_AVX2 __attribute__((target("avx2")))
+
+// Vector counterparts of the helpers above, macros so they inherit the caller's target
+#define VROTR(x, n) (((x) >> (n)) | ((x) << (0x20 - (n))))
+#define VCH(x, y, z) (((x) & (y)) ^ (~(x) & (z)))
+#define VMAJ(x, y, z) (((x) & (y)) ^ ((x) & (z)) ^ ((y) & (z)))
+#define VSUM0(x) (VROTR(x, 0x02) ^ VROTR(x, 0x0d) ^ VROTR(x, 0x16))
+#define VSUM1(x) (VROTR(x, 0x06) ^ VROTR(x, 0x0b) ^ VROTR(x, 0x19))
+#define VSIG0(x) (VROTR(x, 0x07) ^ VROTR(x, 0x12) ^ ((x) >> 0x03))
+#define VSIG1(x) (VROTR(x, 0x11) ^ VROTR(x, 0x13) ^ ((x) >> 0x0a))
+
+// Word `i` of every lane's state and message schedule lives in one vector, so each round
+// advances all eight hashes at once
+static TARGET_AVX2 void sha256_avx2_blocks(sha256_x8_t *ctx, const uint8_t *const *data, size_t blocks)
+{
+    vec8_t state[8];
+    for (size_t i = 0; i < 8; i++) {
+        for (size_t n = 0; n < SHA256_LANES; n++) {
+            state[i][n] = ctx->lane[n].state[i];
+        }
+    }
+
+    for (size_t offset = 0; offset < SHA256_BLOCK_SIZE * blocks; offset += SHA256_BLOCK_SIZE) {
+        // Message schedule (6.2.2.1), kept as a ring of the last 16 words
+        vec8_t w[16];
+        for (size_t i = 0; i < 16; i++) {
+            for (size_t n = 0; n < SHA256_LANES; n++) {
+                const uint8_t *word = &data[n][offset + 4 * i];
+                w[i][n] = (uint32_t)word[0] << 0x18 | (uint32_t)word[1] << 0x10 |
+                          (uint32_t)word[2] << 0x08 | (uint32_t)word[3] << 0x00;
+            }
+        }
+
+        // (6.2.2.2)
+        vec8_t s[8];
+        memcpy(s, state, sizeof(s));
+
+        for (size_t i = 0; i < 64; i++) {
+            if (i >= 16) {
+                w[i & 15] += VSIG1(w[(i - 0x02) & 15]) + VSIG0(w[(i - 0x0f) & 15]) + w[(i - 0x07) & 15];
+            }
+            // (6.2.2.3)
+            const vec8_t t1 = s[7] + VSUM1(s[4]) + VCH(s[4], s[5], s[6]) + k[i] + w[i & 15];
+            const vec8_t t2 = VSUM0(s[0]) + VMAJ(s[0], s[1], s[2]);
+            s[7] = s[6];
+            s[6] = s[5];
+            s[5] = s[4];
+            s[4] = s[3] + t1;
+            s[3] = s[2];
+            s[2] = s[1];
+            s[1] = s[0];
+            s[0] = t1 + t2;
+        }
+
+        // (6.2.2.4)
+        for (size_t i = 0; i < 8; i++) {
+            state[i] += s[i];
+        }
+    }
+
+    for (size_t i = 0; i < 8; i++) {
+        for (size_t n = 0; n < SHA256_LANES; n++) {
+            ctx->lane[n].state[i] = state[i][n];
+        }
+    }
+}
+
+static bool sha256_avx2(void)
+{
+    static int avx2 = -1;
+    if (avx2 < 0) {
+        __builtin_cpu_init();
+        avx2 = __builtin_cpu_supports("avx2");
+    }
+    return avx2;
+}
+#endif
+
+// Compress `blocks` blocks from each of the SHA256_LANES sources into their lanes. A single
+// SHA-NI stream still outruns eight AVX2 lanes, so the lanes only go side by side without it
+static void sha256_blocks_x8(sha256_x8_t *ctx, const uint8_t *const *data, size_t blocks)
+{
+#if SHA256_AVX2
+    if (sha256_get_backend() != SHA256_BACKEND_SHANI && sha256_avx2()) {
+        sha256_avx2_blocks(ctx, data, blocks);
+        return;
+    }
+#endif
+    for (size_t n = 0; n < SHA256_LANES; n++) {
+        sha256_blocks(ctx->lane[n].state, data[n], blocks);
+    }
+}
+
+void sha256_init_x8(sha256_x8_t *ctx)
+{
+    for (size_t n = 0; n < SHA256_LANES; n++) {
+        sha256_init(&ctx->lane[n]);
+    }
+}
+
+void sha256_append_x8(sha256_x8_t *ctx, const void *const *src, size_t len)
+{
+    const uint8_t *data[SHA256_LANES];
+    for (size_t n = 0; n < SHA256_LANES; n++) {
+        data[n] = (const uint8_t *)src[n];
+    }
+
+    // Every lane has buffered the same number of bytes
+    const size_t buffered = ctx->lane[0].block_bytes;
+    if (buffered) {
+        const size_t fill = len < SHA256_BLOCK_SIZE - buffered ? len : SHA256_BLOCK_SIZE - buffered;
+        for (size_t n = 0; n < SHA256_LANES; n++) {
+            memcpy(&ctx->lane[n].data[buffered], data[n], fill);
+            ctx->lane[n].block_bytes += fill;
+            data[n] += fill;
+        }
+        len -= fill;
+        if (buffered + fill < SHA256_BLOCK_SIZE) {
+            return;
+        }
+
+        const uint8_t *block[SHA256_LANES];
+        for (size_t n = 0; n < SHA256_LANES; n++) {
+            block[n] = ctx->lane[n].data;
+            ctx->lane[n].bits_total += 512;
+            ctx->lane[n].block_bytes = 0;
+        }
+        sha256_blocks_x8(ctx, block, 1);
+    }
+
+    const size_t blocks = len / SHA256_BLOCK_SIZE;
+    if (blocks) {
+        sha256_blocks_x8(ctx, data, blocks);
+        for (size_t n = 0; n < SHA256_LANES; n++) {
+            ctx->lane[n].bits_total += 512 * blocks;
+            data[n] += SHA256_BLOCK_SIZE * blocks;
+        }
+        len -= SHA256_BLOCK_SIZE * blocks;
+    }
+
+    if (len) {
+        for (size_t n = 0; n < SHA256_LANES; n++) {
+            memcpy(ctx->lane[n].data, data[n], len);
+            ctx->lane[n].block_bytes = len;
+        }
+    }
+}
+
+void sha256_finish_x8(sha256_x8_t *ctx, void *dst)
+{
+    uint8_t tail[SHA256_LANES][2 * SHA256_BLOCK_SIZE];
+    const uint8_t *block[SHA256_LANES];
+    size_t blocks = 0;
+    for (size_t n = 0; n < SHA256_LANES; n++) {
+        blocks = sha256_pad(&ctx->lane[n], tail[n]);
+        block[n] = tail[n];
+    }
+    sha256_blocks_x8(ctx, block, blocks);
+
+    uint8_t *hash = (uint8_t *)dst;
+    for (size_t n = 0; n < SHA256_LANES; n++) {
+        sha256_output(ctx->lane[n].state, &hash[SHA256_DIGEST_LEN * n]);
+    }
+}
@@ -12,9 +12,21 @@
 
 #pragma once
 
+#include <stdbool.h>
 #include <stdint.h>
 #include <string.h>
 
+enum Sha256 {
+    SHA256_BLOCK_SIZE = 64,
+    SHA256_DIGEST_LEN = 32,
+    SHA256_LANES = 8,
+};
+
+typedef enum sha256_backend_t {
+    SHA256_BACKEND_SOFTWARE,
+    SHA256_BACKEND_SHANI,
+} sha256_backend_t;
+
 typedef struct sha256_t {
     uint8_t data[64];
     uint64_t block_bytes;
@@ -22,6 +34,36 @@ typedef struct sha256_t {
     uint32_t state[8];
 } sha256_t;
 
+// Eight independent hashes advanced together. Every lane is given the same number of
+// bytes on each append, so the lanes always share a block boundary
+typedef struct sha256_x8_t {
+    sha256_t lane[SHA256_LANES];
+} sha256_x8_t;
+
+/**
+ * @brief Get the implementation behind the sha256_* functions. The SHA extensions are used
+ * when CPUID reports them and they pass a known-answer self-test against the portable code
+ *
+ * @return Selected backend
+ */
+sha256_backend_t sha256_get_backend(void);
+
+/**
+ * @brief Override the backend chosen by `sha256_get_backend()`, for benchmarking
+ *
+ * @param[in] selected backend to use from now on
+ * @return false if `selected` is unavailable on this machine
+ */
+bool sha256_set_backend(sha256_backend_t selected);
+
+/**
+ * @brief Human-readable name of a sha256 backend
+ *
+ * @param[in] backend backend returned by `sha256_get_backend()`
+ * @return "sha-ni" or "portable"
+ */
+const char *sha256_backend_name(sha256_backend_t backend);
+
 /**
  * @brief Initialize a new context or reset an old context
  *
@@ -45,3 +87,28 @@ void sha256_append(sha256_t *ctx, const void *src, size_t len);
  * @param[out] dst destination
  */
 void sha256_finish(sha256_t *ctx, void *dst);
+
+/**
+ * @brief Initialize all eight lanes of a multi-buffer context
+ *
+ * @param[out] ctx sha256_x8_t instance
+ */
+void sha256_init_x8(sha256_x8_t *ctx);
+
+/**
+ * @brief Append `len` bytes to every lane, with lane `n` reading from `src[n]`. Lanes are
+ * compressed side by side with AVX2 unless the SHA extensions are available, one after another otherwise
+ *
+ * @param[inout] ctx sha256_x8_t context
+ * @param[in] src SHA256_LANES source pointers
+ * @param[in] len number of bytes to process from each source
+ */
+void sha256_append_x8(sha256_x8_t *ctx, const void *const *src, size_t len);
+
+/**
+ * @brief Finish all eight hashes
+ *
+ * @param[inout] ctx sha256_x8_t context
+ * @param[out] dst SHA256_LANES * SHA256_DIGEST_LEN bytes, lane `n` at offset `n * SHA256_DIGEST_LEN`
+ */
+void sha256_finish_x8(sha256_x8_t *ctx, void *dst);
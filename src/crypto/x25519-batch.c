@@ -0,0 +1,215 @@
+/**
+ * @file x25519-batch.c
+ * @author Jason Conway (jpc@jasonconway.dev)
+ * @brief Batched X25519, several independent scalar multiplications per call
+ * @ref https://cr.yp.to/ecdh/curve25519-20060209.pdf
+ * @ref https://www.rfc-editor.org/rfc/rfc7748#section-5
+ * @version 0.9.4
+ * @date 2025-01-12
+ *
+ * @copyright Copyright (c) 2025 Jason Conway. All rights reserved.
+ *
+ */
+
+#include "x25519.h"
+#include <stdatomic.h>
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+    #include <immintrin.h>
+    #define X25519_SIMD 1
+#else
+    #define X25519_SIMD 0
+#endif
+
+#if X25519_SIMD
+
+// Bit offset of each radix 2^25.5 limb
+static const uint8_t limb_offset[11] = { 0, 26, 51, 77, 102, 128, 153, 179, 204, 230, 255 };
+
+static inline uint64_t load64_le(const uint8_t *src)
+{
+    uint64_t w = 0;
+    for (size_t i = 0; i < 8; i++) {
+        w |= (uint64_t)src[i] << (8 * i);
+    }
+    return w;
+}
+
+// Convert from byte array, ignoring the most-significant bit
+static void unpack_limbs(uint64_t *dst, const uint8_t *src)
+{
+    uint64_t w[5] = { 0 };
+    for (size_t i = 0; i < 4; i++) {
+        w[i] = load64_le(&src[8 * i]);
+    }
+
+    for (size_t i = 0; i < 10; i++) {
+        const size_t word = limb_offset[i] / 64, shift = limb_offset[i] % 64;
+        const uint64_t mask = (UINT64_C(1) << (limb_offset[i + 1] - limb_offset[i])) - 1;
+        uint64_t limb = w[word] >> shift;
+        if (shift) {
+            limb |= w[word + 1] << (64 - shift);
+        }
+        dst[i] = limb & mask;
+    }
+}
+
+// Fully reduce mod p and convert to byte array
+static void pack_limbs(uint8_t *dst, const uint64_t *src)
+{
+    uint64_t h[10];
+    memcpy(h, src, sizeof(h));
+
+    // Two carry passes leave every limb in range and h < 2p
+    for (size_t pass = 0; pass < 2; pass++) {
+        for (size_t i = 0; i < 10; i++) {
+            const size_t bits = limb_offset[i + 1] - limb_offset[i];
+            const uint64_t c = h[i] >> bits;
+            h[i] &= (UINT64_C(1) << bits) - 1;
+            if (i < 9) {
+                h[i + 1] += c;
+            }
+            else {
+                h[0] += 19 * c;
+            }
+        }
+    }
+
+    // q = floor((h + 19) / 2^255) is 1 exactly when h >= p
+    uint64_t q = 19;
+    for (size_t i = 0; i < 10; i++) {
+        q = (h[i] + q) >> (limb_offset[i + 1] - limb_offset[i]);
+    }
+
+    // h - qp = h + 19q - 2^255q, the 2^255 falls off the top of h9
+    h[0] += 19 * q;
+    for (size_t i = 0; i < 10; i++) {
+        const size_t bits = limb_offset[i + 1] - limb_offset[i];
+        if (i < 9) {
+            h[i + 1] += h[i] >> bits;
+        }
+        h[i] &= (UINT64_C(1) << bits) - 1;
+    }
+
+    uint64_t w[5] = { 0 };
+    for (size_t i = 0; i < 10; i++) {
+        const size_t word = limb_offset[i] / 64, shift = limb_offset[i] % 64;
+        w[word] |= h[i] << shift;
+        if (shift) {
+            w[word + 1] |= h[i] >> (64 - shift);
+        }
+    }
+
+    for (size_t i = 0; i < 32; i++) {
+        dst[i] = (uint8_t)(w[i / 8] >> (8 * (i % 8)));
+    }
+}
+
+#define ALWAYS_INLINE inline __attribute__((always_inline))
+
+// 4 lanes with AVX2
+#define LANES 4
+#define TARGET __attribute__((target("avx2")))
+#define LANES_FN(fn) fn##_x4
+#define mul32(a, b) ((vec_t)_mm256_mul_epu32((__m256i)(a), (__m256i)(b)))
+#define vec_t vec4_t
+typedef uint64_t vec_t __attribute__((vector_size(8 * LANES)));
+#include "x25519-lanes.h"
+#undef LANES
+#undef TARGET
+#undef LANES_FN
+#undef mul32
+#undef vec_t
+
+// 8 lanes with AVX-512
+#define LANES 8
+#define TARGET __attribute__((target("avx512f")))
+#define LANES_FN(fn) fn##_x8
+#define mul32(a, b) ((vec_t)_mm512_mul_epu32((__m512i)(a), (__m512i)(b)))
+#define vec_t vec8_t
+typedef uint64_t vec_t __attribute__((vector_size(8 * LANES)));
+#include "x25519-lanes.h"
+#undef LANES
+#undef TARGET
+#undef LANES_FN
+#undef mul32
+#undef vec_t
+#undef ALWAYS_INLINE
+
+#endif
+
+static bool x25519_batch_supported(x25519_batch_backend_t backend)
+{
+#if X25519_SIMD
+    __builtin_cpu_init();
+    switch (backend) {
+        case X25519_BATCH_BACKEND_AVX512:
+            return __builtin_cpu_supports("avx512f");
+        case X25519_BATCH_BACKEND_AVX2:
+            return __builtin_cpu_supports("avx2");
+        case X25519_BATCH_BACKEND_SCALAR:
+        default:
+            return true;
+    }
+#else
+    return backend == X25519_BATCH_BACKEND_SCALAR;
+#endif
+}
+
+static atomic_int backend = -1;
+
+x25519_batch_backend_t x25519_batch_get_backend(void)
+{
+    int selected = atomic_load_explicit(&backend, memory_order_relaxed);
+    if (selected < 0) {
+        selected = X25519_BATCH_BACKEND_AVX512;
+        while (!x25519_batch_supported((x25519_batch_backend_t)selected)) {
+            selected--;
+        }
+        atomic_store_explicit(&backend, selected, memory_order_relaxed);
+    }
+    return (x25519_batch_backend_t)selected;
+}
+
+bool x25519_batch_set_backend(x25519_batch_backend_t selected)
+{
+    if (!x25519_batch_supported(selected)) {
+        return false;
+    }
+    atomic_store_explicit(&backend, selected, memory_order_relaxed);
+    return true;
+}
+
+const char *x25519_batch_backend_name(x25519_batch_backend_t backend)
+{
+    switch (backend) {
+        case X25519_BATCH_BACKEND_AVX512:
+            return "avx512";
+        case X25519_BATCH_BACKEND_AVX2:
+            return "avx2";
+        case X25519_BATCH_BACKEND_SCALAR:
+        default:
+            return "scalar";
+    }
+}
+
+void x25519_batch(uint8_t *public, const uint8_t *secret, const uint8_t *basepoint, size_t count)
+{
+#if X25519_SIMD
+    const x25519_batch_backend_t isa = x25519_batch_get_backend();
+    for (; isa >= X25519_BATCH_BACKEND_AVX512 && count >= 8; count -= 8) {
+        x25519_lanes_x8(public, secret, basepoint);
+        public += 8 * 32, secret += 8 * 32, basepoint += 8 * 32;
+    }
+    for (; isa >= X25519_BATCH_BACKEND_AVX2 && count >= 4; count -= 4) {
+        x25519_lanes_x4(public, secret, basepoint);
+        public += 4 * 32, secret += 4 * 32, basepoint += 4 * 32;
+    }
+#endif
+
+    // Whatever doesn't fill a vector goes through the scalar ladder
+    for (; count; count--) {
+        x25519(public, secret, basepoint);
+        public += 32, secret += 32, basepoint += 32;
+    }
+}
@@ -0,0 +1,246 @@
+/**
+ * @file x25519-lanes.h
+ * @author Jason Conway (jpc@jasonconway.dev)
+ * @brief Multi-lane X25519 ladder, one independent scalar multiplication per SIMD lane
+ * @ref https://cr.yp.to/ecdh/curve25519-20060209.pdf
+ * @ref https://www.rfc-editor.org/rfc/rfc7748#section-5
+ * @version 0.9.4
+ * @date 2025-01-12
+ *
+ * @copyright Copyright (c) 2025 Jason Conway. All rights reserved.
+ *
+ * This file is a template and is intentionally missing an include guard.
+ * x25519-batch.c includes it once per vector width after defining:
+ *
+ *  LANES         number of 64-bit lanes in `vec_t`
+ *  vec_t         GCC vector of LANES uint64_t
+ *  mul32(a, b)   lane-wise product of the low 32 bits of `a` and `b`
+ *  TARGET        target attribute enabling the instruction set
+ *  LANES_FN(fn)  name mangling for this instantiation
+ *
+ * The carry helpers are forced inline since -Os would otherwise leave them as calls
+ *
+ * Field elements are ten radix 2^25.5 limbs h0 + h1·2^26 + h2·2^51 + ... + h9·2^230,
+ * stored as `vec_t[10]` where lane `n` of every limb belongs to the n-th scalar multiplication.
+ * Limbs are unsigned and carried after every operation, which keeps multiply() inputs
+ * (including the 2 and 19 pre-multipliers) below 2^32 and its column sums below 2^64
+ */
+
+static TARGET ALWAYS_INLINE vec_t LANES_FN(times19)(vec_t v)
+{
+    return v + (v << 1) + (v << 4);
+}
+
+static TARGET ALWAYS_INLINE void LANES_FN(carry_limb)(vec_t *t, size_t i, unsigned bits)
+{
+    t[i + 1] += t[i] >> bits;
+    t[i] &= (UINT64_C(1) << bits) - 1;
+}
+
+// Bring every limb back down to 26 / 25 bits, folding the carry out of h9 back in as 19 * 2^255 ≡ 19
+// Runs as two interleaved chains (h0 -> h4 and h4 -> h9) to halve the dependency depth
+static TARGET ALWAYS_INLINE void LANES_FN(carry)(vec_t *dst, vec_t *t)
+{
+    LANES_FN(carry_limb)(t, 0, 26);
+    LANES_FN(carry_limb)(t, 4, 26);
+    LANES_FN(carry_limb)(t, 1, 25);
+    LANES_FN(carry_limb)(t, 5, 25);
+    LANES_FN(carry_limb)(t, 2, 26);
+    LANES_FN(carry_limb)(t, 6, 26);
+    LANES_FN(carry_limb)(t, 3, 25);
+    LANES_FN(carry_limb)(t, 7, 25);
+    LANES_FN(carry_limb)(t, 4, 26);
+    LANES_FN(carry_limb)(t, 8, 26);
+    t[0] += LANES_FN(times19)(t[9] >> 25);
+    t[9] &= 0x1ffffff;
+    LANES_FN(carry_limb)(t, 0, 26);
+
+    memcpy(dst, t, 10 * sizeof(vec_t));
+}
+
+// Products of two odd limbs pick up an extra factor of 2 since 2^ceil(25.5i) · 2^ceil(25.5j) = 2 · 2^ceil(25.5(i + j))
+static TARGET void LANES_FN(multiply)(vec_t *dst, const vec_t *f, const vec_t *g)
+{
+    vec_t f2[10], g19[10], t[10];
+    for (size_t i = 0; i < 10; i++) {
+        f2[i] = f[i] << 1;
+        g19[i] = LANES_FN(times19)(g[i]);
+    }
+
+    t[0] = mul32(f[0], g[0]) + mul32(f2[1], g19[9]) + mul32(f[2], g19[8]) + mul32(f2[3], g19[7]) + mul32(f[4], g19[6]) + mul32(f2[5], g19[5]) + mul32(f[6], g19[4]) + mul32(f2[7], g19[3]) + mul32(f[8], g19[2]) + mul32(f2[9], g19[1]);
+    t[1] = mul32(f[0], g[1]) + mul32(f[1], g[0]) + mul32(f[2], g19[9]) + mul32(f[3], g19[8]) + mul32(f[4], g19[7]) + mul32(f[5], g19[6]) + mul32(f[6], g19[5]) + mul32(f[7], g19[4]) + mul32(f[8], g19[3]) + mul32(f[9], g19[2]);
+    t[2] = mul32(f[0], g[2]) + mul32(f2[1], g[1]) + mul32(f[2], g[0]) + mul32(f2[3], g19[9]) + mul32(f[4], g19[8]) + mul32(f2[5], g19[7]) + mul32(f[6], g19[6]) + mul32(f2[7], g19[5]) + mul32(f[8], g19[4]) + mul32(f2[9], g19[3]);
+    t[3] = mul32(f[0], g[3]) + mul32(f[1], g[2]) + mul32(f[2], g[1]) + mul32(f[3], g[0]) + mul32(f[4], g19[9]) + mul32(f[5], g19[8]) + mul32(f[6], g19[7]) + mul32(f[7], g19[6]) + mul32(f[8], g19[5]) + mul32(f[9], g19[4]);
+    t[4] = mul32(f[0], g[4]) + mul32(f2[1], g[3]) + mul32(f[2], g[2]) + mul32(f2[3], g[1]) + mul32(f[4], g[0]) + mul32(f2[5], g19[9]) + mul32(f[6], g19[8]) + mul32(f2[7], g19[7]) + mul32(f[8], g19[6]) + mul32(f2[9], g19[5]);
+    t[5] = mul32(f[0], g[5]) + mul32(f[1], g[4]) + mul32(f[2], g[3]) + mul32(f[3], g[2]) + mul32(f[4], g[1]) + mul32(f[5], g[0]) + mul32(f[6], g19[9]) + mul32(f[7], g19[8]) + mul32(f[8], g19[7]) + mul32(f[9], g19[6]);
+    t[6] = mul32(f[0], g[6]) + mul32(f2[1], g[5]) + mul32(f[2], g[4]) + mul32(f2[3], g[3]) + mul32(f[4], g[2]) + mul32(f2[5], g[1]) + mul32(f[6], g[0]) + mul32(f2[7], g19[9]) + mul32(f[8], g19[8]) + mul32(f2[9], g19[7]);
+    t[7] = mul32(f[0], g[7]) + mul32(f[1], g[6]) + mul32(f[2], g[5]) + mul32(f[3], g[4]) + mul32(f[4], g[3]) + mul32(f[5], g[2]) + mul32(f[6], g[1]) + mul32(f[7], g[0]) + mul32(f[8], g19[9]) + mul32(f[9], g19[8]);
+    t[8] = mul32(f[0], g[8]) + mul32(f2[1], g[7]) + mul32(f[2], g[6]) + mul32(f2[3], g[5]) + mul32(f[4], g[4]) + mul32(f2[5], g[3]) + mul32(f[6], g[2]) + mul32(f2[7], g[1]) + mul32(f[8], g[0]) + mul32(f2[9], g19[9]);
+    t[9] = mul32(f[0], g[9]) + mul32(f[1], g[8]) + mul32(f[2], g[7]) + mul32(f[3], g[6]) + mul32(f[4], g[5]) + mul32(f[5], g[4]) + mul32(f[6], g[3]) + mul32(f[7], g[2]) + mul32(f[8], g[1]) + mul32(f[9], g[0]);
+
+    LANES_FN(carry)(dst, t);
+}
+
+// Cross terms appear twice, leaving 55 of multiply()'s 100 products
+static TARGET void LANES_FN(square)(vec_t *dst, const vec_t *f)
+{
+    vec_t f2[10], f19[10], f38[10], t[10];
+    for (size_t i = 0; i < 10; i++) {
+        f2[i] = f[i] << 1;
+        f19[i] = LANES_FN(times19)(f[i]);
+        f38[i] = f19[i] << 1;
+    }
+
+    t[0] = mul32(f[0], f[0]) + mul32(f2[1], f38[9]) + mul32(f2[2], f19[8]) + mul32(f2[3], f38[7]) + mul32(f2[4], f19[6]) + mul32(f2[5], f19[5]);
+    t[1] = mul32(f2[0], f[1]) + mul32(f2[2], f19[9]) + mul32(f2[3], f19[8]) + mul32(f2[4], f19[7]) + mul32(f2[5], f19[6]);
+    t[2] = mul32(f2[0], f[2]) + mul32(f2[1], f[1]) + mul32(f2[3], f38[9]) + mul32(f2[4], f19[8]) + mul32(f2[5], f38[7]) + mul32(f[6], f19[6]);
+    t[3] = mul32(f2[0], f[3]) + mul32(f2[1], f[2]) + mul32(f2[4], f19[9]) + mul32(f2[5], f19[8]) + mul32(f2[6], f19[7]);
+    t[4] = mul32(f2[0], f[4]) + mul32(f2[1], f2[3]) + mul32(f[2], f[2]) + mul32(f2[5], f38[9]) + mul32(f2[6], f19[8]) + mul32(f2[7], f19[7]);
+    t[5] = mul32(f2[0], f[5]) + mul32(f2[1], f[4]) + mul32(f2[2], f[3]) + mul32(f2[6], f19[9]) + mul32(f2[7], f19[8]);
+    t[6] = mul32(f2[0], f[6]) + mul32(f2[1], f2[5]) + mul32(f2[2], f[4]) + mul32(f2[3], f[3]) + mul32(f2[7], f38[9]) + mul32(f[8], f19[8]);
+    t[7] = mul32(f2[0], f[7]) + mul32(f2[1], f[6]) + mul32(f2[2], f[5]) + mul32(f2[3], f[4]) + mul32(f2[8], f19[9]);
+    t[8] = mul32(f2[0], f[8]) + mul32(f2[1], f2[7]) + mul32(f2[2], f[6]) + mul32(f2[3], f2[5]) + mul32(f[4], f[4]) + mul32(f2[9], f19[9]);
+    t[9] = mul32(f2[0], f[9]) + mul32(f2[1], f[8]) + mul32(f2[2], f[7]) + mul32(f2[3], f[6]) + mul32(f2[4], f[5]);
+
+    LANES_FN(carry)(dst, t);
+}
+
+static TARGET void LANES_FN(square_n)(vec_t *dst, const vec_t *src, size_t n)
+{
+    LANES_FN(square)(dst, src);
+    while (--n) {
+        LANES_FN(square)(dst, dst);
+    }
+}
+
+// Multiply by (A - 2) / 4 = 121665
+static TARGET void LANES_FN(multiply_a24)(vec_t *dst, const vec_t *src)
+{
+    vec_t t[10];
+    for (size_t i = 0; i < 10; i++) {
+        t[i] = mul32(src[i], (vec_t){ 0 } + 121665);
+    }
+    LANES_FN(carry)(dst, t);
+}
+
+static TARGET void LANES_FN(add)(vec_t *dst, const vec_t *a, const vec_t *b)
+{
+    vec_t t[10];
+    for (size_t i = 0; i < 10; i++) {
+        t[i] = a[i] + b[i];
+    }
+    LANES_FN(carry)(dst, t);
+}
+
+// Add 4p before subtracting so limbs never wrap
+static TARGET void LANES_FN(subtract)(vec_t *dst, const vec_t *a, const vec_t *b)
+{
+    vec_t t[10];
+    t[0] = a[0] + 0xfffffb4 - b[0];
+    for (size_t i = 1; i < 10; i++) {
+        t[i] = a[i] + ((i & 1) ? 0x7fffffc : 0xffffffc) - b[i];
+    }
+    LANES_FN(carry)(dst, t);
+}
+
+// Conditionally swap the contents of a and b per lane, must be constant time
+static TARGET void LANES_FN(swap)(vec_t *restrict a, vec_t *restrict b, vec_t mask)
+{
+    for (size_t i = 0; i < 10; i++) {
+        const vec_t val = mask & (a[i] ^ b[i]);
+        a[i] ^= val;
+        b[i] ^= val;
+    }
+}
+
+// Same addition chain as the scalar inverse()
+static TARGET void LANES_FN(inverse)(vec_t *dst, const vec_t *src)
+{
+    vec_t a[10], b[10], c[10], t[10];
+
+    LANES_FN(square)(a, src);
+    LANES_FN(square_n)(t, a, 2);
+    LANES_FN(multiply)(b, t, src);
+    LANES_FN(multiply)(a, b, a);
+    LANES_FN(square)(t, a);
+    LANES_FN(multiply)(b, t, b);
+    LANES_FN(square_n)(t, b, 5);
+    LANES_FN(multiply)(b, t, b);
+    LANES_FN(square_n)(t, b, 10);
+    LANES_FN(multiply)(c, t, b);
+    LANES_FN(square_n)(t, c, 20);
+    LANES_FN(multiply)(t, t, c);
+    LANES_FN(square_n)(t, t, 10);
+    LANES_FN(multiply)(b, t, b);
+    LANES_FN(square_n)(t, b, 50);
+    LANES_FN(multiply)(c, t, b);
+    LANES_FN(square_n)(t, c, 100);
+    LANES_FN(multiply)(t, t, c);
+    LANES_FN(square_n)(t, t, 50);
+    LANES_FN(multiply)(t, t, b);
+    LANES_FN(square_n)(t, t, 5);
+    LANES_FN(multiply)(dst, t, a);
+}
+
+// LANES consecutive 32-byte keys in each of `public`, `secret`, and `basepoint`
+static TARGET void LANES_FN(x25519_lanes)(uint8_t *public, const uint8_t *secret, const uint8_t *basepoint)
+{
+    vec_t x1[10], x2[10] = { 0 }, z2[10] = { 0 }, x3[10], z3[10] = { 0 };
+    vec_t a[10], b[10], c[10], d[10];
+
+    uint64_t limbs[10];
+    for (size_t n = 0; n < LANES; n++) {
+        unpack_limbs(limbs, &basepoint[32 * n]);
+        for (size_t i = 0; i < 10; i++) {
+            x1[i][n] = limbs[i];
+        }
+    }
+    memcpy(x3, x1, sizeof(x1));
+    x2[0] += 1;
+    z3[0] += 1;
+
+    vec_t swap = { 0 };
+    for (int i = 254; i >= 0; i--) {
+        vec_t bit;
+        for (size_t n = 0; n < LANES; n++) {
+            bit[n] = (secret[32 * n + (i >> 3)] >> (i & 7)) & 1;
+        }
+        swap ^= bit;
+        LANES_FN(swap)(x2, x3, -swap);
+        LANES_FN(swap)(z2, z3, -swap);
+        swap = bit;
+
+        LANES_FN(add)(a, x2, z2);      // A = x2 + z2
+        LANES_FN(subtract)(b, x2, z2); // B = x2 - z2
+        LANES_FN(add)(c, x3, z3);      // C = x3 + z3
+        LANES_FN(subtract)(d, x3, z3); // D = x3 - z3
+        LANES_FN(multiply)(d, d, a);   // DA
+        LANES_FN(multiply)(c, c, b);   // CB
+        LANES_FN(square)(a, a);        // AA
+        LANES_FN(square)(b, b);        // BB
+
+        LANES_FN(add)(x3, d, c);
+        LANES_FN(square)(x3, x3);      // x3 = (DA + CB)^2
+        LANES_FN(subtract)(z3, d, c);
+        LANES_FN(square)(z3, z3);
+        LANES_FN(multiply)(z3, z3, x1); // z3 = x1 * (DA - CB)^2
+
+        LANES_FN(multiply)(x2, a, b);   // x2 = AA * BB
+        LANES_FN(subtract)(b, a, b);    // E = AA - BB
+        LANES_FN(multiply_a24)(c, b);
+        LANES_FN(add)(c, c, a);
+        LANES_FN(multiply)(z2, b, c);   // z2 = E * (AA + a24 * E)
+    }
+    LANES_FN(swap)(x2, x3, -swap);
+    LANES_FN(swap)(z2, z3, -swap);
+
+    LANES_FN(inverse)(z2, z2);
+    LANES_FN(multiply)(x2, x2, z2);
+
+    for (size_t n = 0; n < LANES; n++) {
+        for (size_t i = 0; i < 10; i++) {
+            limbs[i] = x2[i][n];
+        }
+        pack_limbs(&public[32 * n], limbs);
+    }
+}
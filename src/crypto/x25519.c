@@ -9,6 +9,9 @@
  * @ref https://martin.kleppmann.com/papers/curve25519.pdf
  * @ref https://cr.yp.to/ecdh.html
  * @ref https://cr.yp.to/ecdh/curve25519-20060209.pdf
+ * @ref https://github.com/agl/curve25519-donna
+ * @ref https://ed25519.cr.yp.to/ed25519-20110926.pdf
+ * @ref https://eprint.iacr.org/2008/522.pdf
  * @version 0.9.4
  * @date 2022-02-01
  *
@@ -17,6 +20,195 @@
  */
 
 #include "x25519.h"
+#include "x25519-table.h"
+
+// Use five 51-bit limbs whenever the compiler gives us a 64x64 -> 128-bit multiply
+// Define X25519_PORTABLE to force the sixteen 16-bit limb backend
+#if defined(__SIZEOF_INT128__) && !defined(X25519_PORTABLE)
+    #define X25519_RADIX51 1
+#else
+    #define X25519_RADIX51 0
+#endif
+
+const char *x25519_backend_name(void)
+{
+    return X25519_RADIX51 ? "radix51" : "portable";
+}
+
+#if X25519_RADIX51
+
+typedef unsigned __int128 uint128_t;
+
+// u0 + u1·2^51 + u2·2^102 + u3·2^153 + u4·2^204
+// Limbs are kept below 2^54 between operations, which leaves multiply() plenty
+// of headroom in its 128-bit accumulators
+typedef union field_t {
+    uint64_t q[5];
+} field_t;
+
+static const uint64_t mask51 = (UINT64_C(1) << 51) - 1;
+
+// Propagate the carries of five 128-bit column sums, folding the top carry back in as 19 * 2^255 ≡ 19
+static inline void carry_reduce_wide(field_t *dst, uint128_t *t)
+{
+    t[1] += (uint64_t)(t[0] >> 51);
+    t[2] += (uint64_t)(t[1] >> 51);
+    t[3] += (uint64_t)(t[2] >> 51);
+    t[4] += (uint64_t)(t[3] >> 51);
+
+    uint64_t r0 = ((uint64_t)t[0] & mask51) + 19 * (uint64_t)(t[4] >> 51);
+    uint64_t r1 = ((uint64_t)t[1] & mask51) + (r0 >> 51);
+
+    dst->q[0] = r0 & mask51;
+    dst->q[1] = r1;
+    dst->q[2] = (uint64_t)t[2] & mask51;
+    dst->q[3] = (uint64_t)t[3] & mask51;
+    dst->q[4] = (uint64_t)t[4] & mask51;
+}
+
+static inline void carry_reduce(field_t *dst)
+{
+    for (size_t i = 0; i < 4; i++) {
+        dst->q[i + 1] += dst->q[i] >> 51;
+        dst->q[i] &= mask51;
+    }
+    dst->q[0] += 19 * (dst->q[4] >> 51);
+    dst->q[4] &= mask51;
+}
+
+// Schoolbook product with the upper half pre-multiplied by 19 (2^255 ≡ 19 mod p)
+static inline void multiply(field_t *dst, const field_t *a, const field_t *b)
+{
+    const uint64_t a0 = a->q[0], a1 = a->q[1], a2 = a->q[2], a3 = a->q[3], a4 = a->q[4];
+    const uint64_t b0 = b->q[0], b1 = b->q[1], b2 = b->q[2], b3 = b->q[3], b4 = b->q[4];
+    const uint64_t b1_19 = 19 * b1, b2_19 = 19 * b2, b3_19 = 19 * b3, b4_19 = 19 * b4;
+
+    uint128_t t[5];
+    t[0] = (uint128_t)a0 * b0 + (uint128_t)a1 * b4_19 + (uint128_t)a2 * b3_19 + (uint128_t)a3 * b2_19 + (uint128_t)a4 * b1_19;
+    t[1] = (uint128_t)a0 * b1 + (uint128_t)a1 * b0 + (uint128_t)a2 * b4_19 + (uint128_t)a3 * b3_19 + (uint128_t)a4 * b2_19;
+    t[2] = (uint128_t)a0 * b2 + (uint128_t)a1 * b1 + (uint128_t)a2 * b0 + (uint128_t)a3 * b4_19 + (uint128_t)a4 * b3_19;
+    t[3] = (uint128_t)a0 * b3 + (uint128_t)a1 * b2 + (uint128_t)a2 * b1 + (uint128_t)a3 * b0 + (uint128_t)a4 * b4_19;
+    t[4] = (uint128_t)a0 * b4 + (uint128_t)a1 * b3 + (uint128_t)a2 * b2 + (uint128_t)a3 * b1 + (uint128_t)a4 * b0;
+
+    carry_reduce_wide(dst, t);
+}
+
+// Squaring only needs 15 of multiply()'s 25 products since the cross terms pair up
+static inline void square(field_t *dst, const field_t *src)
+{
+    const uint64_t a0 = src->q[0], a1 = src->q[1], a2 = src->q[2], a3 = src->q[3], a4 = src->q[4];
+    const uint64_t d0 = 2 * a0, d1 = 2 * a1;
+    const uint64_t d2_19 = 38 * a2, d3_19 = 38 * a3, a3_19 = 19 * a3, a4_19 = 19 * a4;
+
+    uint128_t t[5];
+    t[0] = (uint128_t)a0 * a0 + (uint128_t)d1 * a4_19 + (uint128_t)d2_19 * a3;
+    t[1] = (uint128_t)d0 * a1 + (uint128_t)d2_19 * a4 + (uint128_t)a3 * a3_19;
+    t[2] = (uint128_t)d0 * a2 + (uint128_t)a1 * a1 + (uint128_t)d3_19 * a4;
+    t[3] = (uint128_t)d0 * a3 + (uint128_t)d1 * a2 + (uint128_t)a4 * a4_19;
+    t[4] = (uint128_t)d0 * a4 + (uint128_t)d1 * a3 + (uint128_t)a2 * a2;
+
+    carry_reduce_wide(dst, t);
+}
+
+// Multiply by (A - 2) / 4 = 121665
+static inline void multiply_a24(field_t *dst, const field_t *src)
+{
+    uint128_t t[5];
+    for (size_t i = 0; i < 5; i++) {
+        t[i] = (uint128_t)src->q[i] * 121665;
+    }
+    carry_reduce_wide(dst, t);
+}
+
+static inline void add(field_t *dst, const field_t *a, const field_t *b)
+{
+    for (size_t i = 0; i < 5; i++) {
+        dst->q[i] = a->q[i] + b->q[i];
+    }
+}
+
+// Add 4p before subtracting so limbs never go negative (requires b < 2^53 per limb)
+static inline void subtract(field_t *dst, const field_t *a, const field_t *b)
+{
+    dst->q[0] = (a->q[0] + UINT64_C(0x1fffffffffffb4)) - b->q[0];
+    for (size_t i = 1; i < 5; i++) {
+        dst->q[i] = (a->q[i] + UINT64_C(0x1ffffffffffffc)) - b->q[i];
+    }
+}
+
+// Conditionally swap the contents of a and b, must be constant time
+static inline void swap(field_t *restrict a, field_t *restrict b, uint8_t bit)
+{
+    const uint64_t mask = 0 - (uint64_t)bit;
+    for (size_t i = 0; i < 5; i++) {
+        const uint64_t val = mask & (a->q[i] ^ b->q[i]);
+        a->q[i] ^= val;
+        b->q[i] ^= val;
+    }
+}
+
+static inline uint64_t load64_le(const uint8_t *src)
+{
+    uint64_t w = 0;
+    for (size_t i = 0; i < 8; i++) {
+        w |= (uint64_t)src[i] << (8 * i);
+    }
+    return w;
+}
+
+static inline void store64_le(uint8_t *dst, uint64_t w)
+{
+    for (size_t i = 0; i < 8; i++) {
+        dst[i] = (uint8_t)(w >> (8 * i));
+    }
+}
+
+// Convert to byte array
+static inline void pack(uint8_t *dst, const field_t *src)
+{
+    field_t t = *src;
+
+    // Ensure all limbs are in [0, 2^51 - 1] and the value is below 2^255
+    carry_reduce(&t);
+    carry_reduce(&t);
+
+    // Add 19 so that anything in [p, 2^255 - 1] carries out of bit 255
+    t.q[0] += 19;
+    carry_reduce(&t);
+
+    // Add 2^255 - 19 and drop the 2^255 to leave the canonical value in [0, p - 1]
+    t.q[0] += (UINT64_C(1) << 51) - 19;
+    for (size_t i = 1; i < 5; i++) {
+        t.q[i] += (UINT64_C(1) << 51) - 1;
+    }
+    for (size_t i = 0; i < 4; i++) {
+        t.q[i + 1] += t.q[i] >> 51;
+        t.q[i] &= mask51;
+    }
+    t.q[4] &= mask51;
+
+    store64_le(&dst[0x00], t.q[0] >> 0x00 | t.q[1] << 0x33);
+    store64_le(&dst[0x08], t.q[1] >> 0x0d | t.q[2] << 0x26);
+    store64_le(&dst[0x10], t.q[2] >> 0x1a | t.q[3] << 0x19);
+    store64_le(&dst[0x18], t.q[3] >> 0x27 | t.q[4] << 0x0c);
+}
+
+// Convert from byte array, ignoring the most-significant bit
+static inline void unpack(field_t *dst, const uint8_t *src)
+{
+    const uint64_t w0 = load64_le(&src[0x00]);
+    const uint64_t w1 = load64_le(&src[0x08]);
+    const uint64_t w2 = load64_le(&src[0x10]);
+    const uint64_t w3 = load64_le(&src[0x18]);
+
+    dst->q[0] = w0 & mask51;
+    dst->q[1] = (w0 >> 0x33 | w1 << 0x0d) & mask51;
+    dst->q[2] = (w1 >> 0x26 | w2 << 0x1a) & mask51;
+    dst->q[3] = (w2 >> 0x19 | w3 << 0x27) & mask51;
+    dst->q[4] = (w3 >> 0x0c) & mask51;
+}
+
+#else
 
 typedef union field_t {
     int64_t q[16];
@@ -38,16 +230,9 @@ static inline void carry_reduce(field_t *dst)
     }
 }
 
-static inline void multiply(field_t *dst, const field_t *a, const field_t *b)
+// Reduce the 510-bit result mod 2^256 - 38
+static inline void reduce_product(field_t *dst, int64_t *product)
 {
-    int64_t product[31] = { 0 };
-    for (size_t i = 0; i < 16; i++) {
-        for (size_t j = 0; j < 16; j++) {
-            product[i + j] += a->q[i] * b->q[j];
-        }
-    }
-
-    // Reduce the 510-bit result mod 2^256 - 38
     for (size_t i = 0; i < 15; i++) {
         product[i] += 38 * product[i + 16];
     }
@@ -58,52 +243,48 @@ static inline void multiply(field_t *dst, const field_t *a, const field_t *b)
     carry_reduce(dst);
 }
 
-static inline void square(field_t *dst, const field_t *src)
-{
-    multiply(dst, src, src);
-}
-
-// a^2i = a^i· a^i and a^2i+1 = a·a^i· ai
-// Compute a^i recursively, and then square a^i to obtain a^2i
-// If the exponent is odd, we additionally multiply the result with another copy of a to obtain a^2i+1
-static inline void inverse(field_t *dst, const field_t *src)
+static inline void multiply(field_t *dst, const field_t *a, const field_t *b)
 {
-    field_t elements = *src; // Initialize with src allows starting at bit 253
-
-    for (size_t i = 0; i < 254; i++) {
-        square(&elements, &elements);
-        if (i != 251 && i != 249) {
-            multiply(&elements, &elements, src);
+    int64_t product[31] = { 0 };
+    for (size_t i = 0; i < 16; i++) {
+        for (size_t j = 0; j < 16; j++) {
+            product[i + j] += a->q[i] * b->q[j];
         }
     }
-    *dst = elements;
+    reduce_product(dst, product);
 }
 
-static inline void add(field_t *dst, const field_t *a, const field_t *b)
+// Cross terms appear twice, so only the upper triangle needs to be computed
+static inline void square(field_t *dst, const field_t *src)
 {
+    int64_t product[31] = { 0 };
     for (size_t i = 0; i < 16; i++) {
-        dst->q[i] = a->q[i] + b->q[i];
+        product[2 * i] += src->q[i] * src->q[i];
+        for (size_t j = i + 1; j < 16; j++) {
+            product[i + j] += 2 * src->q[i] * src->q[j];
+        }
     }
+    reduce_product(dst, product);
 }
 
-static inline void add_inplace(field_t *restrict a, const field_t *restrict b)
+// Multiply by (A - 2) / 4 = 121665
+static inline void multiply_a24(field_t *dst, const field_t *src)
 {
-    for (size_t i = 0; i < 16; i++) {
-        a->q[i] += b->q[i];
-    }
+    static const field_t c1db41 = { .q = { 0xdb41, 0x0001 } }; // 121665
+    multiply(dst, src, &c1db41);
 }
 
-static inline void subtract(field_t *dst, const field_t *a, const field_t *b)
+static inline void add(field_t *dst, const field_t *a, const field_t *b)
 {
     for (size_t i = 0; i < 16; i++) {
-        dst->q[i] = a->q[i] - b->q[i];
+        dst->q[i] = a->q[i] + b->q[i];
     }
 }
 
-static inline void subtract_inplace(field_t *restrict a, const field_t *restrict b)
+static inline void subtract(field_t *dst, const field_t *a, const field_t *b)
 {
     for (size_t i = 0; i < 16; i++) {
-        a->q[i] -= b->q[i];
+        dst->q[i] = a->q[i] - b->q[i];
     }
 }
 
@@ -156,25 +337,63 @@ static inline void unpack(field_t *dst, const uint8_t *src)
     dst->q[15] &= 0x7fff;
 }
 
+#endif
+
+static inline void square_n(field_t *dst, const field_t *src, size_t n)
+{
+    square(dst, src);
+    while (--n) {
+        square(dst, dst);
+    }
+}
+
+// Fermat inversion, a^(p - 2) = a^(2^255 - 21)
+// The addition chain below takes 254 squarings but only 11 multiplications
+static inline void inverse(field_t *dst, const field_t *src)
+{
+    field_t a, b, c, t;
+
+    square(&a, src);           // 2
+    square_n(&t, &a, 2);       // 8
+    multiply(&b, &t, src);     // 9
+    multiply(&a, &b, &a);      // 11
+    square(&t, &a);            // 22
+    multiply(&b, &t, &b);      // 2^5 - 2^0
+    square_n(&t, &b, 5);       // 2^10 - 2^5
+    multiply(&b, &t, &b);      // 2^10 - 2^0
+    square_n(&t, &b, 10);      // 2^20 - 2^10
+    multiply(&c, &t, &b);      // 2^20 - 2^0
+    square_n(&t, &c, 20);      // 2^40 - 2^20
+    multiply(&t, &t, &c);      // 2^40 - 2^0
+    square_n(&t, &t, 10);      // 2^50 - 2^10
+    multiply(&b, &t, &b);      // 2^50 - 2^0
+    square_n(&t, &b, 50);      // 2^100 - 2^50
+    multiply(&c, &t, &b);      // 2^100 - 2^0
+    square_n(&t, &c, 100);     // 2^200 - 2^100
+    multiply(&t, &t, &c);      // 2^200 - 2^0
+    square_n(&t, &t, 50);      // 2^250 - 2^50
+    multiply(&t, &t, &b);      // 2^250 - 2^0
+    square_n(&t, &t, 5);       // 2^255 - 2^5
+    multiply(dst, &t, &a);     // 2^255 - 21
+}
+
 void x25519(uint8_t *public, const uint8_t *secret, const uint8_t *basepoint)
 {
     // Using a local copy of the secret key
     uint8_t private_key[32];
     memcpy(private_key, secret, 32);
 
-    int64_t x[80];
-    unpack((field_t *)&x[0], basepoint);
+    field_t x;
+    unpack(&x, basepoint);
 
     field_t inputs[4] = { 0 }; // a, b, c, and d
 
     inputs[0].q[0] = 1;
-    memcpy(&inputs[1], &x[0], 128);
+    inputs[1] = x;
     inputs[3].q[0] = 1;
 
     field_t intermediate[2]; // e and f
 
-    static const field_t c1db41 = { .q = { 0xdb41, 0x0001 } }; // 121665
-
     // Infamous Montgomery ladder
     for (int64_t i = 254; i >= 0; i--) {
         const uint8_t bit = (private_key[i / 8] >> (i & 7ul)) & 1ul;
@@ -187,13 +406,13 @@ void x25519(uint8_t *public, const uint8_t *secret, const uint8_t *basepoint)
         add(&intermediate[0], &inputs[0], &inputs[2]);
 
         // v2 = a - c
-        subtract_inplace(&inputs[0], &inputs[2]);
+        subtract(&inputs[0], &inputs[0], &inputs[2]);
 
         // v3 = b + d
         add(&inputs[2], &inputs[1], &inputs[3]);
 
         // v4  = b - d
-        subtract_inplace(&inputs[1], &inputs[3]);
+        subtract(&inputs[1], &inputs[1], &inputs[3]);
 
         // v5 = v1**2 = (a + c)**2
         square(&inputs[3], &intermediate[0]);
@@ -211,7 +430,7 @@ void x25519(uint8_t *public, const uint8_t *secret, const uint8_t *basepoint)
         add(&intermediate[0], &inputs[0], &inputs[2]);
 
         // v10 = v7 - v8 = 2(ad - bc)
-        subtract_inplace(&inputs[0], &inputs[2]);
+        subtract(&inputs[0], &inputs[0], &inputs[2]);
 
         // v11 = v10**2 = 4(ad - bc)**2
         square(&inputs[1], &inputs[0]);
@@ -220,10 +439,10 @@ void x25519(uint8_t *public, const uint8_t *secret, const uint8_t *basepoint)
         subtract(&inputs[2], &inputs[3], &intermediate[1]);
 
         // v13 = 121665*v12 = 486660ac  = (A - 2)ac
-        multiply(&inputs[0], &inputs[2], &c1db41);
+        multiply_a24(&inputs[0], &inputs[2]);
 
         // v14 = v13 + v5 = a**2 + Aac + c**2
-        add_inplace(&inputs[0], &inputs[3]);
+        add(&inputs[0], &inputs[0], &inputs[3]);
 
         // v15 = v12*v14 = 4ac(a**2 + Aac + c**2)
         multiply(&inputs[2], &inputs[2], &inputs[0]);
@@ -232,7 +451,7 @@ void x25519(uint8_t *public, const uint8_t *secret, const uint8_t *basepoint)
         multiply(&inputs[0], &inputs[3], &intermediate[1]);
 
         // v17 = v11*x = 4x(ad - bc)**2
-        multiply(&inputs[3], &inputs[1], (field_t *)&x[0]);
+        multiply(&inputs[3], &inputs[1], &x);
 
         // v18 = v9**2 = 4(ab - cd)**2
         square(&inputs[1], &intermediate[0]);
@@ -241,14 +460,154 @@ void x25519(uint8_t *public, const uint8_t *secret, const uint8_t *basepoint)
         swap(&inputs[2], &inputs[3], bit);
     }
 
-    memcpy(&x[0x10], &inputs[0], 128);
-    memcpy(&x[0x20], &inputs[2], 128);
-    memcpy(&x[0x30], &inputs[1], 128);
-    memcpy(&x[0x40], &inputs[3], 128);
+    // Back to affine, x = a / c
+    inverse(&inputs[2], &inputs[2]);
+    multiply(&inputs[0], &inputs[0], &inputs[2]);
+    pack(public, &inputs[0]);
+}
+
+/**
+ * @section Fixed-base scalar multiplication
+ *
+ * Curve25519 is birationally equivalent to the twisted Edwards curve
+ * -x^2 + y^2 = 1 + dx^2y^2 via u = (1 + y) / (1 - y), and the Edwards base point
+ * (y = 4/5) maps to u = 9. Since the base point never changes, its multiples
+ * can be tabulated and k·B reduced to 64 table lookups, 64 additions and 4 doublings
+ */
+
+// Extended coordinates, x = X/Z, y = Y/Z, xy = T/Z
+typedef struct point_t {
+    field_t x, y, z, t;
+} point_t;
 
-    inverse((field_t *)&x[0x20], (field_t *)&x[0x20]);
+// Affine precomputed point, (y + x, y - x, 2dxy)
+typedef struct niels_t {
+    field_t yplusx, yminusx, xy2d;
+} niels_t;
 
-    multiply((field_t *)&x[0x10], (field_t *)&x[0x10], (field_t *)&x[0x20]);
+static const field_t zero = { 0 };
 
-    pack(public, (field_t *)&x[0x10]);
-}
\ No newline at end of file
+static inline uint8_t equal(uint8_t a, uint8_t b)
+{
+    return (uint8_t)(((uint32_t)(a ^ b) - 1) >> 31);
+}
+
+// Load ±|b|·256^pos·B from the table without branching or indexing on `b`
+static void select_niels(niels_t *dst, size_t pos, int8_t b)
+{
+    const uint8_t negative = (uint8_t)b >> 7;
+    const uint8_t babs = (uint8_t)(b - ((-negative & b) * 2));
+
+    uint64_t w[12] = { 1, 0, 0, 0, 1 }; // Neutral element, (1, 1, 0)
+    for (size_t i = 0; i < 8; i++) {
+        const uint64_t mask = 0 - (uint64_t)equal(babs, (uint8_t)(i + 1));
+        for (size_t j = 0; j < 12; j++) {
+            w[j] ^= mask & (w[j] ^ base_comb[pos][i][j]);
+        }
+    }
+
+    uint8_t bytes[96];
+    for (size_t i = 0; i < 96; i++) {
+        bytes[i] = (uint8_t)(w[i / 8] >> (8 * (i % 8)));
+    }
+    unpack(&dst->yplusx, &bytes[0x00]);
+    unpack(&dst->yminusx, &bytes[0x20]);
+    unpack(&dst->xy2d, &bytes[0x40]);
+
+    // -(x, y) = (-x, y), so swap y + x with y - x and negate 2dxy
+    field_t minus_xy2d;
+    subtract(&minus_xy2d, &zero, &dst->xy2d);
+    swap(&dst->yplusx, &dst->yminusx, negative);
+    swap(&dst->xy2d, &minus_xy2d, negative);
+}
+
+// r = p + q (madd-2008-hwcd-3 with Z2 = 1)
+static void point_add(point_t *r, const point_t *p, const niels_t *q)
+{
+    field_t a, b, c, d, e, f, g, h;
+
+    subtract(&a, &p->y, &p->x);
+    multiply(&a, &a, &q->yminusx);
+    add(&b, &p->y, &p->x);
+    multiply(&b, &b, &q->yplusx);
+    multiply(&c, &p->t, &q->xy2d);
+    add(&d, &p->z, &p->z);
+
+    subtract(&e, &b, &a);
+    subtract(&f, &d, &c);
+    add(&g, &d, &c);
+    add(&h, &b, &a);
+
+    multiply(&r->x, &e, &f);
+    multiply(&r->y, &g, &h);
+    multiply(&r->t, &e, &h);
+    multiply(&r->z, &f, &g);
+}
+
+// r = 2p (dbl-2008-hwcd with a = -1)
+static void point_double(point_t *r, const point_t *p)
+{
+    field_t a, b, c, e, f, g, h;
+
+    square(&a, &p->x);
+    square(&b, &p->y);
+    square(&c, &p->z);
+    add(&c, &c, &c);
+    add(&h, &a, &b);
+
+    add(&e, &p->x, &p->y);
+    square(&e, &e);
+    subtract(&e, &e, &h);    // E = (X + Y)^2 - A - B
+    subtract(&g, &b, &a);    // G = B - A
+    subtract(&f, &g, &c);    // F = G - C
+    subtract(&h, &zero, &h); // H = -A - B
+
+    multiply(&r->x, &e, &f);
+    multiply(&r->y, &g, &h);
+    multiply(&r->t, &e, &h);
+    multiply(&r->z, &f, &g);
+}
+
+void x25519_base(uint8_t *public, const uint8_t *secret)
+{
+    // Recode the scalar into 64 signed radix-16 digits in [-8, 8]
+    int8_t e[64];
+    for (size_t i = 0; i < 32; i++) {
+        e[2 * i + 0] = (int8_t)((secret[i] >> 0) & 15);
+        e[2 * i + 1] = (int8_t)((secret[i] >> 4) & 15);
+    }
+    e[63] &= 7; // Bit 255 is ignored by the ladder as well
+
+    int8_t carry = 0;
+    for (size_t i = 0; i < 63; i++) {
+        e[i] += carry;
+        carry = (int8_t)((e[i] + 8) >> 4);
+        e[i] -= (int8_t)(carry * 16);
+    }
+    e[63] += carry;
+
+    // Sum the odd digits, shift up by 16, then sum the even digits
+    point_t h = { .y.q[0] = 1, .z.q[0] = 1 };
+    niels_t t;
+    for (size_t i = 1; i < 64; i += 2) {
+        select_niels(&t, i / 2, e[i]);
+        point_add(&h, &h, &t);
+    }
+
+    for (size_t i = 0; i < 4; i++) {
+        point_double(&h, &h);
+    }
+
+    for (size_t i = 0; i < 64; i += 2) {
+        select_niels(&t, i / 2, e[i]);
+        point_add(&h, &h, &t);
+    }
+
+    // Back to Montgomery form, u = (1 + y) / (1 - y) = (Z + Y) / (Z - Y)
+    field_t u, v;
+    add(&u, &h.z, &h.y);
+    subtract(&v, &h.z, &h.y);
+    inverse(&v, &v);
+    multiply(&u, &u, &v);
+    pack(public, &u);
+}
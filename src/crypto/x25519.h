@@ -11,10 +11,47 @@
 
 #pragma once
 
+#include <stdbool.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 
+typedef enum x25519_batch_backend_t {
+    X25519_BATCH_BACKEND_SCALAR,
+    X25519_BATCH_BACKEND_AVX2,
+    X25519_BATCH_BACKEND_AVX512,
+} x25519_batch_backend_t;
+
+/**
+ * @brief Field arithmetic `x25519()` and `x25519_base()` were built with, chosen at compile time
+ *
+ * @return "radix51" or "portable"
+ */
+const char *x25519_backend_name(void);
+
+/**
+ * @brief Widest vector unit `x25519_batch()` runs on, picked on first use from the CPU's features
+ *
+ * @return Selected backend
+ */
+x25519_batch_backend_t x25519_batch_get_backend(void);
+
+/**
+ * @brief Override the backend chosen by `x25519_batch_get_backend()`, for benchmarking
+ *
+ * @param[in] selected backend to use from now on
+ * @return false if `selected` is unavailable on this machine
+ */
+bool x25519_batch_set_backend(x25519_batch_backend_t selected);
+
+/**
+ * @brief Human-readable name of an x25519_batch backend
+ *
+ * @param[in] backend backend returned by `x25519_batch_get_backend()`
+ * @return "avx512", "avx2", or "scalar"
+ */
+const char *x25519_batch_backend_name(x25519_batch_backend_t backend);
+
 /**
  * @brief X25519 Elliptic-Curve Diffie-Hellman
  *
@@ -24,3 +61,24 @@
  *
  */
 void x25519(uint8_t *public, const uint8_t *secret, const uint8_t *basepoint);
+
+/**
+ * @brief X25519 with the fixed base point { 9 }, equivalent to but several
+ * times faster than `x25519(public, secret, basepoint)`
+ *
+ * @param[out] public 32-byte public key
+ * @param[in] secret 32-byte secret key
+ *
+ */
+void x25519_base(uint8_t *public, const uint8_t *secret);
+
+/**
+ * @brief `count` independent X25519 operations, run across AVX2 / AVX-512 lanes when available
+ *
+ * @param[out] public `count` consecutive 32-byte public keys / shared secrets
+ * @param[in] secret `count` consecutive 32-byte secret keys
+ * @param[in] basepoint `count` consecutive 32-byte basepoints / their_public
+ * @param[in] count Number of key pairs
+ *
+ */
+void x25519_batch(uint8_t *public, const uint8_t *secret, const uint8_t *basepoint, size_t count);
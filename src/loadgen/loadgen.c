@@ -0,0 +1,853 @@
+/**
+ * @file loadgen.c
+ * @author Jason Conway (jpc@jasonconway.dev)
+ * @brief Loopback load generator for parceld built on the parcel client
+ * @version 0.9.4
+ * @date 2025-01-12
+ *
+ * @copyright Copyright (c) 2025 Jason Conway. All rights reserved.
+ *
+ * N headless clients join a daemon, exchange timestamped text and file wires at a fixed
+ * rate, then leave one at a time. Every join and leave triggers a group rekey, which the
+ * first client to join (and last to leave) times. Files larger than FILE_CHUNK_SIZE go
+ * through transmit_file() as chunked transfers, and an extra client can churn through the
+ * group mid-traffic so rekeys land while they're under way. The results are printed as JSON
+ */
+
+#include "client.h"
+#include "cable.h"
+#include "csprng.h"
+#include "log.h"
+#include "wire-batch.h"
+#include "wire-ctrl.h"
+#include "wire-file.h"
+#include "wire-text.h"
+#include "xplatform.h"
+#include "xutils.h"
+
+enum LoadgenDefaults {
+    LOADGEN_CLIENTS = 10,
+    LOADGEN_CLIENTS_MAX = FD_SETSIZE - 24, // leave the daemon and this process a few descriptors
+    LOADGEN_SECONDS = 10,
+    LOADGEN_RATE = 100,               // messages per second across all clients
+    LOADGEN_TEXT_SIZE = 64,
+    LOADGEN_TEXT_SIZE_MIN = 48,       // room for the embedded timestamp
+    LOADGEN_FILE_SIZE = 1 << 16,
+    LOADGEN_SENDERS_MAX = 8,
+    LOADGEN_DRAIN_MS = 2000,          // how long stragglers are waited on after sending stops
+    LOADGEN_STACK_SIZE = 1 << 19,
+    LOADGEN_REKEYS_MAX = 2 * LOADGEN_CLIENTS_MAX,
+};
+
+// Log-linear latency histogram: exact below 8 ns, then 8 buckets per power of two (< 12.5% error)
+enum Histogram {
+    HIST_SUB_BUCKETS = 8,
+    HIST_BUCKETS = (64 - 2) * HIST_SUB_BUCKETS,
+};
+
+typedef struct histogram_t {
+    uint64_t buckets[HIST_BUCKETS];
+    uint64_t count;
+    uint64_t max;
+} histogram_t;
+
+typedef enum phase_t {
+    PHASE_JOIN,
+    PHASE_TRAFFIC,
+    PHASE_LEAVE,
+} phase_t;
+
+typedef struct rekey_t {
+    phase_t phase;
+    size_t members;
+    uint64_t ns;
+} rekey_t;
+
+typedef struct loadgen_t loadgen_t;
+
+// A chunked file being received, delivered once all `size` bytes are in
+typedef struct lg_transfer_t {
+    uint32_t id;
+    uint64_t sent;
+    size_t size;
+    size_t received;
+} lg_transfer_t;
+
+typedef struct lg_client_t {
+    client_t client;
+    loadgen_t *lg;
+    size_t id;
+    pthread_t thread;
+    bool started;
+    atomic_bool connected;
+    atomic_bool failed;
+    atomic_size_t members;   // group size as of this client's latest completed rekey
+    atomic_size_t delivered; // timestamped wires received
+    uint64_t handshake_ns;
+    size_t delivered_bytes;
+    histogram_t text_latency;
+    histogram_t file_latency;
+    lg_transfer_t transfers[FILE_TRANSFERS_MAX];
+} lg_client_t;
+
+struct loadgen_t {
+    char address[ADDRESS_MAX_LENGTH];
+    char port[PORT_MAX_LENGTH];
+    size_t count;
+    size_t seconds;
+    size_t rate;
+    size_t text_size;
+    size_t file_size;
+    size_t file_percent;
+    size_t batch_ms;
+    bool churn;
+    char dir[64];          // chunked files are written here before they're sent
+    uint8_t *file_data;    // contents of every chunked file
+    lg_client_t *clients;  // `count` of them, plus the churning client last
+    atomic_int phase;
+    atomic_bool sending;
+    pthread_mutex_t lock; // guards `rekeys`
+    rekey_t rekeys[LOADGEN_REKEYS_MAX];
+    size_t rekey_count;
+};
+
+typedef struct lg_sender_t {
+    loadgen_t *lg;
+    size_t first;  // index of the first client this sender drives
+    size_t stride; // number of senders
+    pthread_t thread;
+    size_t sent_text;
+    size_t sent_file;
+    size_t bytes;
+} lg_sender_t;
+
+/**
+ * @section Histograms
+ */
+
+static size_t hist_bucket(uint64_t v)
+{
+    if (v < HIST_SUB_BUCKETS) {
+        return (size_t)v;
+    }
+    const size_t msb = 63 - (size_t)__builtin_clzll(v);
+    return (msb - 2) * HIST_SUB_BUCKETS + (size_t)((v >> (msb - 3)) & (HIST_SUB_BUCKETS - 1));
+}
+
+// Smallest value that lands in bucket `b`
+static uint64_t hist_lower(size_t b)
+{
+    if (b < HIST_SUB_BUCKETS) {
+        return b;
+    }
+    const size_t msb = b / HIST_SUB_BUCKETS + 2;
+    return (uint64_t)(HIST_SUB_BUCKETS + b % HIST_SUB_BUCKETS) << (msb - 3);
+}
+
+static void hist_record(histogram_t *h, uint64_t v)
+{
+    h->buckets[hist_bucket(v)]++;
+    h->count++;
+    h->max = MAX(h->max, v);
+}
+
+static void hist_merge(histogram_t *dst, const histogram_t *src)
+{
+    for (size_t i = 0; i < HIST_BUCKETS; i++) {
+        dst->buckets[i] += src->buckets[i];
+    }
+    dst->count += src->count;
+    dst->max = MAX(dst->max, src->max);
+}
+
+static uint64_t hist_percentile(const histogram_t *h, double p)
+{
+    const uint64_t rank = (uint64_t)(p * (double)h->count);
+    uint64_t seen = 0;
+    for (size_t i = 0; i < HIST_BUCKETS; i++) {
+        seen += h->buckets[i];
+        if (seen > rank) {
+            return MIN(hist_lower(i + 1) - 1, h->max);
+        }
+    }
+    return h->max;
+}
+
+static void print_hist(const char *name, const histogram_t *h)
+{
+    printf("    \"%s\": {\"count\": %" PRIu64, name, h->count);
+    if (h->count) {
+        printf(", \"p50\": %.1f, \"p90\": %.1f, \"p99\": %.1f, \"p999\": %.1f, \"max\": %.1f, \"histogram\": [",
+            hist_percentile(h, 0.5) / 1e3, hist_percentile(h, 0.9) / 1e3, hist_percentile(h, 0.99) / 1e3,
+            hist_percentile(h, 0.999) / 1e3, h->max / 1e3);
+        bool first = true;
+        for (size_t i = 0; i < HIST_BUCKETS; i++) {
+            if (h->buckets[i]) {
+                printf("%s[%.1f, %" PRIu64 "]", first ? "" : ", ", hist_lower(i) / 1e3, h->buckets[i]);
+                first = false;
+            }
+        }
+        printf("]");
+    }
+    printf("}");
+}
+
+/**
+ * @section Clients
+ */
+
+static void record_rekey(loadgen_t *lg, size_t members, uint64_t ns)
+{
+    pthread_mutex_lock(&lg->lock);
+    if (lg->rekey_count < LOADGEN_REKEYS_MAX) {
+        lg->rekeys[lg->rekey_count++] = (rekey_t) {
+            .phase = (phase_t)atomic_load(&lg->phase),
+            .members = members,
+            .ns = ns,
+        };
+    }
+    pthread_mutex_unlock(&lg->lock);
+    fprintf(stderr, "rekey: %zu members in %.2f ms\n", members, (double)ns / 1e6);
+}
+
+// Same as proc_ctrl() in the interactive client, minus announcing the connection
+static bool lg_proc_ctrl(loadgen_t *lg, lg_client_t *c, wire_t *wire, uint64_t start)
+{
+    ctrl_msg_view_t ctrl;
+    if (!ctrl_msg_view(&ctrl, wire->data, wire_get_data_length(wire))) {
+        log_fatal("client %zu: malformed ctrl message", c->id);
+        return false;
+    }
+    if (ctrl_msg_get_type(ctrl.msg) == CTRL_STALE) {
+        c->client.stale = true;
+        return true;
+    }
+    if (ctrl.data_len < KEY_LEN) {
+        log_fatal("client %zu: malformed ctrl message", c->id);
+        return false;
+    }
+    const size_t rounds = ctrl_msg_get_cnt(ctrl.msg);
+
+    // Nothing else goes out until the exchange is done and the new keys are in place
+    pthread_mutex_lock(&c->client.send_lock);
+    uint8_t session[KEY_LEN] = { 0 };
+    if (ctrl_msg_get_type(ctrl.msg) == CTRL_DHKE && !n_party_client(c->client.socket, session, rounds)) {
+        pthread_mutex_unlock(&c->client.send_lock);
+        log_fatal("client %zu: n-party key exchange failure (%zu rounds)", c->id, rounds);
+        return false;
+    }
+
+    keys_t k = { 0 };
+    client_get_keys(&c->client, &k);
+    memcpy(k.ctrl, ctrl.data, KEY_LEN);
+    memcpy(k.session, session, KEY_LEN);
+    client_set_keys(&c->client, &k);
+    pthread_mutex_unlock(&c->client.send_lock);
+    memset(session, 0, KEY_LEN);
+
+    if (!c->id) {
+        record_rekey(lg, rounds + 1, xclock_ns() - start);
+    }
+    atomic_store(&c->members, rounds + 1);
+    return true;
+}
+
+// Text messages lead with "<scheduled send time> <sender>"
+static void lg_proc_text(lg_client_t *c, const void *data, size_t len, uint64_t now)
+{
+    text_msg_view_t text;
+    if (!text_msg_view(&text, data, len)) {
+        return;
+    }
+    const uint64_t sent = strtoull((const char *)text.data, NULL, 10);
+    if (sent && sent <= now) {
+        hist_record(&c->text_latency, now - sent);
+        c->delivered_bytes += text.data_len;
+        atomic_fetch_add(&c->delivered, 1);
+    }
+}
+
+// Text batched by the sender is timed message by message
+static void lg_proc_batch(lg_client_t *c, wire_t *wire, uint64_t now)
+{
+    batch_msg_view_t batch;
+    if (!batch_msg_view(&batch, wire->data, wire_get_data_length(wire))) {
+        return;
+    }
+    size_t at = 0;
+    batch_entry_t entry;
+    for (size_t i = batch_msg_get_count(batch.msg); i && batch_entry_next(batch.data, batch.data_len, &at, &entry); i--) {
+        if (entry.type == TYPE_TEXT) {
+            lg_proc_text(c, entry.msg, entry.len, now);
+        }
+    }
+}
+
+static void lg_file_delivered(lg_client_t *c, uint64_t sent, size_t size, uint64_t now)
+{
+    hist_record(&c->file_latency, now - sent);
+    c->delivered_bytes += size;
+    atomic_fetch_add(&c->delivered, 1);
+}
+
+// File wires carry the same tag as their filename. A chunked file is timed to its last chunk
+static void lg_proc_file(lg_client_t *c, wire_t *wire, uint64_t now)
+{
+    file_msg_view_t file;
+    char filename[FILE_NAME_LEN + 1] = { 0 };
+    if (!file_msg_view(&file, wire->data, wire_get_data_length(wire)) || !file_msg_get_filename(&file, filename)) {
+        return;
+    }
+    const uint64_t sent = strtoull(filename, NULL, 10);
+    if (!sent || sent > now) {
+        return;
+    }
+    const uint32_t id = file_msg_get_id(file.msg);
+    if (!id) {
+        lg_file_delivered(c, sent, file.data_len, now);
+        return;
+    }
+    for (size_t i = 0; i < FILE_TRANSFERS_MAX; i++) {
+        if (!c->transfers[i].id) {
+            c->transfers[i] = (lg_transfer_t) { .id = id, .sent = sent, .size = file_msg_get_size(file.msg), .received = file.data_len };
+            return;
+        }
+    }
+    log_fatal("client %zu: too many chunked transfers at once", c->id);
+}
+
+// Chunks have to arrive in order and decrypt, so one sealed with a stale key is a lost file
+static void lg_proc_file_chunk(lg_client_t *c, wire_t *wire, uint64_t now)
+{
+    file_chunk_msg_view_t chunk;
+    if (!file_chunk_msg_view(&chunk, wire->data, wire_get_data_length(wire))) {
+        return;
+    }
+    const uint32_t id = file_chunk_msg_get_id(chunk.msg);
+    for (size_t i = 0; i < FILE_TRANSFERS_MAX; i++) {
+        lg_transfer_t *t = &c->transfers[i];
+        if (t->id != id) {
+            continue;
+        }
+        if (file_chunk_msg_get_offset(chunk.msg) != t->received || chunk.data_len > t->size - t->received) {
+            log_fatal("client %zu: chunk of transfer %08x out of order", c->id, id);
+            *t = (lg_transfer_t) { 0 };
+            return;
+        }
+        t->received += chunk.data_len;
+        if (t->received == t->size) {
+            lg_file_delivered(c, t->sent, t->size, now);
+            *t = (lg_transfer_t) { 0 };
+        }
+        return;
+    }
+}
+
+// Connect, then handle wires until the socket is shut down
+static void *client_thread(void *arg)
+{
+    lg_client_t *c = arg;
+    loadgen_t *lg = c->lg;
+
+    const uint64_t start = xclock_ns();
+    if (!connect_server(&c->client, lg->address, lg->port)) {
+        atomic_store(&c->failed, true);
+        return NULL;
+    }
+    c->handshake_ns = xclock_ns() - start;
+    if (!client_batch_start(&c->client, lg->batch_ms)) {
+        atomic_store(&c->failed, true);
+        return NULL;
+    }
+    atomic_store(&c->connected, true);
+
+    cable_buffer_t buf = { 0 };
+    for (;;) {
+        keys_t keys = { 0 };
+        client_get_keys(&c->client, &keys);
+        const wire_key_t *session = c->client.stale ? &keys.stale_wire : &keys.session_wire;
+        c->client.stale = false;
+        bool decrypted = false;
+        cable_t *cable = recv_cable_decrypt(c->client.socket, &buf, session, &keys.ctrl_wire, &decrypted);
+        const uint64_t now = xclock_ns();
+        if (!cable) {
+            break;
+        }
+        if (!decrypted) {
+            log_fatal("client %zu: wire decryption error", c->id);
+            continue;
+        }
+
+        size_t len = 0;
+        wire_t *wire = get_cabled_wire(cable, &len);
+        wire_t *inflated = NULL;
+        if (wire_get_flags(wire) & WIRE_FLAG_COMPRESSED) {
+            if (!(inflated = wire_decompress(wire))) {
+                continue;
+            }
+            wire = inflated;
+        }
+        bool ok = true;
+        switch (wire_get_type(wire)) {
+            case TYPE_CTRL:
+                ok = lg_proc_ctrl(lg, c, wire, now);
+                break;
+            case TYPE_TEXT:
+                lg_proc_text(c, wire->data, wire_get_data_length(wire), now);
+                break;
+            case TYPE_BATCH:
+                lg_proc_batch(c, wire, now);
+                break;
+            case TYPE_FILE:
+                lg_proc_file(c, wire, now);
+                break;
+            case TYPE_FILE_CHUNK:
+                lg_proc_file_chunk(c, wire, now);
+                break;
+            default:
+                break;
+        }
+        free_wire(inflated);
+        if (!ok) {
+            atomic_store(&c->failed, true);
+            break;
+        }
+    }
+    cable_buffer_free(&buf);
+    return NULL;
+}
+
+static bool spawn_client(loadgen_t *lg, lg_client_t *c, size_t id)
+{
+    c->lg = lg;
+    c->id = id;
+    snprintf(c->client.username, sizeof(c->client.username), "loadgen-%zu", id);
+    atomic_store(&c->client.keep_alive, true);
+    pthread_mutex_init(&c->client.lock, NULL);
+    pthread_mutex_init(&c->client.send_lock, NULL);
+
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setstacksize(&attr, LOADGEN_STACK_SIZE);
+    c->started = !pthread_create(&c->thread, &attr, client_thread, c);
+    pthread_attr_destroy(&attr);
+    return c->started;
+}
+
+// Wait until the first `count` clients have all finished the rekey for a group of `count`
+static bool wait_keyed(loadgen_t *lg, size_t count)
+{
+    for (;;) {
+        size_t keyed = 0;
+        for (size_t i = 0; i < count; i++) {
+            if (atomic_load(&lg->clients[i].failed)) {
+                return false;
+            }
+            keyed += atomic_load(&lg->clients[i].members) == count;
+        }
+        if (keyed == count) {
+            return true;
+        }
+        nanosleep((struct timespec []) { [0] = { 0, 1000000 } }, NULL);
+    }
+}
+
+/**
+ * @section Traffic
+ */
+
+static void sleep_until(uint64_t deadline)
+{
+    for (uint64_t now; (now = xclock_ns()) < deadline;) {
+        const uint64_t ns = deadline - now;
+        nanosleep((struct timespec []) { [0] = { (time_t)(ns / 1000000000), (long)(ns % 1000000000) } }, NULL);
+    }
+}
+
+// Text and files are tagged with the time they were scheduled to go out rather than the time
+// they actually did, so a stalled sender shows up as latency instead of hiding it
+static wire_t *init_text_wire(lg_client_t *c, uint64_t scheduled, size_t len)
+{
+    char *text = xcalloc(len);
+    const int tag = snprintf(text, len, "%" PRIu64 " %zu ", scheduled, c->id);
+    memset(&text[tag], '.', len - (size_t)tag);
+
+    wire_t *wire = client_init_text_wire(&c->client, text, len);
+    xfree(text);
+    return wire;
+}
+
+static wire_t *init_file_wire(lg_client_t *c, uint64_t scheduled, size_t len)
+{
+    char filename[64] = { 0 };
+    snprintf(filename, sizeof(filename), "%" PRIu64 "-%zu.bin", scheduled, c->id);
+
+    wire_t *wire = NULL;
+    const size_t name_len = strlen(filename);
+    file_msg_t *file = init_file_msg_wire(&wire, TYPE_FILE, FILE_TYPE_BINARY, wire_field_length(name_len) + len);
+    if (!file) {
+        return NULL;
+    }
+    file_msg_set_member(file, c->client.member);
+    file_msg_set_name(file, filename, name_len);
+    file_msg_set_mode(file, 0644);
+    file_msg_set_size(file, len);
+    return wire;
+}
+
+// Files too large for one wire are written out and sent from disk like any other
+static bool transmit_chunked_file(lg_client_t *c, uint64_t scheduled, size_t len)
+{
+    loadgen_t *lg = c->lg;
+    char path[128] = { 0 };
+    snprintf(path, sizeof(path), "%s/%" PRIu64 "-%zu.bin", lg->dir, scheduled, c->id);
+
+    FILE *f = fopen(path, "wb");
+    bool ok = f && fwrite(lg->file_data, 1, len, f) == len;
+    ok = f && !fclose(f) && ok;
+    ok = ok && transmit_file(&c->client, path);
+    remove(path);
+    return ok;
+}
+
+// Sender `first` drives clients first, first + stride, ... in turn, at rate / stride messages per second
+static void *sender_thread(void *arg)
+{
+    lg_sender_t *s = arg;
+    loadgen_t *lg = s->lg;
+
+    const size_t clients = (lg->count - s->first + s->stride - 1) / s->stride;
+    const uint64_t interval = (uint64_t)s->stride * 1000000000 / lg->rate;
+    const uint64_t start = xclock_ns() + s->first * 1000000000 / lg->rate;
+    const uint64_t end = start + (uint64_t)lg->seconds * 1000000000;
+
+    for (size_t k = 0; atomic_load(&lg->sending); k++) {
+        const uint64_t scheduled = start + k * interval;
+        if (scheduled >= end) {
+            break;
+        }
+        sleep_until(scheduled);
+
+        lg_client_t *c = &lg->clients[s->first + s->stride * (k % clients)];
+        const bool file = (k * s->stride + s->first) % 100 < lg->file_percent;
+        bool ok = false;
+        if (file && lg->file_size > FILE_CHUNK_SIZE) {
+            ok = transmit_chunked_file(c, scheduled, lg->file_size);
+        }
+        else {
+            wire_t *wire = file ? init_file_wire(c, scheduled, lg->file_size) : init_text_wire(c, scheduled, lg->text_size);
+            ok = wire && (file ? transmit_wire(&c->client, wire) : transmit_batched(&c->client, wire));
+            free_wire(wire);
+        }
+        if (!ok) {
+            log_fatal("client %zu: unable to send wire", c->id);
+            break;
+        }
+        if (file) {
+            s->sent_file++;
+            s->bytes += lg->file_size;
+        }
+        else {
+            s->sent_text++;
+            s->bytes += lg->text_size;
+        }
+    }
+    return NULL;
+}
+
+// An extra client joins a third of the way through the traffic and leaves at two thirds,
+// so the group is rekeyed twice while messages and chunked files are in flight
+static void *churn_thread(void *arg)
+{
+    loadgen_t *lg = arg;
+    lg_client_t *c = &lg->clients[lg->count];
+    const uint64_t start = xclock_ns();
+    const uint64_t third = (uint64_t)lg->seconds * 1000000000 / 3;
+
+    sleep_until(start + third);
+    if (!spawn_client(lg, c, lg->count) || !wait_keyed(lg, lg->count + 1)) {
+        log_fatal("churning client failed to join");
+        return NULL;
+    }
+    sleep_until(start + 2 * third);
+    client_batch_stop(&c->client);
+    xshutdown(c->client.socket);
+    pthread_join(c->thread, NULL);
+    xclose(c->client.socket);
+    if (!wait_keyed(lg, lg->count)) {
+        log_fatal("rekey after the churning client left failed");
+    }
+    return NULL;
+}
+
+static size_t delivered(loadgen_t *lg)
+{
+    size_t total = 0;
+    for (size_t i = 0; i < lg->count; i++) {
+        total += atomic_load(&lg->clients[i].delivered);
+    }
+    return total;
+}
+
+/**
+ * @section Report
+ */
+
+static const char *phase_name(phase_t phase)
+{
+    static const char *names[] = {
+        [PHASE_JOIN] = "join",
+        [PHASE_TRAFFIC] = "traffic",
+        [PHASE_LEAVE] = "leave",
+    };
+    return names[phase];
+}
+
+typedef struct report_t {
+    uint64_t join_ns;
+    uint64_t traffic_ns; // first scheduled send until the last delivery (or the drain timeout)
+    size_t sent_text;
+    size_t sent_file;
+    size_t sent_bytes;
+    size_t expected;
+    size_t delivered;
+    size_t delivered_bytes;
+    histogram_t handshake;
+    histogram_t text_latency;
+    histogram_t file_latency;
+} report_t;
+
+static void print_report(loadgen_t *lg, const report_t *r)
+{
+    const double seconds = (double)r->traffic_ns / 1e9;
+    const size_t sent = r->sent_text + r->sent_file;
+
+    printf("{\n");
+    printf("  \"version\": \"" STR(PARCEL_VERSION) "\",\n");
+    printf("  \"clients\": %zu,\n", lg->count);
+    printf("  \"suite\": \"%s\",\n", wire_suite_name(lg->clients[0].client.keys.suite));
+    printf("  \"config\": {\"seconds\": %zu, \"rate\": %zu, \"text_size\": %zu, \"file_size\": %zu, \"file_percent\": %zu, \"batch_ms\": %zu, \"churn\": %s},\n",
+        lg->seconds, lg->rate, lg->text_size, lg->file_size, lg->file_percent, lg->batch_ms, lg->churn ? "true" : "false");
+
+    printf("  \"join\": {\n    \"ms\": %.3f,\n", (double)r->join_ns / 1e6);
+    print_hist("handshake_us", &r->handshake);
+    printf("\n  },\n");
+
+    printf("  \"traffic\": {\n");
+    printf("    \"sent\": {\"text\": %zu, \"file\": %zu, \"bytes\": %zu, \"msgs_per_s\": %.1f},\n",
+        r->sent_text, r->sent_file, r->sent_bytes, (double)sent / seconds);
+    printf("    \"delivered\": {\"expected\": %zu, \"count\": %zu, \"bytes\": %zu, \"msgs_per_s\": %.1f, \"mb_per_s\": %.3f},\n",
+        r->expected, r->delivered, r->delivered_bytes, (double)r->delivered / seconds,
+        (double)r->delivered_bytes / seconds / 1e6);
+    print_hist("text_latency_us", &r->text_latency);
+    printf(",\n");
+    print_hist("file_latency_us", &r->file_latency);
+    printf("\n  },\n");
+
+    printf("  \"rekeys\": [");
+    for (size_t i = 0; i < lg->rekey_count; i++) {
+        printf("%s\n    {\"phase\": \"%s\", \"members\": %zu, \"ms\": %.3f}", i ? "," : "",
+            phase_name(lg->rekeys[i].phase), lg->rekeys[i].members, (double)lg->rekeys[i].ns / 1e6);
+    }
+    printf("\n  ]\n}\n");
+}
+
+static void usage(FILE *f)
+{
+    static const char usage[] =
+        "usage: parcel-loadgen [-h] [-a ADDR] [-p PORT] [-n CLIENTS] [-d SECS] [-r RATE] [-s SIZE] [-f PCT] [-F SIZE] [-b MS] [-c]\n"
+        "  -a ADDR    daemon address (default 127.0.0.1)\n"
+        "  -p PORT    daemon port (default 2315)\n"
+        "  -n CLIENTS number of synthetic clients (default 10)\n"
+        "  -d SECS    seconds of traffic (default 10)\n"
+        "  -r RATE    messages per second across all clients (default 100)\n"
+        "  -s SIZE    text message size in bytes (default 64)\n"
+        "  -f PCT     percentage of messages sent as files (default 0)\n"
+        "  -F SIZE    file size in bytes, above 1048576 they're sent in chunks (default 65536)\n"
+        "  -b MS      batch each client's text within MS milliseconds into one wire (default 0, off)\n"
+        "  -c         have an extra client join and leave during the traffic, rekeying mid-transfer\n"
+        "  -h         print this usage information\n"
+        "Progress goes to stderr, results to stdout as JSON\n";
+    fprintf(f, "%s", usage);
+}
+
+static bool parse_size(char *arg, size_t *out, long min, long max, char opt)
+{
+    long value = 0;
+    if (!xstrrange(arg, &value, min, max)) {
+        fprintf(stderr, "-%c must be between %ld and %ld\n", opt, min, max);
+        return false;
+    }
+    *out = (size_t)value;
+    return true;
+}
+
+int main(int argc, char **argv)
+{
+#if __unix__ || __APPLE__
+    signal(SIGPIPE, SIG_IGN);
+#endif
+    log_init(LOG_FATAL); // every departure makes a receive fail on purpose
+
+    static loadgen_t lg = {
+        .address = "127.0.0.1",
+        .port = "2315",
+        .count = LOADGEN_CLIENTS,
+        .seconds = LOADGEN_SECONDS,
+        .rate = LOADGEN_RATE,
+        .text_size = LOADGEN_TEXT_SIZE,
+        .file_size = LOADGEN_FILE_SIZE,
+        .lock = PTHREAD_MUTEX_INITIALIZER,
+    };
+
+    xgetopt_t xgo = { 0 };
+    for (ptrdiff_t opt; (opt = xgetopt(&xgo, argc, argv, "ha:p:n:d:r:s:f:F:b:c")) != -1;) {
+        bool ok = true;
+        switch (opt) {
+            case 'a':
+                ok = strlen(xgo.arg) < ADDRESS_MAX_LENGTH;
+                if (ok) {
+                    strcpy(lg.address, xgo.arg);
+                }
+                break;
+            case 'p':
+                ok = xstrrange(xgo.arg, NULL, 0, 65535);
+                if (ok) {
+                    strcpy(lg.port, xgo.arg);
+                }
+                break;
+            case 'n':
+                ok = parse_size(xgo.arg, &lg.count, 2, LOADGEN_CLIENTS_MAX, 'n');
+                break;
+            case 'd':
+                ok = parse_size(xgo.arg, &lg.seconds, 1, 86400, 'd');
+                break;
+            case 'r':
+                ok = parse_size(xgo.arg, &lg.rate, 1, 1000000, 'r');
+                break;
+            case 's':
+                ok = parse_size(xgo.arg, &lg.text_size, LOADGEN_TEXT_SIZE_MIN, DATA_LEN_MAX - TEXT_HEADER_LENGTH, 's');
+                break;
+            case 'f':
+                ok = parse_size(xgo.arg, &lg.file_percent, 0, 100, 'f');
+                break;
+            case 'F':
+                ok = parse_size(xgo.arg, &lg.file_size, 1, FILE_DATA_MAX_SIZE, 'F');
+                break;
+            case 'b':
+                ok = parse_size(xgo.arg, &lg.batch_ms, 0, BATCH_BUDGET_MS_MAX, 'b');
+                break;
+            case 'c':
+                lg.churn = true;
+                break;
+            case 'h':
+                usage(stdout);
+                return 0;
+            default:
+                usage(stderr);
+                return 1;
+        }
+        if (!ok) {
+            usage(stderr);
+            return 1;
+        }
+    }
+
+    lg.clients = xcalloc((lg.count + 1) * sizeof(lg_client_t));
+    report_t report = { 0 };
+
+    // Random contents, so compression can't shrink chunked files to nothing
+    if (lg.file_percent && lg.file_size > FILE_CHUNK_SIZE) {
+        strcpy(lg.dir, "/tmp/parcel-loadgen-XXXXXX");
+        lg.file_data = xmalloc(lg.file_size);
+        if (!mkdtemp(lg.dir) || !csprng_fill(lg.file_data, lg.file_size)) {
+            log_fatal("unable to set up chunked files");
+            return 1;
+        }
+    }
+
+    // Everyone joins at once, the daemon admits them in handshake batches
+    uint64_t start = xclock_ns();
+    for (size_t i = 0; i < lg.count; i++) {
+        if (!spawn_client(&lg, &lg.clients[i], i)) {
+            log_fatal("unable to create client thread %zu", i);
+            return 1;
+        }
+    }
+    if (!wait_keyed(&lg, lg.count)) {
+        log_fatal("clients failed to join");
+        return 1;
+    }
+    report.join_ns = xclock_ns() - start;
+    fprintf(stderr, "join: %zu clients in %.1f ms\n", lg.count, (double)report.join_ns / 1e6);
+
+    atomic_store(&lg.phase, PHASE_TRAFFIC);
+    atomic_store(&lg.sending, true);
+    lg_sender_t senders[LOADGEN_SENDERS_MAX] = { 0 };
+    const size_t stride = MIN(lg.count, (size_t)LOADGEN_SENDERS_MAX);
+    start = xclock_ns();
+    for (size_t i = 0; i < stride; i++) {
+        senders[i] = (lg_sender_t) { .lg = &lg, .first = i, .stride = stride };
+        if (pthread_create(&senders[i].thread, NULL, sender_thread, &senders[i])) {
+            log_fatal("unable to create sender thread %zu", i);
+            return 1;
+        }
+    }
+    pthread_t churn;
+    if (lg.churn && pthread_create(&churn, NULL, churn_thread, &lg)) {
+        log_fatal("unable to create churn thread");
+        return 1;
+    }
+    for (size_t i = 0; i < stride; i++) {
+        pthread_join(senders[i].thread, NULL);
+        report.sent_text += senders[i].sent_text;
+        report.sent_file += senders[i].sent_file;
+        report.sent_bytes += senders[i].bytes;
+    }
+    atomic_store(&lg.sending, false);
+    if (lg.churn) {
+        pthread_join(churn, NULL);
+    }
+    for (size_t i = 0; i < lg.count; i++) {
+        client_batch_stop(&lg.clients[i].client);
+    }
+
+    // Every wire is relayed to everyone but its sender
+    report.expected = (report.sent_text + report.sent_file) * (lg.count - 1);
+    const uint64_t drain = xclock_ns() + (uint64_t)LOADGEN_DRAIN_MS * 1000000;
+    while (delivered(&lg) < report.expected && xclock_ns() < drain) {
+        nanosleep((struct timespec []) { [0] = { 0, 1000000 } }, NULL);
+    }
+    report.traffic_ns = xclock_ns() - start;
+    fprintf(stderr, "traffic: %zu of %zu wires delivered\n", delivered(&lg), report.expected);
+
+    // Leave one at a time so the daemon rekeys the rest after each departure, a lone member isn't rekeyed
+    atomic_store(&lg.phase, PHASE_LEAVE);
+    for (size_t i = lg.count; i--;) {
+        lg_client_t *c = &lg.clients[i];
+        xshutdown(c->client.socket);
+        pthread_join(c->thread, NULL);
+        xclose(c->client.socket);
+        if (i > 1 && !wait_keyed(&lg, i)) {
+            log_fatal("rekey after client %zu left failed", i);
+            break;
+        }
+    }
+
+    for (size_t i = 0; i < lg.count; i++) {
+        lg_client_t *c = &lg.clients[i];
+        hist_record(&report.handshake, c->handshake_ns);
+        hist_merge(&report.text_latency, &c->text_latency);
+        hist_merge(&report.file_latency, &c->file_latency);
+        report.delivered += atomic_load(&c->delivered);
+        report.delivered_bytes += c->delivered_bytes;
+    }
+    print_report(&lg, &report);
+
+    if (lg.file_data) {
+        remove(lg.dir);
+        xfree(lg.file_data);
+    }
+    xfree(lg.clients);
+    return report.delivered == report.expected ? 0 : 2;
+}
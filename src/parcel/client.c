@@ -11,6 +11,7 @@
 
 #include "client.h"
 #include "cable.h"
+#include "csprng.h"
 #include "log.h"
 #include "wire-stat.h"
 #include "xplatform.h"
@@ -24,10 +25,17 @@ void client_get_keys(client_t *ctx, keys_t *out)
     pthread_mutex_unlock(&ctx->lock);
 }
 
+// Key schedules are expanded here, once per key change, instead of for every wire
 void client_set_keys(client_t *ctx, keys_t *keys)
 {
     pthread_mutex_lock(&ctx->lock);
+    const size_t epoch = ctx->keys.epoch;
+    const wire_key_t stale = ctx->keys.session_wire;
     memcpy(&ctx->keys, keys, sizeof(keys_t));
+    ctx->keys.stale_wire = stale;
+    ctx->keys.epoch = epoch + 1;
+    wire_key_init(&ctx->keys.session_wire, keys->session, keys->suite, WIRE_KEY_SESSION);
+    wire_key_init(&ctx->keys.ctrl_wire, keys->ctrl, keys->suite, WIRE_KEY_CTRL);
     pthread_mutex_unlock(&ctx->lock);
 }
 
@@ -63,12 +71,12 @@ void redraw_prompt(void)
 
 bool announce_connection(client_t *ctx)
 {
-    wire_t *wire = client_init_stat_conn_wire(ctx, STAT_USER_CONNECT);
+    wire_t *wire = client_init_stat_wire(ctx, STAT_USER_CONNECT);
     bool ok = transmit_wire(ctx, wire);
     if (!ok) {
         log_error("error sending wire via cable");
     }
-    xfree(wire);
+    free_wire(wire);
 
     atomic_store(&ctx->conn_announced, ok);
     return ok;
@@ -77,11 +85,11 @@ bool announce_connection(client_t *ctx)
 bool send_text_msg(client_t *ctx, void *data, size_t length)
 {
     wire_t *wire = client_init_text_wire(ctx, data, length);
-    bool ok = transmit_wire(ctx, wire);
+    bool ok = wire && transmit_batched(ctx, wire);
     if (!ok) {
         log_error("error sending wire via cable");
     }
-    xfree(wire);
+    free_wire(wire);
     return ok;
 }
 
@@ -134,32 +142,25 @@ int send_thread(void *ctx)
     return 0;
 }
 
-cable_t *client_recv_cable(client_t *ctx)
+// Receive the next cable, with its wire decrypted under whichever keys are current when it starts arriving
+static cable_t *client_recv_cable(client_t *ctx, cable_buffer_t *buf, bool *decrypted)
 {
     sock_t s = client_get_socket(ctx);
-    size_t len = 0;
-    return recv_cable(s, &len);
-}
-
-static wire_t *decrypt_cabled_wire(client_t *ctx, cable_t *cable)
-{
-    size_t len = 0;
-    wire_t *wire = get_cabled_wire(cable, &len);
     keys_t keys = { 0 };
     client_get_keys(ctx, &keys);
-    if (!decrypt_wire(wire, len, keys.session, keys.ctrl)) {
-        log_error("wire decryption error");
-        return NULL;
-    }
-    return wire;
+    const wire_key_t *session = ctx->stale ? &keys.stale_wire : &keys.session_wire;
+    ctx->stale = false;
+    return recv_cable_decrypt(s, buf, session, &keys.ctrl_wire, decrypted);
 }
 
 void *recv_thread(void *ctx)
 {
     client_t *client = ctx;
+    cable_buffer_t buf = { 0 }; // every cable lands here, so chat never allocates
 
     for (;;) {
-        cable_t *cable = client_recv_cable(client);
+        bool decrypted = false;
+        cable_t *cable = client_recv_cable(client, &buf, &decrypted);
         if (!cable) {
             // TODO: cleanly exit without user interaction
             bool run = atomic_load(&client->keep_alive);
@@ -170,26 +171,30 @@ void *recv_thread(void *ctx)
                 redraw_prompt();
             }
             else {
+                cable_buffer_free(&buf);
+                roster_free(&client->roster);
                 xclose(client->socket);
                 return (void *)0;
             }
+            continue;
         }
 
-        wire_t *wire = decrypt_cabled_wire(client, cable);
-        if (!wire) {
-            xfree(cable);
+        if (!decrypted) {
+            log_error("wire decryption error");
             continue;
         }
 
+        size_t len = 0;
+        wire_t *wire = get_cabled_wire(cable, &len);
+
         if (!handle_wire(client, wire)) {
             log_error("encountered error while handling wire");
         }
 
-        free_cabled_wire(wire);
-
         nanosleep((struct timespec []) { [0] = { 0, 1000000} }, NULL);
     }
 
+    cable_buffer_free(&buf);
     xclose(client->socket);
     return (void *)0;
 }
@@ -234,13 +239,21 @@ bool connect_server(client_t *client, const char *ip, const char *port)
 
     freeaddrinfo(srv_addr);
 
-    if (!two_party_client(client->socket, client->keys.ctrl)) {
+    keys_t keys = { 0 };
+    if (!two_party_client(client->socket, keys.ctrl, &keys.suite, &keys.features)) {
         // [note] error logged internally 
         xclose(client->socket);
         return false;
     }
+    client_set_keys(client, &keys);
 
-    xprintf(GRN, BOLD, "=== Connected to server ===\n");
+    // Drawn like a chunked transfer id: collisions within a group are vanishingly unlikely
+    while (!client->member) {
+        if (!csprng_fill(&client->member, sizeof(client->member))) {
+            xclose(client->socket);
+            return false;
+        }
+    }
     return true;
 }
 
@@ -13,6 +13,7 @@
 
 #include "console.h"
 #include "key-exchange.h"
+#include "wire-batch.h"
 #include "wire-file.h"
 #include "wire-stat.h"
 #include "wire.h"
@@ -29,6 +30,18 @@ enum ParcelConstants {
     ADDRESS_MAX_LENGTH = 32
 };
 
+// Worker pool used by transmit_file() to encrypt the pieces of a chunked file transfer
+enum FileSend {
+    FILE_SEND_THREADS_MAX = 16,
+    FILE_SEND_WINDOW_MAX = 2 * FILE_SEND_THREADS_MAX,
+};
+
+// Latency budget of transmit_batched(), in milliseconds
+enum BatchBudget {
+    BATCH_BUDGET_MS = 4,
+    BATCH_BUDGET_MS_MAX = 1000,
+};
+
 #define SELF_SENDER "::self::"
 
 typedef enum cmd_type_t {
@@ -62,8 +75,41 @@ struct username {
 typedef struct keys_t {
     uint8_t session[KEY_LEN]; // Group-derived symmetric key
     uint8_t ctrl[KEY_LEN];    // Ephemeral daemon control key
+    wire_suite_t suite;       // Wire suite selected by the daemon
+    uint8_t features;         // WireFeatures selected by the daemon
+    wire_key_t session_wire;  // `session` expanded for `suite` by client_set_keys()
+    wire_key_t ctrl_wire;     // `ctrl` expanded for `suite` by client_set_keys()
+    wire_key_t stale_wire;    // `session_wire` before the latest client_set_keys(), see CTRL_STALE
+    size_t epoch;             // bumped by client_set_keys(), so a stale copy can be told apart
 } keys_t;
 
+// Another member of the group, as last announced in a TYPE_STAT
+typedef struct member_t {
+    uint32_t id;
+    const char *color; // xhash_color() of `name`, worked out once per name
+    char name[USERNAME_MAX_LENGTH];
+} member_t;
+
+// Names of the other members by member id. Only the receive thread touches it, so no lock
+typedef struct roster_t {
+    member_t *members;
+    size_t count;
+    size_t capacity;
+} roster_t;
+
+// Text queued by transmit_batched(), waiting to go out as one TYPE_BATCH wire
+typedef struct batch_t {
+    pthread_mutex_t lock; // held from flushing the queue until the wire after it is sent, so wires keep their order
+    pthread_cond_t queued;
+    pthread_t thread;
+    atomic_bool running;
+    uint64_t budget_ns;   // longest the first queued message waits
+    uint64_t deadline;
+    size_t count;
+    size_t len;
+    uint8_t entries[BATCH_DATA_MAX];
+} batch_t;
+
 struct client_internal {
     bitfield conn_announced : 1;
     bitfield kill_threads : 1;
@@ -73,10 +119,15 @@ typedef struct client_t client_t;
 struct client_t {
     sock_t socket;
     char username[USERNAME_MAX_LENGTH];
+    uint32_t member; // random id other members know us by, fixed once connected
+    roster_t roster;
     keys_t keys;
+    batch_t batch;
+    bool stale; // the next cable is sealed with `keys.stale_wire`, only the receive thread touches it
     atomic_bool conn_announced;
     atomic_bool keep_alive;
     pthread_mutex_t lock;
+    pthread_mutex_t send_lock; // held for every write to `socket`, which the send, receive, and batch threads all do
 };
 
 bool connect_server(client_t *client, const char *ip, const char *port);
@@ -110,11 +161,22 @@ bool send_text_msg(client_t *client, void *data, size_t length);
 sock_t client_get_socket(client_t *ctx);
 void client_get_username(client_t *ctx, char *out);
 
+member_t *roster_find(roster_t *roster, uint32_t id);
+member_t *roster_add(roster_t *roster, uint32_t id, const char *name);
+void roster_remove(roster_t *roster, uint32_t id);
+void roster_free(roster_t *roster);
+
 void client_get_keys(client_t *ctx, keys_t *out);
 void client_set_keys(client_t *ctx, keys_t *keys);
 
+bool client_batch_start(client_t *client, size_t budget_ms);
+void client_batch_stop(client_t *client);
+
 bool transmit_wire(client_t *client, wire_t *wire);
+// Chat text, renames, and replies to connects, see wire-interface.c
+bool transmit_batched(client_t *client, wire_t *wire);
+bool transmit_file(client_t *client, const char *path);
 wire_t *client_init_text_wire(client_t *client, const void *data, size_t len);
-wire_t *client_init_stat_conn_wire(client_t *client, stat_msg_type_t type);
+wire_t *client_init_stat_wire(client_t *client, stat_msg_type_t type);
 wire_t *client_init_stat_rename_wire(client_t *client, const char *new);
 wire_t *client_init_file_wire(client_t *client, const char *path);
@@ -19,11 +19,11 @@ static bool cmd_username(client_t *ctx)
     char *new_username = xprompt("> New username: ", "username", &new_username_length);
     
     wire_t *wire = client_init_stat_rename_wire(ctx, new_username);
-    bool ok = transmit_wire(ctx, wire);
+    bool ok = wire && transmit_batched(ctx, wire);
     if (!ok) {
         log_error("error sending wire via cable");
     }
-    xfree(wire);
+    free_wire(wire);
 
     pthread_mutex_lock(&ctx->lock);
         memset(&ctx->username, 0, USERNAME_MAX_LENGTH);
@@ -43,12 +43,10 @@ static bool cmd_send_file(client_t *ctx)
         xfree(path);
         return 0;
     }
-    wire_t *wire = client_init_file_wire(ctx, path);
-    bool ok = transmit_wire(ctx, wire);
+    bool ok = transmit_file(ctx, path);
     if (!ok) {
-        log_error("error sending wire via cable");
+        log_error("error sending file via cable");
     }
-    xfree(wire);
     xfree(path);
     return ok;
 }
@@ -78,12 +76,13 @@ static void cmd_not_found(char *message)
 
 bool cmd_exit(client_t *ctx)
 {
-    wire_t *wire = client_init_stat_conn_wire(ctx, STAT_USER_DISCONNECT);
+    wire_t *wire = client_init_stat_wire(ctx, STAT_USER_DISCONNECT);
     bool ok = transmit_wire(ctx, wire);
     if (!ok) {
         log_error("error sending wire via cable");
     }
-    xfree(wire);
+    free_wire(wire);
+    client_batch_stop(ctx);
 
     shutdown(ctx->socket, SHUT_RDWR);
     atomic_store(&ctx->keep_alive, false);
@@ -23,11 +23,12 @@ static void catch_sigint(int sig)
 static void usage(FILE *f)
 {
     static const char usage[] =
-        "usage: parcel [-hd] [-a ADDR] [-p PORT] [-u NAME]\n"
+        "usage: parcel [-hd] [-a ADDR] [-p PORT] [-u NAME] [-b MS]\n"
         "  -a ADDR  server address (www.example.com, 111.222.333.444)\n"
         "  -p PORT  server port (3724, 9216)\n"
         "  -u NAME  username displayed alongside sent messages\n"
         "  -l       use computer login as username\n"
+        "  -b MS    batch text sent within MS milliseconds into one wire (default: 4, 0 disables)\n"
         "  -h       print this usage information\n";
     fprintf(f, "%s", usage);
 }
@@ -41,14 +42,16 @@ int main(int argc, char **argv)
     memset(address, 0, ADDRESS_MAX_LENGTH);
 
     char port[PORT_MAX_LENGTH] = "2315";
+    long batch_ms = BATCH_BUDGET_MS;
 
     client_t client = { 0 };
     atomic_store(&client.keep_alive, true);
     pthread_mutex_init(&client.lock, NULL);
+    pthread_mutex_init(&client.send_lock, NULL);
     init_ui_lock();
 
     xgetopt_t xgo = { 0 };
-    for (ptrdiff_t opt; (opt = xgetopt(&xgo, argc, argv, "lha:p:u:")) != -1;) {
+    for (ptrdiff_t opt; (opt = xgetopt(&xgo, argc, argv, "lha:p:u:b:")) != -1;) {
         switch (opt) {
             case 'a':
                 if (strlen(xgo.arg) < ADDRESS_MAX_LENGTH) {
@@ -72,6 +75,12 @@ int main(int argc, char **argv)
                 }
                 xwarn("Username argument too long\n");
                 break;
+            case 'b':
+                if (xstrrange(xgo.arg, &batch_ms, 0, BATCH_BUDGET_MS_MAX)) {
+                    break;
+                }
+                xwarn("Using default batch budget: %d ms\n", BATCH_BUDGET_MS);
+                break;
             case 'l':
                 if (!xgetlogin(client.username, USERNAME_MAX_LENGTH)) {
                     break;
@@ -97,6 +106,12 @@ int main(int argc, char **argv)
     if (!connect_server(&client, address, port)) {
         return -1;
     }
+    xprintf(GRN, BOLD, "=== Connected to server ===\n");
+
+    if (!client_batch_start(&client, (size_t)batch_ms)) {
+        xalert("Unable to create batching thread\n");
+        return -1;
+    }
 
     pthread_t recv_ctx;
     if (pthread_create(&recv_ctx, NULL, recv_thread, (void *)&client)) {
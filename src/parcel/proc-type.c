@@ -16,6 +16,7 @@
 #include "wire-text.h"
 #include "wire-file.h"
 #include "wire-ctrl.h"
+#include "wire-batch.h"
 #include "wire.h"
 #include "xplatform.h"
 #include <stdio.h>
@@ -79,31 +80,45 @@ void update_last_sender(const char *username)
     pthread_mutex_unlock(&ui_lock);
 }
 
-static bool proc_file(void *data)
+// Wires from a member whose connect hasn't been seen yet are shown under their member id
+static const member_t *get_sender(client_t *ctx, uint32_t id, member_t *unknown)
 {
-    file_msg_t *fm = data;
-    char filename[FILENAME_MAX] = { 0 };
-    if (!file_msg_get_filename(fm, filename)) {
-        log_error("file_msg_t has empty filename field");
+    const member_t *member = roster_find(&ctx->roster, id);
+    if (member) {
+        return member;
+    }
+    log_debug("no name for member %08x", id);
+    unknown->id = id;
+    unknown->color = "\033[0m";
+    snprintf(unknown->name, sizeof(unknown->name), "member %08x", id);
+    return unknown;
+}
+
+static bool proc_file(client_t *ctx, void *data, size_t len)
+{
+    file_msg_view_t fm;
+    if (!file_msg_view(&fm, data, len)) {
+        log_error("malformed file message");
         return false;
     }
-    char sender[FILE_USERNAME_LENGTH] = { 0 };
-    if (file_msg_get_user(fm, sender)) {
-        log_error("file_msg_t has empty username field");
+    char filename[FILE_NAME_LEN + 1] = { 0 };
+    if (!file_msg_get_filename(&fm, filename)) {
+        log_error("file_msg_t has empty filename field");
         return false;
     }
 
-    const char *color = xhash_color(sender);
-    fprintf(stdout, "\033[2K\r\033[2m%s%s\033[0m", color, sender);
+    member_t unknown;
+    const member_t *sender = get_sender(ctx, file_msg_get_member(fm.msg), &unknown);
+    fprintf(stdout, "\033[2K\r\033[2m%s%s\033[0m", sender->color, sender->name);
     time_t now = time(NULL);
     if (need_timestamp(now)) {
         show_timestamp(now);
     }
 
-    size_t filesize = file_msg_get_payload_length(fm);
+    size_t filesize = file_msg_get_size(fm.msg);
     fprintf(stdout, "\n  \033[32m⏺\033[0m sent a file: %s (%zu kb)\n\n", filename, filesize >> 10);
 
-    if (!file_msg_to_file(fm, xgethome())) {
+    if (!file_msg_to_file(&fm, xgethome())) {
         log_error("error writing file to disk");
         return false;
     }
@@ -112,19 +127,48 @@ static bool proc_file(void *data)
     return true;
 }
 
-static bool proc_stat(void *data)
+static bool proc_file_chunk(void *data, size_t len)
 {
-    reset_last_sender();
+    file_chunk_msg_view_t chunk;
+    if (!file_chunk_msg_view(&chunk, data, len)) {
+        log_error("malformed file chunk message");
+        return false;
+    }
+    if (!file_chunk_msg_to_file(&chunk)) {
+        log_error("error writing file chunk to disk");
+        return false;
+    }
+    return true;
+}
 
-    stat_msg_t *stat = data;
-    stat_msg_type_t type = stat_msg_get_type(stat);
+// Introduce ourselves to a member who just connected. Everyone already in the group replies at
+// once, and a burst of joins brings a reply for each, so these are batched like text
+static bool reply_present(client_t *ctx)
+{
+    if (!atomic_load(&ctx->conn_announced)) {
+        return true; // our own connect is still on its way
+    }
+    wire_t *wire = client_init_stat_wire(ctx, STAT_USER_PRESENT);
+    bool ok = wire && transmit_batched(ctx, wire);
+    free_wire(wire);
+    return ok;
+}
+
+static bool proc_stat(client_t *ctx, const void *data, size_t len)
+{
+    stat_msg_view_t stat;
+    if (!stat_msg_view(&stat, data, len)) {
+        log_error("malformed stat message");
+        return false;
+    }
+    stat_msg_type_t type = stat_msg_get_type(stat.msg);
+    const uint32_t id = stat_msg_get_member(stat.msg);
 
     char username[USERNAME_MAX_LENGTH] = { 0 };
-    if (!stat_msg_get_user(stat, username)) {
+    if (type != STAT_USER_DISCONNECT && !stat_msg_get_user(&stat, username)) {
         log_error("empty user field");
         return false;
     }
-    const char *aux = stat_msg_get_data(stat);
 
     static const char *msgs[] = {
         [STAT_USER_CONNECT]    = "\033[2K\r\033[32m⏺\033[3;90m %s is online\033[0m\n",
@@ -132,38 +176,49 @@ static bool proc_stat(void *data)
         [STAT_USER_RENAME]     = "\033[2K\r\033[90m⏺\033[3;90m %s → %s\033[0m\n"
     };
 
+    member_t unknown;
     switch (type) {
         case STAT_USER_CONNECT:
+            reset_last_sender();
+            fprintf(stdout, msgs[type], roster_add(&ctx->roster, id, username)->name);
+            return reply_present(ctx);
+        case STAT_USER_PRESENT:
+            roster_add(&ctx->roster, id, username);
+            return true;
         case STAT_USER_DISCONNECT:
-            fprintf(stdout, msgs[type], username);
-            break;
+            reset_last_sender();
+            fprintf(stdout, msgs[type], get_sender(ctx, id, &unknown)->name);
+            roster_remove(&ctx->roster, id);
+            return true;
         case STAT_USER_RENAME:
-            fprintf(stdout, msgs[type], username, aux);
-            break;
+            reset_last_sender();
+            fprintf(stdout, msgs[type], get_sender(ctx, id, &unknown)->name, username);
+            roster_add(&ctx->roster, id, username);
+            return true;
         default:
-            break;
+            log_error("invalid type for stat message");
+            return false;
     }
-    return true;
 }
 
 
-static bool proc_text(void *data)
+static bool proc_text(client_t *ctx, const void *data, size_t len)
 {
-    text_msg_t *text = data;
-    text_msg_type_t type = text_msg_get_type(text);
-    if (type != TEXT_MSG_NORMAL) {
-        log_error("invalid type for text message");
+    text_msg_view_t text;
+    if (!text_msg_view(&text, data, len)) {
+        log_error("malformed text message");
         return false;
     }
-    char username[USERNAME_MAX_LENGTH] = { 0 };
-    if (!text_msg_get_user(text, username)) {
-        log_error("empty user field");
+    text_msg_type_t type = text_msg_get_type(text.msg);
+    if (type != TEXT_MSG_NORMAL) {
+        log_error("invalid type for text message");
         return false;
     }
 
-    if (need_sender(username)) {
-        const char *color = xhash_color(username);
-        fprintf(stdout, "\033[2K\r\033[2m%s%s\033[0m", color, username);
+    member_t unknown;
+    const member_t *sender = get_sender(ctx, text_msg_get_member(text.msg), &unknown);
+    if (need_sender(sender->name)) {
+        fprintf(stdout, "\033[2K\r\033[2m%s%s\033[0m", sender->color, sender->name);
         time_t now = time(NULL);
         if (need_timestamp(now)) {
             show_timestamp(now);
@@ -171,37 +226,94 @@ static bool proc_text(void *data)
         fprintf(stdout, "\n");
     }
 
-    const char *aux = text_msg_get_data(text);
-    fprintf(stdout, "\033[2K\r  %s\n", aux);
+    const char *aux = (const char *)text.data;
+    const int aux_len = (int)strnlen(aux, text.data_len);
+    fprintf(stdout, "\033[2K\r  %.*s\n", aux_len, aux);
 
-    update_last_sender(username);
+    update_last_sender(sender->name);
     return true;
 }
 
-static bool proc_ctrl(client_t *ctx, void *data)
+// Every message in a batch is handled as though it came in a wire of its own
+static bool proc_batch(client_t *ctx, const void *data, size_t len)
 {
-    ctrl_msg_t *ctrl = data;
-    ctrl_msg_type_t type = ctrl_msg_get_type(ctrl);
+    batch_msg_view_t batch;
+    if (!batch_msg_view(&batch, data, len)) {
+        log_error("malformed batch message");
+        return false;
+    }
 
+    size_t at = 0;
+    for (size_t i = batch_msg_get_count(batch.msg); i; i--) {
+        batch_entry_t entry;
+        if (!batch_entry_next(batch.data, batch.data_len, &at, &entry)) {
+            log_error("malformed batch entry");
+            return false;
+        }
+        bool ok = false;
+        switch (entry.type) {
+            case TYPE_TEXT:
+                ok = proc_text(ctx, entry.msg, entry.len);
+                break;
+            case TYPE_STAT:
+                ok = proc_stat(ctx, entry.msg, entry.len);
+                break;
+            default:
+                log_error("invalid type for batch entry");
+                break;
+        }
+        if (!ok) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool proc_ctrl(client_t *ctx, void *data, size_t len)
+{
+    ctrl_msg_view_t ctrl;
+    if (!ctrl_msg_view(&ctrl, data, len)) {
+        log_error("malformed ctrl message");
+        return false;
+    }
+    ctrl_msg_type_t type = ctrl_msg_get_type(ctrl.msg);
+
+    // Relayed by the daemon after a rekey it arrived in the middle of
+    if (type == CTRL_STALE) {
+        ctx->stale = true;
+        return true;
+    }
+    if (ctrl.data_len < KEY_LEN) {
+        log_error("malformed ctrl message");
+        return false;
+    }
+
+    // The daemon reads nothing but key exchange messages until it's done, and nothing else
+    // goes out until the new keys are in place
+    pthread_mutex_lock(&ctx->send_lock);
     uint8_t session[32] = { 0 };
     if (type == CTRL_DHKE) {
         log_info("received DHKE ctrl msg");
-        size_t rounds = ctrl_msg_get_cnt(ctrl);
+        size_t rounds = ctrl_msg_get_cnt(ctrl.msg);
         log_debug("rounds: %zu", rounds);
         sock_t s = client_get_socket(ctx);
         if (!n_party_client(s, session, rounds)) {
+            pthread_mutex_unlock(&ctx->send_lock);
             log_fatal("n-party key exchange failure (%zu rounds)", rounds);
             return false;
         }
     }
 
-    const void *renewed_key = ctrl_msg_get_data(ctrl);
+    const void *renewed_key = ctrl.data;
 
+    // Only the keys are renewed, the suite stays as negotiated
     keys_t k = { 0 };
+    client_get_keys(ctx, &k);
     memcpy(&k.ctrl, renewed_key, KEY_LEN);
     memcpy(&k.session, session, KEY_LEN);
 
     client_set_keys(ctx, &k);
+    pthread_mutex_unlock(&ctx->send_lock);
 
     bool announced = atomic_load(&ctx->conn_announced);
     if (!announced) {
@@ -223,25 +335,44 @@ bool handle_wire(client_t *ctx, wire_t *wire)
         [TYPE_CTRL] = "TYPE_CTRL",
         [TYPE_STAT] = "TYPE_STAT",
         [TYPE_SESSION_KEY] = "TYPE_SESSION_KEY",
+        [TYPE_FILE_CHUNK] = "TYPE_FILE_CHUNK",
+        [TYPE_BATCH] = "TYPE_BATCH",
     };
     log_trace("handle_wire(%s)", types[type]);
 
+    // Expanded into a wire of its own, the received one stays in the cable buffer
+    wire_t *inflated = NULL;
+    if (wire_get_flags(wire) & WIRE_FLAG_COMPRESSED) {
+        if (!(inflated = wire_decompress(wire))) {
+            return false;
+        }
+        wire = inflated;
+    }
+
+    const size_t len = wire_get_data_length(wire);
     bool ok = true;
     bool redraw = false;
     switch (type) {
         case TYPE_CTRL:
-            ok = proc_ctrl(ctx, wire->data);
+            ok = proc_ctrl(ctx, wire->data, len);
             break;
         case TYPE_FILE:
-            ok = proc_file(wire->data);
+            ok = proc_file(ctx, wire->data, len);
             redraw = true;
             break;
+        case TYPE_FILE_CHUNK:
+            ok = proc_file_chunk(wire->data, len);
+            break;
         case TYPE_TEXT:
-            ok = proc_text(wire->data);
+            ok = proc_text(ctx, wire->data, len);
             redraw = true;
             break;
         case TYPE_STAT:
-            ok = proc_stat(wire->data);
+            ok = proc_stat(ctx, wire->data, len);
+            redraw = true;
+            break;
+        case TYPE_BATCH:
+            ok = proc_batch(ctx, wire->data, len);
             redraw = true;
             break;
         default:
@@ -251,5 +382,6 @@ bool handle_wire(client_t *ctx, wire_t *wire)
     if (redraw) {
         redraw_prompt();
     }
+    free_wire(inflated);
     return ok;
 }
@@ -0,0 +1,57 @@
+/**
+ * @file roster.c
+ * @author Jason Conway (jpc@jasonconway.dev)
+ * @brief Member id to username table (client-side)
+ * @version 0.9.4
+ * @date 2025-01-12
+ *
+ * @copyright Copyright (c) 2025 Jason Conway. All rights reserved.
+ *
+ * Members announce their name once, in the connect TYPE_STAT, and send only their member id
+ * after that. Groups are small enough that a linear scan beats anything fancier
+ */
+
+#include "client.h"
+
+member_t *roster_find(roster_t *roster, uint32_t id)
+{
+    for (size_t i = 0; i < roster->count; i++) {
+        if (roster->members[i].id == id) {
+            return &roster->members[i];
+        }
+    }
+    return NULL;
+}
+
+// Add `id`, or rename it if it's already known
+member_t *roster_add(roster_t *roster, uint32_t id, const char *name)
+{
+    member_t *member = roster_find(roster, id);
+    if (!member) {
+        if (roster->count == roster->capacity) {
+            roster->capacity = roster->capacity ? 2 * roster->capacity : 8;
+            roster->members = xrealloc(roster->members, roster->capacity * sizeof(member_t));
+        }
+        member = &roster->members[roster->count++];
+        member->id = id;
+    }
+    const size_t len = strnlen(name, USERNAME_MAX_LENGTH - 1);
+    memcpy(member->name, name, len);
+    member->name[len] = '\0';
+    member->color = xhash_color(member->name);
+    return member;
+}
+
+void roster_remove(roster_t *roster, uint32_t id)
+{
+    member_t *member = roster_find(roster, id);
+    if (member) {
+        *member = roster->members[--roster->count];
+    }
+}
+
+void roster_free(roster_t *roster)
+{
+    xfree(roster->members);
+    memset(roster, 0, sizeof(*roster));
+}
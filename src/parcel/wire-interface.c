@@ -1,80 +1,433 @@
 #include "wire.h"
+#include "csprng.h"
 #include "wire-stat.h"
 #include "wire-file.h"
 #include "wire-text.h"
 #include "wire-ctrl.h"
+#include "wire-batch.h"
+#include "log.h"
 #include "client.h"
 #include "xplatform.h"
 #include "xutils.h"
 #include "cable.h"
 #include <stddef.h>
 
-wire_t *client_init_stat_conn_wire(client_t *client, stat_msg_type_t type)
+wire_t *client_init_stat_wire(client_t *client, stat_msg_type_t type)
 {
-    assert(type == STAT_USER_CONNECT || type == STAT_USER_DISCONNECT);
+    assert(type != STAT_USER_RENAME);
+    if (type == STAT_USER_DISCONNECT) {
+        return init_wire_from_stat(type, client->member, NULL);
+    }
 
     char username[USERNAME_MAX_LENGTH] = { 0 };
     client_get_username(client, username);
-
-    stat_msg_t *stat_msg = init_stat_conn_msg(type, username);
-    wire_t *wire = init_wire_from_stat_msg(stat_msg);
-    xfree(stat_msg);
-    return wire;
+    return init_wire_from_stat(type, client->member, username);
 }
 
 wire_t *client_init_stat_rename_wire(client_t *client, const char *new)
 {
-    char username[USERNAME_MAX_LENGTH] = { 0 };
-    client_get_username(client, username);
+    return init_wire_from_stat(STAT_USER_RENAME, client->member, new);
+}
 
-    stat_msg_t *stat_msg = init_stat_rename_msg(username, new);
-    wire_t *wire = init_wire_from_stat_msg(stat_msg);
-    xfree(stat_msg);
-    return wire;
+wire_t *client_init_text_wire(client_t *client, const void *data, size_t len)
+{
+    return init_wire_from_text(client->member, data, len);
 }
 
-text_msg_t *client_init_text_msg(client_t *client, const void *data, size_t len)
+wire_t *client_init_file_wire(client_t *client, const char *path)
 {
-    char username[USERNAME_MAX_LENGTH] = { 0 };
-    client_get_username(client, username);
-    return text_msg_from_text(username, data, len);
+    return init_wire_from_file(client->member, path);
 }
 
-wire_t *client_init_text_wire(client_t *client, const void *data, size_t len)
+
+// Text and text files are compressed when the session allows it. Binary files, as told apart
+// by `xfiletype()` when they're read, are left alone, as is anything that doesn't shrink
+static wire_t *compress_session_wire(uint8_t features, wire_t *wire)
 {
-    text_msg_t *text_msg = client_init_text_msg(client, data, len);
-    wire_t *wire = init_wire_from_text_msg(text_msg);
-    xfree(text_msg);
-    return wire;
+    if (!(features & WIRE_FEATURE_COMPRESS)) {
+        return NULL;
+    }
+    switch (wire_get_type(wire)) {
+        case TYPE_TEXT:
+        case TYPE_BATCH:
+            return wire_compress(wire);
+        case TYPE_FILE:
+            return file_msg_get_type((file_msg_t *)wire->data) == FILE_TYPE_TEXT ? wire_compress(wire) : NULL;
+        case TYPE_FILE_CHUNK:
+            return file_chunk_msg_get_type((file_chunk_msg_t *)wire->data) == FILE_TYPE_TEXT ? wire_compress(wire) : NULL;
+        default:
+            return NULL;
+    }
 }
 
-wire_t *client_init_file_wire(client_t *client, const char *path)
+// The keys are read with the send lock held, so a wire can't go out under the keys a rekey
+// just replaced
+static bool send_wire(client_t *client, wire_t *wire)
 {
-    char username[USERNAME_MAX_LENGTH] = { 0 };
-    client_get_username(client, username);
+    pthread_mutex_lock(&client->send_lock);
+    keys_t keys = { 0 };
+    client_get_keys(client, &keys);
 
-    file_msg_t *file_msg = file_msg_from_file(username, path);
-    if (!file_msg) {
-        return NULL;
+    wire_t *packed = compress_session_wire(keys.features, wire);
+    bool ok = transmit_cabled_wire(client_get_socket(client), packed ? packed : wire, &keys.session_wire);
+    pthread_mutex_unlock(&client->send_lock);
+    free_wire(packed);
+    return ok;
+}
+
+// Send whatever's queued with `batch->lock` held. A lone message goes out as a wire of its own,
+// so it doesn't pay for the batch header. The queue is emptied even if the send fails
+static bool batch_flush(client_t *client)
+{
+    batch_t *batch = &client->batch;
+    if (!batch->count) {
+        return true;
+    }
+
+    wire_t *wire = NULL;
+    if (batch->count == 1) {
+        size_t at = 0;
+        batch_entry_t entry;
+        if (batch_entry_next(batch->entries, batch->len, &at, &entry)) {
+            size_t len = entry.len;
+            wire = init_wire(entry.type, entry.msg, &len);
+        }
+    }
+    else {
+        wire = init_wire_from_batch(batch->entries, batch->len, batch->count);
+    }
+    batch->count = 0;
+    batch->len = 0;
+
+    bool ok = wire && send_wire(client, wire);
+    free_wire(wire);
+    return ok;
+}
+
+// Waits out the budget from the first message queued, then sends the lot. Stopping sends
+// anything still queued straight away
+static void *batch_thread(void *arg)
+{
+    client_t *client = arg;
+    batch_t *batch = &client->batch;
+
+    pthread_mutex_lock(&batch->lock);
+    while (atomic_load(&batch->running) || batch->count) {
+        if (!batch->count) {
+            pthread_cond_wait(&batch->queued, &batch->lock);
+            continue;
+        }
+        const uint64_t now = xclock_ns();
+        if (now < batch->deadline && atomic_load(&batch->running)) {
+            const uint64_t ns = batch->deadline - now;
+            pthread_mutex_unlock(&batch->lock);
+            nanosleep((struct timespec []) { [0] = { (time_t)(ns / 1000000000), (long)(ns % 1000000000) } }, NULL);
+            pthread_mutex_lock(&batch->lock);
+            continue;
+        }
+        if (!batch_flush(client)) {
+            log_error("error sending batched wire via cable");
+        }
+    }
+    pthread_mutex_unlock(&batch->lock);
+    return NULL;
+}
+
+// A budget of 0 leaves batching off, and transmit_batched() sends every wire as it comes
+bool client_batch_start(client_t *client, size_t budget_ms)
+{
+    batch_t *batch = &client->batch;
+    if (!budget_ms) {
+        return true;
     }
-    wire_t *wire = init_wire_from_file_msg(file_msg);
-    xfree(file_msg);
-    return wire;
+    pthread_mutex_init(&batch->lock, NULL);
+    pthread_cond_init(&batch->queued, NULL);
+    batch->budget_ns = (uint64_t)budget_ms * 1000000;
+    atomic_store(&batch->running, true);
+    if (pthread_create(&batch->thread, NULL, batch_thread, client)) {
+        atomic_store(&batch->running, false);
+        pthread_cond_destroy(&batch->queued);
+        pthread_mutex_destroy(&batch->lock);
+        return false;
+    }
+    return true;
 }
 
+// Sends anything still queued, after which wires go out as they come
+void client_batch_stop(client_t *client)
+{
+    batch_t *batch = &client->batch;
+    if (!atomic_load(&batch->running)) {
+        return;
+    }
+    pthread_mutex_lock(&batch->lock);
+    atomic_store(&batch->running, false);
+    pthread_cond_signal(&batch->queued);
+    pthread_mutex_unlock(&batch->lock);
+
+    pthread_join(batch->thread, NULL);
+    pthread_cond_destroy(&batch->queued);
+    pthread_mutex_destroy(&batch->lock);
+}
 
+// Anything queued goes first, so a wire is never overtaken by text sent before it
 bool transmit_wire(client_t *client, wire_t *wire)
 {
+    batch_t *batch = &client->batch;
+    if (!atomic_load(&batch->running)) {
+        return send_wire(client, wire);
+    }
+    pthread_mutex_lock(&batch->lock);
+    bool ok = batch_flush(client);
+    ok &= send_wire(client, wire);
+    pthread_mutex_unlock(&batch->lock);
+    return ok;
+}
+
+// Bursts of small messages share one wire, so they share its IV, MACs, and headers, one send,
+// and one relay through the daemon. Nothing waits longer than the budget given to
+// client_batch_start(), and a full batch goes out right away
+bool transmit_batched(client_t *client, wire_t *wire)
+{
+    batch_t *batch = &client->batch;
+    const size_t len = wire_get_data_length(wire);
+    const size_t entry_len = batch_entry_length(len);
+    if (!atomic_load(&batch->running) || entry_len > BATCH_DATA_MAX) {
+        return transmit_wire(client, wire);
+    }
+
+    pthread_mutex_lock(&batch->lock);
+    bool ok = true;
+    if (batch->count == BATCH_ENTRIES_MAX || entry_len > BATCH_DATA_MAX - batch->len) {
+        ok = batch_flush(client);
+    }
+    batch->len += batch_entry_put(&batch->entries[batch->len], wire_get_type(wire), wire->data, len);
+    if (!batch->count++) {
+        batch->deadline = xclock_ns() + batch->budget_ns;
+        pthread_cond_signal(&batch->queued);
+    }
+    pthread_mutex_unlock(&batch->lock);
+    return ok;
+}
+
+// A piece of a file, sealed and waiting for the socket
+typedef struct file_piece_t {
+    wire_t *wire;
+    const uint8_t *cable; // inside `wire`, as it goes on the socket
+    size_t len;
+    size_t epoch;         // keys_t.epoch of the session key it was sealed with
+} file_piece_t;
+
+// Large files are split into FILE_CHUNK_SIZE pieces, each its own wire with its own IV and MAC,
+// so a pool of workers can read and encrypt pieces in parallel while this thread sends them
+// in order. Workers never run more than `window` pieces ahead of the socket. A rekey can land
+// while pieces wait, so each is checked against the current keys right before it's sent
+typedef struct file_sender_t {
+    client_t *client;
+    const char *path;
+    uint8_t features;
+    file_msg_type_t type;
+    uint32_t member;
+    uint32_t id;
+    size_t size;
+    size_t chunks;
+    size_t next;   // next piece to be claimed by a worker
+    size_t sent;   // pieces handed to the socket
+    size_t window;
+    file_piece_t pieces[FILE_SEND_WINDOW_MAX]; // finished pieces, indexed by piece % window
+    bool failed;
+    pthread_mutex_t lock;
+    pthread_cond_t ready; // a piece was finished
+    pthread_cond_t space; // a piece was sent
+} file_sender_t;
+
+static file_piece_t file_sender_build(file_sender_t *ctx, FILE *f, size_t index, const keys_t *keys)
+{
+    const size_t offset = index * FILE_CHUNK_SIZE;
+    const size_t len = MIN((size_t)FILE_CHUNK_SIZE, ctx->size - offset);
+
+    file_piece_t piece = { 0 };
+    piece.wire = index ? init_wire_from_file_chunk(f, ctx->type, ctx->id, offset, len)
+                       : init_wire_from_file_head(ctx->member, ctx->path, f, ctx->id, ctx->size, len);
+
+    // Each worker compresses its own pieces, so this is spread across the pool as well
+    wire_t *packed = piece.wire ? compress_session_wire(ctx->features, piece.wire) : NULL;
+    if (packed) {
+        free_wire(piece.wire);
+        piece.wire = packed;
+    }
+    if (piece.wire && !(piece.cable = seal_cable(piece.wire, &keys->session_wire, &piece.len))) {
+        piece.wire = free_wire(piece.wire);
+    }
+    piece.epoch = keys->epoch;
+    return piece;
+}
+
+static void *file_sender_worker(void *arg)
+{
+    file_sender_t *ctx = arg;
+    FILE *f = fopen(ctx->path, "rb");
+
+    pthread_mutex_lock(&ctx->lock);
+    if (!f) {
+        ctx->failed = true;
+        pthread_cond_broadcast(&ctx->ready);
+    }
+    while (f) {
+        while (!ctx->failed && ctx->next < ctx->chunks && ctx->next >= ctx->sent + ctx->window) {
+            pthread_cond_wait(&ctx->space, &ctx->lock);
+        }
+        if (ctx->failed || ctx->next == ctx->chunks) {
+            break;
+        }
+        const size_t index = ctx->next++;
+        pthread_mutex_unlock(&ctx->lock);
+
+        keys_t keys = { 0 };
+        client_get_keys(ctx->client, &keys);
+        file_piece_t piece = file_sender_build(ctx, f, index, &keys);
+        memset(&keys, 0, sizeof(keys));
+
+        pthread_mutex_lock(&ctx->lock);
+        ctx->pieces[index % ctx->window] = piece;
+        ctx->failed |= !piece.wire;
+        pthread_cond_broadcast(&ctx->ready);
+    }
+    pthread_mutex_unlock(&ctx->lock);
+
+    if (f) {
+        fclose(f);
+    }
+    return NULL;
+}
+
+bool transmit_file(client_t *client, const char *path)
+{
+    const size_t size = xfilesize(path);
+    if (!size || size > FILE_DATA_MAX_SIZE) {
+        log_error("file size (%zu bytes) is outside the allowed range", size);
+        return false;
+    }
+
+    // Small files still go out as a single wire
+    if (size <= FILE_CHUNK_SIZE) {
+        wire_t *wire = client_init_file_wire(client, path);
+        bool ok = wire && transmit_wire(client, wire);
+        free_wire(wire);
+        return ok;
+    }
+
+    // Queued text goes ahead of the file, as it would have if it weren't batched
+    batch_t *batch = &client->batch;
+    if (atomic_load(&batch->running)) {
+        pthread_mutex_lock(&batch->lock);
+        const bool flushed = batch_flush(client);
+        pthread_mutex_unlock(&batch->lock);
+        if (!flushed) {
+            return false;
+        }
+    }
+
     keys_t keys = { 0 };
     client_get_keys(client, &keys);
 
+    file_sender_t *ctx = xcalloc(sizeof(file_sender_t));
+    ctx->client = client;
+    ctx->path = path;
+    ctx->features = keys.features;
+    ctx->type = xfiletype(path) ? FILE_TYPE_BINARY : FILE_TYPE_TEXT;
+    ctx->member = client->member;
+    ctx->size = size;
+    ctx->chunks = (size + FILE_CHUNK_SIZE - 1) / FILE_CHUNK_SIZE;
+    while (!ctx->id) {
+        if (!csprng_fill(&ctx->id, sizeof(ctx->id))) {
+            xfree(ctx);
+            return false;
+        }
+    }
+
+    size_t threads = MIN(xgetncpu(), (size_t)FILE_SEND_THREADS_MAX);
+    threads = MIN(threads, ctx->chunks);
+    ctx->window = MIN(2 * threads, (size_t)FILE_SEND_WINDOW_MAX);
+
+    pthread_mutex_init(&ctx->lock, NULL);
+    pthread_cond_init(&ctx->ready, NULL);
+    pthread_cond_init(&ctx->space, NULL);
+
+    pthread_t tids[FILE_SEND_THREADS_MAX];
+    size_t started = 0;
+    for (; started < threads; started++) {
+        if (pthread_create(&tids[started], NULL, file_sender_worker, ctx)) {
+            break;
+        }
+    }
+
     sock_t sock = client_get_socket(client);
+    FILE *f = NULL; // only opened to rebuild pieces sealed before a rekey
+    bool ok = started > 0;
+    for (size_t i = 0; ok && i < ctx->chunks;) {
+        pthread_mutex_lock(&ctx->lock);
+        while (!ctx->pieces[i % ctx->window].wire && !ctx->failed) {
+            pthread_cond_wait(&ctx->ready, &ctx->lock);
+        }
+
+        // Every piece that's finished by now goes out in the same gathered send
+        file_piece_t pieces[XIOV_MAX];
+        xiovec_t iov[XIOV_MAX];
+        size_t ready = 0;
+        for (; ready < XIOV_MAX && i + ready < ctx->chunks; ready++) {
+            file_piece_t *slot = &ctx->pieces[(i + ready) % ctx->window];
+            if (!slot->wire) {
+                break;
+            }
+            pieces[ready] = *slot;
+            *slot = (file_piece_t) { 0 };
+        }
+        pthread_mutex_unlock(&ctx->lock);
 
-    size_t len = wire_get_length(wire);
-    encrypt_wire(wire, keys.session);
-    cable_t *cable = init_cable(wire, &len);
+        // Other threads' wires can go out between gathered sends, never in the middle of one.
+        // Rekeys hold the same lock, so the keys can't change again before these are sent
+        pthread_mutex_lock(&client->send_lock);
+        client_get_keys(client, &keys);
+        ok = ready > 0;
+        for (size_t j = 0; ok && j < ready; j++) {
+            if (pieces[j].epoch != keys.epoch) {
+                log_debug("resealing piece %zu of %zu after a rekey", i + j, ctx->chunks);
+                free_wire(pieces[j].wire);
+                f = f ? f : fopen(path, "rb");
+                pieces[j] = f ? file_sender_build(ctx, f, i + j, &keys) : (file_piece_t) { 0 };
+                ok = pieces[j].wire != NULL;
+            }
+            iov[j] = (xiovec_t) { .base = pieces[j].cable, .len = pieces[j].len };
+        }
+        ok = ok && xsendallv(sock, iov, ready);
+        pthread_mutex_unlock(&client->send_lock);
+        for (size_t j = 0; j < ready; j++) {
+            free_wire(pieces[j].wire);
+        }
+        i += ready;
 
-    bool ok = xsendall(sock, cable, len);
-    xfree(cable);
+        pthread_mutex_lock(&ctx->lock);
+        ctx->sent += ready;
+        ctx->failed |= !ok;
+        pthread_cond_broadcast(&ctx->space);
+        pthread_mutex_unlock(&ctx->lock);
+    }
+
+    for (size_t i = 0; i < started; i++) {
+        pthread_join(tids[i], NULL);
+    }
+    for (size_t i = 0; i < ctx->window; i++) {
+        free_wire(ctx->pieces[i].wire);
+    }
+
+    pthread_mutex_destroy(&ctx->lock);
+    pthread_cond_destroy(&ctx->ready);
+    pthread_cond_destroy(&ctx->space);
+    if (f) {
+        fclose(f);
+    }
+    memset(&keys, 0, sizeof(keys));
+    xfree(ctx);
     return ok;
 }
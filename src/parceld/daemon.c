@@ -12,6 +12,7 @@
 #include "daemon.h"
 #include "cable.h"
 #include "wire.h"
+#include "wire-ctrl.h"
 #include <stddef.h>
 
 void catch_sigint(int sig)
@@ -79,9 +80,12 @@ bool init_daemon(server_t *ctx)
     ctx->descriptors.nfds = xfd_init_count(ctx->sockets.sfds[0]);
 
     // Collect entropy for initial server key
-    if (xgetrandom(ctx->server_key, KEY_LEN) < 0) {
+    uint8_t server_key[KEY_LEN];
+    if (xgetrandom(server_key, KEY_LEN) < 0) {
         return false;
     }
+    wire_key_init(&ctx->server_key, server_key, ctx->suite, WIRE_KEY_CTRL);
+    memset(server_key, 0, KEY_LEN);
     return true;
 }
 
@@ -98,51 +102,140 @@ static size_t socket_index(server_t *srv, sock_t socket)
 }
 
 // TODO: enumerate ACCEPT_XXX return values
-static int add_client(server_t *srv)
+static int accept_client(server_t *srv, sock_t *new_client)
 {
     struct sockaddr_storage client_sockaddr;
     socklen_t len[] = { sizeof(struct sockaddr_storage) };
-    sock_t new_client;
-    if (xaccept(&new_client, srv->sockets.sfds[0], (struct sockaddr *)&client_sockaddr, len) < 0) {
+    if (xaccept(new_client, srv->sockets.sfds[0], (struct sockaddr *)&client_sockaddr, len) < 0) {
         log_error("unable to accept new client");
         return -1;
     }
 
     if (srv->sockets.cnt + 1 == countof(srv->sockets.sfds)) {
         log_warn("rejecting new connection");
+        xclose(*new_client);
         return 1;
     }
 
-    FD_SET(new_client, &srv->descriptors.fds); // Add descriptor to set and update max
-    srv->descriptors.nfds = xfd_count(new_client, srv->descriptors.nfds);
-    srv->sockets.cnt++;
-
     char address[INET_ADDRSTRLEN];
     in_port_t port;
-    if (!xgetpeeraddr(new_client, address, &port)) {
+    if (!xgetpeeraddr(*new_client, address, &port)) {
         log_error("unable to determine human-readable IP for new client");
-        return -1;
+        xclose(*new_client);
+        return 1;
+    }
+
+    // Until its key exchange is done, a client that stops talking only holds things up so long
+    if (xsetrecvtimeout(*new_client, HANDSHAKE_TIMEOUT_MS)) {
+        log_warn("unable to set handshake timeout for new client");
     }
 
+    FD_SET(*new_client, &srv->descriptors.fds); // Add descriptor to set and update max
+    srv->descriptors.nfds = xfd_count(*new_client, srv->descriptors.nfds);
+    srv->sockets.cnt++;
+
     // Copy new connection's socket to the next free slot
     log_debug("adding socket to empty slot");
     for (size_t i = 1; i < countof(srv->sockets.sfds); i++) {
         log_trace("slot[%zu]: %s", i, !srv->sockets.sfds[i] ? "free" : "in use");
         if (!srv->sockets.sfds[i]) {
-            srv->sockets.sfds[i] = new_client;
+            srv->sockets.sfds[i] = *new_client;
             log_debug("connection from %s:%u added to slot %zu", address, port, i);
             break;
         }
     }
+    return 0;
+}
 
-    if (!two_party_server(new_client, srv->server_key)) {
-        log_error("two-party key exchange with new client failed");
-        return -1;
+// Check whether another connection is already waiting on the listening socket
+static bool connection_pending(server_t *srv)
+{
+    fd_set rdy;
+    FD_ZERO(&rdy);
+    FD_SET(srv->sockets.sfds[0], &rdy);
+    struct timeval timeout = { 0 };
+    return select(srv->descriptors.nfds + 1, &rdy, NULL, NULL, &timeout) > 0;
+}
+
+static int disconnect_client(server_t *ctx, size_t client_index);
+
+// Pass on the cables held during a rekey to the first `members` sockets, the ones that were in
+// the group when they were sent. Each is flagged as sealed with the previous session key
+static bool relay_held_cables(server_t *srv, held_cables_t *held, size_t members)
+{
+    bool ok = true;
+    for (size_t i = 0; ok && i < held->count; i++) {
+        const held_cable_t *cable = &held->cables[i];
+        for (size_t j = 1; ok && j <= members; j++) {
+            if (j == cable->sender) {
+                continue;
+            }
+            wire_t *wire = init_ctrl_stale_wire();
+            ok = wire != NULL;
+            if (ok && (!transmit_cabled_wire(srv->sockets.sfds[j], wire, &srv->server_key) || !xsendall(srv->sockets.sfds[j], cable->data, cable->len))) {
+                log_warn("unable to relay held cable to socket %zu", j);
+            }
+            free_wire(wire);
+        }
+    }
+    if (held->count) {
+        log_debug("relayed %zu cable%s held during the rekey", held->count, held->count > 1 ? "s" : "");
+    }
+    held_cables_free(held);
+    return ok;
+}
+
+static bool regenerate_keys(server_t *srv, size_t members)
+{
+    held_cables_t held = { 0 };
+    if (!n_party_server(srv->sockets.sfds, srv->sockets.cnt, &srv->server_key, &held)) {
+        held_cables_free(&held);
+        return false;
+    }
+    return relay_held_cables(srv, &held, members);
+}
+
+// Accept every pending connection (up to HANDSHAKE_BATCH) before running the key
+// exchanges, so a burst of clients shares one batched x25519 pass and one key regeneration.
+// Clients that fail their exchange are dropped without affecting the others
+static int add_clients(server_t *srv)
+{
+    sock_t pending[HANDSHAKE_BATCH];
+    size_t count = 0;
+    int ret = 0;
+    do {
+        if ((ret = accept_client(srv, &pending[count]))) {
+            break;
+        }
+        count++;
+    } while (count < HANDSHAKE_BATCH && connection_pending(srv));
+
+    // Anything accepted before an error still gets its key exchange
+    if (!count) {
+        return ret < 0 ? -1 : 1;
     }
 
+    log_debug("starting key exchange with %zu new client%s", count, count > 1 ? "s" : "");
+    bool joined[HANDSHAKE_BATCH];
+    const size_t n = two_party_server_batch(pending, count, &srv->server_key, srv->features, joined);
+    for (size_t i = 0; i < count; i++) {
+        if (joined[i]) {
+            xsetrecvtimeout(pending[i], 0);
+            continue;
+        }
+        log_warn("dropping client after failed two-party key exchange");
+        if (disconnect_client(srv, socket_index(srv, pending[i]))) {
+            log_error("error closing socket");
+        }
+    }
+    if (!n) {
+        return 1;
+    }
+
+    // New sockets are appended, so the members from before the join come first
     if (srv->sockets.cnt > 1) {
         log_debug("connection added - starting key regeneration");
-        if (!n_party_server(srv->sockets.sfds, srv->sockets.cnt, srv->server_key)) {
+        if (!regenerate_keys(srv, srv->sockets.cnt - n)) {
             log_fatal("key regeneration failure");
             return -1;
         }
@@ -150,17 +243,18 @@ static int add_client(server_t *srv)
     return 0;
 }
 
-static bool transfer_message(server_t *srv, size_t sender_index, cable_t *cable)
+static bool transfer_message(server_t *srv, size_t sender_index, const void *cable, size_t len)
 {
-    size_t len = cable_get_total_len(cable);
     for (size_t i = 1; i <= srv->sockets.cnt; i++) {
         if (i == sender_index) {
             log_trace("skipping message orgin");
             continue;
         }
         log_trace("forwarding message to socket %zu", i);
+
+        // A member that's gone is dropped once its socket reports the disconnect, the rest still get the message
         if (!xsendall(srv->sockets.sfds[i], cable, len)) {
-            return false;
+            log_warn("unable to forward message to socket %zu", i);
         }
     }
     return true;
@@ -202,7 +296,7 @@ bool daemon_handle_disconnect(server_t *srv, size_t client_id, bool clean)
         return false;
     }
     log_info("active connections: %zu", srv->sockets.cnt);
-    if (!n_party_server(srv->sockets.sfds, srv->sockets.cnt, srv->server_key)) {
+    if (srv->sockets.cnt && !regenerate_keys(srv, srv->sockets.cnt)) {
         log_fatal("catastrophic key exchange");
         return false;
     }
@@ -211,22 +305,22 @@ bool daemon_handle_disconnect(server_t *srv, size_t client_id, bool clean)
 
 static bool recv_client(server_t *srv, size_t sender_index)
 {
-    cable_t *cable = alloc_cable();
-    ssize_t ret = xrecv(srv->sockets.sfds[sender_index], cable, sizeof(cable_header_t), 0);
+    cable_buffer_t *buf = &srv->recv_buffer;
+    cable_t *cable = cable_buffer_get(buf);
+    ssize_t ret = xrecv(srv->sockets.sfds[sender_index], cable, cable_prefix_len(srv->suite), 0);
     if (ret <= 0) {
-        xfree(cable);
         log_trace("socket %zu disconnected", sender_index);
         return daemon_handle_disconnect(srv, sender_index, ret == 0);
     }
 
-    size_t len = cable_recv_data(srv->sockets.sfds[sender_index], &cable);
+    // Cables are relayed exactly as they arrived, whatever the framing
+    size_t len = cable_recv_data(srv->sockets.sfds[sender_index], buf, srv->suite, (size_t)ret);
     if (!len) {
         // [note] cause logged by function
-        xfree(cable);
         return false;
     }
     log_trace("received %zu byte cable from slot %zu", len, sender_index);
-    if (!transfer_message(srv, sender_index, cable)) {
+    if (!transfer_message(srv, sender_index, buf->cable, len)) {
         log_error("error broadcasting message from slot %zu", sender_index);
         return false;
     }
@@ -243,6 +337,9 @@ bool display_daemon_info(server_t *ctx)
     };
     fprintf(stdout, "%s", header);
 
+    fprintf(stdout, "\033[1mWire suite:\033[0m\n");
+    fprintf(stdout, "=> %s%s\n", wire_suite_name(ctx->suite), (ctx->features & WIRE_FEATURE_COMPRESS) ? " with compression" : "");
+
     fprintf(stdout, "\033[1mLocally accessible at:\033[0m\n");
     if (xgetifaddrs("=> ", ctx->server_port)) {
         log_warn("failed to obtain a list of local interfaces");
@@ -260,12 +357,15 @@ bool display_daemon_info(server_t *ctx)
 int main_thread(void *ctx)
 {
     signal(SIGINT, catch_sigint);
+#if __unix__ || __APPLE__
+    signal(SIGPIPE, SIG_IGN); // a member leaving mid-relay shows up as a failed send instead
+#endif
 
     server_t *server = (server_t *)ctx;
     fd_set rdy;
     FD_ZERO(&rdy);
 
-    log_set_loglvl(LOG_TRACE);
+    log_set_loglvl(server->log_level);
 
     for (;;) {
         rdy = server->descriptors.fds;
@@ -279,7 +379,7 @@ int main_thread(void *ctx)
             if ((fd = xfd_isset(&server->descriptors.fds, &rdy, i))) {
                 if (fd == server->sockets.sfds[0]) {
                     log_debug("pending connection from unknown client");
-                    switch (add_client(server)) {
+                    switch (add_clients(server)) {
                         case -1:
                             log_fatal("key exchange failure");
                             return -1;
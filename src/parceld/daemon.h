@@ -23,6 +23,8 @@ enum ParceldConstants {
     SOCK_LEN = sizeof(struct sockaddr),
     SUPPORTED_CONNECTIONS = FD_SETSIZE,
     MAX_QUEUE = 32,
+    HANDSHAKE_BATCH = 8,
+    HANDSHAKE_TIMEOUT_MS = 5000, // a client that stalls this long mid-handshake is dropped
     DEFAULT_PORT = 2315,
     PORT_MAX_LENGTH = 6
 };
@@ -34,7 +36,11 @@ enum SocketIndices {
 typedef struct server_t {
     char server_port[PORT_MAX_LENGTH];
     size_t max_queue;
-    uint8_t server_key[KEY_LEN];
+    wire_suite_t suite;
+    uint8_t features; // WireFeatures offered to every client, which have to support them to join
+    loglvl_t log_level;
+    wire_key_t server_key; // Control key, re-expanded each time it's renewed
+    cable_buffer_t recv_buffer; // Cables are read and fanned out one at a time, so one buffer serves every client
     struct fd_set_t {
         fd_set fds;
         size_t nfds;
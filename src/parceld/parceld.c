@@ -14,9 +14,13 @@
 static void usage(FILE *f)
 {
     static const char usage[] =
-        "usage: parceld [-h] [-p PORT] [-m CMAX] [-q LMAX]\n"
+        "usage: parceld [-h] [-p PORT] [-m CMAX] [-q LMAX] [-s SUITE] [-u] [-l LEVEL]\n"
         "  -p PORT  start daemon on port PORT\n"
         "  -q LMAX  limit length of pending connections queue to LMAX\n"
+        "  -s SUITE wire suite, chacha20-poly1305-compact (default),\n"
+        "           chacha20-poly1305, or aes128-cbc-cmac\n"
+        "  -u       don't let clients compress text in this session\n"
+        "  -l LEVEL log level, 0 (trace, default) through 5 (fatal)\n"
         "  -h        print this usage information\n"
         "  -v        print build version\n";
     fprintf(f, "%s", usage);
@@ -29,10 +33,13 @@ int main(int argc, char **argv)
     server_t server = {
         .server_port = "2315",
         .max_queue = MAX_QUEUE,
+        .suite = WIRE_SUITE_DEFAULT,
+        .features = WIRE_FEATURE_COMPRESS,
+        .log_level = LOG_TRACE,
     };
 
     xgetopt_t xgo = { 0 };
-    for (ptrdiff_t opt = -1; (opt = xgetopt(&xgo, argc, argv, "hvp:q:")) != -1;) {
+    for (ptrdiff_t opt = -1; (opt = xgetopt(&xgo, argc, argv, "hvp:q:s:ul:")) != -1;) {
         switch (opt) {
             case 'p':
                 if (xstrrange(xgo.arg, NULL, 0, 65535)) {
@@ -47,6 +54,24 @@ int main(int argc, char **argv)
                 xwarn("Specified queue limit is outside allowed range\n");
                 xwarn("Using default maximum, %u\n", MAX_QUEUE);
                 break;
+            case 's':
+                if (!wire_suite_from_name(xgo.arg, &server.suite)) {
+                    fprintf(stderr, "unknown wire suite: %s\n", xgo.arg);
+                    return 1;
+                }
+                break;
+            case 'u':
+                server.features &= ~WIRE_FEATURE_COMPRESS;
+                break;
+            case 'l': {
+                long level = 0;
+                if (!xstrrange(xgo.arg, &level, LOG_TRACE, LOG_FATAL)) {
+                    fprintf(stderr, "log level must be between %d and %d\n", LOG_TRACE, LOG_FATAL);
+                    return 1;
+                }
+                server.log_level = (loglvl_t)level;
+                break;
+            }
             case 'h':
                 usage(stdout);
                 return 0;